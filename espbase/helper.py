@@ -24,6 +24,7 @@ import struct
 import fnmatch
 import hashlib
 import argparse
+import urllib.request
 import tempfile
 import threading
 import subprocess
@@ -32,10 +33,12 @@ from os import path as op, environ as ENV
 from datetime import datetime
 from contextlib import suppress
 from urllib.parse import urljoin
+from http.client import IncompleteRead
 from socketserver import ThreadingMixIn
 from wsgiref.simple_server import WSGIServer
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
 
-# requirements.txt: bottle, requests, zeroconf
+# requirements.txt: bottle, requests, zeroconf, detools
 # requirements.txt: numpy, pyturbojpeg, turbojpeg, opencv-python
 try:
     import bottle
@@ -49,6 +52,10 @@ try:
     import zeroconf
 except Exception:
     zeroconf = None
+try:
+    import detools
+except Exception:
+    detools = None
 try:
     import numpy as np
 except Exception:
@@ -468,6 +475,235 @@ def gendeps(args):
         print('Update main/CMakeLists.txt failed:', e)
 
 
+PKG_CTYPES = [  # same as guess_type in main/server.c
+    ('htm', 'text/html'), ('json', 'application/json'), ('css', 'text/css'),
+    ('xml', 'text/xml'), ('ttf', 'font/ttf'), ('eot', 'font/rot'),
+    ('woff', 'font/woff'), ('wav', 'audio/wav'), ('png', 'image/png'),
+    ('gif', 'image/gif'), ('jpg', 'image/jpeg'), ('ico', 'image/x-icon'),
+    ('svg', 'image/svg+xml'), ('pdf', 'application/pdf'),
+    ('zip', 'application/zip'), ('js', 'application/javascript'),
+]
+
+
+def pkg_ctype(url):
+    ext = op.splitext(url)[1][1:]
+    for prefix, ctype in PKG_CTYPES:
+        if ext.startswith(prefix):
+            return ctype
+    return 'text/plain'
+
+
+def fnv1a(string):
+    value = 0x811C9DC5
+    for c in string.encode('utf8'):
+        value = ((value ^ c) * 0x01000193) & 0xFFFFFFFF
+    return value
+
+
+def genpkg(args):
+    '''
+    Image layout (little endian, all offsets from beginning of the image):
+        header:  magic "EPKG", u16 version, u16 count, u32 size, u32 crc32
+        entries: u32 hash, path, ctype, etag, data, size, flags (sorted)
+        strings: NUL terminated URI, Content-Type and ETag
+        data:    file contents (4 Bytes aligned)
+    '''
+    files, urls = {}, {}
+    for prefix, root in (('/', args.html), ('/docs/', args.docs)):
+        if not root or not op.isdir(root):
+            continue
+        for dirname, dirs, fns in walk_exclude(root):
+            for fn in sorted(fns):
+                path = op.join(dirname, fn)
+                url = prefix + op.relpath(path, root).replace(os.sep, '/')
+                with open(path, 'rb') as f:
+                    files[path] = f.read()
+                gzip = url.endswith('.gz')
+                name = url[:-3] if gzip else url
+                alias = [url]
+                if not gzip or name not in urls:
+                    alias.append(name)
+                if op.basename(name) == 'index.html':
+                    alias.append(name[:-10])
+                    if len(name) > 11:
+                        alias.append(name[:-11])
+                for key in alias:
+                    urls[key] = (path, pkg_ctype(name), gzip)
+    if not urls:
+        return print('No files to pack', file=sys.stderr)
+    entries = sorted(urls.items(), key=lambda kv: (fnv1a(kv[0]), kv[0]))
+    offset = 16 + 28 * len(entries)
+    strings, strtab, blobs, datatab = b'', {}, b'', {}
+
+    def addstr(s):
+        nonlocal strings
+        if s not in strtab:
+            strtab[s] = offset + len(strings)
+            strings += s.encode('utf8') + b'\0'
+        return strtab[s]
+
+    table = []
+    for url, (path, ctype, gzip) in entries:
+        etag = '"%s"' % hashlib.sha256(files[path]).hexdigest()[:16]
+        table.append([fnv1a(url), addstr(url), addstr(ctype), addstr(etag),
+                      path, len(files[path]), int(gzip)])
+    strings += b'\0' * (-len(strings) % 4)
+    offset += len(strings)
+    for path in files:
+        datatab[path] = offset + len(blobs)
+        blobs += files[path] + b'\0' * (-len(files[path]) % 4)
+    body = b''.join(
+        struct.pack('<7I', h, p, c, e, datatab[d], s, f)
+        for h, p, c, e, d, s, f in table
+    ) + strings + blobs
+    image = struct.pack(
+        '<4sHHII', b'EPKG', 1, len(table), 16 + len(body), zlib.crc32(body)
+    ) + body
+    if args.size and len(image) > int(args.size, 0):
+        return print('Bundle size %d exceeds partition size %s' % (
+            len(image), args.size), file=sys.stderr)
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    if not args.quiet:
+        print('Packed %d files (%d URIs) into `%s` (%d Bytes)' % (
+            len(files), len(table), relpath(args.output), len(image)))
+
+
+def app_digest(image):
+    # same as esp_partition_get_sha256 on app partition
+    if len(image) > 56 and image[0] == 0xE9 and image[23]:
+        return image[-32:]  # SHA-256 appended to the image
+    return hashlib.sha256(image).digest()
+
+
+def genpatch(args):
+    '''
+    Patch layout (little endian) accepted by ota_updation_write:
+        header:  u32 magic 0xFCCDDE10, SHA-256 of base app, reserved (64 B)
+        patch:   detools sequential patch compressed by heatshrink
+    '''
+    if detools is None:
+        return print('Could not generate patch: pip install detools')
+    with open(args.base, 'rb') as f:
+        base = f.read()
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    with tempfile.TemporaryFile() as fpatch, tempfile.TemporaryFile() as fto:
+        with open(args.base, 'rb') as ffrom, open(args.image, 'rb') as fnew:
+            detools.create_patch(ffrom, fnew, fpatch, compression='heatshrink',
+                                 patch_type='sequential')
+        with open(args.base, 'rb') as ffrom:            # round-trip check
+            fpatch.seek(0)
+            detools.apply_patch(ffrom, fpatch, fto)
+        fto.seek(0)
+        if fto.read() != image:
+            return print('Patched image does not match `%s`' % args.image)
+        fpatch.seek(0)
+        patch = fpatch.read()
+    header = struct.pack('<I32s', 0xFCCDDE10, app_digest(base))
+    with open(args.output, 'wb') as f:
+        f.write(header.ljust(64, b'\0') + patch)
+    if not args.quiet:
+        print('Patch `%s` => `%s`: %d / %d Bytes (%.1f%%)' % (
+            relpath(args.base), relpath(args.output), 64 + len(patch),
+            len(image), 100 * (64 + len(patch)) / len(image)))
+
+
+class OTAHandler(BaseHTTPRequestHandler):
+    '''Serve one firmware file with Range / If-Range and broken links'''
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, fmt, *a):
+        if not self.server.quiet:
+            print('%s - %s' % (self.address_string(), fmt % a))
+
+    def do_GET(self):
+        data, etag = self.server.data, self.server.etag
+        start, rng = 0, self.headers.get('Range', '')
+        match = re.match(r'bytes=(\d+)-$', rng)
+        ifrange = self.headers.get('If-Range')
+        if match and (not ifrange or ifrange == etag):
+            start = int(match.group(1))
+        if start >= len(data) > 0:
+            self.send_response(416)
+            self.send_header('Content-Range', 'bytes */%d' % len(data))
+            self.send_header('Content-Length', '0')
+            return self.end_headers()
+        self.send_response(206 if start else 200)
+        self.send_header('ETag', etag)
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('Content-Length', str(len(data) - start))
+        if start:
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (
+                start, len(data) - 1, len(data)))
+        self.end_headers()
+        end = len(data)
+        if self.server.drop:    # break the link somewhere in this response
+            end = min(end, start + self.server.drop + int(
+                self.server.drop * (time.time() % 1)))
+        self.wfile.write(data[start:end])
+        if end < len(data):
+            self.close_connection = True
+            self.connection.shutdown(socket.SHUT_RDWR)
+
+
+def ota_fetch(url, timeout=3, retry=50):
+    '''Download like ota_updation_url: resume with Range after disconnect'''
+    data, etag, total = b'', None, -1
+    for _ in range(retry):
+        req = urllib.request.Request(url)
+        if data:
+            req.add_header('Range', 'bytes=%d-' % len(data))
+            if etag:
+                req.add_header('If-Range', etag)
+        try:
+            with urllib.request.urlopen(req, timeout=timeout) as resp:
+                if resp.status == 200:
+                    data, total = b'', int(resp.headers['Content-Length'])
+                elif resp.status != 206 or not data:
+                    raise ValueError('Invalid status %d' % resp.status)
+                etag = resp.headers.get('ETag') or etag
+                while chunk := resp.read(1024):
+                    data += chunk
+        except IncompleteRead as e:
+            data += e.partial
+        except (OSError, ValueError):
+            pass
+        if len(data) == total:
+            break
+    return data
+
+
+def otaserve(args):
+    with open(args.image, 'rb') as f:
+        data = f.read()
+    server = ThreadingHTTPServer((args.host, args.port), OTAHandler)
+    server.data, server.drop, server.quiet = data, args.drop, args.quiet
+    server.etag = '"%s"' % hashlib.sha256(data).hexdigest()[:16]
+    url = 'http://%s:%d/%s' % (
+        args.host if args.host != '0.0.0.0' else '127.0.0.1',
+        server.server_address[1], op.basename(args.image))
+    if not args.test:
+        print('Serving `%s` at %s (drop after %s Bytes)' % (
+            relpath(args.image), url, args.drop or 'no'))
+        with suppress(KeyboardInterrupt):
+            server.serve_forever()
+        return server.server_close()
+    server.quiet = True
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        fetched = ota_fetch(url)
+    finally:
+        server.shutdown()
+        server.server_close()
+    if fetched != data:
+        return print('Resumed download does not match: %d / %d Bytes' % (
+            len(fetched), len(data))) or 1
+    print('Resumed download matches `%s` (%d Bytes)' % (
+        relpath(args.image), len(data)))
+
+
 def prebuild(args):
     print('-- Running prebuild scripts (%s) ...' % __file__)
     with suppress(Exception):
@@ -1497,6 +1733,52 @@ def make_parser():
         '--output', metavar='PATH', help='dest font file [auto]')
     sparser.set_defaults(func=genfont)
 
+    pkgdist = fromroot('build', 'assets.bin')
+    sparser = subparsers.add_parser(
+        'genpkg', help='Pack static files into read-only bundle partition')
+    sparser.add_argument(
+        '--html', default=fromroot('files', 'www'),
+        help='files served under / [default files/www]')
+    sparser.add_argument(
+        '--docs', default=fromroot('files', 'docs'),
+        help='files served under /docs/ [default files/docs]')
+    sparser.add_argument(
+        '--size', type=str, help='bundle partition size [optional]')
+    sparser.add_argument(
+        '--output', metavar='DEST', default=pkgdist,
+        help='write bundle image to file [default %s]' % relpath(pkgdist))
+    sparser.set_defaults(func=genpkg)
+
+    appbin = fromroot('build', project_name() + '.bin')
+    sparser = subparsers.add_parser(
+        'genpatch', help='Generate delta OTA patch between two app images')
+    sparser.add_argument('base', help='app image running on the board')
+    sparser.add_argument(
+        'image', nargs='?', default=appbin,
+        help='new app image [default %s]' % relpath(appbin))
+    sparser.add_argument(
+        '--output', metavar='DEST', default=fromroot('build', 'patch.bin'),
+        help='write patch to file [default build/patch.bin]')
+    sparser.set_defaults(func=genpatch)
+
+    sparser = subparsers.add_parser(
+        'otaserve', help='Serve firmware for OTA fetch and break connections')
+    sparser.add_argument(
+        '-H', '--host', default='0.0.0.0',
+        help='host to listen on [default 0.0.0.0]')
+    sparser.add_argument(
+        '-P', '--port', type=int, default=PORT + 1,
+        help='port to listen on [default %d]' % (PORT + 1))
+    sparser.add_argument(
+        '--drop', type=int, default=65536,
+        help='disconnect after about N Bytes, 0 to disable [default 65536]')
+    sparser.add_argument(
+        '--test', action='store_true', help='run resumable download test')
+    sparser.add_argument(
+        'image', nargs='?', default=appbin,
+        help='firmware to serve [default %s]' % relpath(appbin))
+    sparser.set_defaults(func=otaserve)
+
     sparser = subparsers.add_parser(
         'gendeps', help='Scan source files to resolve components dependency')
     sparser.set_defaults(func=gendeps)
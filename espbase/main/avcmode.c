@@ -8,7 +8,11 @@
 #include "avcmode.h"
 #include "drivers.h"
 #include "timesync.h"           // for format_timestamp
+#include "filesys.h"            // for filesys_xxx
+#include "config.h"             // for config_nvs_xxx
 
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
 
 ESP_EVENT_DEFINE_BASE(AVC_EVENT);
@@ -18,6 +22,268 @@ static UNUSED const char *TAG = "AVCMode";
 static UNUSED bool audio_run, video_run;
 static UNUSED esp_event_handler_instance_t aud_shdl, vid_shdl;
 
+// Frame ring
+
+#define AVC_WRITING BIT(31)     // set in frame->refs while capture task fills
+
+typedef struct {
+    uint8_t size;               // number of slots in use (<= AVC_SLOTS)
+    uint32_t head;              // sequence number of next frame to publish
+    uint32_t drops;             // frames dropped because slot was still held
+    void (*reclaim)(avc_frame_t *); // free resources of the overwritten frame
+    avc_frame_t slots[AVC_SLOTS];
+    avc_reader_t *readers[AVC_READERS];
+} avc_ring_t;
+
+static avc_ring_t aud_ring = { .size = AVC_SLOTS };
+static avc_ring_t vid_ring = { .size = AVC_SLOTS };
+
+static avc_ring_t * ring_get(int target) {
+    if (target == AUDIO_TARGET) return &aud_ring;
+    if (target == VIDEO_TARGET) return &vid_ring;
+    return NULL;
+}
+
+// Called by capture task only: take the slot of next frame for writing.
+// Return NULL if some reader is still holding the oldest frame in it.
+static avc_frame_t * ring_claim(avc_ring_t *ring) {
+    avc_frame_t *frame = ring->slots + ring->head % ring->size;
+    uint32_t refs = 0;
+    if (!__atomic_compare_exchange_n(&frame->refs, &refs, AVC_WRITING,
+                                     false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return NULL;
+    __atomic_store_n(&frame->seq, 0, __ATOMIC_RELAXED);
+    if (ring->reclaim && frame->priv) ring->reclaim(frame);
+    frame->priv = NULL;
+    return frame;
+}
+
+// Called by capture task only: give up the claimed slot without publishing.
+static void ring_abort(avc_frame_t *frame) {
+    __atomic_fetch_and(&frame->refs, ~AVC_WRITING, __ATOMIC_RELEASE);
+}
+
+// Called by capture task only: publish the claimed frame and wake readers.
+static void ring_commit(avc_ring_t *ring, avc_frame_t *frame) {
+    uint32_t seq = ring->head + 1;
+    __atomic_store_n(&frame->seq, seq, __ATOMIC_RELEASE);
+    __atomic_fetch_and(&frame->refs, ~AVC_WRITING, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, seq, __ATOMIC_RELEASE);
+    ITERP(ptr, ring->readers) {
+        avc_reader_t *reader = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+        if (reader && reader->wake) reader->wake(reader);
+    }
+}
+
+// START and STOP frames should not be dropped: wait until the slot is free.
+static bool ring_publish(avc_ring_t *ring, int32_t type, void *evt, void *p) {
+    avc_frame_t *frame;
+    for (int ms = 500; !( frame = ring_claim(ring) ); ms -= 5) {
+        if (ms <= 0) {
+            ring->drops++;
+            return false;
+        }
+        msleep(5);
+    }
+    frame->type = type;
+    frame->priv = p;
+    if (type < VID_EVENT_START) {
+        memcpy(&frame->aud, evt, sizeof(audio_evt_t));
+    } else {
+        memcpy(&frame->vid, evt, sizeof(video_evt_t));
+    }
+    ring_commit(ring, frame);
+    return true;
+}
+
+// Called by capture task before exit: wait until readers released all frames
+// and invalidate them, so that buffers on the task's stack can be freed.
+static void ring_drain(avc_ring_t *ring, uint32_t tout_ms) {
+    LOOPN(i, ring->size) {
+        avc_frame_t *frame = ring->slots + i;
+        uint32_t refs = 0;
+        for (int ms = tout_ms; ; ms -= 5, refs = 0) {
+            if (__atomic_compare_exchange_n(
+                    &frame->refs, &refs, AVC_WRITING,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+            if (ms > 0) { msleep(5); continue; }
+            ESP_LOGW(TAG, "frame in slot %d not released", i);
+            break;
+        }
+        __atomic_store_n(&frame->seq, 0, __ATOMIC_RELAXED);
+        if (ring->reclaim && frame->priv) ring->reclaim(frame);
+        frame->priv = NULL;
+        __atomic_fetch_and(&frame->refs, ~AVC_WRITING, __ATOMIC_RELEASE);
+    }
+}
+
+esp_err_t avc_attach(avc_reader_t *reader) {
+    avc_ring_t *ring = ring_get(reader ? reader->target : 0);
+    if (!ring) return ESP_ERR_INVALID_ARG;
+    if (reader->ring) return ESP_OK;
+    reader->seq = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    reader->frames = reader->overruns = 0;
+    reader->ring = ring;
+    ITERP(ptr, ring->readers) {
+        avc_reader_t *empty = NULL;
+        if (__atomic_compare_exchange_n(ptr, &empty, reader, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return ESP_OK;
+    }
+    reader->ring = NULL;
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t avc_detach(avc_reader_t *reader) {
+    avc_ring_t *ring = reader ? reader->ring : NULL;
+    if (!ring) return ESP_ERR_INVALID_STATE;
+    ITERP(ptr, ring->readers) {
+        avc_reader_t *self = reader;
+        __atomic_compare_exchange_n(ptr, &self, NULL, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    reader->ring = NULL;
+    return ESP_OK;
+}
+
+avc_frame_t * avc_read(avc_reader_t *reader) {
+    avc_ring_t *ring = reader ? reader->ring : NULL;
+    if (!ring) return NULL;
+    uint32_t head;
+    while (reader->seq != ( head = __atomic_load_n(&ring->head,
+                                                     __ATOMIC_ACQUIRE) )) {
+        if (head - reader->seq > ring->size) {  // overwritten already
+            reader->overruns += head - reader->seq - ring->size;
+            reader->seq = head - ring->size;
+        }
+        avc_frame_t *frame = ring->slots + reader->seq % ring->size;
+        uint32_t refs = __atomic_add_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL);
+        uint32_t seq = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+        if (!(refs & AVC_WRITING) && seq == reader->seq + 1) {
+            reader->seq++;
+            reader->frames++;
+            return frame;
+        }
+        __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_RELEASE);
+        if (seq || (refs & AVC_WRITING)) reader->overruns++; // not drained
+        reader->seq++;
+    }
+    return NULL;
+}
+
+void avc_release(avc_frame_t *frame) {
+    if (frame) __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_RELEASE);
+}
+
+static void ring_stats(avc_ring_t *ring, FILE *out) {
+    fprintf(out, " - %-8s: %" PRIu32 " (%" PRIu32 " dropped)\n",
+            "frames", ring->head, ring->drops);
+    ITERP(ptr, ring->readers) {
+        avc_reader_t *reader = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+        if (!reader) continue;
+        fprintf(out, " - %-8s: %" PRIu32 " frames (%" PRIu32 " overruns)\n",
+                reader->name ?: "reader", reader->frames, reader->overruns);
+    }
+}
+
+// Wake up visualisers in sys_evt task without blocking capture task.
+static UNUSED void visual_wake(avc_reader_t *reader) {
+    esp_event_post(AVC_EVENT, reader->target, &reader, sizeof(reader), 0);
+}
+
+// IMA-ADPCM
+
+static const int16_t ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+    209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+    796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272,
+    2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132,
+    7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+    22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t ima_index[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+#define ADPCM_BLOCK_ALIGN(nch)  ( (4 + (ADPCM_BLOCK_SAMPLES - 1) / 2) * (nch) )
+
+size_t adpcm_header(adpcm_state_t *st, const audio_mode_t *mode, void *out) {
+    if (!st || !mode || mode->depth != 2 || !mode->nch || mode->nch > 2)
+        return 0;
+    uint16_t BpB = ADPCM_BLOCK_ALIGN(mode->nch);
+    uint32_t nblk = (UINT32_MAX - sizeof(adpcm_header_t)) / BpB;
+    adpcm_header_t ADPCM = {
+        "RIFF", nblk * BpB + sizeof(ADPCM) - 8,
+        "WAVE",
+        "fmt ", ADPCM_HEADER_FMT_LEN,
+            0x11, mode->nch, mode->srate,
+            (uint64_t)BpB * mode->srate / ADPCM_BLOCK_SAMPLES,
+            BpB, 4, 2, ADPCM_BLOCK_SAMPLES,
+        "fact", 4, MIN((uint64_t)nblk * ADPCM_BLOCK_SAMPLES, UINT32_MAX),
+        "data", nblk * BpB
+    };
+    memset(st, 0, sizeof(adpcm_state_t));
+    st->nch = mode->nch;
+    if (out) memcpy(out, &ADPCM, sizeof(ADPCM));
+    return sizeof(ADPCM);
+}
+
+static uint8_t adpcm_nibble(adpcm_state_t *st, uint8_t ch, int32_t val) {
+    int32_t step = ima_steps[st->index[ch]], delta = step >> 3;
+    int32_t diff = val - st->pred[ch];
+    uint8_t code = diff < 0 ? 8 : 0;
+    if (code) diff = -diff;
+    if (diff >= step) { code |= 4; diff -= step; delta += step; }
+    if (diff >= (step >>= 1)) { code |= 2; diff -= step; delta += step; }
+    if (diff >= (step >>= 1)) { code |= 1; delta += step; }
+    val = st->pred[ch] + (code & 8 ? -delta : delta);
+    st->pred[ch] = CONS(val, INT16_MIN, INT16_MAX);
+    st->index[ch] = CONS(st->index[ch] + ima_index[code & 7], 0, 88);
+    return code;
+}
+
+// Block: header of each channel (first sample, step index and reserved byte),
+// followed by 4 Bytes (8 samples, low nibble first) of each channel in turn.
+static size_t adpcm_block(adpcm_state_t *st, uint8_t *out) {
+    uint16_t nch = st->nch;
+    uint8_t *ptr = out;
+    LOOPN(ch, nch) {
+        st->pred[ch] = st->pcm[ch];
+        *ptr++ = st->pred[ch] & 0xFF;
+        *ptr++ = st->pred[ch] >> 8;
+        *ptr++ = st->index[ch];
+        *ptr++ = 0;
+    }
+    for (int16_t *pcm = st->pcm + nch; ptr < out + ADPCM_BLOCK_ALIGN(nch);) {
+        LOOPN(ch, nch) {
+            LOOPN(i, 4) {
+                uint8_t lo = adpcm_nibble(st, ch, pcm[(2 * i) * nch + ch]);
+                uint8_t hi = adpcm_nibble(st, ch, pcm[(2 * i + 1) * nch + ch]);
+                *ptr++ = lo | (hi << 4);
+            }
+        }
+        pcm += 8 * nch;
+    }
+    st->num = 0;
+    return ptr - out;
+}
+
+size_t adpcm_encode(adpcm_state_t *st, const void *pcm, size_t len, void *out) {
+    if (!st || !st->nch) return 0;
+    size_t num = len / sizeof(int16_t) / st->nch, olen = 0;
+    if (!pcm) return (st->num + num) / ADPCM_BLOCK_SAMPLES
+                     * ADPCM_BLOCK_ALIGN(st->nch);
+    for (const int16_t *src = pcm; num;) {
+        size_t cnt = MIN(num, ADPCM_BLOCK_SAMPLES - st->num);
+        memcpy(st->pcm + st->num * st->nch, src, cnt * st->nch * 2);
+        src += cnt * st->nch;
+        num -= cnt;
+        if (( st->num += cnt ) == ADPCM_BLOCK_SAMPLES)
+            olen += adpcm_block(st, out + olen);
+    }
+    return olen;
+}
+
 // I2S PDM Microphone
 
 #ifdef CONFIG_BASE_USE_I2S
@@ -91,11 +357,172 @@ static void i2s_initialize() {
 }
 #endif // IDF_TARGET_V4
 
-static void aud_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
+// Audio DSP chain is applied in place on each 20ms buffer before publishing:
+// DC-blocking high-pass -> digital gain -> soft-knee limiter -> RMS / peak.
+// All stages are fused into one fixed-point pass over the samples, so that
+// the cost is a few microseconds per frame on any target (with or w/o FPU).
+#define DSP_GAIN_MIN    -40
+#define DSP_GAIN_MAX    18              // dB, Q12 multiplier fits in int16_t
+#define DSP_LIMIT_MIN   -24
+#define DSP_HPF_MAX     1000
+
+static struct {
+    struct {
+        int16_t hpf;                    // cutoff in Hz, 0 to disable
+        int16_t gain;                   // digital gain in dB
+        int16_t limit;                  // limiter threshold in dBFS, 0 to skip
+    } cfg;
+    int32_t coef;                       // Q15 pole of the DC blocker
+    int32_t mul;                        // Q12 linear gain
+    int32_t knee;                       // limiter threshold in linear scale
+    int32_t x1[2], y1[2], err[2];       // filter states (with error feedback)
+    uint16_t peak[2], rms[2];           // levels of last processed buffer
+    uint32_t us, cnt;                   // processing time of this session
+} dsp = { .cfg = { .hpf = 20, .gain = 0, .limit = -1 } };
+
+static void dsp_update() {
+    dsp.cfg.hpf = CONS(dsp.cfg.hpf, 0, DSP_HPF_MAX);
+    dsp.cfg.gain = CONS(dsp.cfg.gain, DSP_GAIN_MIN, DSP_GAIN_MAX);
+    dsp.cfg.limit = CONS(dsp.cfg.limit, DSP_LIMIT_MIN, 0);
+    dsp.coef = dsp.cfg.hpf ? 32768 * (1 - 2 * M_PI * dsp.cfg.hpf / PDM_SHZ) : 0;
+    dsp.mul = 4096 * powf(10, dsp.cfg.gain / 20.0) + 0.5;
+    dsp.knee = dsp.cfg.limit ? INT16_MAX * powf(10, dsp.cfg.limit / 20.0) : 0;
+}
+
+static void dsp_reset() {
+    memset(dsp.x1, 0, sizeof(dsp.x1));
+    memset(dsp.y1, 0, sizeof(dsp.y1));
+    memset(dsp.err, 0, sizeof(dsp.err));
+    dsp.us = dsp.cnt = 0;
+}
+
+static void dsp_apply(audio_evt_t *evt) {
+    uint16_t nch = MIN(evt->mode->nch, LEN(dsp.x1));
+    size_t num = evt->len / PDM_BPC / nch;
+    int32_t coef = dsp.coef, mul = dsp.mul, knee = dsp.knee;
+    int32_t room = INT16_MAX - knee;
+    if (!num) return;
+    LOOPN(j, nch) {
+        int32_t x, y, a, x1 = dsp.x1[j], y1 = dsp.y1[j], e = dsp.err[j];
+        uint32_t peak = 0;
+        uint64_t sum = 0;
+        PDM_TYPE *ptr = (PDM_TYPE *)evt->data + j, *end = ptr + num * nch;
+        for (; ptr < end; ptr += nch) {
+            y = x = *ptr;
+            if (coef) {                 // y[n] = x[n] - x[n-1] + a * y[n-1]
+                a = coef * y1 + e;
+                e = a & 0x7FFF;         // keep truncated bits to avoid DC
+                y = y1 = CONS(x - x1 + (a >> 15), -INT16_MAX, INT16_MAX);
+                x1 = x;
+            }
+            y = (y * mul + 2048) >> 12; // round Q12 to nearest, no DC bias
+            a = ABS(y);
+            if (knee && a > knee) {     // compress above knee towards 0dBFS
+                a -= knee;
+                a = knee + (int64_t)a * room / (a + room);
+            } else if (a > INT16_MAX) {
+                a = INT16_MAX;
+            }
+            *ptr = y < 0 ? -a : a;
+            peak = MAX(peak, a);
+            sum += (uint32_t)(a * a);
+        }
+        dsp.x1[j] = x1; dsp.y1[j] = y1; dsp.err[j] = e;
+        evt->peak[j] = dsp.peak[j] = peak;
+        evt->rms[j] = dsp.rms[j] = sqrtf((float)sum / num) + 0.5;
+    }
+}
+
+static void dsp_save() {
+    void *nvs = NULL;
+    if (config_nvs_open(&nvs, "audio", false)) return;
+    config_nvs_write(nvs, "dsp", &dsp.cfg, sizeof(dsp.cfg));
+    config_nvs_close(&nvs);
+}
+
+static void dsp_restore() {
+    void *nvs = NULL;
+    if (!config_nvs_open(&nvs, "audio", true)) {
+        typeof(dsp.cfg) cfg;
+        if (config_nvs_read(nvs, "dsp", &cfg, sizeof(cfg)) == sizeof(cfg))
+            dsp.cfg = cfg;
+        config_nvs_close(&nvs);
+    }
+    dsp_update();
+}
+
+static esp_err_t aud_loads(const char *json) {
+    cJSON *obj = cJSON_Parse(json);
+    if (!obj) {
+        ESP_LOGE(TAG, "Failed to load config from `%s`", json);
+        return ESP_ERR_INVALID_ARG;
+    }
+    typeof(dsp.cfg) cfg = dsp.cfg;
+    for (cJSON *ptr = obj->child; ptr; ptr = ptr->next) {
+        int32_t value;
+        if (!ptr->string) continue;
+        if (cJSON_IsNumber(ptr)) {
+            value = ptr->valuedouble;
+        } else if (!parse_s32(cJSON_GetStringValue(ptr), &value)) {
+            continue;
+        }
+        if (!strcmp(ptr->string, "hpf")) {
+            cfg.hpf = CONS(value, 0, DSP_HPF_MAX);
+        } else if (!strcmp(ptr->string, "gain")) {
+            cfg.gain = CONS(value, DSP_GAIN_MIN, DSP_GAIN_MAX);
+        } else if (!strcmp(ptr->string, "limit")) {
+            cfg.limit = CONS(value, DSP_LIMIT_MIN, 0);
+        }
+    }
+    cJSON_Delete(obj);
+    dsp.cfg = cfg;
+    dsp_update();
+    dsp_save();
+    return ESP_OK;
+}
+
+static float dBFS(uint16_t val) {
+    return val ? 20 * log10f(val / (float)INT16_MAX) : -INFINITY;
+}
+
+static char * aud_dumps(FILE *stream) {
+    uint16_t nch = MIN(PDM_NCH, LEN(dsp.peak));
+    if (stream) {
+        fprintf(stream, "%5s: %d Hz\n", "hpf", dsp.cfg.hpf);
+        fprintf(stream, "%5s: %d dB\n", "gain", dsp.cfg.gain);
+        fprintf(stream, "%5s: %d dBFS\n", "limit", dsp.cfg.limit);
+        LOOPN(j, nch) {
+            fprintf(stream, "%5s: peak %.1f dBFS, rms %.1f dBFS\n",
+                    j ? "right" : nch > 1 ? "left" : "level",
+                    dBFS(dsp.peak[j]), dBFS(dsp.rms[j]));
+        }
+        if (dsp.cnt) fprintf(stream, "%5s: %.1f us per 20ms\n",
+                             "cost", (float)dsp.us / dsp.cnt);
+        fflush(stream);
+        return NULL;
+    }
+    cJSON *obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "hpf", dsp.cfg.hpf);
+    cJSON_AddNumberToObject(obj, "gain", dsp.cfg.gain);
+    cJSON_AddNumberToObject(obj, "limit", dsp.cfg.limit);
+    cJSON *peak = cJSON_AddArrayToObject(obj, "peak");
+    cJSON *rms = cJSON_AddArrayToObject(obj, "rms");
+    LOOPN(j, nch) {
+        cJSON_AddItemToArray(peak, cJSON_CreateNumber(dsp.peak[j]));
+        cJSON_AddItemToArray(rms, cJSON_CreateNumber(dsp.rms[j]));
+    }
+    char *json = cJSON_PrintUnformatted(obj);
+    cJSON_Delete(obj);
+    return json;
+}
+
+static avc_reader_t aud_vis = {
+    .name = "visual", .target = AUDIO_TARGET, .wake = visual_wake
+};
+
+static void aud_print(FILE *stream, int32_t id, audio_evt_t *evt) {
     static char eqls[80 - 4 - 3 - 13];
-    audio_evt_t *evt = *(audio_evt_t **)data;
-    FILE *stream = arg;
-    if (id == AUD_EVENT_START) {
+    if (id == AUD_EVENT_START || !eqls[0]) {
         memset(eqls, '=', sizeof(eqls) - 1);
         eqls[sizeof(eqls) - 1] = '\0';
     } else if (id == AUD_EVENT_STOP) {
@@ -104,16 +531,10 @@ static void aud_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
     }
     if (id != AUD_EVENT_DATA || evt->id % 10 || !evt->mode->nch) return;
     uint16_t nch = evt->mode->nch, tlen = (sizeof(eqls) - (nch - 1) * 6) / nch;
-    uint64_t vmax = BIT(evt->mode->depth * 8 - 1);
-    PDM_TYPE *buf = evt->data, vol[nch], len[nch];
-    LOOPN(i, evt->len / nch / evt->mode->depth) {
-        LOOPN(j, nch) {
-            vol[j] = MAX(vol[j], ABS(buf[i * nch + j]));
-        }
-    }
+    uint16_t vol[nch], len[nch];
     fprintf(stream, "\r%s [", format_timestamp_us(0));
     LOOPN(j, nch) {
-        vol[j] = vol[j] * 100 / vmax;           // 0 ~ 100
+        vol[j] = evt->peak[MIN(j, 1)] * 100 / INT16_MAX;    // 0 ~ 100
         len[j] = vol[j] * tlen / 100;           // 0 ~ tlen
         if (j) fputc('|', stream);
         if (j % 2 || nch == 1) {
@@ -128,42 +549,76 @@ static void aud_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
     fflush(stream);
 }
 
-static void audio_capture(void *arg) {
-    audio_mode_t mode = { PDM_SHZ, PDM_NCH, PDM_BPC };
+static void aud_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
+    avc_reader_t *reader = *(avc_reader_t **)data;
+    avc_frame_t *frame;
+    if (id != AUDIO_TARGET || reader != &aud_vis) return;
+    while (( frame = avc_read(reader) )) {
+        aud_print(arg, frame->type, &frame->aud);
+        avc_release(frame);
+    }
+    return; NOTUSED(b);
+}
+
+static void wav_header(wav_header_t *wav, audio_mode_t *m, uint32_t dlen) {
     wav_header_t WAV = {
-        "RIFF", -1,
+        "RIFF", dlen + sizeof(WAV) - 8,
         "WAVE",
         "fmt ", WAV_HEADER_FMT_LEN,
-            0x01, mode.nch, mode.srate,
-            mode.nch * mode.depth * mode.srate,
-            mode.nch * mode.depth, mode.depth * 8,
-        "data", -1
+            0x01, m->nch, m->srate,
+            m->nch * m->depth * m->srate,
+            m->nch * m->depth, m->depth * 8,
+        "data", dlen
     };
-    uint32_t dlen = WAV.Bps * MIN(UINT32_MAX / WAV.Bps, (uint32_t)arg / 1000);
+    memcpy(wav, &WAV, sizeof(WAV));
+}
+
+static void audio_capture(void *arg) {
+    audio_mode_t mode = { PDM_SHZ, PDM_NCH, PDM_BPC };
+    wav_header_t WAV;
+    wav_header(&WAV, &mode, -1);
+    uint32_t dlen = WAV.Bps * MIN(UINT32_MAX / WAV.Bps, (uintptr_t)arg / 1000);
     size_t rlen, blen = WAV.Bps / 50; // 20ms buffer
-    void *data = malloc(2 * blen), *task = xTaskGetCurrentTaskHandle();
+    void *data = malloc((aud_ring.size + 1) * blen); // last one for dropping
     if (!data) return vTaskDelete(NULL);
     WAV.filelen = (WAV.datalen = dlen) + sizeof(WAV) - 8;  // < U32_MAX
-    audio_evt_t wav = { .task = task, .data = &WAV, .len = sizeof(WAV) };
-    audio_evt_t evt = { .task = task, .data = data, .mode = &mode };
-    AVC_POST(AUD_EVENT_START, wav, -1);
+    audio_evt_t wav = { .data = &WAV, .len = sizeof(WAV) };
+    audio_evt_t evt = { .mode = &mode };
+    ring_publish(&aud_ring, AUD_EVENT_START, &wav, NULL);
 
+    dsp_reset();
     I2S_ACQUIRE();
     for (evt.id = 0; audio_run && dlen; evt.id++) {
-        if (I2S_READ(evt.data + blen, blen, &rlen, TIMEOUT(25)) || !rlen) break;
+        // read into slot directly, or into the spare buffer if it is held
+        avc_frame_t *frame = ring_claim(&aud_ring);
+        size_t idx = frame ? frame - aud_ring.slots : aud_ring.size;
+        evt.data = data + idx * blen;
+        if (I2S_READ(evt.data, blen, &rlen, TIMEOUT(25)) || !rlen) {
+            TRYNULL(frame, ring_abort);
+            break;
+        }
         dlen -= (evt.len = MIN(rlen, dlen));
-        if (!notify_wait_for(0, 500, 0)) continue;
-        memcpy(evt.data, evt.data + blen, evt.len);
-        AVC_POST(AUD_EVENT_DATA, evt, 10);
+        int64_t ts = esp_timer_get_time();
+        dsp_apply(&evt);
+        dsp.us += esp_timer_get_time() - ts;
+        dsp.cnt++;
+        if (!frame) {
+            aud_ring.drops++;
+            continue;
+        }
+        frame->type = AUD_EVENT_DATA;
+        frame->aud = evt;
+        ring_commit(&aud_ring, frame);
     }
     I2S_RELEASE();
 
-    notify_wait_for(0, 500, 5);
     wav.len = 0; wav.data = NULL;
-    AVC_POST(AUD_EVENT_STOP, wav, -1);
-    notify_wait_for(0, 50, 10);
+    ring_publish(&aud_ring, AUD_EVENT_STOP, &wav, NULL);
+    msleep(10);                 // let readers see the STOP frame
+    ring_drain(&aud_ring, 500);
+    avc_detach(&aud_vis);
     UREGEVTS(AVC, aud_shdl);
-    TRYFREE(evt.data);
+    TRYFREE(data);
     vTaskDelete(NULL);
 }
 #endif // CONFIG_BASE_USE_I2S
@@ -225,6 +680,7 @@ static void cam_initialize() {
         cam_conf.fb_location  = CAMERA_FB_IN_PSRAM;
     }
 #   endif
+    vid_ring.size = MIN(cam_conf.fb_count, AVC_SLOTS); // frames held in ring
     if (( err = esp_camera_init(&cam_conf) )) {
         ESP_LOGE(TAG, "Camera init failed: %s", esp_err_to_name(err));
         return;
@@ -367,9 +823,9 @@ static esp_err_t cam_loads(sensor_t *cam, const char *json) {
 
 static char * cam_dumps(sensor_t *cam, FILE *stream) {
     if (stream) {
-        size_t klen = strlen("framerate");
+        int klen = strlen("framerate");
 #   ifdef CONFIG_BASE_AUTO_ALIGN
-        ITERP(attr, cam_attrs) { klen = MAX(klen, strlen(attr->key)); }
+        ITERP(attr, cam_attrs) { klen = MAX(klen, (int)strlen(attr->key)); }
 #   endif
         fprintf(stream, "%*s: %.3f\n", klen, "framerate", cam_fps(cam, NULL));
         fprintf(stream, "%*s: %d\n", klen, "width", CAM_HORRES(cam));
@@ -396,91 +852,543 @@ static char * cam_dumps(sensor_t *cam, FILE *stream) {
     return json;
 }
 
-static void vid_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
+static avc_reader_t vid_vis = {
+    .name = "visual", .target = VIDEO_TARGET, .wake = visual_wake
+};
+
+static void vid_print(FILE *stream, int32_t id, video_evt_t *evt) {
     static TickType_t ts;
-    video_evt_t *evt = *(video_evt_t **)data;
     size_t eid = evt->id;
-    notify_increase(evt->task);
     TickType_t dt = xTaskGetTickCount() - ts; ts += dt;
     if (id == VID_EVENT_STOP) {
-        fputc('\n', arg);
+        fputc('\n', stream);
     } else if (id == VID_EVENT_DATA && (eid % evt->mode->fps) == 0) {
         float fps = dt ? 1e3 / pdTICKS_TO_MS(dt) : 0;
-        fprintf(arg, "\r%s %08d %dx%dx%d %dFPS %.4s %d Bytes %.*fFPS\n",
+        fprintf(stream, "\r%s %08zu %dx%dx%d %dFPS %.4s %zu Bytes %.*fFPS\n",
                 format_timestamp_us(0),
                 eid, evt->mode->width, evt->mode->height,
                 evt->mode->depth, evt->mode->fps,
                 evt->mode->fourcc, evt->len,
                 fps >= 10 ? 1 : 2, fps);
     }
-    fflush(arg);
-    notify_decrease(evt->task);
+    fflush(stream);
 }
 
-static void video_capture(void *arg) {
-    sensor_t *cam = esp_camera_sensor_get();
-    if (!cam) return;
-    float fps = cam_fps(cam, NULL);
-    video_mode_t mode = { fps, CAM_HORRES(cam), CAM_VERRES(cam), 3, "MJPG" };
-    uint32_t BPF = mode.width * mode.height * mode.depth / 10; // BytePerFrame
-    uint32_t nframe = fps * MIN(UINT32_MAX / fps, (uint32_t)arg / 1000.0);
-    camera_fb_t *next = NULL, *prev = NULL;
+static void vid_visual(void *arg, esp_event_base_t b, int32_t id, void *data) {
+    avc_reader_t *reader = *(avc_reader_t **)data;
+    avc_frame_t *frame;
+    if (id != VIDEO_TARGET || reader != &vid_vis) return;
+    while (( frame = avc_read(reader) )) {
+        vid_print(arg, frame->type, &frame->vid);
+        avc_release(frame);
+    }
+    return; NOTUSED(b);
+}
+
+// Return camera frame buffer when its slot in the ring is going to be reused.
+static void vid_reclaim(avc_frame_t *frame) {
+    camera_fb_t *fb = frame->priv;
+    if (fb->format != PIXFORMAT_JPEG) TRYFREE(frame->vid.data); // frame2jpg
+    esp_camera_fb_return(fb);
+}
+
+static void avi_header(avi_header_t *avi, video_mode_t *m, uint32_t nframe) {
+    uint32_t BPF = m->width * m->height * m->depth / 10;    // BytePerFrame
     avi_header_t AVI = {
         "RIFF", -1,
         "AVI ",
         "LIST", AVI_HEADER_HDLR_LEN, "hdlr",
             "avih", AVI_HEADER_AVIH_LEN,
-                1000000 / mode.fps, mode.fps * BPF, 0, 0x910, nframe, 0, 1,
-                0x100000, mode.width, mode.height, { 0, 0, 0, 0 },
+                1000000 / m->fps, m->fps * BPF, 0, 0x910, nframe, 0, 1,
+                0x100000, m->width, m->height, { 0, 0, 0, 0 },
         "LIST", AVI_HEADER_STRL_LEN, "strl",
             "strh", AVI_HEADER_STRH_LEN,
-                "vids", "MJPG", 0, 0, 0, 0, 1, mode.fps, 0, nframe,
-                BPF, -1, 0, 0, 0, mode.width, mode.height,
+                "vids", "MJPG", 0, 0, 0, 0, 1, m->fps, 0, nframe,
+                BPF, -1, 0, 0, 0, m->width, m->height,
             "strf", AVI_HEADER_STRF_LEN,
-                AVI_HEADER_STRF_LEN, mode.width, mode.height, 1,
-                mode.depth * 8, "MJPG", BPF, 0, 0, 0, 0,
+                AVI_HEADER_STRF_LEN, m->width, m->height, 1,
+                m->depth * 8, "MJPG", BPF, 0, 0, 0, 0,
         "LIST", -1, "movi",
     };
-    void *task = xTaskGetCurrentTaskHandle();
-    video_evt_t avi = { .task = task, .data = &AVI, .len = sizeof(AVI) };
-    video_evt_t evt = { .task = task, .data = NULL, .mode = &mode };
-    AVC_POST(VID_EVENT_START, avi, -1);
+    memcpy(avi, &AVI, sizeof(AVI));
+}
+
+static void video_capture(void *arg) {
+    sensor_t *cam = esp_camera_sensor_get();
+    if (!cam) return;
+    float fps = cam_fps(cam, NULL);
+    video_mode_t mode = { fps, CAM_HORRES(cam), CAM_VERRES(cam), 3, "MJPG" };
+    uint32_t nframe = fps * MIN(UINT32_MAX / fps, (uintptr_t)arg / 1000.0);
+    avi_header_t AVI;
+    avi_header(&AVI, &mode, nframe);
+    video_evt_t avi = { .data = &AVI, .len = sizeof(AVI) };
+    video_evt_t evt = { .mode = &mode };
+    vid_ring.reclaim = vid_reclaim;
+    ring_publish(&vid_ring, VID_EVENT_START, &avi, NULL);
 
     CAM_ACQUIRE(cam);
     cam_flush();
+    TickType_t ts, period = pdMS_TO_TICKS(1000 / MAX(mode.fps, 1));
+    camera_fb_t *fb = NULL;
+    avc_frame_t *frame = NULL;
     for (evt.id = 0; video_run && evt.id < nframe; evt.id++) {
-        if (!( next = esp_camera_fb_get() )) break;
-        if (!notify_wait_for(0, 500, 0)) {
-            ESP_LOGD(TAG, "%08u: frame not released", evt.id);
-            esp_camera_fb_return(next);
+        // Every frame buffer of the camera may be held in the ring, so claim
+        // a slot (i.e. return the oldest frame buffer) before grabbing.
+        ts = xTaskGetTickCount();
+        while (!( frame = ring_claim(&vid_ring) ) &&
+               (xTaskGetTickCount() - ts) < period) { msleep(5); }
+        if (!frame) {
+            ESP_LOGD(TAG, "%08zu: frame not released", evt.id);
+            vid_ring.drops++;
             continue;
         }
-        if (prev && prev->format != PIXFORMAT_JPEG) TRYFREE(evt.data);
-        if (next->format == PIXFORMAT_JPEG) {
-            evt.data = next->buf;
-            evt.len = next->len;
-        } else if (!frame2jpg(next, 80, (uint8_t **)&evt.data, &evt.len)) {
-            ESP_LOGE(TAG, "%08u: JPEG compression failed", evt.id);
-            esp_camera_fb_return(next);
+        if (!( fb = esp_camera_fb_get() )) {
+            ring_abort(frame);
             break;
         }
-        AVC_POST(VID_EVENT_DATA, evt, 10);
-        TRYNULL(prev, esp_camera_fb_return);
-        prev = next;
+        if (fb->format == PIXFORMAT_JPEG) {
+            evt.data = fb->buf;
+            evt.len = fb->len;
+        } else if (!frame2jpg(fb, 80, (uint8_t **)&evt.data, &evt.len)) {
+            ESP_LOGE(TAG, "%08zu: JPEG compression failed", evt.id);
+            esp_camera_fb_return(fb);
+            ring_abort(frame);
+            break;
+        }
+        frame->type = VID_EVENT_DATA;
+        frame->priv = fb;
+        frame->vid = evt;
+        ring_commit(&vid_ring, frame);
     }
     CAM_RELEASE(cam);
 
-    notify_wait_for(0, 500, 5);
     avi.len = 0; avi.data = NULL;
-    AVC_POST(VID_EVENT_STOP, avi, -1);
-    notify_wait_for(0, 50, 10);
+    ring_publish(&vid_ring, VID_EVENT_STOP, &avi, NULL);
+    msleep(10);                 // let readers see the STOP frame
+    ring_drain(&vid_ring, 500); // frame buffers are returned here
+    avc_detach(&vid_vis);
     UREGEVTS(AVC, vid_shdl);
-    if (prev && prev->format != PIXFORMAT_JPEG) TRYFREE(evt.data);
-    TRYNULL(prev, esp_camera_fb_return);
     vTaskDelete(NULL);
 }
 #endif // CONFIG_BASE_USE_CAM
 
+// Recorder
+
+#if ( defined(CONFIG_BASE_USE_SDFS) || defined(CONFIG_BASE_USE_FFS) ) && \
+    ( defined(CONFIG_BASE_USE_I2S) || defined(CONFIG_BASE_USE_CAM) )
+#   define AVC_RECORD
+#   define REC_BUFSIZE      ( 32 * 1024 )   // rounded up to cluster size
+#   define REC_SEGMENT_MB   64
+#   define REC_SEGMENT_SEC  300
+#   define REC_SYNC_MS      1000            // update WAV header periodically
+
+// Files are written through a write-back buffer allocated once when recording
+// starts. The buffer is flushed only when full, so that every write (except
+// the last one) covers whole clusters at cluster-aligned offsets.
+typedef struct avc_rec avc_rec_t;
+struct avc_rec {
+    const char *name, *ext;
+    bool run;
+    bool stop;              // stop capture task after recording
+    bool prealloc;          // extend file to segment size when opened
+    filesys_type_t fs;
+    uint32_t seg_size;      // roll segment if file is larger (Bytes)
+    uint32_t seg_secs;      // roll segment if duration is longer (seconds)
+    filesys_path_t dir, path;
+    FILE *fp;
+    uint8_t *buf;
+    size_t bsize, blen;     // size and used length of write-back buffer
+    uint32_t flen;          // file length including buffered data
+    int64_t since;          // timestamp when segment was opened
+    int64_t synced;         // timestamp when header was updated
+    uint32_t segs;          // number of segments saved
+    uint32_t dels;          // number of segments deleted for free space
+    uint32_t period;        // capture period in us (i.e. write budget)
+    uint32_t wmax, wall;    // longest write in us (segment & all segments)
+    uint32_t slow;          // number of writes longer than capture period
+    uint32_t num, cap;      // number of frames in segment and capacity of idx
+    uint32_t *sizes;        // frame sizes to build AVI idx1 on close
+    void (*handle)(avc_rec_t *, avc_frame_t *);
+    void (*close)(avc_rec_t *);
+    union {
+        avi_header_t avi;
+        wav_header_t wav;
+    };
+    avc_reader_t reader;
+    TaskHandle_t task;
+};
+
+static esp_err_t rec_flush(avc_rec_t *rec) {
+    if (!rec->blen) return ESP_OK;
+    int64_t ts = esp_timer_get_time();
+    size_t len = fwrite(rec->buf, 1, rec->blen, rec->fp);
+    uint32_t dt = esp_timer_get_time() - ts;
+    rec->wmax = MAX(rec->wmax, dt);
+    if (rec->period && dt > rec->period) rec->slow++;
+    if (len != rec->blen) return ESP_FAIL;
+    rec->blen = 0;
+    return ESP_OK;
+}
+
+static esp_err_t rec_write(avc_rec_t *rec, const void *data, size_t len) {
+    while (len) {
+        size_t num = MIN(len, rec->bsize - rec->blen);
+        memcpy(rec->buf + rec->blen, data, num);
+        rec->blen += num; rec->flen += num;
+        data += num; len -= num;
+        if (rec->blen == rec->bsize && rec_flush(rec)) return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Overwrite data that has been flushed (i.e. header) at offset of the file.
+static esp_err_t rec_patch(avc_rec_t *rec, long off, void *data, size_t len) {
+    if (fseek(rec->fp, off, SEEK_SET)) return ESP_FAIL;
+    bool done = fwrite(data, 1, len, rec->fp) == len;
+    if (fseek(rec->fp, rec->flen - rec->blen, SEEK_SET) || !done)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+static void rec_oldest(const char *base, const struct stat *st, void *arg) {
+    avc_rec_t *rec = arg;
+    if (rec->path[0] || S_ISDIR(st->st_mode) || !endswith(base, rec->ext))
+        return;
+    snprintf(rec->path, sizeof(rec->path), "%s", base); // sorted by name
+}
+
+// Files are on the flash if path starts with its mountpoint, else SDCard.
+static filesys_type_t rec_fstype(const char *path) {
+    filesys_type_t fs = 0;
+#   ifdef CONFIG_BASE_USE_FFS
+    if (startswith(path, CONFIG_BASE_FFS_MP)) fs = FILESYS_FLASH;
+#   endif
+#   ifdef CONFIG_BASE_USE_SDFS
+    if (!fs) fs = FILESYS_SDCARD;
+#   endif
+    return fs;
+}
+
+// Delete oldest segments until there is room for two more segments.
+static void rec_cleanup(avc_rec_t *rec) {
+    filesys_info_t info;
+    filesys_path_t name;
+    while (filesys_get_info(rec->fs, &info) &&
+           info.total - info.used < 2ULL * rec->seg_size) {
+        rec->path[0] = '\0';
+        filesys_walk(rec->fs, rec->dir, rec_oldest, rec);
+        if (!rec->path[0]) break;
+        snprintf(name, sizeof(name), "%s", rec->path);
+        filesys_join_r(rec->fs, rec->path, 2, rec->dir, name);
+        if (unlink(rec->path)) {
+            ESP_LOGE(TAG, "Could not delete %s: %s", rec->path, strerror(errno));
+            break;
+        }
+        ESP_LOGI(TAG, "Deleted %s for free space", rec->path);
+        rec->dels++;
+    }
+}
+
+static esp_err_t rec_open(avc_rec_t *rec) {
+    char name[32];
+    time_t now = time(NULL);
+    size_t len = strftime(name, sizeof(name), "%Y%m%d-%H%M%S", localtime(&now));
+    rec_cleanup(rec);
+    for (int i = 0; i < 100; i++) {
+        if (i) snprintf(name + len, sizeof(name) - len, "_%d%s", i, rec->ext);
+        else   snprintf(name + len, sizeof(name) - len, "%s", rec->ext);
+        filesys_join_r(rec->fs, rec->path, 2, rec->dir, name);
+        if (access(rec->path, F_OK)) break;
+    }
+    if (!( rec->fp = fopen(rec->path, "wb") )) {
+        ESP_LOGE(TAG, "Could not open %s: %s", rec->path, strerror(errno));
+        return ESP_FAIL;
+    }
+    setvbuf(rec->fp, NULL, _IONBF, 0);  // data is buffered in rec->buf
+    // Allocate the whole cluster chain now instead of growing it (i.e. FAT
+    // lookup and update) in every write. File is truncated in rec_close.
+    if (rec->prealloc && (
+        fseek(rec->fp, rec->seg_size - 1, SEEK_SET) ||
+        fputc(0, rec->fp) == EOF || fseek(rec->fp, 0, SEEK_SET)
+    )) {
+        ESP_LOGW(TAG, "Could not preallocate %s", rec->path);
+        fseek(rec->fp, 0, SEEK_SET);
+    }
+    rec->blen = rec->flen = rec->num = rec->wmax = 0;
+    rec->since = rec->synced = esp_timer_get_time();
+    return ESP_OK;
+}
+
+static void rec_close(avc_rec_t *rec, esp_err_t err) {
+    if (!rec->fp) return;
+    float secs = (esp_timer_get_time() - rec->since) / 1e6;
+    if (!err) err = rec_flush(rec);
+    if (!err && rec->prealloc && ftruncate(fileno(rec->fp), rec->flen))
+        err = ESP_FAIL;
+    if (fclose(rec->fp) && !err) err = ESP_FAIL;
+    rec->fp = NULL;
+    rec->wall = MAX(rec->wall, rec->wmax);
+    if (err) {
+        ESP_LOGE(TAG, "%s segment %s broken: %s",
+                 rec->name, rec->path, strerror(errno));
+    } else {
+        rec->segs++;
+        ESP_LOGI(TAG, "%s segment %s saved: %" PRIu32 " frames, %s, %.1fs, "
+                 "max write %.1f/%.1fms", rec->name, rec->path, rec->num,
+                 format_size(rec->flen), secs,
+                 rec->wmax / 1e3, rec->period / 1e3);
+    }
+}
+
+// Roll segment if it is too long or next len Bytes will make it too large.
+static bool rec_full(avc_rec_t *rec, size_t len) {
+    return rec->fp && (
+        esp_timer_get_time() - rec->since >= rec->seg_secs * 1000000LL ||
+        rec->flen + len > rec->seg_size
+    );
+}
+
+#ifdef CONFIG_BASE_USE_CAM
+static esp_err_t avi_open(avc_rec_t *rec, video_mode_t *mode) {
+    if (rec_open(rec)) return ESP_FAIL;
+    rec->period = 1000000 / MAX(mode->fps, 1);
+    avi_header(&rec->avi, mode, 0);     // lengths are patched in avi_close
+    return rec_write(rec, &rec->avi, sizeof(rec->avi));
+}
+
+static esp_err_t avi_write(avc_rec_t *rec, video_evt_t *evt) {
+    if (rec->num == rec->cap) {
+        uint32_t cap = rec->cap ? rec->cap * 2 : 1024;
+        if (EREALLOC(rec->sizes, cap * sizeof(uint32_t)))
+            return ESP_ERR_NO_MEM;
+        rec->cap = cap;
+    }
+    avi_frame_t chunk = { "00dc", evt->len };
+    if (rec_write(rec, &chunk, sizeof(chunk)) ||
+        rec_write(rec, evt->data, evt->len) ||
+        (evt->len % 2 && rec_write(rec, "", 1))     // chunks are WORD aligned
+    ) return ESP_FAIL;
+    rec->sizes[rec->num++] = evt->len;
+    return ESP_OK;
+}
+
+// Append idx1 chunk and patch lengths in header (RIFF, movi, nframe and fps)
+static void avi_close(avc_rec_t *rec) {
+    if (!rec->fp) return;
+    esp_err_t err = ESP_OK;
+    int64_t us = esp_timer_get_time() - rec->since;
+    uint32_t movi = rec->flen - offsetof(avi_header_t, movi);
+    avi_frame_t chunk = { "idx1", rec->num * sizeof(avi_index_t) };
+    avi_index_t idx = { "00dc", AVI_INDEX_KEYFRAME, 4, 0 };
+    err = rec_write(rec, &chunk, sizeof(chunk));
+    LOOPN(i, rec->num) {
+        if (err) break;
+        idx.length = rec->sizes[i];
+        err = rec_write(rec, &idx, sizeof(idx));
+        idx.offset += sizeof(avi_frame_t) + idx.length + idx.length % 2;
+    }
+    avi_header_t *avi = &rec->avi;
+    avi->filelen = rec->flen - 8;
+    avi->lst3len = movi;
+    avi->total_frames = avi->length = rec->num;
+    if (rec->num > 1 && us > 0) {                   // actual frame rate
+        avi->us_per_frame = us / rec->num;
+        avi->max_Bps = movi * 1e6 / us;
+        avi->scale = 1000;
+        avi->fps = rec->num * 1e9 / us;
+    }
+    if (!err) err = rec_flush(rec) ?: rec_patch(rec, 0, avi, sizeof(*avi));
+    rec_close(rec, err);
+}
+
+static void avi_frame(avc_rec_t *rec, avc_frame_t *frame) {
+    video_evt_t *evt = &frame->vid;
+    if (frame->type == VID_EVENT_STOP) return avi_close(rec);
+    if (frame->type != VID_EVENT_DATA) return;
+    if (rec_full(rec, sizeof(avi_frame_t) + evt->len + 1 +
+                      (rec->num + 1) * sizeof(avi_index_t) + 8))
+        avi_close(rec);
+    if (!rec->fp && avi_open(rec, evt->mode)) return rec_close(rec, ESP_FAIL);
+    esp_err_t err = avi_write(rec, evt);
+    if (err == ESP_ERR_NO_MEM) {            // no more room for idx1
+        avi_close(rec);
+    } else if (err) {
+        rec_close(rec, err);
+    }
+}
+#endif // CONFIG_BASE_USE_CAM
+
+#ifdef CONFIG_BASE_USE_I2S
+// Path of the WAV file being recorded is saved in NVS, so that it can be
+// finalized (i.e. truncated to the synced length) after power loss.
+static void wav_track(const char *path) {
+    void *nvs = NULL;
+    if (config_nvs_open(&nvs, "avcrec", false)) return;
+    if (path) {
+        config_nvs_write(nvs, "wav", path, strlen(path) + 1);
+    } else {
+        config_nvs_delete(nvs, "wav");
+    }
+    config_nvs_close(&nvs);
+}
+
+static void wav_recover() {
+    filesys_path_t path;
+    wav_header_t WAV;
+    void *nvs = NULL;
+    if (config_nvs_open(&nvs, "avcrec", true)) return;
+    int len = config_nvs_read(nvs, "wav", path, sizeof(path) - 1);
+    config_nvs_close(&nvs);
+    if (len <= 0) return;
+    path[len] = '\0';
+    if (!filesys_get_info(rec_fstype(path), NULL)) return;  // not mounted
+    FILE *fp = fopen(path, "r+b");
+    bool valid = fp && fread(&WAV, 1, sizeof(WAV), fp) == sizeof(WAV) &&
+                 !strncmp(WAV.RIFF, "RIFF", 4) && WAV.datalen != UINT32_MAX;
+    if (valid && !ftruncate(fileno(fp), sizeof(WAV) + WAV.datalen))
+        ESP_LOGW(TAG, "Recovered %s: %s", path, format_size(WAV.datalen));
+    TRYNULL(fp, fclose);
+    // header was still in the write-back buffer: the file has no data
+    if (!valid && !unlink(path)) ESP_LOGW(TAG, "Deleted empty %s", path);
+    wav_track(NULL);
+}
+
+// Update RIFF lengths in header to the flushed data and commit to storage.
+static esp_err_t wav_sync(avc_rec_t *rec) {
+    uint32_t dlen = rec->flen - rec->blen - sizeof(wav_header_t);
+    if (dlen == rec->wav.datalen) return ESP_OK;
+    rec->wav.datalen = dlen;
+    rec->wav.filelen = dlen + sizeof(wav_header_t) - 8;
+    rec->synced = esp_timer_get_time();
+    esp_err_t err = rec_patch(rec, 0, &rec->wav, sizeof(rec->wav));
+    return err ?: (fsync(fileno(rec->fp)) ? ESP_FAIL : ESP_OK);
+}
+
+static esp_err_t wav_open(avc_rec_t *rec, audio_mode_t *mode) {
+    if (rec_open(rec)) return ESP_FAIL;
+    rec->period = 20000;                // see audio_capture
+    wav_header(&rec->wav, mode, 0);     // lengths are patched in wav_sync
+    if (rec->prealloc) wav_track(rec->path);
+    return rec_write(rec, &rec->wav, sizeof(rec->wav));
+}
+
+static void wav_close(avc_rec_t *rec) {
+    if (!rec->fp) return;
+    esp_err_t err = rec_flush(rec) ?: wav_sync(rec);
+    rec_close(rec, err);
+    if (!err && rec->prealloc) wav_track(NULL);
+}
+
+static void wav_frame(avc_rec_t *rec, avc_frame_t *frame) {
+    audio_evt_t *evt = &frame->aud;
+    if (frame->type == AUD_EVENT_STOP) return wav_close(rec);
+    if (frame->type != AUD_EVENT_DATA) return;
+    if (rec_full(rec, evt->len)) wav_close(rec);
+    if (!rec->fp && wav_open(rec, evt->mode)) return rec_close(rec, ESP_FAIL);
+    esp_err_t err = rec_write(rec, evt->data, evt->len);
+    if (!err) rec->num++;
+    if (!err && esp_timer_get_time() - rec->synced > REC_SYNC_MS * 1000)
+        err = wav_sync(rec);
+    if (err) rec_close(rec, err);
+}
+#endif // CONFIG_BASE_USE_I2S
+
+static void rec_wake(avc_reader_t *reader) {
+    avc_rec_t *rec = reader->arg;
+    if (rec->task) xTaskNotifyGive(rec->task);
+}
+
+#ifdef CONFIG_BASE_USE_I2S
+static avc_rec_t aud_rec = {
+    .name = "Audio", .ext = ".wav",
+    .handle = wav_frame, .close = wav_close,
+    .reader = {
+        .name = "record", .target = AUDIO_TARGET,
+        .wake = rec_wake, .arg = &aud_rec,
+    },
+};
+#endif
+
+#ifdef CONFIG_BASE_USE_CAM
+static avc_rec_t vid_rec = {
+    .name = "Video", .ext = ".avi",
+    .handle = avi_frame, .close = avi_close,
+    .reader = {
+        .name = "record", .target = VIDEO_TARGET,
+        .wake = rec_wake, .arg = &vid_rec,
+    },
+};
+#endif
+
+static void record_task(void *arg) {
+    avc_rec_t *rec = arg;
+    avc_frame_t *frame;
+    while (rec->run) {
+        ulTaskNotifyTake(pdTRUE, TIMEOUT(100));
+        while (( frame = avc_read(&rec->reader) )) {
+            rec->handle(rec, frame);
+            avc_release(frame);
+        }
+    }
+    avc_detach(&rec->reader);
+    rec->close(rec);
+    ESP_LOGI(TAG, "%s recording stopped: %" PRIu32 " segments saved, %" PRIu32
+             " deleted, %" PRIu32 " overruns, max write %.1fms (%" PRIu32
+             " writes longer than %.1fms)", rec->name, rec->segs, rec->dels,
+             rec->reader.overruns, rec->wall / 1e3, rec->slow,
+             rec->period / 1e3);
+    TRYFREE(rec->sizes);
+    TRYFREE(rec->buf);
+    rec->cap = 0;
+    rec->task = NULL;
+    vTaskDelete(NULL);
+}
+
+static esp_err_t rec_start(avc_rec_t *rec, const char *dir, uint32_t mb, uint32_t sec) {
+    filesys_info_t info;
+    if (rec->task) return ESP_ERR_INVALID_STATE;
+    rec->fs = rec_fstype(dir);
+    if (!rec->fs || !filesys_get_info(rec->fs, &info))
+        return ESP_ERR_NOT_FOUND;
+    if (!strlen(filesys_norm_r(rec->fs, rec->dir, dir)) ||
+        !filesys_mkdir(rec->fs, rec->dir)) return ESP_ERR_INVALID_ARG;
+    size_t clsize = info.clsize ?: 512;
+    rec->prealloc = info.clsize != 0;   // FAT only (i.e. not SPIFFS)
+    rec->bsize = (REC_BUFSIZE + clsize - 1) / clsize * clsize;
+    rec->buf = heap_caps_malloc_prefer(rec->bsize, 2,
+        MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL, MALLOC_CAP_DEFAULT);
+    if (!rec->buf) return ESP_ERR_NO_MEM;
+    rec->seg_size = MIN(mb ?: REC_SEGMENT_MB, 2047) << 20;
+    rec->seg_size = MIN(rec->seg_size, info.total / 4);
+    rec->seg_secs = sec ?: REC_SEGMENT_SEC;
+    rec->segs = rec->dels = rec->wall = rec->slow = rec->period = 0;
+    rec->run = true;
+    if (avc_attach(&rec->reader)) {
+        TRYFREE(rec->buf);
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskCreate(record_task, "record", 4096, rec, 15, &rec->task);
+    if (!rec->task) {
+        avc_detach(&rec->reader);
+        TRYFREE(rec->buf);
+        return ESP_ERR_NO_MEM;
+    }
+    int target = rec->reader.target;
+    const char *name = target == AUDIO_TARGET ? "audio" : "video";
+    if (( rec->stop = !xTaskGetHandle(name) )) avc_async(target, "1", 0, NULL);
+    return ESP_OK;
+}
+
+static esp_err_t rec_stop(avc_rec_t *rec) {
+    if (!rec->task) return ESP_OK;
+    if (rec->stop) avc_async(rec->reader.target, "0", 0, NULL); // STOP frame
+    rec->run = false;
+    xTaskNotifyGive(rec->task);
+    for (int ms = 1000; ms > 0 && rec->task; ms -= 10) { msleep(10); }
+    return rec->task ? ESP_ERR_TIMEOUT : ESP_OK;
+}
+#endif // AVC_RECORD
+
 esp_err_t avc_async(
     int targets, const void *ctrl, uint32_t tout_ms, FILE *stream
 ) {
@@ -488,7 +1396,18 @@ esp_err_t avc_async(
     bool atgt = targets & AUDIO_TARGET, vtgt = targets & VIDEO_TARGET;
     TaskHandle_t atask = xTaskGetHandle("audio");
     TaskHandle_t vtask = xTaskGetHandle("video");
-    if (targets & IMAGE_TARGET) {
+    if (atgt && targets & (ACTION_READ | ACTION_WRITE)) {
+#ifdef CONFIG_BASE_USE_I2S
+        if (targets & ACTION_WRITE)
+            return ctrl ? aud_loads(ctrl) : ESP_ERR_INVALID_ARG;
+        if (stream) aud_dumps(stream);
+        if (ctrl && !( *(char **)ctrl = aud_dumps(NULL) ))
+            return ESP_ERR_NO_MEM;
+        return ESP_OK;
+#else
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    } else if (targets & IMAGE_TARGET) {
 #ifdef CONFIG_BASE_USE_CAM
         sensor_t *cam = esp_camera_sensor_get();
         if (!cam) return ESP_ERR_INVALID_STATE;
@@ -513,7 +1432,7 @@ esp_err_t avc_async(
                 msleep(ms);
             }
         } else {
-            UNUSED void *arg = (void *)(tout_ms ?: UINT32_MAX);
+            UNUSED void *arg = (void *)(uintptr_t)(tout_ms ?: UINT32_MAX);
 #ifdef CONFIG_BASE_USE_I2S
             if (atgt && !atask) {
                 audio_run = true;
@@ -533,16 +1452,50 @@ esp_err_t avc_async(
     if (stream) {
 #ifdef CONFIG_BASE_USE_I2S
         if (atgt && !aud_shdl) REGEVTS(AVC, aud_visual, stream, &aud_shdl);
+        if (atgt && aud_shdl && avc_attach(&aud_vis)) UREGEVTS(AVC, aud_shdl);
 #endif
 #ifdef CONFIG_BASE_USE_CAM
         if (vtgt && !vid_shdl) REGEVTS(AVC, vid_visual, stream, &vid_shdl);
+        if (vtgt && vid_shdl && avc_attach(&vid_vis)) UREGEVTS(AVC, vid_shdl);
 #endif
     }
-    if (atgt) printf("Audio Capture: %s\n", atask ? "on" : "off");
-    if (vtgt) printf("Video Capture: %s\n", vtask ? "on" : "off");
+    if (atgt) {
+        printf("Audio Capture: %s\n", atask ? "on" : "off");
+        ring_stats(&aud_ring, stdout);
+#ifdef CONFIG_BASE_USE_I2S
+        aud_dumps(stdout);
+#endif
+    }
+    if (vtgt) {
+        printf("Video Capture: %s\n", vtask ? "on" : "off");
+        ring_stats(&vid_ring, stdout);
+    }
     return ESP_OK;
 }
 
+esp_err_t avc_record(int targets, const char *dir, uint32_t mb, uint32_t sec) {
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+#ifdef AVC_RECORD
+    avc_rec_t *rec;
+#   ifdef CONFIG_BASE_USE_I2S
+    if (targets & AUDIO_TARGET) {
+        rec = &aud_rec;
+        if (dir && !rec->task) wav_recover();
+        if (( err = dir ? rec_start(rec, dir, mb, sec) : rec_stop(rec) ))
+            return err;
+    }
+#   endif
+#   ifdef CONFIG_BASE_USE_CAM
+    if (targets & VIDEO_TARGET) {
+        rec = &vid_rec;
+        if (( err = dir ? rec_start(rec, dir, mb, sec) : rec_stop(rec) ))
+            return err;
+    }
+#   endif
+#endif
+    return err; NOTUSED(dir); NOTUSED(mb); NOTUSED(sec);
+}
+
 esp_err_t avc_sync(int targets, void **buf, size_t *len) {
     if (!len || !buf) return ESP_ERR_INVALID_ARG;
     if (targets & IMAGE_TARGET) {
@@ -566,9 +1519,17 @@ esp_err_t avc_sync(int targets, void **buf, size_t *len) {
     return ESP_OK;
 }
 
+// Called after filesys_initialize, as avc_initialize is before it.
+void avc_recover() {
+#if defined(AVC_RECORD) && defined(CONFIG_BASE_USE_I2S)
+    wav_recover();
+#endif
+}
+
 void avc_initialize() {
 #ifdef CONFIG_BASE_USE_I2S
     i2s_initialize();
+    dsp_restore();
 #endif
 #ifdef CONFIG_BASE_USE_CAM
     cam_initialize();
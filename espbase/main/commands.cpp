@@ -10,6 +10,7 @@
 #include "drivers.h"
 #include "filesys.h"
 #include "network.h"
+#include "server.h"
 #include "sensors.h"
 #include "avcmode.h"
 #include "ledmode.h"
@@ -44,6 +45,7 @@
 #define CONSOLE_UTIL_LSMEM          // 1308 Bytes
 #define CONSOLE_UTIL_CONFIG         // 2852 Bytes
 #define CONSOLE_UTIL_LOGGING        //  596 Bytes
+#define CONSOLE_UTIL_SCHED          // 2108 Bytes
 #if defined(CONFIG_BASE_USE_FFS) || defined(CONFIG_BASE_USE_SDFS)
 #   define CONSOLE_UTIL_LSFS        //  512 Bytes
 #   define CONSOLE_UTIL_HISTORY     //  806 Bytes
@@ -87,6 +89,9 @@
 #   endif
 #   define CONSOLE_NET_TSYNC        // 7888 Bytes
 #   define CONSOLE_NET_HBEAT        //  160 Bytes
+#   ifdef CONFIG_BASE_USE_WEBSERVER
+#       define CONSOLE_NET_HTTP     // TODO Bytes
+#   endif
 #endif
 #if defined(CONFIG_BASE_USE_WIFI) && defined(CONFIG_ESP_WIFI_FTM_ENABLE)
 #   define CONSOLE_NET_FTM          // 1860 Bytes
@@ -115,9 +120,11 @@ static const char * TAG = "Command";
  * Some common utilities
  */
 
+extern "C" esp_err_t console_register_command(const esp_console_cmd_t *);
+
 static esp_err_t register_commands(const esp_console_cmd_t *cmds, size_t num) {
     esp_err_t err = ESP_OK;
-    LOOPN(i, num) { if (( err = esp_console_cmd_register(cmds + i) )) break; }
+    LOOPN(i, num) { if (( err = console_register_command(cmds + i) )) break; }
     return err;
 }
 
@@ -886,7 +893,10 @@ static int util_lshw(int c, char **v) { hardware_info(); return ESP_OK; }
 #endif
 
 #ifdef CONSOLE_UTIL_LSPART
-static int util_lspart(int c, char **v) { partition_info(); return ESP_OK; }
+static int util_lspart(int c, char **v) {
+    partition_info(console_jsonw());
+    return ESP_OK;
+}
 #endif
 
 #ifdef CONSOLE_UTIL_LSTASK
@@ -905,7 +915,8 @@ static int util_lstask(int argc, char **argv) {
     switch (util_lstask_args.lvl->count) {
     case 2: esp_event_dump(stdout); putchar('\n'); FALLTH;
     case 1: esp_timer_dump(stdout); putchar('\n'); FALLTH;
-    default: task_info((tsort_t)ARG_INT(util_lstask_args.sort, TSORT_TID));
+    default: task_info((tsort_t)ARG_INT(util_lstask_args.sort, TSORT_TID),
+                       console_jsonw());
     }
     return ESP_OK;
 }
@@ -929,7 +940,7 @@ static int util_lsmem(int argc, char **argv) {
             heap_caps_print_heap_info(MALLOC_CAP_EXEC); FALLTH;
     case 1: heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
             heap_caps_print_heap_info(MALLOC_CAP_INTERNAL); break;
-    default: memory_info(); break;
+    default: memory_info(console_jsonw()); break;
     }
     switch (util_lsmem_args.chk->count) {
     case 3: heap_caps_check_integrity_all(true); break;
@@ -964,7 +975,30 @@ static int util_lsfs(int argc, char **argv) {
     ARG_PARSE(argc, argv, &util_lsfs_args);
     const char *path = ARG_STR(util_lsfs_args.dir, "/");
     filesys_type_t type = FILESYS_TYPE(util_lsfs_args.ext->count);
-    if (util_lsfs_args.info->count) {
+    jsonw_t *jw = console_jsonw();
+    if (jw && util_lsfs_args.info->count) {
+        filesys_info_t info;
+        if (!filesys_get_info(type, &info)) return ESP_ERR_NOT_FOUND;
+        jsonw_open(jw, NULL, false);
+        jsonw_int(jw, "used", info.used);
+        jsonw_int(jw, "total", info.total);
+        jsonw_int(jw, "blksize", info.blksize);
+        jsonw_close(jw);
+    } else if (jw && util_lsfs_args.stat->count) {
+        struct stat st;
+        if (stat(filesys_norm(type, path), &st)) return errval();
+        jsonw_open(jw, NULL, false);
+        jsonw_str(jw, "path", path);
+        jsonw_int(jw, "size", st.st_size);
+        jsonw_int(jw, "mode", st.st_mode);
+        jsonw_int(jw, "atime", st.st_atime);
+        jsonw_int(jw, "mtime", st.st_mtime);
+        jsonw_int(jw, "ctime", st.st_ctime);
+        jsonw_str(jw, "type", S_ISDIR(st.st_mode) ? "dir" : "file");
+        jsonw_close(jw);
+    } else if (jw && !util_lsfs_args.vfs->count) {
+        filesys_listdir_jsonw(type, path, jw);
+    } else if (util_lsfs_args.info->count) {
         filesys_print_info(type);
     } else if (util_lsfs_args.vfs->count) {
 #   ifdef IDF_TARGET_V4
@@ -1012,6 +1046,7 @@ static int util_config(int argc, char **argv) {
     const char *val = ARG_STR(util_config_args.val, NULL);
     const char *del = ARG_STR(util_config_args.del, NULL);
     bool env = util_config_args.env->count;
+    jsonw_t *jw = console_jsonw();
     if (del) {
         if (!env) {
             void *hdl = NULL;
@@ -1030,10 +1065,22 @@ static int util_config(int argc, char **argv) {
             } else if (setenv(key, val, true)) {
                 err = errval();
             }
-            printf("Set `%s` to `%s` %s\n", key, val, esp_err_to_name(err));
+            if (!jw) {
+                printf("Set `%s` to `%s` %s\n", key, val, esp_err_to_name(err));
+            } else if (!err) {
+                jsonw_open(jw, NULL, false);
+                jsonw_str(jw, key, val);
+                jsonw_close(jw);
+            }
         } else {
             val = !env ? config_get(key) : getenv(key);
-            printf("Get `%s` is `%s`\n", key, val ?: "(notset)");
+            if (!jw) {
+                printf("Get `%s` is `%s`\n", key, val ?: "(notset)");
+            } else {
+                jsonw_open(jw, NULL, false);
+                jsonw_str(jw, key, val);
+                jsonw_close(jw);
+            }
         }
     } else if (util_config_args.load->count) {
         err = config_nvs_load();
@@ -1044,7 +1091,11 @@ static int util_config(int argc, char **argv) {
     } else if (util_config_args.lall->count) {
         config_nvs_list(true);
     } else if (!env) {
-        config_stats();
+        config_stats(jw);
+    } else if (jw) {
+        jsonw_open(jw, NULL, true);
+        for (int i = 0; environ[i]; i++) { jsonw_str(jw, NULL, environ[i]); }
+        jsonw_close(jw);
     } else {
         int num = 0; while (environ[num]) { num++; }
         LOOPN(i, num) { printf("[%d/%d] %s\n", i, num, environ[i]); }
@@ -1158,6 +1209,49 @@ static int util_hist(int argc, char **argv) {
 }
 #endif // CONSOLE_UTIL_HISTORY
 
+#ifdef CONSOLE_UTIL_SCHED
+static struct {
+    arg_str_t *cmd;
+    arg_int_t *intv;
+    arg_str_t *at;
+    arg_lit_t *once;
+    arg_str_t *del;
+    arg_end_t *end;
+} util_sched_args = {
+    .cmd  = arg_str0(NULL, NULL, "CMD", "command or JSON-RPC (quoted)"),
+    .intv = arg_int0("i", NULL, "MS", "run every MS milliseconds"),
+    .at   = arg_str0("a", NULL, "HH:MM[:SS]", "run daily at local time"),
+    .once = arg_lit0("1", "once", "run only once"),
+    .del  = arg_str0("d", NULL, "ID|all", "delete scheduled job"),
+    .end  = arg_end(sizeof(util_sched_args) / sizeof(void *))
+};
+
+static int util_sched(int argc, char **argv) {
+    ARG_PARSE(argc, argv, &util_sched_args);
+    const char *cmd = ARG_STR(util_sched_args.cmd, NULL);
+    const char *del = ARG_STR(util_sched_args.del, NULL);
+    const char *at = ARG_STR(util_sched_args.at, NULL);
+    int intv = ARG_INT(util_sched_args.intv, 0), hh, mm, ss = 0;
+    if (del) return console_sched_del(strcmp(del, "all") ? atoi(del) : -1);
+    if (!cmd) {
+        console_sched_list(console_jsonw());
+        return ESP_OK;
+    }
+    if (at && (sscanf(at, "%d:%d:%d", &hh, &mm, &ss) < 2 ||
+               hh < 0 || hh > 23 || mm < 0 || mm > 59 || ss < 0 || ss > 59)) {
+        printf("Invalid time: `%s`\n", at);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!at == !intv || intv < 0) {
+        printf("Specify either interval or time of the job\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return console_sched_add(
+        cmd, intv, at ? hh * 3600 + mm * 60 + ss : -1,
+        util_sched_args.once->count);
+}
+#endif // CONSOLE_UTIL_SCHED
+
 static esp_err_t register_util() {
     const esp_console_cmd_t cmds[] = {
 #ifdef CONSOLE_UTIL_DATETIME
@@ -1189,6 +1283,9 @@ static esp_err_t register_util() {
 #endif
 #ifdef CONSOLE_UTIL_HISTORY
         ESP_CMD_ARG(util, hist, "Dump / load console history from flash"),
+#endif
+#ifdef CONSOLE_UTIL_SCHED
+        ESP_CMD_ARG(util, sched, "Run commands periodically or at given time"),
 #endif
     };
     return register_commands(cmds, LEN(cmds));
@@ -1517,6 +1614,21 @@ static int net_hbeat(int argc, char **argv) {
 }
 #endif
 
+#ifdef CONSOLE_NET_HTTP
+static struct {
+    arg_str_t *ctrl;
+    arg_end_t *end;
+} net_http_args = {
+    .ctrl = arg_str0(NULL, NULL, "list|clear", "list / drop cached files"),
+    .end  = arg_end(sizeof(net_http_args) / sizeof(void *))
+};
+
+static int net_http(int argc, char **argv) {
+    ARG_PARSE(argc, argv, &net_http_args);
+    return server_command(ARG_STR(net_http_args.ctrl, NULL));
+}
+#endif
+
 static esp_err_t register_net() {
     const esp_console_cmd_t cmds[] = {
 #ifdef CONSOLE_NET_BT
@@ -1548,6 +1660,9 @@ static esp_err_t register_net() {
 #endif
 #ifdef CONSOLE_NET_HBEAT
         ESP_CMD_ARG(net, hbeat, "HeartBeat to upload device info periodically"),
+#endif
+#ifdef CONSOLE_NET_HTTP
+        ESP_CMD_ARG(net, http, "Query web server static file cache"),
 #endif
     };
     return register_commands(cmds, LEN(cmds));
@@ -1753,12 +1868,18 @@ static struct {
     arg_str_t *ctrl;
     arg_lit_t *viz;
     arg_int_t *tout;
+    arg_str_t *rec;
+    arg_int_t *seg;
+    arg_int_t *dur;
     arg_end_t *end;
 } app_avc_args = {
     .tgt  = arg_str0(NULL, NULL, "1~4", "audio|video|all|cam"),
     .ctrl = arg_str0(NULL, NULL, "on|off", "enable / disable"),
     .viz  = arg_lit0(NULL, "viz", "print audio volume / video frame info"),
     .tout = arg_int0("t", NULL, "0~2^31", "capture task timeout in ms"),
+    .rec  = arg_str0("r", "rec", "DIR|off", "record into WAV / AVI files"),
+    .seg  = arg_int0(NULL, "seg", "MB", "roll segment by size, default 64"),
+    .dur  = arg_int0(NULL, "dur", "SEC", "roll segment by time, default 300"),
     .end  = arg_end(sizeof(app_avc_args) / sizeof(void *))
 };
 
@@ -1784,6 +1905,18 @@ static int app_avc(int argc, char **argv) {
         }
         return err;
     }
+    if (index == AUDIO_TARGET && ctrl && strncnt(ctrl, "{:=}", -1)) {
+        return AUDIO_LOADS(ctrl) ?:
+            avc_async(AUDIO_TARGET | ACTION_READ, NULL, 0, stdout);
+    }
+    if (app_avc_args.rec->count) {
+        const char *dir = ARG_STR(app_avc_args.rec, NULL);
+        return avc_record(
+            MIN(index, 3), strcmp(dir, "off") ? dir : NULL,
+            ARG_INT(app_avc_args.seg, 0),
+            ARG_INT(app_avc_args.dur, 0)
+        );
+    }
     return avc_async(
         MIN(index, 3), ctrl,
         ARG_INT(app_avc_args.tout, 0),
@@ -1805,6 +1938,60 @@ static struct {
     .end  = arg_end(sizeof(app_sen_args) / sizeof(void *))
 };
 
+// Sample once and emit typed values in JSON mode
+static esp_err_t app_sen_json(uint8_t index, jsonw_t *jw) {
+    esp_err_t err = ESP_OK;
+    if (index == 0) {
+        float val = temp_celsius();
+        if (!val) return ESP_FAIL;
+        jsonw_open(jw, NULL, false);
+        jsonw_num(jw, "temp", val);
+    } else if (index == 1) {
+        int val = tpad_read(0);
+        if (val == -1) return ESP_FAIL;
+        jsonw_open(jw, NULL, false);
+        jsonw_int(jw, "touch", val);
+    } else if (index == 2) {
+        tscn_data_t dat;
+        if (( err = tscn_read(&dat, true) )) return err;
+        jsonw_open(jw, NULL, false);
+        jsonw_int(jw, "gesture", dat.ges);
+        jsonw_open(jw, "points", true);
+        LOOPN(i, MIN(dat.num, LEN(dat.pts))) {
+            jsonw_open(jw, NULL, false);
+            jsonw_int(jw, "id", dat.pts[i].id);
+            jsonw_int(jw, "evt", dat.pts[i].evt);
+            jsonw_int(jw, "x", dat.pts[i].x);
+            jsonw_int(jw, "y", dat.pts[i].y);
+            jsonw_close(jw);
+        }
+        jsonw_close(jw);
+    } else if (index == 3) {
+        uint16_t val = vlx_read();
+        if (val == UINT16_MAX) return ESP_FAIL;
+        jsonw_open(jw, NULL, false);
+        jsonw_int(jw, "range", val);
+    } else if (index == 4) {
+        gy39_data_t dat;
+        if (( err = gy39_read(&dat) )) return err;
+        jsonw_open(jw, NULL, false);
+        jsonw_num(jw, "brightness", dat.brightness);
+        jsonw_num(jw, "temperature", dat.temperature);
+        jsonw_num(jw, "atmosphere", dat.atmosphere);
+        jsonw_num(jw, "humidity", dat.humidity);
+        jsonw_num(jw, "altitude", dat.altitude);
+    } else if (index == 5) {
+        int val = pwr_vbat();
+        if (val == -1) return ESP_ERR_INVALID_STATE;
+        jsonw_open(jw, NULL, false);
+        jsonw_int(jw, "vbat", val);
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    jsonw_close(jw);
+    return err;
+}
+
 static int app_sen(int argc, char **argv) {
     ARG_PARSE(argc, argv, &app_sen_args);
     esp_err_t err = ESP_FAIL;
@@ -1812,6 +1999,7 @@ static int app_sen(int argc, char **argv) {
     const char *itpl = app_sen_args.name->hdr.glossary;
     const char *istr = strstr(itpl, sensor);
     uint8_t index = istr ? strncnt(itpl, "|", istr - itpl) : sensor[0] - '0';
+    if (console_jsonw()) return app_sen_json(index, console_jsonw());
     uint16_t intv_ms = CONS(ARG_INT(app_sen_args.intv, 500), 10, 1000);
     uint32_t tout_ms = ARG_INT(app_sen_args.tout, 0);
     uint64_t state = asleep(intv_ms, 0);
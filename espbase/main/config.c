@@ -202,7 +202,16 @@ const char * config_get(const char *key) {
     return idx == -1 ? "Unknown" : *rwlst[idx].val;
 }
 
-void config_stats() {
+void config_stats(jsonw_t *jw) {
+    if (jw) {
+        jsonw_open(jw, NULL, false);
+        LOOPN(i, rwlen) {
+            bool pass = endswith(rwlst[i].key, "pass");
+            jsonw_str(jw, rwlst[i].key, pass ? "********" : *rwlst[i].val);
+        }
+        jsonw_close(jw);
+        return;
+    }
 #ifdef CONFIG_BASE_AUTO_ALIGN
     size_t keylen = 0;
     LOOPN(i, rwlen) { keylen = MAX(keylen, strlen(rwlst[i].key)); }
@@ -11,12 +11,15 @@
 
 #ifdef CONFIG_BASE_USE_CONSOLE
 
+#include <sys/time.h>
 #include <sys/fcntl.h>
 #include "cJSON.h"
+#include "esp_timer.h"
 #include "esp_console.h"
 #include "esp_task_wdt.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "linenoise/linenoise.h"
 
@@ -38,14 +41,62 @@
 #   endif
 #endif
 
+#define CONSOLE_ARGS 8
+
 static const char *TAG = "Console";
 
 static char prompt[32] = "$ ", context[32];
 
-static void *mutex = NULL;
+static void *mutex = NULL;                          // for esp_console_run
+
+static __thread jsonw_t *jsonw;                     // JSON mode of the task
+
+// Commands are looked up and called here instead of esp_console_run, which
+// splits command line in a static buffer. Arguments of each command are
+// parsed into its static argtable, so one command can only run once at a
+// time but different commands can run concurrently.
+typedef struct {
+    const char *name;
+    esp_console_cmd_func_t func;
+#ifndef IDF_TARGET_V4
+    esp_console_cmd_func_with_context_t func_w_context;
+    void *context;
+#endif
+    void *lock;
+} console_cmd_t;
+
+static struct {
+    size_t num;
+    console_cmd_t *cmds;
+} registry;
 
 void console_register_commands();                   // see commands.cpp
 
+esp_err_t console_register_command(const esp_console_cmd_t *cmd) {
+    esp_err_t err = esp_console_cmd_register(cmd);
+    if (err) return err;
+    size_t size = (registry.num + 1) * sizeof(console_cmd_t);
+    if (( err = EREALLOC(registry.cmds, size) )) return err;
+    console_cmd_t *ent = registry.cmds + registry.num;
+    ent->name = cmd->command;
+    ent->func = cmd->func;
+#ifndef IDF_TARGET_V4
+    ent->func_w_context = cmd->func_w_context;
+    ent->context = cmd->context;
+#endif
+    if (!( ent->lock = MUTEX() )) return ESP_ERR_NO_MEM;
+    RELEASE(ent->lock);
+    registry.num++;
+    return ESP_OK;
+}
+
+static console_cmd_t * console_find_command(const char *name) {
+    LOOPN(i, registry.num) {
+        if (!strcmp(registry.cmds[i].name, name)) return registry.cmds + i;
+    }
+    return NULL;
+}
+
 void console_register_prompt(const char *str, const char *ctx) {
     if (ctx) {
         if (!strlen(ctx)) context[0] = '\0';
@@ -69,6 +120,8 @@ void console_register_prompt(const char *str, const char *ctx) {
     }
 }
 
+static void sched_load();
+
 void console_initialize() {
     /* esp_system/startup.c -> esp_vfs_console_register()
      *  - /dev/uart/{NUM_UART}
@@ -127,7 +180,7 @@ void console_initialize() {
     }
     esp_console_config_t console_config = {
         .max_cmdline_length = 256,
-        .max_cmdline_args = 8,
+        .max_cmdline_args = CONSOLE_ARGS,
 #if CONFIG_LOG_COLORS
         .hint_color = atoi(LOG_COLOR_CYAN),
         .hint_bold = atoi(LOG_COLOR_CYAN)
@@ -142,6 +195,7 @@ void console_initialize() {
     } else {
         ESP_LOGE(TAG, "Could not create semaphore! This is NOT thread-safe!");
     }
+    sched_load();
 }
 
 /* Redirect STDOUT to a buffer, thus any thing printed to STDOUT will be
@@ -198,17 +252,104 @@ void console_initialize() {
  *      stderr = fopen("/dev/ram/2", "w");
  *
  * Currently method 2 is in use. Try method 4 if necessary in the future.
+ *
+ * Note that `stdout` of newlib in ESP-IDF is a member of `struct _reent`,
+ * which is allocated for each task. Redirecting it only affects the calling
+ * task, so commands executed by other tasks and their logs are not mixed.
  */
 
-char * console_handle_command(const char *cmd, bool pipe, bool history) {
-    if (!ACQUIRE(mutex, 100)) return strdup("Console task is busy");
+jsonw_t * console_jsonw() { return jsonw; }
+
+/* Streaming output: instead of collecting all output in a memstream, stdout
+ * of the command is redirected to a cookie stream, which is line buffered in
+ * no more than CONSOLE_CHUNK bytes. Each flushed chunk is delivered to the
+ * sink immediately, so memory usage is flat regardless of output length.
+ * A blocking sink (e.g. socket send) throttles the command itself. Once the
+ * sink refuses data, the rest of output is discarded.
+ */
+
+typedef struct {
+    console_sink_t sink;
+    void *arg;
+    char *id;                       // wrap chunks as notify if not NULL
+    bool closed;
+    char tmp[CONSOLE_CHUNK + 1];
+} console_stream_t;
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t len) {
+    console_stream_t *st = cookie;
+    for (size_t off = 0, n; !st->closed && off < len; off += n) {
+        n = MIN(len - off, CONSOLE_CHUNK);
+        if (!st->id) {
+            st->closed = !st->sink(st->arg, buf + off, n);
+            continue;
+        }
+        size_t size = 0;
+        char *msg = NULL;
+        jsonw_t jw = { .fp = open_memstream(&msg, &size) };
+        if (!jw.fp) {
+            st->closed = true;
+            break;
+        }
+        memcpy(st->tmp, buf + off, n);
+        st->tmp[n] = '\0';
+        fprintf(jw.fp, "{\"jsonrpc\":\"2.0\",\"method\":\"output\","
+                       "\"params\":[%s,", st->id);
+        jsonw_str(&jw, NULL, st->tmp);
+        fputs("]}", jw.fp);
+        fclose(jw.fp);
+        st->closed = !msg || !st->sink(st->arg, msg, size);
+        TRYFREE(msg);
+    }
+    return len;                     // pretend written, so command goes on
+}
+
+static FILE * stream_open(console_stream_t *st) {
+    cookie_io_functions_t funcs = { .write = stream_write };
+    FILE *fp = fopencookie(st, "w", funcs);
+    if (fp) setvbuf(fp, NULL, _IOLBF, CONSOLE_CHUNK);
+    return fp;
+}
+
+// Output is written to `to` if specified, else collected in a memstream if
+// `pipe` is true. JSON output of the command is written to a separate
+// memstream so that logs and plain text printed meanwhile will not break it.
+// If JSON mode is requested, `json` indicates whether a complete JSON value
+// is returned.
+static char * console_exec(
+    const char *cmd, bool pipe, bool history, bool *json, FILE *to
+) {
+    char *line = strdup(cmd ?: ""), *argv[CONSOLE_ARGS + 1] = { NULL };
+    size_t argc = line ? esp_console_split_argv(line, argv, LEN(argv)) : 0;
+    console_cmd_t *ent = argc ? console_find_command(argv[0]) : NULL;
+    void *lock = ent ? ent->lock : mutex;
+    if (!ACQUIRE(lock, 100)) {
+        TRYFREE(line);
+        if (json) *json = false;
+        return strdup("Console task is busy");
+    }
 
     size_t size = 0;
     char *buf = NULL;
-    FILE *bak = stdout;
-    if (pipe) stdout = open_memstream(&buf, &size);
+    FILE *bak = stdout, *out = to;
+    if (!out && pipe) out = open_memstream(&buf, &size);
+    if (out) stdout = out;
+
+    size_t jlen = 0;
+    char *jbuf = NULL;
+    jsonw_t jw = { .fp = json && out ? open_memstream(&jbuf, &jlen) : NULL };
+    if (jw.fp) jsonw = &jw;
 
-    int code, err = esp_console_run(cmd, &code) ?: code;
+    int code, err;
+    if (!ent) {
+        err = esp_console_run(cmd, &code) ?: code;
+#ifndef IDF_TARGET_V4
+    } else if (ent->func_w_context) {
+        err = ent->func_w_context(ent->context, argc, argv);
+#endif
+    } else {
+        err = ent->func(argc, argv);
+    }
     if (err == ESP_OK || err == ESP_ERR_CONSOLE_ARGPARSE) {
         // do nothing
     } else if (err == ESP_ERR_NOT_FOUND) {
@@ -216,10 +357,18 @@ char * console_handle_command(const char *cmd, bool pipe, bool history) {
     } else {
         ESP_LOGE(TAG, "Command error: %d (%s)", err, esp_err_to_name(err));
     }
-    if (pipe) {
-        fclose(stdout);
+    if (jw.fp) {
+        jsonw = NULL;
+        fclose(jw.fp);
+    }
+    if (out) {
+        if (out == to) {
+            fflush(out);
+        } else {
+            fclose(out);
+        }
         stdout = bak;
-    } else {
+    } else if (!pipe) {
         putchar('\n');
     }
     if (buf != NULL) {
@@ -227,11 +376,40 @@ char * console_handle_command(const char *cmd, bool pipe, bool history) {
         if (!size) TRYFREE(buf);                    // no log output
         if (size && !pipe) putchar('\n');           // one more blank line
     }
+    if (json) *json = jbuf && jw.items && !jw.depth;
+    if (json && *json) {
+        TRYFREE(buf);
+        buf = jbuf;
+    } else {
+        TRYFREE(jbuf);
+    }
     if (history) linenoiseHistoryAdd(cmd);
-    RELEASE(mutex);
+    RELEASE(lock);
+    TRYFREE(line);
     return buf;
 }
 
+char * console_handle_command(const char *cmd, bool pipe, bool history) {
+    return console_exec(cmd, pipe, history, NULL, NULL);
+}
+
+esp_err_t console_handle_stream(
+    const char *cmd, console_sink_t sink, void *arg
+) {
+    console_stream_t *st = NULL;
+    if (EMALLOC(st, sizeof(console_stream_t))) return ESP_ERR_NO_MEM;
+    *st = (console_stream_t){ .sink = sink, .arg = arg };
+    FILE *fp = stream_open(st);
+    if (fp) {
+        char *ret = console_exec(cmd, true, false, NULL, fp);
+        if (ret) fputs(ret, fp);                    // e.g. console is busy
+        TRYFREE(ret);
+        fclose(fp);
+    }
+    TRYFREE(st);
+    return fp ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
 void console_handle_one() {
     char *raw = linenoise(context[0] ? context : prompt),
          *trim = strtrim(raw, " \t\r\n"), *cmd = NULL;
@@ -271,71 +449,669 @@ void console_loop_begin(int xCoreID) {
     }
 }
 
-static char * rpc_error(double code, const char *errstr) {
+static cJSON * rpc_error(const cJSON *id, double code, const char *errstr) {
     cJSON *rep = cJSON_CreateObject(), *error;
-    cJSON_AddNullToObject(rep, "id");
+    if (id) {
+        cJSON_AddItemToObject(rep, "id", cJSON_Duplicate(id, false));
+    } else {
+        cJSON_AddNullToObject(rep, "id");
+    }
     cJSON_AddItemToObject(rep, "error", error = cJSON_CreateObject());
     cJSON_AddStringToObject(rep, "jsonrpc", "2.0");
     cJSON_AddNumberToObject(error, "code", code);
     cJSON_AddStringToObject(error, "message", errstr);
-    char *json = cJSON_PrintUnformatted(rep);
-    cJSON_Delete(rep);
-    return json;
+    return rep;
 }
 
-static char * rpc_response(const char *id, const char *result) {
+static cJSON * rpc_response(const cJSON *id, const char *result, bool raw) {
     cJSON *rep = cJSON_CreateObject();
-    if (id) {
-        cJSON_AddStringToObject(rep, "id", id);
+    cJSON_AddItemToObject(rep, "id", cJSON_Duplicate(id, false));
+    cJSON_AddStringToObject(rep, "jsonrpc", "2.0");
+    if (raw) {
+        cJSON_AddRawToObject(rep, "result", result);    // already JSON
     } else {
-        cJSON_AddNullToObject(rep, "id");
+        cJSON_AddStringToObject(rep, "result", result);
     }
-    cJSON_AddStringToObject(rep, "jsonrpc", "2.0");
-    cJSON_AddStringToObject(rep, "result", result);
-    char *json = cJSON_PrintUnformatted(rep);
-    cJSON_Delete(rep);
-    return json;
+    return rep;
 }
 
-char * console_handle_rpc(const char *json) {
-    char *ret = NULL, *cmd = NULL, *tmp = NULL;
-    cJSON *obj = cJSON_Parse(json),
+static cJSON * rpc_handle(const cJSON *obj, console_sink_t sink, void *arg) {
+    char *cmd = NULL, *tmp = NULL;
+    bool json = cJSON_IsTrue(cJSON_GetObjectItem(obj, "json"));
+    bool stream = sink && cJSON_IsTrue(cJSON_GetObjectItem(obj, "stream"));
+    cJSON *rep = NULL,
           *uid = cJSON_GetObjectItem(obj, "id"),
           *method = cJSON_GetObjectItem(obj, "method"),
           *params = cJSON_GetObjectItem(obj, "params");
-    if (!obj) {
-        ret = rpc_error(-32700, "Parse Error");
-        goto exit;
-    }
-    if (!method || (params && !cJSON_IsArray(params))) {
-        ret = rpc_error(-32600, "Invalid Request");
-        goto exit;
-    }
+    if (!cJSON_IsString(method) || (params && !cJSON_IsArray(params)))
+        return rpc_error(uid, -32600, "Invalid Request");
     if (cJSON_GetArraySize(params)) {           // command with arguments
         size_t size = 0; FILE *buf = open_memstream(&cmd, &size);
         fprintf(buf, "%s", method->valuestring);
         for (cJSON *child = params->child; child; child = child->next) {
-            fprintf(buf, " %s", child->valuestring);
+            if (cJSON_IsString(child)) {
+                fprintf(buf, " %s", child->valuestring);
+            } else if (cJSON_IsNumber(child)) {
+                fprintf(buf, " %g", child->valuedouble);
+            } else if (cJSON_IsBool(child)) {
+                fprintf(buf, " %s", cJSON_IsTrue(child) ? "true" : "false");
+            }
         }
         fclose(buf);
     } else {                                    // command without arguments
         cmd = strdup(method->valuestring);
     }
-    if (!cmd) {                                 // command not parsed from json
-        ret = rpc_error(-32400, "System Error");
-        goto exit;
-    }
+    if (!cmd)                                   // command not parsed from json
+        return rpc_error(uid, -32400, "System Error");
     ESP_LOGD(TAG, "Got RPC command: `%s`", cmd);
-    tmp = console_handle_command(cmd, true, false);
+    FILE *fp = NULL;
+    console_stream_t *st = NULL;
+    if (stream && uid && !EMALLOC(st, sizeof(console_stream_t))) {
+        *st = (console_stream_t){ .sink = sink, .arg = arg };
+        if (( st->id = cJSON_PrintUnformatted(uid) )) fp = stream_open(st);
+    }
+    tmp = console_exec(cmd, true, false, json ? &json : NULL, fp);
+    TRYNULL(fp, fclose);
+    if (st) TRYFREE(st->id);
+    TRYFREE(st);
     ESP_LOGD(TAG, "Got RPC result: %s", tmp);
-    if (uid) ret = rpc_response(uid->valuestring, tmp ?: "");   // not notify
-exit:
-    TRYNULL(obj, cJSON_Delete);
+    if (uid) rep = rpc_response(uid, tmp ?: "", json);  // not notify
     TRYFREE(tmp);
     TRYFREE(cmd);
+    return rep;
+}
+
+char * console_handle_rpc(const char *json) {
+    return console_handle_rpc_stream(json, NULL, NULL);
+}
+
+char * console_handle_rpc_stream(
+    const char *json, console_sink_t sink, void *arg
+) {
+    cJSON *obj = cJSON_Parse(json), *rep = NULL, *item;
+    if (!obj) {
+        rep = rpc_error(NULL, -32700, "Parse Error");
+    } else if (!cJSON_IsArray(obj)) {
+        rep = rpc_handle(obj, sink, arg);
+    } else if (!cJSON_GetArraySize(obj)) {      // empty batch
+        rep = rpc_error(NULL, -32600, "Invalid Request");
+    } else {                                    // batch: one reply per call
+        rep = cJSON_CreateArray();
+        cJSON_ArrayForEach(item, obj) {
+            item = rpc_handle(item, sink, arg);
+            if (item) cJSON_AddItemToArray(rep, item);
+        }
+        if (!cJSON_GetArraySize(rep)) TRYNULL(rep, cJSON_Delete);
+    }
+    char *ret = rep ? cJSON_PrintUnformatted(rep) : NULL;
+    TRYNULL(rep, cJSON_Delete);
+    TRYNULL(obj, cJSON_Delete);
     return ret;
 }
 
+/* MessagePack-RPC: same requests / replies as JSON-RPC but packed in binary.
+ * Only nil, bool, int, float, str, array and map are supported.
+ */
+
+enum { MP_NIL, MP_BOOL, MP_INT, MP_FLOAT, MP_STR, MP_ARRAY, MP_MAP };
+
+typedef struct {
+    const uint8_t *ptr, *end;
+} mp_reader_t;
+
+typedef struct {
+    int type;
+    uint32_t len;           // bytes of str or number of items of array / map
+    const char *str;
+    int64_t num;
+    double flt;
+} mp_item_t;
+
+static bool mp_take(mp_reader_t *rd, size_t len, uint64_t *val) {
+    if ((size_t)(rd->end - rd->ptr) < len) return false;
+    for (*val = 0; len--; rd->ptr++) { *val = *val << 8 | *rd->ptr; }
+    return true;
+}
+
+static bool mp_read(mp_reader_t *rd, mp_item_t *item) {
+    uint64_t val;
+    if (!mp_take(rd, 1, &val)) return false;
+    uint8_t tag = val;
+    item->len = 0;
+    if (tag < 0x80 || tag >= 0xE0) {
+        item->type = MP_INT;
+        item->num = (int8_t)tag;
+        if (tag < 0x80) item->num = tag;
+        return true;
+    }
+    if (tag < 0x90) { item->type = MP_MAP;   item->len = tag & 0x0F; return true; }
+    if (tag < 0xA0) { item->type = MP_ARRAY; item->len = tag & 0x0F; return true; }
+    if (tag < 0xC0) { item->type = MP_STR;   val = tag & 0x1F; goto str; }
+    switch (tag) {
+    case 0xC0: item->type = MP_NIL; return true;
+    case 0xC2: FALLTH;
+    case 0xC3: item->type = MP_BOOL; item->num = tag & 1; return true;
+    case 0xCA: {
+        if (!mp_take(rd, 4, &val)) return false;
+        uint32_t u32 = val; float f32;
+        memcpy(&f32, &u32, 4);
+        item->type = MP_FLOAT; item->flt = f32;
+        return true;
+    }
+    case 0xCB:
+        if (!mp_take(rd, 8, &val)) return false;
+        item->type = MP_FLOAT; memcpy(&item->flt, &val, 8);
+        return true;
+    case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+        if (!mp_take(rd, 1 << (tag - 0xCC), &val)) return false;
+        item->type = MP_INT; item->num = val;
+        return true;
+    case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+        size_t len = 1 << (tag - 0xD0);
+        if (!mp_take(rd, len, &val)) return false;
+        item->type = MP_INT;
+        item->num = len == 8 ? (int64_t)val : ((int64_t)(val << (64 - len * 8)) >> (64 - len * 8));
+        return true;
+    }
+    case 0xD9: case 0xDA: case 0xDB:
+        if (!mp_take(rd, 1 << (tag - 0xD9), &val)) return false;
+        item->type = MP_STR;
+        goto str;
+    case 0xDC: case 0xDD:
+        if (!mp_take(rd, 2 << (tag - 0xDC), &val)) return false;
+        item->type = MP_ARRAY; item->len = val;
+        return true;
+    case 0xDE: case 0xDF:
+        if (!mp_take(rd, 2 << (tag - 0xDE), &val)) return false;
+        item->type = MP_MAP; item->len = val;
+        return true;
+    default:
+        return false;       // bin, ext and reserved are not supported
+    }
+str:
+    if ((size_t)(rd->end - rd->ptr) < val) return false;
+    item->str = (const char *)rd->ptr;
+    item->len = val;
+    rd->ptr += val;
+    return true;
+}
+
+static bool mp_skip(mp_reader_t *rd, int depth) {
+    mp_item_t item;
+    if (depth > 8 || !mp_read(rd, &item)) return false;
+    size_t num = item.type == MP_MAP ? item.len * 2 :
+                 item.type == MP_ARRAY ? item.len : 0;
+    while (num--) { if (!mp_skip(rd, depth + 1)) return false; }
+    return true;
+}
+
+static void mp_put_head(FILE *fp, uint8_t fix, uint8_t tag, size_t len) {
+    if (fix == 0xA0 ? len < 32 : len < 16) {
+        fputc(fix | len, fp);
+    } else if (fix == 0xA0 && len < 256) {
+        fputc(0xD9, fp); fputc(len, fp);
+    } else if (len < 65536) {
+        fputc(tag, fp); fputc(len >> 8, fp); fputc(len, fp);
+    } else {
+        fputc(tag + 1, fp);
+        LOOPN(i, 4) { fputc(len >> (24 - 8 * i), fp); }
+    }
+}
+
+#define mp_put_map(fp, n)   mp_put_head((fp), 0x80, 0xDE, (n))
+#define mp_put_array(fp, n) mp_put_head((fp), 0x90, 0xDC, (n))
+#define mp_put_nil(fp)      fputc(0xC0, (fp))
+
+static void mp_put_str(FILE *fp, const char *str) {
+    size_t len = strlen(str);
+    mp_put_head(fp, 0xA0, 0xDA, len);
+    fwrite(str, 1, len, fp);
+}
+
+static void mp_put_int(FILE *fp, int32_t num) {
+    if (num >= -32 && num < 128) {
+        fputc((uint8_t)num, fp);
+    } else {
+        fputc(0xD2, fp);
+        LOOPN(i, 4) { fputc((uint32_t)num >> (24 - 8 * i), fp); }
+    }
+}
+
+// id is packed as it is, error is omitted if msg is NULL
+static void mp_reply(FILE *fp, const mp_reader_t *id, int code, const char *msg) {
+    mp_put_map(fp, 3);
+    mp_put_str(fp, "jsonrpc");
+    mp_put_str(fp, "2.0");
+    mp_put_str(fp, "id");
+    if (id->ptr) {
+        fwrite(id->ptr, 1, id->end - id->ptr, fp);
+    } else {
+        mp_put_nil(fp);
+    }
+    if (!msg) {
+        mp_put_str(fp, "result");
+        return;             // caller appends the result
+    }
+    mp_put_str(fp, "error");
+    mp_put_map(fp, 2);
+    mp_put_str(fp, "code");
+    mp_put_int(fp, code);
+    mp_put_str(fp, "message");
+    mp_put_str(fp, msg);
+}
+
+// handle one packed request and return number of replies (0 or 1)
+static int rpc_handle_binary(mp_reader_t *rd, FILE *out) {
+    mp_reader_t id = { NULL, NULL };
+    mp_item_t item, method = { .type = MP_NIL }, param;
+    char *cmd = NULL, *tmp = NULL;
+    size_t size = 0;
+    FILE *buf = NULL;
+    if (!mp_read(rd, &item) || item.type != MP_MAP) goto invalid;
+    LOOPN(i, item.len) {
+        mp_item_t key;
+        if (!mp_read(rd, &key)) goto invalid;
+        if (key.type == MP_STR && key.len == 2 && !memcmp(key.str, "id", 2)) {
+            const uint8_t *ptr = rd->ptr;
+            if (!mp_skip(rd, 0)) goto invalid;
+            id = (mp_reader_t){ ptr, rd->ptr };
+        } else if (key.type == MP_STR && key.len == 6 &&
+                   !memcmp(key.str, "method", 6)) {
+            if (!mp_read(rd, &method) || method.type != MP_STR) goto invalid;
+        } else if (key.type == MP_STR && key.len == 6 &&
+                   !memcmp(key.str, "params", 6)) {
+            if (!mp_read(rd, &param) || param.type != MP_ARRAY) goto invalid;
+            if (!buf && !( buf = open_memstream(&cmd, &size) )) goto invalid;
+            LOOPN(j, param.len) {
+                mp_item_t arg;
+                if (!mp_read(rd, &arg)) goto invalid;
+                switch (arg.type) {
+                case MP_BOOL:  fprintf(buf, " %s", arg.num ? "true" : "false");
+                               break;
+                case MP_INT:   fprintf(buf, " %" PRId64, arg.num); break;
+                case MP_FLOAT: fprintf(buf, " %g", arg.flt); break;
+                case MP_STR:   fprintf(buf, " %.*s", (int)arg.len, arg.str);
+                               break;
+                case MP_NIL:   break;
+                default:       goto invalid;
+                }
+            }
+        } else if (!mp_skip(rd, 0)) {
+            goto invalid;
+        }
+    }
+    if (method.type != MP_STR) goto invalid;
+    if (!buf && !( buf = open_memstream(&cmd, &size) )) goto invalid;
+    fclose(buf);
+    buf = NULL;
+    if (!EMALLOC(tmp, method.len + size + 1)) {  // method + arguments
+        sprintf(tmp, "%.*s%s", (int)method.len, method.str, cmd);
+        TRYFREE(cmd);
+        cmd = tmp;
+        tmp = NULL;
+    } else {
+        TRYFREE(cmd);
+        mp_reply(out, &id, -32400, "System Error");
+        return 1;
+    }
+    ESP_LOGD(TAG, "Got RPC command: `%s`", cmd);
+    tmp = console_handle_command(cmd, true, false);
+    TRYFREE(cmd);
+    if (!id.ptr) {          // notify
+        TRYFREE(tmp);
+        return 0;
+    }
+    mp_reply(out, &id, 0, NULL);
+    mp_put_str(out, tmp ?: "");
+    TRYFREE(tmp);
+    return 1;
+invalid:
+    TRYNULL(buf, fclose);
+    TRYFREE(cmd);
+    mp_reply(out, &id, -32600, "Invalid Request");
+    return 1;
+}
+
+uint8_t * console_handle_rpc_binary(const uint8_t *inp, size_t len, size_t *olen) {
+    mp_reader_t rd = { inp, inp + len }, elem = rd, none = { NULL, NULL };
+    mp_item_t item;
+    char *body = NULL, *out = NULL;
+    size_t size = 0, count = 0;
+    bool batch = false;
+    FILE *fp = open_memstream(&body, &size);
+    if (!fp) return NULL;
+    if (!mp_read(&elem, &item)) {
+        mp_reply(fp, &none, -32700, "Parse Error");
+        count = 1;
+    } else if (item.type != MP_ARRAY) {
+        count = rpc_handle_binary(&rd, fp);
+    } else if (!item.len) {                     // empty batch
+        mp_reply(fp, &none, -32600, "Invalid Request");
+        count = 1;
+    } else {                                    // batch: one reply per call
+        batch = true;
+        LOOPN(i, item.len) {
+            rd.ptr = elem.ptr;
+            if (!mp_skip(&elem, 0)) {
+                mp_reply(fp, &none, -32700, "Parse Error");
+                count++;
+                break;
+            }
+            rd.end = elem.ptr;
+            count += rpc_handle_binary(&rd, fp);
+        }
+    }
+    fclose(fp);
+    if (batch && count && ( fp = open_memstream(&out, olen) )) {
+        mp_put_array(fp, count);
+        fwrite(body, 1, size, fp);
+        fclose(fp);
+    }
+    if (batch || !count) {
+        TRYFREE(body);
+        if (!out) *olen = 0;
+        return (uint8_t *)out;
+    }
+    *olen = size;
+    return (uint8_t *)body;
+}
+
+/* Command scheduler: run console commands (or JSON-RPC requests if starts
+ * with `{`) every N milliseconds, or at HH:MM:SS of local time (TZ applied)
+ * every day. Timers are esp_timer based (see setInterval / setTimeout), and
+ * their callbacks only queue the job, which is run by the scheduler task.
+ * Timers get the job ID instead of a pointer, and look it up under the lock
+ * as the job may be deleted (and its slot reused) while a callback is due.
+ * Jitter is measured from the deadline to the time the job is started. If a
+ * job is still pending when its next deadline comes, that run is skipped and
+ * counted as missed. Jobs are saved in NVS and restored at startup.
+ */
+
+#define SCHED_JOBS      8
+#define SCHED_CMDLEN    80
+#define SCHED_WAKE_MAX  600         // seconds, re-check wall clock
+
+typedef struct {
+    uint32_t intv;                  // ms, 0 if run at wall-clock time
+    int32_t at;                     // seconds since midnight, -1 if periodic
+    bool once;
+    char cmd[SCHED_CMDLEN];
+} sched_rec_t;
+
+typedef struct {
+    uint16_t id;                    // 0 if unused
+    sched_rec_t rec;
+    void *timer;
+    bool pending;
+    int64_t due, next, wake;        // us, monotonic or wall clock
+    uint32_t runs, missed;
+    int64_t jmin, jmax, jsum;       // jitter in us
+} sched_job_t;
+
+static struct {
+    uint16_t uid;
+    void *lock;
+    QueueHandle_t queue;
+    sched_job_t jobs[SCHED_JOBS];
+} sched;
+
+static int64_t sched_wall() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// next occurrence of `at` seconds since midnight in local time
+static int64_t sched_next_at(int32_t at) {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = at / 3600;
+    tm.tm_min = at / 60 % 60;
+    tm.tm_sec = at % 60;
+    time_t next = mktime(&tm);
+    if (next <= now) {
+        tm.tm_mday++;
+        tm.tm_isdst = -1;           // let mktime handle DST switch
+        next = mktime(&tm);
+    }
+    return next * 1000000LL;
+}
+
+static void sched_arm(sched_job_t *job, int64_t now) {
+    int64_t left = job->next - now;
+    left = CONS(left, 1000, SCHED_WAKE_MAX * 1000000LL);
+    job->wake = now + left;
+    esp_timer_stop(job->timer);     // in case it is still running
+    esp_timer_start_once(job->timer, left);
+}
+
+// Called with lock held when timer of the job expires
+static void sched_due(sched_job_t *job) {
+    if (job->rec.intv) {            // periodic: deadline on monotonic clock
+        int64_t due = job->next;
+        job->next += job->rec.intv * 1000LL;
+        if (job->pending || !xQueueSend(sched.queue, &job->id, 0)) {
+            job->missed++;
+        } else {
+            job->due = due;
+            job->pending = true;
+        }
+        return;
+    }
+    int64_t now = sched_wall();
+    if (llabs(now - job->wake) > 1000000) {
+        job->next = sched_next_at(job->rec.at);     // wall clock adjusted
+    } else if (now >= job->next - 1000) {
+        if (job->pending || !xQueueSend(sched.queue, &job->id, 0)) {
+            job->missed++;
+        } else {
+            job->due = job->next;
+            job->pending = true;
+        }
+        if (job->rec.once) return;
+        job->next = sched_next_at(job->rec.at);
+    }
+    sched_arm(job, now);
+}
+
+// Called in esp_timer task: the lock is only held briefly by others
+static void sched_fire(void *arg) {
+    uint16_t id = (uintptr_t)arg;
+    if (!ACQUIRE(sched.lock, -1)) return;
+    ITERP(job, sched.jobs) { if (job->id == id) sched_due(job); }
+    RELEASE(sched.lock);
+}
+
+static void sched_save() {
+    sched_rec_t recs[SCHED_JOBS];
+    size_t num = 0;
+    ITERP(job, sched.jobs) { if (job->id) recs[num++] = job->rec; }
+    void *nvs = NULL;
+    if (config_nvs_open(&nvs, "sched", false)) return;
+    if (num) {
+        config_nvs_write(nvs, "jobs", recs, num * sizeof(sched_rec_t));
+    } else {
+        config_nvs_delete(nvs, "jobs");
+    }
+    config_nvs_close(&nvs);
+}
+
+static void sched_free(sched_job_t *job) {
+    TRYNULL(job->timer, clearTimer);
+    job->id = 0;
+}
+
+static void sched_task(void *arg) {
+    uint16_t id;
+    char cmd[SCHED_CMDLEN];
+    for (;;) {
+        if (!xQueueReceive(sched.queue, &id, portMAX_DELAY)) continue;
+        sched_job_t *job = NULL;
+        ACQUIRE(sched.lock, -1);
+        ITERP(tmp, sched.jobs) { if (tmp->id == id) job = tmp; }
+        if (job) {
+            int64_t jitter = (job->rec.intv ? esp_timer_get_time()
+                                            : sched_wall()) - job->due;
+            if (!job->runs++) job->jmin = job->jmax = jitter;
+            job->jmin = MIN(job->jmin, jitter);
+            job->jmax = MAX(job->jmax, jitter);
+            job->jsum += jitter;
+            snprintf(cmd, sizeof(cmd), "%s", job->rec.cmd);
+        }
+        RELEASE(sched.lock);
+        if (!job) continue;
+        char *ret = cmd[0] == '{' ? console_handle_rpc(cmd)
+                                  : console_handle_command(cmd, true, false);
+        ESP_LOGD(TAG, "Scheduled `%s`: %s", cmd, ret ?: "");
+        TRYFREE(ret);
+        ACQUIRE(sched.lock, -1);    // never skip, or job stays pending
+        if (job->id == id) {
+            job->pending = false;
+            if (job->rec.once) {
+                sched_free(job);
+                sched_save();
+            }
+        }
+        RELEASE(sched.lock);
+    }
+}
+
+static esp_err_t sched_start(sched_job_t *job) {
+    void *arg = (void *)(uintptr_t)job->id;
+    if (job->rec.intv) {
+        job->next = esp_timer_get_time() + job->rec.intv * 1000LL;
+        job->timer = job->rec.once
+                   ? setTimeout(job->rec.intv, sched_fire, arg)
+                   : setInterval(job->rec.intv, sched_fire, arg);
+    } else {
+        job->next = sched_next_at(job->rec.at);
+        if (( job->timer = setTimeout(SCHED_WAKE_MAX * 1000, sched_fire, arg) ))
+            sched_arm(job, sched_wall());
+    }
+    return job->timer ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t sched_init() {
+    if (sched.queue) return ESP_OK;
+    if (!( sched.lock = MUTEX() )) return ESP_ERR_NO_MEM;
+    RELEASE(sched.lock);
+    sched.queue = xQueueCreate(SCHED_JOBS, sizeof(uint16_t));
+    if (!sched.queue || xTaskCreate(
+            sched_task, "sched", 8192, NULL, 2, NULL) != pdPASS) {
+        TRYNULL(sched.queue, vQueueDelete);
+        TRYNULL(sched.lock, vSemaphoreDelete);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sched_add(const sched_rec_t *rec, bool save) {
+    esp_err_t err = sched_init();
+    if (err) return err;
+    if (!ACQUIRE(sched.lock, 100)) return ESP_ERR_TIMEOUT;
+    sched_job_t *job = NULL;
+    ITERP(tmp, sched.jobs) { if (!job && !tmp->id) job = tmp; }
+    if (!job) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        memset(job, 0, sizeof(sched_job_t));
+        job->rec = *rec;
+        job->id = ++sched.uid ?: ++sched.uid;
+        if (( err = sched_start(job) )) {
+            sched_free(job);
+        } else if (save) {
+            sched_save();
+        }
+    }
+    RELEASE(sched.lock);
+    return err;
+}
+
+esp_err_t console_sched_add(
+    const char *cmd, uint32_t intv_ms, int32_t at_sec, bool once
+) {
+    sched_rec_t rec = { .intv = intv_ms, .at = at_sec, .once = once };
+    if (!cmd || !strlen(cmd) || strlen(cmd) >= sizeof(rec.cmd) ||
+        (intv_ms ? at_sec >= 0 : (at_sec < 0 || at_sec >= 86400)))
+        return ESP_ERR_INVALID_ARG;
+    strcpy(rec.cmd, cmd);
+    return sched_add(&rec, true);
+}
+
+esp_err_t console_sched_del(int id) {
+    if (!sched.lock) return ESP_ERR_NOT_FOUND;
+    if (!ACQUIRE(sched.lock, 100)) return ESP_ERR_TIMEOUT;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    ITERP(job, sched.jobs) {
+        if (!job->id || (id >= 0 && job->id != id)) continue;
+        sched_free(job);
+        err = ESP_OK;
+    }
+    if (!err) sched_save();
+    RELEASE(sched.lock);
+    return err;
+}
+
+void console_sched_list(jsonw_t *jw) {
+    if (jw) {
+        jsonw_open(jw, NULL, true);
+    } else {
+        printf("ID  Schedule   Runs Miss Jitter avg/max ms Command\n");
+    }
+    // copy jobs so that the lock is not held while printing to a stream
+    sched_job_t jobs[SCHED_JOBS];
+    if (!ACQUIRE(sched.lock, 100)) {
+        jsonw_close(jw);
+        return;
+    }
+    memcpy(jobs, sched.jobs, sizeof(jobs));
+    RELEASE(sched.lock);
+    ITERP(job, jobs) {
+        if (!job->id) continue;
+        char when[24];
+        if (job->rec.intv) {
+            snprintf(when, sizeof(when), "%" PRIu32 "ms", job->rec.intv);
+        } else {
+            snprintf(when, sizeof(when), "@%02d:%02d:%02d", (int)job->rec.at
+                     / 3600, (int)job->rec.at / 60 % 60, (int)job->rec.at % 60);
+        }
+        double javg = job->runs ? job->jsum / 1e3 / job->runs : 0;
+        if (jw) {
+            jsonw_open(jw, NULL, false);
+            jsonw_int(jw, "id", job->id);
+            jsonw_str(jw, "when", when);
+            jsonw_bool(jw, "once", job->rec.once);
+            jsonw_str(jw, "cmd", job->rec.cmd);
+            jsonw_int(jw, "runs", job->runs);
+            jsonw_int(jw, "missed", job->missed);
+            jsonw_num(jw, "jitter_avg", javg);
+            jsonw_num(jw, "jitter_min", job->jmin / 1e3);
+            jsonw_num(jw, "jitter_max", job->jmax / 1e3);
+            jsonw_close(jw);
+            continue;
+        }
+        printf("%-3u %-10s %4" PRIu32 " %4" PRIu32 " %8.2f/%-8.2f %s%s\n",
+               job->id, when, job->runs, job->missed, javg, job->jmax / 1e3,
+               job->rec.cmd, job->rec.once ? " (once)" : "");
+    }
+    jsonw_close(jw);
+}
+
+static void sched_load() {
+    sched_rec_t recs[SCHED_JOBS];
+    void *nvs = NULL;
+    if (config_nvs_open(&nvs, "sched", true)) return;
+    int len = config_nvs_read(nvs, "jobs", recs, sizeof(recs));
+    config_nvs_close(&nvs);
+    LOOPN(i, MAX(len, 0) / sizeof(sched_rec_t)) {
+        recs[i].cmd[SCHED_CMDLEN - 1] = '\0';
+        esp_err_t err = sched_add(recs + i, false);
+        if (err) ESP_LOGW(TAG, "Restore `%s` failed: %s",
+                          recs[i].cmd, esp_err_to_name(err));
+    }
+}
+
 #else // CONFIG_BASE_USE_CONSOLE
 
 void console_initialize() {}
@@ -352,6 +1128,28 @@ void console_handle_loop(void *a) { return; NOTUSED(a); }
 
 void console_loop_begin(int x) { return; NOTUSED(x); }
 
+jsonw_t * console_jsonw() { return NULL; }
+
+esp_err_t console_sched_add(const char *c, uint32_t i, int32_t a, bool o) {
+    return ESP_ERR_NOT_SUPPORTED; NOTUSED(c); NOTUSED(i); NOTUSED(a); NOTUSED(o);
+}
+
+esp_err_t console_sched_del(int i) { return ESP_ERR_NOT_SUPPORTED; NOTUSED(i); }
+
+void console_sched_list(jsonw_t *j) { return; NOTUSED(j); }
+
+esp_err_t console_handle_stream(const char *c, console_sink_t s, void *a) {
+    return ESP_ERR_NOT_SUPPORTED; NOTUSED(c); NOTUSED(s); NOTUSED(a);
+}
+
+char * console_handle_rpc_stream(const char *j, console_sink_t s, void *a) {
+    return NULL; NOTUSED(j); NOTUSED(s); NOTUSED(a);
+}
+
 char * console_handle_rpc(const char *j) { return NULL; NOTUSED(j); }
 
+uint8_t * console_handle_rpc_binary(const uint8_t *i, size_t l, size_t *o) {
+    return NULL; NOTUSED(i); NOTUSED(l); NOTUSED(o);
+}
+
 #endif // CONFIG_BASE_USE_CONSOLE
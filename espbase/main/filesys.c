@@ -8,7 +8,6 @@
 #include "drivers.h"            // for PIN_XXX
 #include "config.h"
 
-#include "cJSON.h"
 #include "esp_spiffs.h"
 #include "esp_vfs_fat.h"
 #include "diskio_wl.h"
@@ -217,6 +216,7 @@ bool filesys_get_info(filesys_type_t type, filesys_info_t *info) {
         if (f_getfree(drv, &free_clust, &fs) == FR_OK) {
             info->used = ssize * (fs->n_fatent - 2 - free_clust) * fs->csize;
             info->total = ssize * (fs->n_fatent - 2) * fs->csize;
+            info->clsize = ssize * fs->csize;
         }
         info->blksize = ssize;
         info->blkcnt = info->blksize ? info->total / info->blksize : 0;
@@ -245,6 +245,7 @@ bool filesys_get_info(filesys_type_t type, filesys_info_t *info) {
 #   endif
             info->used = ssize * (fs->n_fatent - 2 - free_clust) * fs->csize;
             info->total = ssize * (fs->n_fatent - 2) * fs->csize;
+            info->clsize = ssize * fs->csize;
         }
     }
 #endif
@@ -601,19 +602,28 @@ void filesys_listdir(filesys_type_t type, const char *path, FILE *stream) {
 }
 
 static void jsonify_files(const char *base, const struct stat *st, void *arg) {
-    cJSON *n = cJSON_CreateObject();
-    cJSON_AddStringToObject(n, "name", base);
-    cJSON_AddNumberToObject(n, "size", st->st_size);
-    cJSON_AddNumberToObject(n, "date", st->st_mtime);
-    cJSON_AddStringToObject(n, "type", S_ISDIR(st->st_mode) ? "dir" : "file");
-    cJSON_AddItemToArray((cJSON *)arg, n);
+    jsonw_t *jw = arg;
+    jsonw_open(jw, NULL, false);
+    jsonw_str(jw, "name", base);
+    jsonw_int(jw, "size", st->st_size);
+    jsonw_int(jw, "date", st->st_mtime);
+    jsonw_str(jw, "type", S_ISDIR(st->st_mode) ? "dir" : "file");
+    jsonw_close(jw);
+}
+
+void filesys_listdir_jsonw(filesys_type_t type, const char *path, jsonw_t *jw) {
+    jsonw_open(jw, NULL, true);
+    filesys_walk(type, path, jsonify_files, jw);
+    jsonw_close(jw);
 }
 
 char * filesys_listdir_json(filesys_type_t type, const char *path) {
-    cJSON *lst = cJSON_CreateArray();
-    filesys_walk(type, path, jsonify_files, lst);
-    char *json = cJSON_PrintUnformatted(lst);
-    cJSON_Delete(lst);
+    char *json = NULL;
+    size_t size = 0;
+    jsonw_t jw = { .fp = open_memstream(&json, &size) };
+    if (!jw.fp) return NULL;
+    filesys_listdir_jsonw(type, path, &jw);
+    fclose(jw.fp);
     return json;
 }
 
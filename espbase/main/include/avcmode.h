@@ -38,6 +38,7 @@ extern "C" {
 #endif
 
 void avc_initialize();
+void avc_recover();     // finalize recordings cut by power loss (after filesys)
 
 typedef char     fcc[4];
 typedef uint8_t  u8;
@@ -69,38 +70,75 @@ typedef struct {
     size_t id;
     size_t len;
     void *data;
-    void *task;
     audio_mode_t *mode;
+    uint16_t peak[2];   // peak level of each channel (0 ~ 32767)
+    uint16_t rms[2];    // RMS level of each channel (0 ~ 32767)
 } audio_evt_t;
 
 typedef struct {
     size_t id;
     size_t len;
     void *data;
-    void *task;
     video_mode_t *mode;
 } video_evt_t;
 
-// esp_event_post keeps a copy of event_data instead of passing it (a pointer)
-// directly to the event handlers. To avoid copying whole xxx_evt_t structure,
-// (audio_evt_t **) and (video_evt_t **) are passed to event handlers.
-ESP_EVENT_DECLARE_BASE(AVC_EVENT);
-
-#define AVC_POST(id, evt, tout)                                             \
-    ({                                                                      \
-        void *ptr = &(evt);                                                 \
-        esp_event_post(AVC_EVENT, (id), &ptr, sizeof(ptr), TIMEOUT(tout));  \
-    })
-
 enum {
     AUD_EVENT_START,    // evt.data = WAV header, evt.len = sizeof(wav_header_t)
     AUD_EVENT_DATA,     // evt.data = audio data, evt.len > 0, evt.id >= 0
     AUD_EVENT_STOP,     // evt.data = NULL,       evt.len = 0
     VID_EVENT_START,    // evt.data = AVI header, evt.len = sizeof(avi_header_t)
     VID_EVENT_DATA,     // evt.data = frame jpeg, evt.len > 0, evt.id >= 0
-    VID_EVENT_STOP,     // evt.data = AVI tailer, evt.len = 8 + evt.id * 16
+    VID_EVENT_STOP,     // evt.data = NULL,       evt.len = 0 (idx1 by recorder)
+};
+
+// Capture tasks publish frames into a fixed-slot ring (one for audio and one
+// for video) instead of waiting for every consumer. Each consumer attaches a
+// reader with its own cursor: a reader that lags more than the ring size
+// skips the lost frames (counted in overruns) without slowing down capture.
+// A frame is refcounted while being read, and the capture task drops a new
+// frame (counted in drops) rather than waiting for a slot that is still held.
+#define AVC_SLOTS           4   // max number of frames buffered per ring
+#define AVC_READERS         4   // max number of readers attached per ring
+
+typedef struct {
+    int32_t type;       // XXX_EVENT_START / XXX_EVENT_DATA / XXX_EVENT_STOP
+    uint32_t seq;       // sequence number + 1 of frame in slot, 0 if invalid
+    uint32_t refs;      // number of readers holding the frame
+    void *priv;         // resources of capture task (e.g. camera_fb_t)
+    union {
+        audio_evt_t aud;
+        video_evt_t vid;
+    };
+} avc_frame_t;
+
+typedef struct avc_reader avc_reader_t;
+struct avc_reader {
+    const char *name;
+    int target;         // AUDIO_TARGET or VIDEO_TARGET
+    uint32_t seq;       // sequence number of next frame to read
+    uint32_t frames;    // number of frames read
+    uint32_t overruns;  // number of frames lost because reader lagged behind
+    void (*wake)(avc_reader_t *); // called by capture task, must not block
+    void *arg;
+    void *ring;
 };
 
+// Readers are referenced by the ring until detached: use static storage.
+esp_err_t avc_attach(avc_reader_t *reader);
+esp_err_t avc_detach(avc_reader_t *reader);
+
+// Get next frame (NULL if none) which must be released after processing.
+avc_frame_t * avc_read(avc_reader_t *reader);
+void avc_release(avc_frame_t *frame);
+
+// Visualisers attached by AUDIO_PRINT and VIDEO_PRINT are woken up by posting
+// AVC_EVENT (id = target) so that they can print in sys_evt task.
+ESP_EVENT_DECLARE_BASE(AVC_EVENT);
+
+// Audio DSP chain: DC-blocking high-pass, digital gain with soft limiter and
+// RMS / peak metering, configured by JSON (e.g. {"hpf":20,"gain":6,"limit":-1})
+#define AUDIO_LOADS(v)  avc_async(AUDIO_TARGET | ACTION_WRITE, (v), 0, NULL)
+#define AUDIO_DUMPS(v)  avc_async(AUDIO_TARGET | ACTION_READ, &(v), 0, NULL)
 #define AUDIO_START(ms) avc_async(AUDIO_TARGET, "1", (ms), NULL)
 #define VIDEO_START(ms) avc_async(VIDEO_TARGET, "1", (ms), NULL)
 #define AUDIO_STOP()    avc_async(AUDIO_TARGET, "0", 0, NULL)
@@ -113,6 +151,15 @@ enum {
 esp_err_t avc_async(int tgt, const void *ctrl, uint32_t tout_ms, FILE *out);
 esp_err_t avc_sync(int tgt, void **buf, size_t *len);
 
+// Record captured frames into files under dir on the SDCard (or on the flash
+// if dir starts with its mountpoint): audio as WAV and video as AVI.
+// Segments roll by size (MB) or duration (seconds), and the oldest segments
+// are deleted when free space is less than two segments. Set dir to NULL to
+// stop recording. Capture task is started (and stopped) if not running yet.
+#define AUDIO_RECORD(d, mb, s)  avc_record(AUDIO_TARGET, (d), (mb), (s))
+#define VIDEO_RECORD(d, mb, s)  avc_record(VIDEO_TARGET, (d), (mb), (s))
+esp_err_t avc_record(int tgt, const char *dir, uint32_t seg_mb, uint32_t sec);
+
 typedef struct {
 #define WAV_HEADER_FMT_LEN 16
     fcc RIFF; u32 filelen;
@@ -127,6 +174,23 @@ typedef struct {
     fcc data; u32 datalen;
 } PACKED wav_header_t;
 
+typedef struct {
+#define ADPCM_HEADER_FMT_LEN 20
+    fcc RIFF; u32 filelen;
+    fcc WAVE;
+    fcc fmt; u32 fmtlen;
+        u16 type;   // 0x11 for IMA-ADPCM
+        u16 nch;    // number of channels
+        u32 shz;    // sample rate in Hz
+        u32 Bps;    // Bytes per second
+        u16 BpB;    // Bytes per Block (256 * nch)
+        u16 bpC;    // bits per Channel (per sample): 4
+        u16 cbsize; // size of extra format info: 2
+        u16 SpB;    // Samples per Block (per channel)
+    fcc fact; u32 factlen; u32 nsample;
+    fcc data; u32 datalen;
+} PACKED adpcm_header_t;
+
 typedef struct {
 #define AVI_HEADER_HDLR_LEN 192
 #define AVI_HEADER_AVIH_LEN 56
@@ -184,6 +248,35 @@ typedef struct {
     u32 length;
 } PACKED avi_frame_t;
 
+typedef struct {
+#define AVI_INDEX_KEYFRAME 0x10
+    fcc ckid;       // same as avi_frame_t.two_code
+    u32 flags;
+    u32 offset;     // offset of avi_frame_t from 'movi' in avi_header_t
+    u32 length;     // same as avi_frame_t.length
+} PACKED avi_index_t;
+
+// IMA-ADPCM (4:1) encoder of 16-bit PCM for streaming audio in WAV container.
+// Input samples are buffered until a block is complete, so the encoded size
+// of each call is a multiple of BpB in the header (possibly 0).
+#define ADPCM_BLOCK_SAMPLES 505 // 1 + 8 * n samples per channel
+
+typedef struct {
+    u16 nch;                    // number of channels (1 or 2)
+    u16 num;                    // number of buffered samples per channel
+    s16 pred[2];                // predicted sample of each channel
+    s8 index[2];                // index of step size of each channel
+    s16 pcm[ADPCM_BLOCK_SAMPLES * 2];
+} adpcm_state_t;
+
+// Reset the state and write WAV header of unknown length (i.e. streaming) into
+// out. Return header length, or 0 if the PCM format is not supported.
+size_t adpcm_header(adpcm_state_t *st, const audio_mode_t *mode, void *out);
+// Encode len Bytes of PCM into out and return number of Bytes written. If pcm
+// is NULL, return number of Bytes that len Bytes of PCM will be encoded into
+// (out can be NULL when it is 0).
+size_t adpcm_encode(adpcm_state_t *st, const void *pcm, size_t len, void *out);
+
 #ifdef __cplusplus
 }
 #endif
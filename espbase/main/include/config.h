@@ -92,7 +92,7 @@ ESP_EVENT_DECLARE_BASE(CFG_EVENT);
 void config_initialize();
 esp_err_t config_loads(const char *);   // load Config from json
 char * config_dumps();                  // dump Config into json
-void config_stats();                    // print configurations
+void config_stats(jsonw_t *);           // print configurations [as JSON]
 
 /* Get one config value by key or set one by key & value.
  *
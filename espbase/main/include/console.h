@@ -21,6 +21,15 @@ void console_register_prompt(const char *str, const char *ctx);
 
 char * console_handle_command(const char *cmd, bool pipe, bool history);
 
+#define CONSOLE_CHUNK 512
+
+// Sink of streamed output. Return false to discard the rest of output.
+typedef bool (*console_sink_t)(void *arg, const char *buf, size_t len);
+
+// Same as console_handle_command(cmd, true, false) but output is delivered
+// to `sink` in chunks (at most CONSOLE_CHUNK bytes) as it is printed.
+esp_err_t console_handle_stream(const char *cmd, console_sink_t, void *arg);
+
 /* (R) Read from console stream
  * (E) parse and Execute the command by `console_handle_command`
  * (P) then Print the result
@@ -34,8 +43,32 @@ void console_handle_loop(void*);
 void console_loop_begin(int xCoreID);
 
 // Light weight JSON RPC dispatcher: parse json -> execute -> pack result
+// Batch of requests in an array is answered in one array (notify omitted)
+// Request with `"json": true` is executed in JSON mode: commands that
+// support it emit typed result through `console_jsonw`, which is embedded
+// into the reply as is. Otherwise result is the text output of command.
 char * console_handle_rpc(const char *json);
 
+// Same as console_handle_rpc. Output of request with `"stream": true` is
+// pushed to `sink` as it is printed, in notifications like
+//  {"jsonrpc": "2.0", "method": "output", "params": [<id>, <text>]}
+// before the final reply, whose result is empty unless in JSON mode.
+char * console_handle_rpc_stream(const char *json, console_sink_t, void *arg);
+
+// Run command or JSON-RPC request every `intv_ms` milliseconds, or daily at
+// `at_sec` seconds since local midnight if intv_ms is 0 (at_sec = -1 else).
+// Jobs are saved in NVS and restored by console_initialize.
+esp_err_t console_sched_add(const char *cmd, uint32_t intv_ms, int32_t at_sec,
+                            bool once);
+esp_err_t console_sched_del(int id);   // delete all jobs if id < 0
+void console_sched_list(jsonw_t *);     // print jobs & jitter stats [as JSON]
+
+// Writer of the command running in JSON mode (in current task), else NULL
+jsonw_t * console_jsonw();
+
+// Same as console_handle_rpc but requests / replies are in MessagePack
+uint8_t * console_handle_rpc_binary(const uint8_t *buf, size_t len, size_t *olen);
+
 #ifdef __cplusplus
 }
 #endif
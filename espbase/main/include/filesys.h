@@ -41,6 +41,7 @@ typedef struct {
     uint64_t total;
     size_t blkcnt;
     size_t blksize;
+    size_t clsize; // allocation unit (i.e. FAT cluster) in Bytes
     int pdrv; // available if FAT Flash or FAT SDCard
     union {
         wl_handle_t wlhdl;
@@ -72,6 +73,7 @@ typedef void (*walk_cb_t)(const char *basename, const struct stat *, void *);
 void filesys_walk(filesys_type_t, const char *, walk_cb_t, void *arg);
 void filesys_pstat(filesys_type_t, const char *);
 void filesys_listdir(filesys_type_t, const char *, FILE *stream);
+void filesys_listdir_jsonw(filesys_type_t, const char *, jsonw_t *);
 char * filesys_listdir_json(filesys_type_t, const char *); // need free
 uint8_t * filesys_load(filesys_type_t, const char *, size_t *); // need free
 esp_err_t filesys_readelf(filesys_type_t, const char *, int verbose); // 0-4
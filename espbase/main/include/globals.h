@@ -194,6 +194,22 @@ const char * format_size(double bytes);
 const char * format_sha256(const void *buf, size_t len);
 const char * format_binary(uint64_t val, size_t maxbits);
 
+// Streaming JSON writer: values are printed to `fp` as soon as they come
+// without building a tree in memory. Key is ignored inside an array.
+typedef struct {
+    FILE *fp;
+    uint8_t depth;
+    uint32_t array;         // bit N set if level N is an array
+    uint32_t items;         // bit N set if level N is not empty
+} jsonw_t;
+void jsonw_open(jsonw_t *, const char *key, bool array);
+void jsonw_close(jsonw_t *);
+void jsonw_null(jsonw_t *, const char *key);
+void jsonw_bool(jsonw_t *, const char *key, bool val);
+void jsonw_int(jsonw_t *, const char *key, int64_t val);
+void jsonw_num(jsonw_t *, const char *key, double val);
+void jsonw_str(jsonw_t *, const char *key, const char *val);
+
 void * setTimeout(uint32_t ms, void (*func)(void *), void *arg);
 void * setInterval(uint32_t ms, void (*func)(void *), void *arg);
 void clearTimer(void *hdl); // = clearTimeout + clearInterval
@@ -211,11 +227,12 @@ typedef enum {
     TSORT_STACK,
     TSORT_USAGE,
 } tsort_t;
-void task_info(tsort_t);
-void memory_info();
+// Print as text table, or as JSON if writer is specified
+void task_info(tsort_t, jsonw_t *);
+void memory_info(jsonw_t *);
 void version_info();
 void hardware_info();
-void partition_info();
+void partition_info(jsonw_t *);
 
 #ifdef __cplusplus
 }
@@ -72,6 +72,8 @@ esp_err_t als_tracking(als_track_t method, int *hdeg, int *vdeg);
 
 esp_err_t pwr_status();     // BQ25895
 
+int pwr_vbat();             // mV, return -1 if error
+
 #ifdef __cplusplus
 }
 #endif
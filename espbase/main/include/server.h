@@ -12,6 +12,10 @@
  * API list (for STA & AP mode):
  *  Name    Method  Description (for STA & AP mode)
  *  /ws     POST    Websocket messages are regarded as JSON-RPC
+ *                  - text frame: JSON-RPC request or batch array
+ *                  - binary frame: same in MessagePack
+ *                  - method `subscribe` with params `[topic, ms]` to
+ *                    receive sensor samples, `unsubscribe` with `[topic]`
  *  /alive  GET     Just respond `200 OK`
  *  /exec   POST    Run commands like using console REPL
  *                  - param `?cmd=str&gcode=str`
@@ -19,6 +23,9 @@
  *                  - param `?video=<mjpg|config>&audo=<wav|config>`
  *  /media  POST    Config microphone or camera
  *                  - param `?video=config&audio=config`
+ *  /metrics GET    Per-route statistics in Prometheus text format
+ *                  - param `?json`
+ *  /logs   GET     Live log lines as Server-Sent Events (text/event-stream)
  *
  * API list (for AP mode only and auth needed):
  *  Name    Method  Description
@@ -59,6 +66,9 @@ void server_initialize();
 void server_loop_begin();
 void server_loop_end();
 
+// Print static file cache statistics, list or drop (ctrl = list|clear)
+esp_err_t server_command(const char *ctrl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,7 +16,7 @@ void update_initialize();
 
 bool ota_updation_url(const char *, bool);  // fetch firmware from URL
 bool ota_updation_boot(const char *);       // set boot partition
-void ota_updation_info();                   // print OTA status
+void ota_updation_info();                   // print OTA status & speed
 
 void ota_updation_reset();                  // reset updation context
 
@@ -8,6 +8,7 @@
 #include "config.h"
 #include "drivers.h"
 #include "filesys.h"
+#include "avcmode.h"
 #include "console.h"
 #include "network.h"
 #include "update.h"
@@ -53,6 +54,7 @@ void app_main(void) {
 
     // 2. necessary modules
     filesys_initialize();       // elf_loader
+    avc_recover();              // filesys, nvs
     console_initialize();       // filesys
     network_initialize();       // wifi, eth, mdns, iperf
     update_initialize();        // filesys, network
@@ -1571,6 +1571,26 @@ esp_err_t sntp_command(
 #define GET_PING_PROF(name, var) \
     esp_ping_get_profile(hdl, ESP_PING_PROF_ ## name, &(var), sizeof(var))
 
+// Replies are printed to stdout of the caller if it is waiting for the end of
+// session (e.g. streamed to a websocket), else to stdout of the ping task.
+// The lock is held by ping task while using `out` and `waiter`, so that the
+// caller can detach them (and close its stream) before returning.
+static struct {
+    esp_ping_handle_t hdl;
+    SemaphoreHandle_t lock;
+    TaskHandle_t waiter;
+    FILE *out;
+} ping;
+
+static void ping_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    bool locked = ACQUIRE(ping.lock, -1);
+    vfprintf(locked && ping.out ? ping.out : stdout, fmt, ap);
+    if (locked) RELEASE(ping.lock);
+    va_end(ap);
+}
+
 static void ping_command_success(esp_ping_handle_t hdl, void *args) {
     uint8_t ttl;
     uint16_t seqno;
@@ -1581,8 +1601,9 @@ static void ping_command_success(esp_ping_handle_t hdl, void *args) {
     GET_PING_PROF(SEQNO, seqno);
     GET_PING_PROF(TIMEGAP, dtms);
     GET_PING_PROF(IPADDR, target);
-    printf("%" PRIu32 " bytes from %s icmp_seq=%u ttl=%u time=%" PRIu32 "ms\n",
-           size, ipaddr_ntoa(&target), seqno, ttl, dtms);
+    ping_printf(
+            "%" PRIu32 " bytes from %s icmp_seq=%u ttl=%u time=%" PRIu32 "ms\n",
+            size, ipaddr_ntoa(&target), seqno, ttl, dtms);
 }
 
 static void ping_command_timeout(esp_ping_handle_t hdl, void *args) {
@@ -1590,10 +1611,11 @@ static void ping_command_timeout(esp_ping_handle_t hdl, void *args) {
     ip_addr_t target;
     GET_PING_PROF(SEQNO, seqno);
     GET_PING_PROF(IPADDR, target);
-    printf("From %s: icmp_seq=%u timeout\n", ipaddr_ntoa(&target), seqno);
+    ping_printf("From %s: icmp_seq=%u timeout\n",
+            ipaddr_ntoa(&target), seqno);
 }
 
-static void ping_command_end(esp_ping_handle_t hdl, void *ptr) {
+static void ping_command_end(esp_ping_handle_t hdl, void *args) {
     ip_addr_t target;
     uint32_t sent, recv, dtms;
     GET_PING_PROF(REPLY, recv);
@@ -1601,11 +1623,21 @@ static void ping_command_end(esp_ping_handle_t hdl, void *ptr) {
     GET_PING_PROF(DURATION, dtms);
     GET_PING_PROF(IPADDR, target);
     uint8_t lost_pcnt = 100 * (sent - recv) / (sent ?: 1);
-    printf("Ping %s: %" PRIu32 " sent, %" PRIu32 " recv, "
-           "%" PRIu32 " lost (%u%%) in %" PRIu32 "ms\n",
-           ipaddr_ntoa(&target), sent, recv, sent - recv, lost_pcnt, dtms);
+    ping_printf("Ping %s: %" PRIu32 " sent, %" PRIu32 " recv, "
+            "%" PRIu32 " lost (%u%%) in %" PRIu32 "ms\n",
+            ipaddr_ntoa(&target), sent, recv, sent - recv, lost_pcnt, dtms);
+    bool locked = ACQUIRE(ping.lock, -1);
     esp_ping_delete_session(hdl);
-    if (ptr) *(esp_ping_handle_t *)ptr = NULL;
+    ping.hdl = NULL;
+    if (ping.waiter) xTaskNotifyGive(ping.waiter);
+    if (locked) RELEASE(ping.lock);
+}
+
+// Stop the session: ping task calls ping_command_end and deletes it.
+static void ping_command_stop() {
+    bool locked = ACQUIRE(ping.lock, -1);
+    if (ping.hdl) esp_ping_stop(ping.hdl);
+    if (locked) RELEASE(ping.lock);
 }
 
 #undef GET_PING_PROF
@@ -1613,18 +1645,16 @@ static void ping_command_end(esp_ping_handle_t hdl, void *ptr) {
 esp_err_t ping_command(
     const char *host, uint16_t intv, uint16_t size, uint16_t count, bool abort
 ) {
-    static esp_ping_handle_t hdl = NULL;
+    if (!ping.lock && ( ping.lock = MUTEX() )) RELEASE(ping.lock);
     if (abort) {
-        if (hdl) {
-            esp_ping_stop(hdl);
+        if (ping.hdl) {
+            ping_command_stop();
             puts("Ping session stopped");
-            esp_ping_delete_session(hdl);
-            hdl = NULL;
         }
         return ESP_OK;
-    } else if (!host || hdl) {
-        printf("Ping session %srunning\n", hdl ? "" : "not ");
-        return hdl ? ESP_ERR_INVALID_STATE : ESP_OK;
+    } else if (!host || ping.hdl) {
+        printf("Ping session %srunning\n", ping.hdl ? "" : "not ");
+        return ping.hdl ? ESP_ERR_INVALID_STATE : ESP_OK;
     }
 
     esp_ping_config_t cfg = ESP_PING_DEFAULT_CONFIG();
@@ -1641,14 +1671,30 @@ esp_err_t ping_command(
         .on_ping_success = ping_command_success,
         .on_ping_timeout = ping_command_timeout,
         .on_ping_end = ping_command_end,
-        .cb_args = &hdl
     };
-    esp_err_t err = esp_ping_new_session(&cfg, &cbs, &hdl);
-    if (!err) err = esp_ping_start(hdl);
+    bool wait = cfg.count != ESP_PING_COUNT_INFINITE && ping.lock;
+    if (wait && ACQUIRE(ping.lock, -1)) {
+        ping.out = stdout;
+        ping.waiter = xTaskGetCurrentTaskHandle();
+        RELEASE(ping.lock);
+        ulTaskNotifyTake(pdTRUE, 0);
+    }
+    esp_err_t err = esp_ping_new_session(&cfg, &cbs, &ping.hdl);
+    if (!err) err = esp_ping_start(ping.hdl);
     if (err) {
-        TRYNULL(hdl, esp_ping_delete_session);
-    } else if (intv && cfg.count != ESP_PING_COUNT_INFINITE) {
-        msleep(intv * cfg.count + 10);
+        TRYNULL(ping.hdl, esp_ping_delete_session);
+    } else if (wait) {
+        uint32_t tout = (cfg.interval_ms + cfg.timeout_ms) * cfg.count + 1000;
+        if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(tout))) {
+            ping_command_stop();    // wait for the current ping to finish
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(cfg.timeout_ms + 1000));
+        }
+    }
+    if (wait && ACQUIRE(ping.lock, -1)) {
+        ping.waiter = NULL;
+        ping.out = NULL;
+        RELEASE(ping.lock);
+        ulTaskNotifyTake(pdTRUE, 0);    // drop notification given too late
     }
     return err;
 }
@@ -1123,6 +1123,13 @@ static UNUSED uint8_t cumsub(int val, int step) {
     return byte;
 }
 
+int pwr_vbat() {
+    uint8_t val;
+    if (!pwr.addr || smbus_read_byte(pwr.bus, pwr.addr, PWR_ADCBAT, &val))
+        return -1;
+    return cumsum(val & 0x7F, 2304, 20);
+}
+
 esp_err_t pwr_status() {
     if (!pwr.addr) return ESP_ERR_INVALID_STATE;
     uint8_t bus = pwr.bus, addr = pwr.addr, reg[0x15];
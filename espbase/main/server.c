@@ -12,12 +12,24 @@
 #include "ledmode.h"            // for led_set_blink
 #include "console.h"            // for console_handle_xxx
 #include "timesync.h"           // for format_datetime
+#include "sensors.h"            // for xxx_read
+#include "drivers.h"            // for adc_read
 
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_rom_md5.h"
+#include "esp_rom_crc.h"
+#include "esp_partition.h"
 #include "esp_http_server.h"
+#include "cJSON.h"
+#include "lwip/sockets.h"
 
 #if defined(CONFIG_BASE_USE_WEBSERVER) && defined(CONFIG_BASE_USE_WIFI)
 
+#if CONFIG_BASE_HTTP_WORKERS > 0 && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#   define WITH_WORKERS     // httpd_req_async_handler_begin since v5.1
+#endif
+
 #define ESP_ERR_HTTPD_AUTH_DIGEST   (ESP_ERR_HTTPD_BASE + 10)
 #define ESP_ERR_HTTPD_SKIP_DATA     (ESP_ERR_HTTPD_BASE + 11)
 
@@ -91,48 +103,6 @@ static const char *MEDIA_HTML =
 
 static httpd_handle_t server;
 
-typedef struct http_param {
-    struct http_param *next;
-    char *key, *val;
-#define FROM_QUERY  0
-#define FROM_BODY   1
-#define FROM_ANY    -1
-    bool body;
-} http_param_t;
-
-static void free_params(void *ctx) {
-    for (http_param_t *ptr = ctx, *next; ptr; ptr = next) {
-        TRYFREE(ptr->key); TRYFREE(ptr->val);
-        next = ptr->next; free(ptr);
-    }
-}
-
-// parse urlencoded key-val pairs: <key1>[=<val1>]&<key2>=<val2>
-static void parse_params(char *buf, bool body, void **arg) {
-    if (!buf || !arg) return;
-    http_param_t **ctx = (http_param_t **)arg, *ptr, *param;
-    char *tok, *save = NULL;
-    for (tok = strtok_r(buf, "&", &save); tok; tok = strtok_r(0, "&", &save)) {
-        char *eql = strchr(tok, '=') ?: (tok + strlen(tok));
-        char *key = strndup(tok, eql - tok);
-        char *val = strlen(eql) > 1 ? strdup(eql + 1) : NULL;
-        if (!key) { TRYFREE(val); break; } // ESP_ERR_NO_MEM
-        for (ptr = *ctx;; ptr = ptr->next) {
-            if (ptr && ptr->next && strncmp(ptr->key, tok, eql - tok)) continue;
-            if (ptr && ptr->next) {
-                TRYFREE(ptr->key); TRYFREE(ptr->val);
-                ptr->key = key; ptr->val = val; ptr->body = body;
-            } else if (ECALLOC(param, 1, sizeof(http_param_t))) {
-                TRYFREE(key); TRYFREE(val);
-            } else {
-                param->key = key; param->val = val; param->body = body;
-                ptr = ptr ? (ptr->next = param) : (*ctx = param);
-            }
-            break;
-        }
-    }
-}
-
 // parse and match key-val pairs: <key1>[="<val1>"]<sep><key2>="<val2>"
 static size_t parse_kvs(char *inp, const char *sep, size_t num,
                         const char **keys, const char **vals)
@@ -168,6 +138,84 @@ static size_t url_decode(char *buf, size_t len) {
     return len - (end - ptr);
 }
 
+#define FROM_QUERY  0
+#define FROM_BODY   1
+#define FROM_ANY    -1
+
+typedef struct {
+    uint16_t hash;          // case-insensitive hash of key for fast lookup
+    uint16_t key, val;      // offsets into arena data (val = 0 if no value)
+    bool body;
+} http_param_t;
+
+// Params of a request are decoded in place into one buffer per session:
+// strings grow from the head and the index grows down from the tail. The
+// buffer is reused by following requests on the same session.
+typedef struct {
+    uint16_t size, used, count;
+    char *data;
+} http_arena_t;
+
+#define ARENA_KEEP      1024    // drop larger buffers between requests
+#define ARENA_MAX       (UINT16_MAX & ~7)   // size is uint16_t, index aligned
+#define ARENA_INDEX(a)  ((http_param_t *)((a)->data + (a)->size) - (a)->count)
+
+static void free_params(void *ctx) {
+    http_arena_t *arena = ctx;
+    if (arena) TRYFREE(arena->data);
+    TRYFREE(arena);
+}
+
+static uint16_t param_hash(const char *key) {
+    uint16_t hash = 0;
+    while (*key) { hash = hash * 31 + (*key++ | 0x20); }
+    return hash;
+}
+
+// make room for `len` more bytes of strings and `num` more params
+static esp_err_t arena_reserve(http_arena_t *arena, size_t len, size_t num) {
+    size_t isize = arena->count * sizeof(http_param_t);
+    size_t need = arena->used + len + isize + num * sizeof(http_param_t);
+    if (need <= arena->size) return ESP_OK;
+    if (need > ARENA_MAX) return ESP_ERR_INVALID_SIZE;
+    need = MIN(CDIV(need, 256) * 256, ARENA_MAX);
+    char *data = arena->data;
+    esp_err_t err = EREALLOC(data, need);
+    if (!err) {
+        memmove(data + need - isize, data + arena->size - isize, isize);
+        arena->data = data;
+        arena->size = need;
+    }
+    return err;
+}
+
+// parse urlencoded key-val pairs: <key1>[=<val1>]&<key2>=<val2> from `len`
+// bytes that have been stored at the head of free space of the arena
+static esp_err_t parse_params(http_arena_t *arena, size_t len, bool body) {
+    char *tok, *save = NULL, *buf = arena->data + arena->used;
+    esp_err_t err = arena_reserve(arena, len + 1, strncnt(buf, "&", len) + 1);
+    if (err) return err;
+    buf = arena->data + arena->used;
+    buf[len] = '\0';
+    arena->used += len + 1;
+    for (tok = strtok_r(buf, "&", &save); tok; tok = strtok_r(0, "&", &save)) {
+        char *val = strchr(tok, '=');
+        if (val) {
+            *val++ = '\0';
+            val[url_decode(val, strlen(val))] = '\0';
+        }
+        tok[url_decode(tok, strlen(tok))] = '\0';
+        if (!strlen(tok)) continue;
+        arena->count++;
+        http_param_t *param = ARENA_INDEX(arena);
+        param->hash = param_hash(tok);
+        param->key = tok - arena->data;
+        param->val = val && strlen(val) ? val - arena->data : 0;
+        param->body = body;
+    }
+    return ESP_OK;
+}
+
 // Basic HTTP auth
 //      Server request: Basic realm="{HOSTNAME}"
 //      Client respond: Basic base64({USERNAME}:{PASSWORD})
@@ -290,22 +338,181 @@ static bool has_header(httpd_req_t *req, const char *key, const char *val) {
     return ret;
 }
 
-static bool has_param(httpd_req_t *req, const char *key, int body) {
-    for (http_param_t *param = req->sess_ctx; param; param = param->next) {
-        if (strcasecmp(param->key, key)) continue;
-        if (body == FROM_ANY || param->body == !!body) return true;
+// params are indexed from the newest so that the last occurrence wins
+static http_param_t * find_param(httpd_req_t *req, const char *key, int body) {
+    http_arena_t *arena = req->sess_ctx;
+    if (!arena || !arena->count || !key) return NULL;
+    uint16_t hash = param_hash(key);
+    http_param_t *param = ARENA_INDEX(arena);
+    LOOPN(i, arena->count) {
+        if (param[i].hash != hash) continue;
+        if (body != FROM_ANY && param[i].body != !!body) continue;
+        if (!strcasecmp(arena->data + param[i].key, key)) return param + i;
     }
-    return false;
+    return NULL;
+}
+
+static bool has_param(httpd_req_t *req, const char *key, int body) {
+    return find_param(req, key, body) != NULL;
 }
 
 static const char * get_param(httpd_req_t *req, const char *key, int body) {
-    for (http_param_t *param = req->sess_ctx; param; param = param->next) {
-        if (strcasecmp(param->key, key)) continue;
-        if (body == FROM_ANY || param->body == !!body) return param->val;
+    http_param_t *param = find_param(req, key, body);
+    if (!param || !param->val) return NULL;
+    return ((http_arena_t *)req->sess_ctx)->data + param->val;
+}
+
+#ifdef CONFIG_BASE_HTTP_METRICS
+
+#define ROUTE_MAX       32
+#define ROUTE_SHIFT     8       // route index is stored in user_ctx[15:8]
+#define ROUTE_INDEX(r)  (((intptr_t)(r)->user_ctx >> ROUTE_SHIFT) & 0xFF)
+#define ROUTE_DEFER     BIT16   // request is handed to a worker
+
+#define LATENCY_BASE    250     // upper bound of the first bucket in us
+#define LATENCY_BINS    16      // 250us, 500us, ..., 4.096s, +Inf
+
+#define METRIC_ADD(v, n) __atomic_fetch_add(&(v), (n), __ATOMIC_RELAXED)
+
+static const int error_codes[] = {
+    400, 401, 403, 404, 405, 408, 416, 500, 501, 503
+};
+
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    uint32_t count, fails, bytes_in, bytes_out;
+    uint32_t errors[LEN(error_codes)];
+    uint32_t bins[LATENCY_BINS];
+    uint32_t usec;      // 32-bit so that METRIC_ADD is lock-free on Xtensa,
+                        // wraps after 71 minutes like any other counter
+} http_route_t;
+
+// Counters are updated with relaxed atomics from httpd task, esp_timer task
+// (media streaming) and worker tasks, and read without locking.
+static struct {
+    uint32_t opened, closed, evicted;
+    size_t num, max_open;
+    http_route_t routes[ROUTE_MAX];     // routes[0] for unmatched requests
+} metrics = { .num = 1, .routes = { { .uri = "*" } } };
+
+// Last activity in ms of sessions indexed by socket. LRU purge closes the
+// session with the oldest activity, which tells it from normal closes.
+static uint32_t sess_active[CONFIG_LWIP_MAX_SOCKETS];
+
+#define SESS_ACTIVE(fd) \
+    sess_active[((fd) - LWIP_SOCKET_OFFSET) % CONFIG_LWIP_MAX_SOCKETS]
+
+static void metrics_active(int fd) {
+    __atomic_store_n(&SESS_ACTIVE(fd), esp_timer_get_time() / 1000,
+                     __ATOMIC_RELAXED);
+}
+
+static void metrics_error(httpd_req_t *req, int code) {
+    http_route_t *route = metrics.routes + ROUTE_INDEX(req);
+    LOOPN(i, LEN(error_codes)) {
+        if (error_codes[i] != code) continue;
+        METRIC_ADD(route->errors[i], 1);
+        break;
     }
-    return NULL;
 }
 
+static void metrics_record(http_route_t *route, size_t len, int64_t usec,
+                           esp_err_t err)
+{
+    uint32_t us = MIN(usec, UINT32_MAX), idx = 0;
+    if (us > LATENCY_BASE) idx = 32 - __builtin_clz((us - 1) / LATENCY_BASE);
+    METRIC_ADD(route->count, 1);
+    METRIC_ADD(route->bytes_in, len);
+    METRIC_ADD(route->bins[MIN(idx, LATENCY_BINS - 1)], 1);
+    METRIC_ADD(route->usec, us);
+    if (err) METRIC_ADD(route->fails, 1);
+}
+
+// Same as httpd_default_send but count bytes for the route of the session
+static int metrics_send(httpd_handle_t hd, int fd, const char *buf,
+                        size_t len, int flags)
+{
+    if (!buf) return HTTPD_SOCK_ERR_INVALID;
+    int ret = send(fd, buf, len, flags);
+    if (ret < 0)
+        return errno == EAGAIN || errno == EINTR
+            ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    http_route_t *route = httpd_sess_get_transport_ctx(hd, fd);
+    if (route) METRIC_ADD(route->bytes_out, ret);
+    metrics_active(fd);
+    return ret;
+}
+
+static esp_err_t metrics_open(httpd_handle_t hd, int fd) {
+    METRIC_ADD(metrics.opened, 1);
+    metrics_active(fd);
+    return httpd_sess_set_send_override(hd, fd, metrics_send);
+}
+
+// LRU purge only happens when the session table is full and closes the
+// least recently active session, so count closes that match both.
+static void metrics_close(httpd_handle_t hd, int fd) {
+    size_t num = metrics.max_open;
+    int fds[num];
+    METRIC_ADD(metrics.closed, 1);
+    if (!httpd_get_client_list(hd, &num, fds) && num >= metrics.max_open) {
+        uint32_t active = SESS_ACTIVE(fd);
+        bool oldest = true;
+        LOOPN(i, num) {
+            if ((int32_t)(SESS_ACTIVE(fds[i]) - active) < 0) oldest = false;
+        }
+        if (oldest) METRIC_ADD(metrics.evicted, 1);
+    }
+}
+
+// Set by worker_submit in user_ctx of the request (which is copied from the
+// URI for each request) when it has been handed to a worker, which records
+// the route metrics itself by metrics_finish.
+#define metrics_defer(req) \
+    ( (req)->user_ctx = (void *)((intptr_t)(req)->user_ctx | ROUTE_DEFER) )
+
+static void metrics_finish(httpd_req_t *req, int64_t ts, esp_err_t err) {
+    metrics_record(metrics.routes + ROUTE_INDEX(req), req->content_len,
+                   esp_timer_get_time() - ts, err);
+}
+
+static esp_err_t on_metered(httpd_req_t *req) {
+    http_route_t *route = metrics.routes + ROUTE_INDEX(req);
+    size_t len = req->content_len;
+    int64_t ts = esp_timer_get_time();
+    int fd = httpd_req_to_sockfd(req);
+    httpd_sess_set_transport_ctx(req->handle, fd, route, NULL);
+    metrics_active(fd);
+    esp_err_t err = route->handler(req);
+    if (!((intptr_t)req->user_ctx & ROUTE_DEFER))
+        metrics_record(route, len, esp_timer_get_time() - ts, err);
+    return err;
+}
+
+// replace handler of the URI with on_metered and save route index in user_ctx
+static void metrics_route(httpd_uri_t *api) {
+    size_t idx = 1;
+    while (idx < metrics.num && (
+        metrics.routes[idx].method != api->method ||
+        strcmp(metrics.routes[idx].uri, api->uri)
+    )) { idx++; }
+    if (idx == ROUTE_MAX) return;
+    http_route_t *route = metrics.routes + idx;
+    if (idx == metrics.num) metrics.num++;
+    route->uri = api->uri;
+    route->method = api->method;
+    route->handler = api->handler;
+    api->handler = on_metered;
+    api->user_ctx = (void *)((intptr_t)api->user_ctx | idx << ROUTE_SHIFT);
+}
+#else
+#   define metrics_error(...)
+#   define metrics_defer(...)
+#   define metrics_finish(...)
+#endif // CONFIG_BASE_HTTP_METRICS
+
 static esp_err_t send_err(httpd_req_t *req, int code, const char *msg) {
     httpd_err_code_t ecode;
     switch (code) {
@@ -319,6 +526,7 @@ static esp_err_t send_err(httpd_req_t *req, int code, const char *msg) {
     case 500: FALLTH;
     default:  ecode = HTTPD_500_INTERNAL_SERVER_ERROR;  break;
     }
+    metrics_error(req, code);
     return httpd_resp_send_err(req, ecode, msg);
 }
 
@@ -349,6 +557,277 @@ static const char * guess_type(const char *filename) {
     return CTYPE_TEXT;
 }
 
+#if CONFIG_BASE_HTTP_CACHE_SIZE > 0
+#define CACHE_SIZE      (CONFIG_BASE_HTTP_CACHE_SIZE * 1024)
+#define CACHE_FILE_MAX  (CACHE_SIZE / 4)
+
+// Small static files are kept in a LRU list (most recently used first).
+// Entries are validated by size and mtime of the file on each request and
+// explicitly dropped when files are modified through /edit (mtime may be
+// not supported by SPIFFS or too coarse on FAT).
+typedef struct http_cache {
+    struct http_cache *prev, *next;
+    time_t mtime;
+    size_t size;
+    char *path;
+    char data[];
+} http_cache_t;
+
+static struct {
+    http_cache_t *head, *tail;
+    size_t used, count;
+    uint32_t hits, miss, evicts;
+    SemaphoreHandle_t lock;
+} cache;
+
+static void cache_unlink(http_cache_t *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else             cache.head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else             cache.tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void cache_remove(http_cache_t *entry) {
+    cache_unlink(entry);
+    cache.used -= entry->size;
+    cache.count--;
+    free(entry);
+}
+
+static void cache_prepend(http_cache_t *entry) {
+    if (( entry->next = cache.head )) cache.head->prev = entry;
+    else                              cache.tail = entry;
+    cache.head = entry;
+}
+
+static http_cache_t * cache_lookup(const char *path, const struct stat *st) {
+    for (http_cache_t *entry = cache.head; entry; entry = entry->next) {
+        if (strcmp(entry->path, path)) continue;
+        if (entry->mtime != st->st_mtime || entry->size != st->st_size) {
+            cache_remove(entry);
+            break;
+        }
+        cache_unlink(entry);
+        cache_prepend(entry);
+        cache.hits++;
+        return entry;
+    }
+    cache.miss++;
+    return NULL;
+}
+
+static http_cache_t * cache_insert(const char *path, const struct stat *st) {
+    size_t size = st->st_size, plen = strlen(path) + 1;
+    if (!size || size > CACHE_FILE_MAX) return NULL;
+    http_cache_t *entry = heap_caps_malloc_prefer(
+        sizeof(http_cache_t) + size + plen, 2,
+        MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    FILE *fd = entry ? fopen(path, "r") : NULL;
+    if (!fd || fread(entry->data, 1, size, fd) != size) {
+        TRYNULL(fd, fclose);
+        TRYFREE(entry);
+        return NULL;
+    }
+    fclose(fd);
+    entry->prev = entry->next = NULL;
+    entry->mtime = st->st_mtime;
+    entry->size = size;
+    entry->path = memcpy(entry->data + size, path, plen);
+    while (cache.tail && cache.used + size > CACHE_SIZE) {
+        cache_remove(cache.tail);
+        cache.evicts++;
+    }
+    cache_prepend(entry);
+    cache.used += size;
+    cache.count++;
+    return entry;
+}
+
+// Drop cached file at `path` or all files under directory `path`
+static void cache_invalidate(const char *path) {
+    size_t plen = strlen(path ?: "");
+    if (!ACQUIRE(cache.lock, 1000)) return;
+    for (http_cache_t *entry = cache.head, *next; entry; entry = next) {
+        next = entry->next;
+        if (plen && (!startswith(entry->path, path) ||
+            (entry->path[plen] && entry->path[plen] != '/'))) continue;
+        cache_remove(entry);
+    }
+    RELEASE(cache.lock);
+}
+
+// Send file from cache in one httpd_resp_send. Return ESP_ERR_NOT_FOUND
+// if the file is not cacheable or could not be loaded.
+static esp_err_t cache_send(httpd_req_t *req, const char *path,
+                            const struct stat *st)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (!ACQUIRE(cache.lock, 100)) return err;
+    http_cache_t *entry = cache_lookup(path, st) ?: cache_insert(path, st);
+    if (entry) err = httpd_resp_send(req, entry->data, entry->size);
+    RELEASE(cache.lock);
+    return err;
+}
+#else
+#   define cache_invalidate(p)
+#   define cache_send(...)  ESP_ERR_NOT_FOUND
+#endif // CONFIG_BASE_HTTP_CACHE_SIZE
+
+#ifdef CONFIG_BASE_HTTP_BUNDLE
+#ifdef IDF_TARGET_V4
+#   define ESP_PARTITION_MMAP_DATA  SPI_FLASH_MMAP_DATA
+typedef spi_flash_mmap_handle_t esp_partition_mmap_handle_t;
+#endif
+
+// Static files packed by `helper.py genpkg` into a read-only image, which is
+// memory mapped from flash and served without VFS. All fields are offsets
+// from the beginning of the image. Entries are sorted by FNV-1a hash of URI.
+typedef struct {
+    char magic[4];          // "EPKG"
+    uint16_t version;
+    uint16_t count;         // number of entries
+    uint32_t size;          // size of the whole image
+    uint32_t crc;           // CRC32 of the image after this header
+} PACKED http_bundle_t;
+
+typedef struct {
+    uint32_t hash, path, ctype, etag, data, size;
+#define BUNDLE_GZIP BIT0
+    uint32_t flags;
+} PACKED http_bundle_entry_t;
+
+static struct {
+    const char *base;
+    const http_bundle_t *head;
+    const http_bundle_entry_t *list;
+    esp_partition_mmap_handle_t hdl;
+} bundle;
+
+static uint32_t fnv1a_hash(const char *str) {
+    uint32_t hash = 0x811C9DC5;
+    while (*str) { hash = (hash ^ (uint8_t)*str++) * 0x01000193; }
+    return hash;
+}
+
+static void bundle_init() {
+    http_bundle_t head;
+    const void *ptr = NULL;
+    const esp_partition_t *part = NULL;
+    if (bundle.base || !strlen(CONFIG_BASE_HTTP_BUNDLE)) return;
+    if (!( part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            ESP_PARTITION_SUBTYPE_ANY, CONFIG_BASE_HTTP_BUNDLE) )) return;
+    if (esp_partition_read(part, 0, &head, sizeof(head)) ||
+        memcmp(head.magic, "EPKG", 4) || head.version != 1 ||
+        head.size > part->size || head.size < sizeof(head) +
+            head.count * sizeof(http_bundle_entry_t)
+    ) {
+        ESP_LOGW(TAG, "No valid bundle found in partition %s", part->label);
+    } else if (esp_partition_mmap(part, 0, head.size, ESP_PARTITION_MMAP_DATA,
+                                  &ptr, &bundle.hdl)) {
+        ESP_LOGE(TAG, "Failed to mmap bundle partition %s", part->label);
+    } else if (head.crc != esp_rom_crc32_le(
+        0, ptr + sizeof(head), head.size - sizeof(head))
+    ) {
+        ESP_LOGE(TAG, "Bundle in partition %s is corrupted", part->label);
+        esp_partition_munmap(bundle.hdl);
+    } else {
+        bundle.base = ptr;
+        bundle.head = ptr;
+        bundle.list = ptr + sizeof(head);
+        ESP_LOGI(TAG, "Loaded %d files (%s) from bundle partition %s",
+                 head.count, format_size(head.size), part->label);
+    }
+}
+
+static const http_bundle_entry_t * bundle_find(const char *path) {
+    if (!bundle.base) return NULL;
+    uint32_t hash = fnv1a_hash(path);
+    size_t lo = 0, hi = bundle.head->count, mid;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (bundle.list[mid].hash < hash) lo = mid + 1;
+        else                              hi = mid;
+    }
+    for (; lo < bundle.head->count && bundle.list[lo].hash == hash; lo++) {
+        if (!strcmp(bundle.base + bundle.list[lo].path, path))
+            return bundle.list + lo;
+    }
+    return NULL;
+}
+
+// Send file from bundle without copying. Return ESP_ERR_NOT_FOUND if the
+// path is not packed in the bundle.
+static esp_err_t bundle_send(httpd_req_t *req, const char *path) {
+    const http_bundle_entry_t *entry = bundle_find(path);
+    if (!entry) return ESP_ERR_NOT_FOUND;
+    const char *etag = bundle.base + entry->etag;
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if (has_header(req, "If-None-Match", etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return send_str(req, NULL);
+    }
+    httpd_resp_set_type(req, bundle.base + entry->ctype);
+    if (entry->flags & BUNDLE_GZIP)
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, bundle.base + entry->data, entry->size);
+}
+#else
+#   define bundle_init()
+#   define bundle_send(...) ESP_ERR_NOT_FOUND
+#endif // CONFIG_BASE_HTTP_BUNDLE
+
+#define RANGE_MAX   8
+#define RANGE_BDARY "BYTERANGES"
+
+typedef struct {
+    size_t start, end;      // inclusive
+} http_range_t;
+
+// Parse `Range: bytes=<first>-[<last>][, -<suffix>]` against file size.
+// Return number of satisfiable ranges, 0 if the header should be ignored
+// (invalid syntax or too many ranges) or -1 if no range is satisfiable.
+static int parse_range(char *hdr, size_t size, http_range_t *ranges, int num) {
+    if (!startswith(hdr ?: "", "bytes=")) return 0;
+    int count = 0, unsat = 0;
+    char *tok, *save = NULL, *end;
+    for (tok = strtok_r(hdr + 6, ",", &save); tok; tok = strtok_r(0, ",", &save)) {
+        size_t first, last = size - 1;
+        while (*tok == ' ') tok++;
+        if (*tok == '-') {                      // suffix: last N bytes
+            size_t suffix = strtoul(tok + 1, &end, 10);
+            if (end == tok + 1 || *strtrim(end, " ")) return 0;
+            if (!suffix || !size) { unsat++; continue; }
+            first = size > suffix ? size - suffix : 0;
+        } else {
+            first = strtoul(tok, &end, 10);
+            if (end == tok || *end++ != '-') return 0;
+            if (*strtrim(end, " ")) {
+                last = strtoul(end, &end, 10);
+                if (*end || last < first) return 0;
+                last = MIN(last, size - 1);
+            }
+            if (first >= size) { unsat++; continue; }
+        }
+        if (count == num) return 0;
+        ranges[count].start = first;
+        ranges[count++].end = last;
+    }
+    return count ?: (unsat ? -1 : 0);
+}
+
+static esp_err_t send_range(httpd_req_t *req, FILE *fd, char *buf,
+                            const http_range_t *range)
+{
+    esp_err_t err = fseek(fd, range->start, SEEK_SET) ? ESP_FAIL : ESP_OK;
+    size_t len, remain = range->end - range->start + 1;
+    while (!err && remain && ( len = fread(buf, 1, MIN(remain, CHUNK_SIZE), fd) )) {
+        err = httpd_resp_send_chunk(req, buf, len);
+        remain -= len;
+    }
+    return err ?: (remain ? ESP_FAIL : ESP_OK);
+}
+
 static esp_err_t send_file(httpd_req_t *req, const char *path, bool dl) {
     struct stat st;
     const char *fullpath = fnorm(path);
@@ -356,29 +835,104 @@ static esp_err_t send_file(httpd_req_t *req, const char *path, bool dl) {
     if (!basename || stat(fullpath, &st))
         return send_err(req, 500, "Failed to open file");
 
+    // ETag is derived from mtime and size, which is not available on SPIFFS
+    char etag[20] = "", *hdr;
     const char *mtime = format_datetime(&st.st_mtim);
-    if (has_header(req, "If-Modified-Since", mtime)) {
+    if (st.st_mtime) snprintf(etag, sizeof(etag), "\"%" PRIx32 "-%" PRIx32 "\"",
+                              (uint32_t)st.st_mtime, (uint32_t)st.st_size);
+    bool fresh;
+    if (( hdr = get_header(req, "If-None-Match") )) {
+        fresh = (etag[0] && strstr(hdr, etag)) || strchr(hdr, '*');
+        TRYFREE(hdr);
+    } else {
+        fresh = has_header(req, "If-Modified-Since", mtime);
+    }
+    if (fresh) {
+        if (etag[0]) httpd_resp_set_hdr(req, "ETag", etag);
         httpd_resp_set_status(req, "304 Not Modified");
         return send_str(req, NULL);
     }
 
-    char clen[10], cdis[strlen(basename) + 24], *buf = basename + 1;
-    httpd_resp_set_type(req, guess_type(basename));
+    http_range_t ranges[RANGE_MAX];
+    int nrange = 0;
+    if (( hdr = get_header(req, "If-Range") )) {
+        bool match = etag[0] ? !strcmp(hdr, etag) : !strcmp(hdr, mtime);
+        TRYFREE(hdr);
+        if (!match) goto range_done;    // file changed: send whole file
+    }
+    if (( hdr = get_header(req, "Range") )) {
+        nrange = parse_range(hdr, st.st_size, ranges, RANGE_MAX);
+        TRYFREE(hdr);
+    }
+range_done:;
+
+    const char *ctype = guess_type(basename);
+    char clen[24], crange[48], cdis[strlen(basename) + 24], *buf = NULL;
+    httpd_resp_set_type(req, ctype);
     httpd_resp_set_hdr(req, "Last-Modified", mtime);
-    sprintf(cdis, "%s; filename=\"%s\"", dl ? "attachment" : "inline", buf);
+    if (etag[0]) httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    sprintf(cdis, "%s; filename=\"%s\"", dl ? "attachment" : "inline",
+            basename + 1);
     httpd_resp_set_hdr(req, "Content-Disposition", cdis);
     if (endswith(basename, ".gz"))
         httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-    if (st.st_size) {
-        snprintf(clen, sizeof(clen), "%ld", st.st_size);
+    if (nrange < 0) {
+        snprintf(crange, sizeof(crange), "bytes */%zu", (size_t)st.st_size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        metrics_error(req, 416);
+        httpd_resp_set_hdr(req, "Content-Range", crange);
+        return send_str(req, NULL);
+    }
+    esp_err_t err = nrange ? ESP_ERR_NOT_FOUND : cache_send(req, fullpath, &st);
+    if (err != ESP_ERR_NOT_FOUND) return err;
+
+    // part header: "\r\n--BDARY\r\nContent-Type: X\r\nContent-Range: Y\r\n\r\n"
+    size_t len, plen = strlen(ctype) + strlen(RANGE_BDARY) + 47;
+    size_t total = nrange ? 0 : st.st_size;
+    if (nrange == 1) {
+        total = ranges[0].end - ranges[0].start + 1;
+        snprintf(crange, sizeof(crange), "bytes %zu-%zu/%zu",
+                 ranges[0].start, ranges[0].end, (size_t)st.st_size);
+        httpd_resp_set_hdr(req, "Content-Range", crange);
+    } else if (nrange) {
+        LOOPN(i, nrange) {
+            total += ranges[i].end - ranges[i].start + 1 + plen + snprintf(
+                crange, sizeof(crange), "%zu-%zu/%zu",
+                ranges[i].start, ranges[i].end, (size_t)st.st_size);
+        }
+        // closing "\r\n--BDARY--\r\n" minus the CRLF omitted before part 0
+        total += strlen(RANGE_BDARY) + 8 - 2;
+        httpd_resp_set_type(req, "multipart/byteranges; boundary=" RANGE_BDARY);
+    }
+    if (nrange) httpd_resp_set_status(req, "206 Partial Content");
+    if (total) {
+        snprintf(clen, sizeof(clen), "%zu", total);
         httpd_resp_set_hdr(req, "Content-Length", clen);
     }
 
-    size_t len;
     FILE *fd = fopen(fullpath, "r");
-    esp_err_t err = fd ? EMALLOC(buf, CHUNK_SIZE) : ESP_ERR_INVALID_STATE;
-    while (!err && ( len = fread(buf, 1, CHUNK_SIZE, fd) )) {
-        err = httpd_resp_send_chunk(req, buf, len);
+    err = fd ? EMALLOC(buf, CHUNK_SIZE) : ESP_ERR_INVALID_STATE;
+    if (!err && nrange == 1) {
+        err = send_range(req, fd, buf, ranges);
+    } else if (!err && nrange) {
+        LOOPN(i, nrange) {
+            len = snprintf(buf, CHUNK_SIZE,
+                           "\r\n--" RANGE_BDARY "\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                           ctype, ranges[i].start, ranges[i].end,
+                           (size_t)st.st_size);
+            if (( err = httpd_resp_send_chunk(req, buf + (i ? 0 : 2),
+                                              len - (i ? 0 : 2)) ) ||
+                ( err = send_range(req, fd, buf, ranges + i) )) break;
+        }
+        if (!err) err = httpd_resp_sendstr_chunk(
+            req, "\r\n--" RANGE_BDARY "--\r\n");
+    } else {
+        while (!err && ( len = fread(buf, 1, CHUNK_SIZE, fd) )) {
+            err = httpd_resp_send_chunk(req, buf, len);
+        }
     }
     TRYFREE(buf);
     TRYNULL(fd, fclose);
@@ -391,104 +945,149 @@ static esp_err_t send_file(httpd_req_t *req, const char *path, bool dl) {
 typedef esp_err_t (*file_cb_t)(httpd_req_t *req, const char *name,
                                size_t idx, char *buf, size_t len, bool end);
 
+typedef struct {
+    size_t len;
+    char str[4 + 70 + 1];   // CRLF + "--" + boundary (RFC2046: 1-70 chars)
+    uint8_t skip[256];      // Horspool bad character shift table
+} http_bdary_t;
+
+static bool bdary_init(http_bdary_t *bdary, const char *ctype) {
+    const char *ptr = strstr(ctype, "boundary=");
+    if (!ptr) return false;
+    size_t len = strcspn(ptr += 9, "; ");
+    if (*ptr == '"') len = strcspn(++ptr, "\"");
+    if (!len || len > 70) return false;
+    bdary->len = snprintf(bdary->str, sizeof(bdary->str), "\r\n--%.*s",
+                          (int)len, ptr);
+    memset(bdary->skip, bdary->len, sizeof(bdary->skip));
+    LOOPN(i, bdary->len - 1) {
+        bdary->skip[(uint8_t)bdary->str[i]] = bdary->len - 1 - i;
+    }
+    return true;
+}
+
+// Binary safe search of delimiter in buf. Return offset of the delimiter if
+// found. Otherwise return offset of the longest tail of buf that may be the
+// beginning of a delimiter, which should be checked again with next chunk.
+static size_t bdary_search(
+    const http_bdary_t *bdary, const char *buf, size_t len, bool *found
+) {
+    size_t pos = 0, last = bdary->len - 1;
+    for (uint8_t c; pos + last < len; pos += bdary->skip[c]) {
+        c = buf[pos + last];
+        if (c != (uint8_t)bdary->str[last]) continue;
+        if (!memcmp(buf + pos, bdary->str, last)) {
+            *found = true;
+            return pos;
+        }
+    }
+    for (pos = MAX(pos, len > last ? len - last : 0); pos < len; pos++) {
+        if (!memcmp(buf + pos, bdary->str, len - pos)) break;
+    }
+    *found = false;
+    return pos;
+}
+
 static esp_err_t parse_files(httpd_req_t *req, file_cb_t callback) {
-#define PARSE_BDARY     0
-#define PARSE_HEADER    1
-#define PARSE_DATA      2
-#define PARSE_FAILED    3
-#define PARSE_ERROR     4
+#define PARSE_DATA      0
+#define PARSE_BDARY     1
+#define PARSE_HEADER    2
+#define PARSE_DONE      3
+#define PARSE_FAILED    4
+#define PARSE_ERROR     5
     if (!req->content_len) return send_err(req, 400, "Invalid content length");
     char *ctype = get_header(req, "Content-Type"), *buf = NULL;
-    char *bdary = ctype ? strstr(ctype, "boundary=") : NULL;
-    if (!ctype || !strstr(ctype, CTYPE_MPRT) || strlen(bdary ?: "") < 9) {
+    http_bdary_t bdary;
+    if (!ctype || !strstr(ctype, CTYPE_MPRT) || !bdary_init(&bdary, ctype)) {
         TRYFREE(ctype);
         return send_err(req, 400, "Invalid content type");
     }
-    if (EMALLOC(buf, CHUNK_SIZE + 1)) {
-        TRYFREE(ctype);
-        return send_err(req, 500, NULL);
-    }
-    bdary += 7; bdary[0] = bdary[1] = '-'; strtok(bdary, ";");
-    const char *vals[2], *keys[2] = { "name", "filename" }, *sep = "\r\n";
-    size_t off = 0, idx = 0, blen = strlen(bdary), slen = strlen(sep);
-    int rc = 0, remain = req->content_len, state = PARSE_BDARY;
+    TRYFREE(ctype);
+    if (EMALLOC(buf, CHUNK_SIZE + 1)) return send_err(req, 500, NULL);
+    const char *vals[2], *keys[2] = { "name", "filename" };
+    char name[128] = { 0 };
+    bool file = false, found = false;
+    int rc = 0, remain = req->content_len, state = PARSE_DATA;
+    size_t off = 2, len, head, idx = 0;
+    memcpy(buf, "\r\n", off); // so that the first boundary is a delimiter
     while (( rc = httpd_req_recv(req, buf + off, CHUNK_SIZE - off) ) >= 0) {
         if (!rc && !off) break;
-        remain -= rc; rc += off; buf[rc] = (off = 0);
-        char *head = buf, *tail = head + rc, *crlf = strstr(head, sep);
-        while (head < tail && state < PARSE_FAILED) {
-            if (state == PARSE_BDARY) {
-                char *ptr = strstr(head, bdary);
-                if (!crlf || !ptr) break;
-                if (!strncmp(ptr + blen, "--", 2)) head = tail;
-                if (strncmp(ptr + blen, sep, slen)) break;
-                crlf = strstr(head = ptr + blen + slen, sep);
-                vals[0] = vals[1] = NULL;
-                state = PARSE_HEADER;
-            }
-            if (state == PARSE_HEADER) {
-                if (!crlf) break;
-                if (crlf != head) {
-                    if (startswith(head, "Content-Disposition:")) {
-                        crlf[0] = '\0';
-                        parse_kvs(head + 20, "; ", LEN(keys), keys, vals);
+        remain -= rc; len = off + rc; head = 0;
+        while (head < len && state < PARSE_DONE) {
+            char *ptr = buf + head;
+            if (state == PARSE_DATA) {          // preamble or part body
+                size_t flen = bdary_search(&bdary, ptr, len - head, &found);
+                if (file && (flen || found)) {
+                    ESP_LOGD(TAG, "idx: %zu, remain: %d, fend: %d, flen: %zu",
+                             idx, remain, found, flen);
+                    rc = callback(req, name, idx, ptr, flen, found);
+                    if (rc == ESP_ERR_HTTPD_SKIP_DATA) {
+                        file = false;
+                    } else if (rc) {
+                        state = PARSE_FAILED;
+                        break;
                     }
-                    crlf = strstr(head = crlf + slen, sep);
-                } else if (vals[1]) {                   // filename
-                    if (!vals[0]) vals[0] = vals[1];    // name
-                    crlf = strstr(head += slen, sep);
-                    state = PARSE_DATA;
-                    idx = 0;
+                    idx += flen;
+                }
+                head += flen;
+                if (!found) break;
+                head += bdary.len;
+                state = PARSE_BDARY;
+            } else if (state == PARSE_BDARY) {  // CRLF or "--" after delimiter
+                if (len - head < 2) break;
+                if (!memcmp(ptr, "--", 2)) {
+                    state = PARSE_DONE;
+                } else if (!memcmp(ptr, "\r\n", 2)) {
+                    state = PARSE_HEADER;
+                    vals[0] = vals[1] = NULL;
+                    name[0] = '\0';
                 } else {
-                    state = vals[0] ? PARSE_BDARY : PARSE_ERROR;
+                    state = PARSE_ERROR;
                 }
-            }
-            if (state == PARSE_DATA) {
-                bool fend = !remain;
-                size_t flen = tail - head, clen;
-                while (crlf) {
-                    if (( clen = tail - crlf - slen ) < blen) {
-                        flen = crlf - head;
-                    } else if (!strncmp(crlf + slen, bdary, blen)) {
-                        flen = crlf - head;
-                        fend = true;
-                        break;
-                    }
-                    crlf = strstr(crlf + slen, sep);
+                head += 2;
+            } else {                            // header lines of a part
+                char *crlf = memmem(ptr, len - head, "\r\n", 2);
+                if (!crlf) {
+                    if (!head && len == CHUNK_SIZE) state = PARSE_ERROR;
+                    break;
                 }
-                state = fend ? PARSE_BDARY : PARSE_DATA;
-                if (!flen && (!fend || !idx)) break;
-                ESP_LOGD(TAG, "idx: %u, remain: %d, fend: %d, flen: %u",
-                         idx, remain, fend, flen);
-                if (!( rc = callback(req, vals[0], idx, head, flen, fend) )) {
-                    crlf = strstr(head += flen, "\r\n");
-                    idx += flen;
-                } else if (rc == ESP_ERR_HTTPD_SKIP_DATA) {
-                    crlf = strstr(head += flen, "\r\n");
-                    state = PARSE_BDARY;
+                head = crlf + 2 - buf;
+                if (crlf != ptr) {
+                    if (strncasecmp(ptr, "Content-Disposition:", 20)) continue;
+                    crlf[0] = '\0';
+                    parse_kvs(ptr + 20, "; ", LEN(keys), keys, vals);
+                    snprintf(name, sizeof(name), "%s", vals[0] ?: vals[1] ?: "");
+                } else if (vals[1]) {                   // filename
+                    state = PARSE_DATA;
+                    file = true;
+                    idx = 0;
                 } else {
-                    state = PARSE_FAILED;
+                    state = vals[0] ? PARSE_DATA : PARSE_ERROR;
+                    file = false;
                 }
             }
         }
-        if (state >= PARSE_FAILED) break;
-        if (head < tail && head != buf) memmove(buf, head, off = tail - head);
+        if (state >= PARSE_DONE) break;
+        if ((off = len - head) && head) memmove(buf, buf + head, off);
+        if (!remain && !rc) break;
     }
     if (state == PARSE_ERROR) {
         rc = send_err(req, 400, "Invalid syntax");
     } else if (state == PARSE_FAILED) {
         rc = ESP_FAIL;
-    } else if (!remain) {
+    } else if (state == PARSE_DONE) {
         rc = send_str(req, NULL);
     } else if (rc == HTTPD_SOCK_ERR_TIMEOUT) {
         rc = send_err(req, 408, NULL);
+    } else {
+        rc = send_err(req, 400, "Incomplete multipart body");
     }
     TRYFREE(buf);
-    TRYFREE(ctype);
     return rc < 0 ? ESP_FAIL : ESP_OK; // HTTPD_SOCK_ERR_xxx < 0
+#undef PARSE_DATA
 #undef PARSE_BDARY
 #undef PARSE_HEADER
-#undef PARSE_DATA
+#undef PARSE_DONE
 #undef PARSE_FAILED
 #undef PARSE_ERROR
 }
@@ -510,18 +1109,21 @@ static esp_err_t redirect(httpd_req_t *req, const char *location) {
 static void log_msg(httpd_req_t *req) {
     const char *mstr = http_method_str(req->method);
     if (req->content_len) {
-        ESP_LOGI(TAG, "%s %s %d", mstr, req->uri, req->content_len);
+        ESP_LOGI(TAG, "%s %s %zu", mstr, req->uri, req->content_len);
     } else {
         ESP_LOGI(TAG, "%s %s", mstr, req->uri);
     }
 }
 
 static void log_param(httpd_req_t *req) {
-    int cnt = 0;
-    for (http_param_t *param = req->sess_ctx; param; param = param->next) {
-        if (!param->key || !strlen(param->key)) continue;
+    http_arena_t *arena = req->sess_ctx;
+    if (!arena || !arena->count) return;
+    http_param_t *param = ARENA_INDEX(arena) + arena->count;
+    LOOPN(i, arena->count) {
+        param--;
         ESP_LOGI(TAG, "Param[%d] key:%s, query:%d `%s`",
-                 cnt++, param->key, !param->body, param->val ?: "");
+                 i, arena->data + param->key, !param->body,
+                 param->val ? arena->data + param->val : "");
     }
 }
 
@@ -536,34 +1138,35 @@ static esp_err_t check_request(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     esp_err_t err = ESP_OK;
     req->free_ctx = free_params;
-    http_param_t *ptr = req->sess_ctx;
-    if (ptr) {
-        TRYNULL(ptr->next, free_params);
-    } else if (!( err = ECALLOC(ptr, 1, sizeof(http_param_t)) )) {
-        ptr->key = strdup(""); // SENTINEL
-        req->sess_ctx = ptr;
+    http_arena_t *arena = req->sess_ctx;
+    if (arena) {
+        if (arena->size > ARENA_KEEP) {
+            TRYFREE(arena->data);
+            arena->size = 0;
+        }
+        arena->used = arena->count = 0;
+    } else if (!( err = ECALLOC(arena, 1, sizeof(http_arena_t)) )) {
+        req->sess_ctx = arena;
     }
     if (!err) {
-        size_t qlen = httpd_req_get_url_query_len(req) + 1;
-        if (qlen > 1) {
-            char buf[qlen];
-            if (!( err = httpd_req_get_url_query_str(req, buf, qlen) )) {
-                buf[url_decode(buf, qlen)] = '\0';
-                parse_params(buf, false, &req->sess_ctx);
-            } else {
+        size_t qlen = httpd_req_get_url_query_len(req);
+        if (qlen && !( err = arena_reserve(arena, qlen + 1, 0) )) {
+            char *buf = arena->data + arena->used;
+            if (httpd_req_get_url_query_str(req, buf, qlen + 1) ||
+                parse_params(arena, qlen, false)) {
                 send_err(req, 400, "Invalid query");
+                err = ESP_ERR_INVALID_ARG;
             }
         }
     }
     if (!err) { // parse POST body which size < CHUNK_SIZE
         bool wanted = has_header(req, "Content-Type", CTYPE_UENC);
         size_t clen = req->content_len < CHUNK_SIZE ? req->content_len : 0;
-        if (clen && wanted) {
-            char buf[clen + 1];
+        if (clen && wanted && !( err = arena_reserve(arena, clen + 1, 0) )) {
+            char *buf = arena->data + arena->used;
             if (( err = httpd_req_recv(req, buf, clen) ) > 0) {
-                buf[url_decode(buf, err)] = '\0';
-                parse_params(buf, true, &req->sess_ctx);
-                err = ESP_OK;
+                err = parse_params(arena, err, true);
+                if (err) send_err(req, 400, "Invalid request body");
             } else if (err == HTTPD_SOCK_ERR_TIMEOUT) {
                 send_err(req, 408, NULL);
             } else {
@@ -580,7 +1183,7 @@ static esp_err_t check_request(httpd_req_t *req) {
         }
     }
 #endif
-    if (!err && (int)req->user_ctx & FLAG_NEED_AUTH) {
+    if (!err && (intptr_t)req->user_ctx & FLAG_NEED_AUTH) {
         char *auth = get_header(req, "Authorization"), *rstr = NULL;
         const char *mstr = http_method_str(req->method);
         http_auth_t *ctx = httpd_get_global_user_ctx(req->handle);
@@ -614,7 +1217,7 @@ static esp_err_t on_success(httpd_req_t *req) {
     size_t nfd = 8;
     int fds[nfd];
     if (httpd_get_client_list(req->handle, &nfd, fds) || !nfd) return ESP_OK;
-    ESP_LOGI(TAG, "Got %d clients", nfd);
+    ESP_LOGI(TAG, "Got %zu clients", nfd);
     LOOPN(i, nfd) {
         ESP_LOGI(TAG, "- fd=%d %s", fds[i], getaddrname(fds[i], false));
     }
@@ -622,19 +1225,622 @@ static esp_err_t on_success(httpd_req_t *req) {
     return send_str(req, NULL);
 }
 
+#ifdef WITH_WORKERS
+typedef struct {
+    httpd_req_t *req;       // NULL for jobs queued by worker_queue
+    esp_err_t (*handler)(httpd_req_t *req);
+    void (*job)(void *arg);
+    void *arg;
+    int64_t ts;
+} http_work_t;
+
+static struct {
+    QueueHandle_t queue;
+    uint32_t busy, depth, queued, rejected;
+    uint32_t max_depth, max_wait;       // max_wait in us
+    uint32_t wait;                      // total wait time in ms
+} workers;
+
+// update maximum with CAS because it may be raced by another worker
+static void worker_max(uint32_t *ptr, uint32_t val) {
+    uint32_t cur = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+    while (val > cur && !__atomic_compare_exchange_n(
+        ptr, &cur, val, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static void worker_task(void *arg) {
+    http_work_t work;
+    while (xQueueReceive(workers.queue, &work, portMAX_DELAY)) {
+        uint32_t wait = MIN(esp_timer_get_time() - work.ts, UINT32_MAX);
+        __atomic_fetch_sub(&workers.depth, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&workers.busy, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&workers.wait, (wait + 500) / 1000, __ATOMIC_RELAXED);
+        worker_max(&workers.max_wait, wait);
+        if (!work.req) {
+            work.job(work.arg);
+            __atomic_fetch_sub(&workers.busy, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        esp_err_t err = work.handler(work.req);
+        metrics_finish(work.req, work.ts, err);
+        if (err != ESP_OK)
+            httpd_sess_trigger_close(work.req->handle,
+                                     httpd_req_to_sockfd(work.req));
+        httpd_req_async_handler_complete(work.req);
+        __atomic_fetch_sub(&workers.busy, 1, __ATOMIC_RELAXED);
+    }
+    vTaskDelete(NULL);
+}
+
+static void worker_init() {
+    if (workers.queue) return;
+    if (!( workers.queue = xQueueCreate(CONFIG_BASE_HTTP_WORKER_QUEUE,
+                                        sizeof(http_work_t)) )) return;
+    char name[16];
+    LOOPN(i, CONFIG_BASE_HTTP_WORKERS) {
+        snprintf(name, sizeof(name), "httpd_worker%d", i);
+        xTaskCreate(worker_task, name, 8192, NULL, 5, NULL);
+    }
+}
+
+// Detach the request from httpd task and run handler in a worker task.
+// Handler is called directly if there is no worker available.
+static esp_err_t worker_submit(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *)) {
+    if (!workers.queue) return handler(req);
+    http_work_t work = { .handler = handler, .ts = esp_timer_get_time() };
+    if (uxQueueSpacesAvailable(workers.queue) &&
+        !httpd_req_async_handler_begin(req, &work.req))
+    {
+        uint32_t depth = __atomic_add_fetch(&workers.depth, 1, __ATOMIC_RELAXED);
+        if (xQueueSend(workers.queue, &work, 0) == pdTRUE) {
+            __atomic_fetch_add(&workers.queued, 1, __ATOMIC_RELAXED);
+            worker_max(&workers.max_depth, depth);
+            metrics_defer(req);
+            return ESP_OK;
+        }
+        __atomic_fetch_sub(&workers.depth, 1, __ATOMIC_RELAXED);
+        httpd_req_async_handler_complete(work.req);
+    }
+    __atomic_fetch_add(&workers.rejected, 1, __ATOMIC_RELAXED);
+    metrics_error(req, 503);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    return send_str(req, "Too many pending requests");
+}
+
+// Run job that is not bound to a request (e.g. websocket message) in worker
+static UNUSED esp_err_t worker_queue(void (*job)(void *), void *arg) {
+    http_work_t work = { .job = job, .arg = arg, .ts = esp_timer_get_time() };
+    if (!workers.queue) return ESP_ERR_INVALID_STATE;
+    uint32_t depth = __atomic_add_fetch(&workers.depth, 1, __ATOMIC_RELAXED);
+    if (xQueueSend(workers.queue, &work, 0) == pdTRUE) {
+        __atomic_fetch_add(&workers.queued, 1, __ATOMIC_RELAXED);
+        worker_max(&workers.max_depth, depth);
+        return ESP_OK;
+    }
+    __atomic_fetch_sub(&workers.depth, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&workers.rejected, 1, __ATOMIC_RELAXED);
+    return ESP_ERR_TIMEOUT;
+}
+#else
+#   define worker_init()
+#   define worker_submit(req, handler) (handler)(req)
+
+#   define JOB_TASKS 2      // max number of jobs running at the same time
+
+typedef struct {
+    void (*job)(void *arg);
+    void *arg;
+} http_job_t;
+
+static uint32_t job_tasks;
+
+static void job_task(void *arg) {
+    http_job_t job = *(http_job_t *)arg;
+    free(arg);
+    job.job(job.arg);
+    __atomic_fetch_sub(&job_tasks, 1, __ATOMIC_RELAXED);
+    vTaskDelete(NULL);
+}
+
+// Without workers, each job runs in a task of its own
+static UNUSED esp_err_t worker_queue(void (*job)(void *), void *arg) {
+    http_job_t *ptr = NULL;
+    if (__atomic_add_fetch(&job_tasks, 1, __ATOMIC_RELAXED) > JOB_TASKS) {
+        __atomic_fetch_sub(&job_tasks, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (!EMALLOC(ptr, sizeof(http_job_t))) {
+        *ptr = (http_job_t){ job, arg };
+        if (xTaskCreate(job_task, "httpd_job", 8192, ptr, 5, NULL) == pdPASS)
+            return ESP_OK;
+        free(ptr);
+    }
+    __atomic_fetch_sub(&job_tasks, 1, __ATOMIC_RELAXED);
+    return ESP_ERR_NO_MEM;
+}
+#endif // WITH_WORKERS
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+// Frames to one client are sent from httpd, worker and telemetry tasks, and
+// httpd_ws_send_frame_async writes header and payload separately, so sends
+// to the same fd are serialized to keep frames from interleaving.
+static SemaphoreHandle_t ws_locks[CONFIG_LWIP_MAX_SOCKETS];
+
+#define WS_LOCK(fd) \
+    ws_locks[((fd) - LWIP_SOCKET_OFFSET) % CONFIG_LWIP_MAX_SOCKETS]
+
+static void ws_init() {
+    ITERP(lock, ws_locks) { if (!*lock && ( *lock = MUTEX() )) RELEASE(*lock); }
+}
+
+// Return ESP_ERR_INVALID_STATE if fd is no longer a websocket client
+static esp_err_t ws_send(int fd, httpd_ws_type_t type, const void *buf,
+                         size_t len, uint32_t tout_ms) {
+    httpd_ws_frame_t frame = {
+        .final = true, .fragmented = false, .type = type,
+        .payload = (uint8_t *)buf, .len = len
+    };
+    if (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+        return ESP_ERR_INVALID_STATE;
+    if (!ACQUIRE(WS_LOCK(fd), tout_ms)) return ESP_ERR_TIMEOUT;
+    esp_err_t err = httpd_ws_send_frame_async(server, fd, &frame);
+    RELEASE(WS_LOCK(fd));
+    return err;
+}
+
+/* Telemetry push over websocket: clients send JSON-RPC
+ *  {"id": 1, "method": "subscribe", "params": ["als", 200]}
+ *  {"id": 2, "method": "unsubscribe", "params": ["als"]}
+ * and receive text frames {"topic": "als", "ts": <ms>, "data": <sample>}.
+ * Each topic is sampled once per tick and shared by all due subscribers.
+ */
+
+#define TOPIC_SUBS      16      // max number of subscriptions
+#define TOPIC_INTV_MIN  50      // ms
+#define TOPIC_INTV_MAX  60000   // ms
+
+static int topic_tscn(char *buf, size_t size) {
+    tscn_data_t dat;
+    if (tscn_read(&dat, true)) return -1;
+    int len = snprintf(buf, size, "{\"ges\":%u,\"pts\":[", dat.ges);
+    LOOPN(i, MIN(dat.num, LEN(dat.pts))) {
+        len += snprintf(buf + len, size - len, "%s[%u,%u,%u]", i ? "," : "",
+                        dat.pts[i].x, dat.pts[i].y, dat.pts[i].evt);
+    }
+    return len + snprintf(buf + len, size - len, "]}");
+}
+
+static int topic_als(char *buf, size_t size) {
+    float lux[ALS_NUM], sum = 0;
+    LOOPN(i, ALS_NUM) { sum += lux[i] = als_brightness(i); }
+    if (!sum) return -1;
+    return snprintf(buf, size, "[%.2f,%.2f,%.2f,%.2f]",
+                    lux[0], lux[1], lux[2], lux[3]);
+}
+
+static int topic_adc(char *buf, size_t size) {
+    int mv[3] = { adc_read(0), adc_read(1), adc_read(2) };
+    if (mv[0] < 0 && mv[1] < 0 && mv[2] < 0) return -1;
+    return snprintf(buf, size, "[%d,%d,%d]", mv[0], mv[1], mv[2]);
+}
+
+static int topic_gy39(char *buf, size_t size) {
+    gy39_data_t dat;
+    if (gy39_read(&dat)) return -1;
+    return snprintf(buf, size,
+        "{\"lux\":%.2f,\"temp\":%.2f,\"pa\":%.0f,\"hum\":%.3f,\"alt\":%.2f}",
+        dat.brightness, dat.temperature, dat.atmosphere,
+        dat.humidity, dat.altitude);
+}
+
+static int topic_dist(char *buf, size_t size) {
+    int mm = vlx_read();
+    return mm < 0 || mm == UINT16_MAX ? -1 : snprintf(buf, size, "%d", mm);
+}
+
+static int topic_bat(char *buf, size_t size) {
+    int mv = pwr_vbat();
+    return mv < 0 ? -1 : snprintf(buf, size, "%d", mv);
+}
+
+static struct {
+    const char *name;
+    int (*read)(char *buf, size_t size);    // format sample, -1 if error
+    uint32_t sent, drops;
+} topics[] = {
+    { "tscn", topic_tscn, 0, 0 },
+    { "als",  topic_als,  0, 0 },
+    { "adc",  topic_adc,  0, 0 },
+    { "gy39", topic_gy39, 0, 0 },
+    { "dist", topic_dist, 0, 0 },
+    { "bat",  topic_bat,  0, 0 },
+};
+
+typedef struct {
+    int fd;                 // 0 if unused
+    uint8_t topic;
+    uint16_t intv;          // ms
+    int64_t next;           // us
+} ws_sub_t;
+
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t lock;
+    uint32_t num;
+    ws_sub_t subs[TOPIC_SUBS];
+} telemetry;
+
+static void telemetry_publish(uint8_t topic, int64_t now, char *buf, size_t size) {
+    int fds[TOPIC_SUBS], num = 0, len;
+    if (!ACQUIRE(telemetry.lock, 100)) return;
+    ITERP(sub, telemetry.subs) {    // coalesce late samples into one
+        if (!sub->fd || sub->topic != topic || sub->next > now) continue;
+        int64_t missed = (now - sub->next) / (sub->intv * 1000);
+        topics[topic].drops += missed;
+        sub->next += (missed + 1) * sub->intv * 1000;
+        fds[num++] = sub->fd;
+    }
+    RELEASE(telemetry.lock);
+    len = snprintf(buf, size, "{\"topic\":\"%s\",\"ts\":%" PRId64 ",\"data\":",
+                   topics[topic].name, now / 1000);
+    int dlen = topics[topic].read(buf + len, size - len - 1);
+    if (dlen < 0 || (size_t)(len += dlen) >= size - 1) {
+        topics[topic].drops += num;
+        return;
+    }
+    buf[len++] = '}';
+    LOOPN(i, num) {
+        // don't wait for a command streaming to the same client
+        esp_err_t err = ws_send(fds[i], HTTPD_WS_TYPE_TEXT, buf, len, 10);
+        if (err == ESP_ERR_INVALID_STATE) {
+            if (!ACQUIRE(telemetry.lock, 100)) continue;
+            ITERP(sub, telemetry.subs) {
+                if (sub->fd != fds[i]) continue;
+                sub->fd = 0;
+                telemetry.num--;
+            }
+            RELEASE(telemetry.lock);
+        } else if (err) {
+            topics[topic].drops++;
+        } else {
+            topics[topic].sent++;
+        }
+    }
+}
+
+static void telemetry_task(void *arg) {
+    char buf[640];
+    for (;;) {
+        int64_t now = esp_timer_get_time(), wait = TOPIC_INTV_MAX * 1000;
+        uint32_t due = 0;
+        if (ACQUIRE(telemetry.lock, 100)) {
+            ITERP(sub, telemetry.subs) {
+                if (!sub->fd) continue;
+                if (sub->next <= now) {
+                    due |= BIT(sub->topic);
+                } else {
+                    wait = MIN(wait, sub->next - now);
+                }
+            }
+            if (!telemetry.num) break;  // exit with lock held
+            RELEASE(telemetry.lock);
+        }
+        LOOPN(i, LEN(topics)) {
+            if (due & BIT(i)) telemetry_publish(i, now, buf, sizeof(buf));
+        }
+        if (!due) vTaskDelay(MAX(1, pdMS_TO_TICKS(wait / 1000)));
+    }
+    telemetry.task = NULL;
+    RELEASE(telemetry.lock);
+    vTaskDelete(NULL);
+}
+
+// topic = NULL to unsubscribe all topics, intv = 0 to unsubscribe
+static esp_err_t telemetry_subscribe(int fd, const char *topic, int intv) {
+    int idx = -1;
+    LOOPN(i, LEN(topics)) { if (!strcmp(topic ?: "", topics[i].name)) idx = i; }
+    if (topic && idx < 0) return ESP_ERR_NOT_FOUND;
+    if (!ACQUIRE(telemetry.lock, 100)) return ESP_ERR_TIMEOUT;
+    ws_sub_t *slot = NULL;
+    ITERP(sub, telemetry.subs) {
+        if (!slot && !sub->fd) slot = sub;
+        if (sub->fd != fd || (topic && sub->topic != idx)) continue;
+        if (intv) {
+            slot = sub;
+            break;
+        }
+        sub->fd = 0;
+        telemetry.num--;
+    }
+    esp_err_t err = ESP_OK;
+    if (!intv) {
+        // done
+    } else if (!slot) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        if (!slot->fd) telemetry.num++;
+        slot->fd = fd;
+        slot->topic = idx;
+        slot->intv = CONS(intv, TOPIC_INTV_MIN, TOPIC_INTV_MAX);
+        slot->next = esp_timer_get_time();
+        if (!telemetry.task && xTaskCreate(
+                telemetry_task, "telemetry", 4096, NULL, 5, &telemetry.task
+            ) != pdPASS) err = ESP_FAIL;
+    }
+    RELEASE(telemetry.lock);
+    return err;
+}
+
+// return JSON-RPC reply if the message is a (un)subscribe request else NULL
+static char * telemetry_request(int fd, const char *json) {
+    if (!strstr(json, "subscribe")) return NULL;
+    cJSON *obj = cJSON_Parse(json), *rep = NULL,
+          *uid = cJSON_GetObjectItem(obj, "id"),
+          *method = cJSON_GetObjectItem(obj, "method"),
+          *params = cJSON_GetObjectItem(obj, "params");
+    const char *name = cJSON_GetStringValue(method) ?: "";
+    bool sub = !strcmp(name, "subscribe");
+    if (!sub && strcmp(name, "unsubscribe")) {
+        TRYNULL(obj, cJSON_Delete);
+        return NULL;            // leave it to console_handle_rpc
+    }
+    const char *topic = cJSON_GetStringValue(cJSON_GetArrayItem(params, 0));
+    cJSON *intv = cJSON_GetArrayItem(params, 1);
+    esp_err_t err = sub && !topic ? ESP_ERR_INVALID_ARG :
+        telemetry_subscribe(fd, topic, sub ? (intv ? intv->valueint : 1000) : 0);
+    rep = cJSON_CreateObject();
+    cJSON_AddItemToObject(rep, "id", uid ? cJSON_Duplicate(uid, false)
+                                         : cJSON_CreateNull());
+    cJSON_AddStringToObject(rep, "jsonrpc", "2.0");
+    if (err) {
+        cJSON *error = cJSON_AddObjectToObject(rep, "error");
+        cJSON_AddNumberToObject(error, "code", -32602);
+        cJSON_AddStringToObject(error, "message", esp_err_to_name(err));
+    } else {
+        cJSON_AddNumberToObject(rep, "result", telemetry.num);
+    }
+    char *ret = cJSON_PrintUnformatted(rep);
+    cJSON_Delete(rep);
+    cJSON_Delete(obj);
+    return ret;
+}
+#endif // CONFIG_HTTPD_WS_SUPPORT
+
+// Subscriptions are dropped before the socket can be reused by a new client
+static void on_close(httpd_handle_t hd, int fd) {
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    telemetry_subscribe(fd, NULL, 0);
+#endif
+#ifdef CONFIG_BASE_HTTP_METRICS
+    metrics_close(hd, fd);
+#endif
+    close(fd); NOTUSED(hd);
+}
+
+#ifdef CONFIG_BASE_HTTP_METRICS
+static esp_err_t on_unmatched(httpd_req_t *req, httpd_err_code_t code) {
+    size_t len = req->content_len;
+    int64_t ts = esp_timer_get_time();
+    int fd = httpd_req_to_sockfd(req);
+    httpd_sess_set_transport_ctx(req->handle, fd, metrics.routes, NULL);
+    metrics_active(fd);
+    esp_err_t err = on_error(req, code);
+    metrics_record(metrics.routes, len, esp_timer_get_time() - ts, err);
+    return err;
+}
+
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t err;
+    size_t len;
+    char buf[CHUNK_SIZE];
+} http_writer_t;
+
+// buffer formatted text and send it in chunks of CHUNK_SIZE
+static void writer_printf(http_writer_t *w, const char *fmt, ...) {
+    LOOPN(retry, 2) {
+        if (w->err) return;
+        va_list ap;
+        va_start(ap, fmt);
+        int len = vsnprintf(w->buf + w->len, CHUNK_SIZE - w->len, fmt, ap);
+        va_end(ap);
+        if (len < 0) return;
+        if (w->len + len < CHUNK_SIZE) { w->len += len; return; }
+        w->buf[w->len] = '\0';  // drop partial text and flush
+        if (w->len) w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+        w->len = 0;
+    }
+}
+
+static void metrics_prom(http_writer_t *w) {
+    char label[64];
+    writer_printf(w,
+        "# TYPE http_sessions_opened_total counter\n"
+        "http_sessions_opened_total %u\n"
+        "# TYPE http_sessions_closed_total counter\n"
+        "http_sessions_closed_total %u\n"
+        "# HELP http_sessions_evicted_total Closed by LRU purge\n"
+        "# TYPE http_sessions_evicted_total counter\n"
+        "http_sessions_evicted_total %u\n",
+        metrics.opened, metrics.closed, metrics.evicted);
+#ifdef WITH_WORKERS
+    writer_printf(w,
+        "# TYPE http_worker_busy gauge\n"
+        "http_worker_busy %u\n"
+        "# TYPE http_worker_queue_depth gauge\n"
+        "http_worker_queue_depth %u\n"
+        "# TYPE http_worker_queue_depth_max gauge\n"
+        "http_worker_queue_depth_max %u\n"
+        "# TYPE http_worker_queued_total counter\n"
+        "http_worker_queued_total %u\n"
+        "# TYPE http_worker_rejected_total counter\n"
+        "http_worker_rejected_total %u\n"
+        "# TYPE http_worker_wait_seconds_total counter\n"
+        "http_worker_wait_seconds_total %u.%03u\n"
+        "# TYPE http_worker_wait_seconds_max gauge\n"
+        "http_worker_wait_seconds_max %u.%06u\n",
+        workers.busy, workers.depth, workers.max_depth,
+        workers.queued, workers.rejected,
+        workers.wait / 1000, workers.wait % 1000,
+        workers.max_wait / 1000000, workers.max_wait % 1000000);
+#endif
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    writer_printf(w,
+        "# TYPE ws_subscriptions gauge\n"
+        "ws_subscriptions %u\n"
+        "# TYPE ws_topic_sent_total counter\n", telemetry.num);
+    ITERP(topic, topics) {
+        writer_printf(w, "ws_topic_sent_total{topic=\"%s\"} %u\n",
+                      topic->name, topic->sent);
+    }
+    writer_printf(w, "# TYPE ws_topic_dropped_total counter\n");
+    ITERP(topic, topics) {
+        writer_printf(w, "ws_topic_dropped_total{topic=\"%s\"} %u\n",
+                      topic->name, topic->drops);
+    }
+#endif
+    const char *names[] = {
+        "http_requests_total", "http_request_failures_total",
+        "http_received_bytes_total", "http_sent_bytes_total",
+    };
+    LOOPN(n, LEN(names)) {
+        writer_printf(w, "# TYPE %s counter\n", names[n]);
+        LOOPN(i, metrics.num) {
+            http_route_t *route = metrics.routes + i;
+            uint32_t vals[] = {
+                route->count, route->fails, route->bytes_in, route->bytes_out
+            };
+            if (!route->count) continue;
+            snprintf(label, sizeof(label), "route=\"%s\",method=\"%s\"",
+                     route->uri, i ? http_method_str(route->method) : "ANY");
+            writer_printf(w, "%s{%s} %u\n", names[n], label, vals[n]);
+        }
+    }
+    writer_printf(w, "# TYPE http_error_responses_total counter\n");
+    LOOPN(i, metrics.num) {
+        http_route_t *route = metrics.routes + i;
+        snprintf(label, sizeof(label), "route=\"%s\",method=\"%s\"",
+                 route->uri, i ? http_method_str(route->method) : "ANY");
+        LOOPN(j, LEN(error_codes)) {
+            if (!route->errors[j]) continue;
+            writer_printf(w, "http_error_responses_total{%s,code=\"%d\"} %u\n",
+                          label, error_codes[j], route->errors[j]);
+        }
+    }
+    writer_printf(w, "# TYPE http_request_duration_seconds histogram\n");
+    LOOPN(i, metrics.num) {
+        http_route_t *route = metrics.routes + i;
+        if (!route->count) continue;
+        snprintf(label, sizeof(label), "route=\"%s\",method=\"%s\"",
+                 route->uri, i ? http_method_str(route->method) : "ANY");
+        uint32_t cnt = 0, usec;
+        LOOPN(j, LATENCY_BINS - 1) {
+            cnt += route->bins[j];
+            usec = LATENCY_BASE << j;
+            writer_printf(w,
+                "http_request_duration_seconds_bucket{%s,le=\"%u.%06u\"} %u\n",
+                label, usec / 1000000, usec % 1000000, cnt);
+        }
+        cnt += route->bins[LATENCY_BINS - 1];
+        writer_printf(w,
+            "http_request_duration_seconds_bucket{%s,le=\"+Inf\"} %u\n"
+            "http_request_duration_seconds_sum{%s} %u.%06u\n"
+            "http_request_duration_seconds_count{%s} %u\n",
+            label, cnt, label, route->usec / 1000000, route->usec % 1000000,
+            label, cnt);
+    }
+}
+
+static void metrics_json(http_writer_t *w) {
+    writer_printf(w,
+        "{\"sessions\":{\"opened\":%u,\"closed\":%u,\"evicted\":%u},"
+        "\"buckets\":[", metrics.opened, metrics.closed, metrics.evicted);
+    LOOPN(j, LATENCY_BINS - 1) {
+        writer_printf(w, "%s%u", j ? "," : "", LATENCY_BASE << j);
+    }
+    writer_printf(w, "],");
+#ifdef WITH_WORKERS
+    writer_printf(w,
+        "\"workers\":{\"busy\":%u,\"depth\":%u,\"max_depth\":%u,"
+        "\"queued\":%u,\"rejected\":%u,"
+        "\"wait_msec\":%u,\"max_wait_usec\":%u},",
+        workers.busy, workers.depth, workers.max_depth, workers.queued,
+        workers.rejected, workers.wait, workers.max_wait);
+#endif
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    writer_printf(w, "\"subscriptions\":%u,\"topics\":{", telemetry.num);
+    ITERP(topic, topics) {
+        writer_printf(w, "%s\"%s\":{\"sent\":%u,\"drops\":%u}",
+                      topic == topics ? "" : ",",
+                      topic->name, topic->sent, topic->drops);
+    }
+    writer_printf(w, "},");
+#endif
+    writer_printf(w, "\"routes\":[");
+    LOOPN(i, metrics.num) {
+        http_route_t *route = metrics.routes + i;
+        writer_printf(w,
+            "%s{\"uri\":\"%s\",\"method\":\"%s\",\"count\":%u,\"fails\":%u,"
+            "\"bytes_in\":%u,\"bytes_out\":%u,\"usec\":%u,\"errors\":{",
+            i ? "," : "", route->uri, i ? http_method_str(route->method) : "ANY",
+            route->count, route->fails, route->bytes_in, route->bytes_out,
+            route->usec);
+        int cnt = 0;
+        LOOPN(j, LEN(error_codes)) {
+            if (!route->errors[j]) continue;
+            writer_printf(w, "%s\"%d\":%u", cnt++ ? "," : "",
+                          error_codes[j], route->errors[j]);
+        }
+        writer_printf(w, "},\"latency\":[");
+        LOOPN(j, LATENCY_BINS) {
+            writer_printf(w, "%s%u", j ? "," : "", route->bins[j]);
+        }
+        writer_printf(w, "]}");
+    }
+    writer_printf(w, "]}");
+}
+
+static esp_err_t on_metrics(httpd_req_t *req) {
+    CHECK_REQUEST(req);
+    http_writer_t *w = NULL;
+    if (EMALLOC(w, sizeof(http_writer_t)))
+        return send_err(req, 500, "No memory for metrics");
+    w->req = req;
+    w->err = ESP_OK;
+    w->len = 0;
+    if (has_param(req, "json", FROM_ANY)) {
+        httpd_resp_set_type(req, CTYPE_JSON);
+        metrics_json(w);
+    } else {
+        httpd_resp_set_type(req, "text/plain; version=0.0.4");
+        metrics_prom(w);
+    }
+    if (!w->err && w->len)
+        w->err = httpd_resp_send_chunk(req, w->buf, w->len);
+    esp_err_t err = w->err ?: httpd_resp_sendstr_chunk(req, NULL);
+    TRYFREE(w);
+    return err;
+}
+#endif // CONFIG_BASE_HTTP_METRICS
+
+// may take seconds (e.g. `lsfs`, `wifi scan`), run it in a worker task
+static esp_err_t run_command(httpd_req_t *req) {
+    const char *cmd = get_param(req, "cmd", FROM_ANY);
+    char *ret = console_handle_command(cmd, true, false);
+    if (ret) httpd_resp_set_type(req, "text/plain");
+    esp_err_t err = send_str(req, ret);
+    TRYFREE(ret);
+    return err;
+}
+
 static esp_err_t on_command(httpd_req_t *req) {
     CHECK_REQUEST(req);
     if (!req->content_len || req->content_len > CHUNK_SIZE)
         return send_err(req, 400, "Invalid content length");
     log_param(req);
     const char *cmd = get_param(req, "cmd", FROM_ANY) ?: "";
-    if (strlen(cmd)) {
-        char *ret = console_handle_command(cmd, true, false);
-        if (ret) httpd_resp_set_type(req, "text/plain");
-        send_str(req, ret);
-        TRYFREE(ret);
-        return ESP_OK;
-    }
+    if (strlen(cmd)) return worker_submit(req, run_command);
     const char *gcode = get_param(req, "gcode", FROM_ANY) ?: "";
     if (strlen(gcode)) {
         ESP_LOGW(TAG, "GCode parser: `%s`", gcode);
@@ -659,6 +1865,7 @@ static esp_err_t on_upload_file(httpd_req_t *req, const char *name,
             goto error;
         }
         fprintf(stderr, "Upload file: %s\n", path);
+        cache_invalidate(path);
     }
     if (fd && len) {
         if (len != fwrite(data, 1, len, fd)) {
@@ -707,12 +1914,14 @@ static esp_err_t on_editor(httpd_req_t *req) {
             return send_file(req, path, has_param(req, "download", FROM_ANY));
         }
     } else if (req->method == HTTP_PUT) {
+        cache_invalidate(path);
         if (!strcmp(type, "dir")) {
             if (!fmkdir(path)) return send_err(req, 500, "Create dir failed");
         } else {
             if (!ftouch(path)) return send_err(req, 500, "Create file failed");
         }
     } else if (req->method == HTTP_DELETE) {
+        cache_invalidate(path);
         if (!strcmp(type, "dir")) {
             if (!frmdir(path)) return send_err(req, 500, "Delete dir failed");
         } else if (fisfile(path)) {
@@ -798,7 +2007,7 @@ static esp_err_t on_update(httpd_req_t *req) {
 
 static esp_err_t on_static(httpd_req_t *req) {
     CHECK_REQUEST(req);
-    int flag = (int)req->user_ctx;
+    int flag = (intptr_t)req->user_ctx;
     const char * dirname = "/";
     if (flag & FLAG_DIR_DATA && strlen(Config.sys.DIR_DATA)) {
         dirname = Config.sys.DIR_DATA;
@@ -809,16 +2018,62 @@ static esp_err_t on_static(httpd_req_t *req) {
     }
     char basename[strcspn(req->uri, "?#") + 1];
     snprintf(basename, sizeof(basename), req->uri); // truncate and pad null
+    if (flag & (FLAG_DIR_DOCS | FLAG_DIR_HTML)) {
+        esp_err_t err = bundle_send(req, basename);
+        if (err != ESP_ERR_NOT_FOUND) return err;
+    }
     if (startswith(basename, dirname)) dirname = NULL;
     const char *path = get_static(fjoin(2, dirname, basename));
     return path ? send_file(req, path, 0) : on_error(req, HTTPD_404_NOT_FOUND);
 }
 
+#define MEDIA_CLIENTS   4
+#define MEDIA_QUEUE     8   // max number of frames queued per client
+#define MEDIA_POLL_MS   10
+
+// Frames are shared by all subscribers of a stream instead of being copied.
+// The slot in capture ring is held until the frame is released, so clients
+// that can not take the whole frame immediately get one private copy (shared
+// by all slow clients) queued instead.
+typedef struct {
+    avc_frame_t *src;       // frame in capture ring to release
+    void *data;
+    size_t len;
+    uint32_t refs;
+    size_t hlen;            // length of per-frame header (e.g. boundary)
+    char head[80];
+} http_frame_t;
+
 typedef struct {
     int fd;
-    bool stop, once;
+    bool once;              // close connection after first frame sent
+    uint32_t count;         // number of frames sent
+    uint32_t drops;         // number of frames dropped (i.e. audio underrun)
+    uint64_t bytes;         // number of bytes sent
+    int64_t since;          // timestamp in us when client subscribed
+    size_t off;             // number of bytes of queue[0] sent
+    uint8_t qnum;
+    http_frame_t *queue[MEDIA_QUEUE];
+    void *media;            // http_media_t that this client subscribed
     char addr[ADDRSTRLEN];
-    esp_event_handler_instance_t inst;
+} http_client_t;
+
+typedef struct {
+    const char *name, *task;
+    int target;             // AUDIO_TARGET or VIDEO_TARGET
+    bool stop;              // stop capture task after last client left
+    bool flush;             // media_flush is queued
+    bool pending;           // handle is queued
+    uint8_t num;            // number of subscribed clients
+    uint8_t qlen;           // drop oldest frame when client queue is full
+    httpd_work_fn_t handle; // read frames from capture ring in httpd task
+    http_client_t clients[MEDIA_CLIENTS];
+    avc_reader_t reader;
+    void *peer;             // http_media_t that shares the capture task
+    adpcm_state_t *adpcm;   // encode frames once for all clients
+    void *timer;            // poll clients with pending frames
+    size_t hlen;            // stream header sent to clients joined later
+    char head[64];
 } http_media_t;
 
 static UNUSED int socket_send_all(int fd, void *buf, size_t len) {
@@ -828,64 +2083,314 @@ static UNUSED int socket_send_all(int fd, void *buf, size_t len) {
         buf += ret;
         len -= ret;
     }
-    if (len) ESP_LOGD(TAG, "%d remain = %d, ret = %d", fd, len, ret);
+    if (len) ESP_LOGD(TAG, "%d remain = %zu, ret = %d", fd, len, ret);
     return MIN(ret, 0);
 }
 
+#if defined(CONFIG_BASE_USE_I2S) || defined(CONFIG_BASE_USE_CAM)
+static http_frame_t * frame_ref(http_frame_t *frame) {
+    if (frame) __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+static void frame_unref(http_frame_t *frame) {
+    if (!frame || __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    avc_release(frame->src); // let capture task reuse the slot
+    free(frame);
+}
+
+static http_frame_t * frame_clone(http_frame_t *frame) {
+    http_frame_t *copy = malloc(sizeof(http_frame_t) + frame->len);
+    if (!copy) return NULL;
+    memcpy(copy, frame, sizeof(http_frame_t));
+    copy->src = NULL;
+    copy->refs = 1;
+    copy->data = memcpy(copy + 1, frame->data, frame->len);
+    return copy;
+}
+
+// Send as much of the frame as possible without blocking the httpd task.
+// Return 0 if the frame is sent out, 1 if socket is busy and -1 on error.
+static int frame_send(http_client_t *client, http_frame_t *frame) {
+    size_t off, len, total = frame->hlen + frame->len;
+    while (( off = client->off ) < total) {
+        const char *buf = off < frame->hlen ?
+            frame->head + off : frame->data + (off - frame->hlen);
+        len = off < frame->hlen ? frame->hlen - off : total - off;
+        int ret = httpd_socket_send(server, client->fd, buf, len, MSG_DONTWAIT);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) return 1;
+        if (ret <= 0) return -1;
+        client->off += ret;
+        client->bytes += ret;
+    }
+    client->off = 0;
+    client->count++;
+    return 0;
+}
+
+static void client_pop(http_client_t *client, uint8_t idx) {
+    frame_unref(client->queue[idx]);
+    memmove(client->queue + idx, client->queue + idx + 1,
+            (--client->qnum - idx) * sizeof(http_frame_t *));
+}
+
+static void client_push(http_client_t *client, http_frame_t *frame, int q) {
+    if (client->qnum >= MIN(q, MEDIA_QUEUE)) {
+        client->drops++;
+        client_pop(client, client->off ? 1 : 0); // keep partially sent one
+    }
+    client->queue[client->qnum++] = frame_ref(frame);
+}
+
+// Clients of still image get nothing after the first frame
+static bool client_done(http_client_t *client) {
+    return client->once && client->count;
+}
+
+static int client_flush(http_client_t *client) {
+    int ret = 0;
+    while (client->qnum && !client_done(client) &&
+           !( ret = frame_send(client, client->queue[0]) )) {
+        client_pop(client, 0);
+    }
+    return ret;
+}
+
+// Called in capture task when new frame is available: must not block.
+static void on_media_data(avc_reader_t *reader) {
+    http_media_t *media = reader->arg;
+    if (__atomic_test_and_set(&media->pending, __ATOMIC_ACQUIRE)) return;
+    if (httpd_queue_work(server, media->handle, media))
+        __atomic_clear(&media->pending, __ATOMIC_RELEASE);
+}
+
+static void media_detach(http_client_t *client) {
+    http_media_t *media = client->media;
+    if (!client->fd || !media) return;
+    float secs = (esp_timer_get_time() - client->since) / 1e6;
+    ESP_LOGI(TAG, "%s stream to %s stopped: %" PRIu32 " frames (%" PRIu32
+             " dropped, %" PRIu32 " overruns), %s, %.1fFPS",
+             media->name, client->addr, client->count, client->drops,
+             media->reader.overruns, format_size(client->bytes),
+             secs > 0 ? client->count / secs : 0);
+    httpd_sess_trigger_close(server, client->fd);
+    while (client->qnum) { client_pop(client, 0); }
+    memset(client, 0, sizeof(http_client_t));
+    if (!media->num || --media->num) return;
+    avc_detach(&media->reader);
+    TRYNULL(media->timer, clearTimer);
+    http_media_t *peer = media->peer;
+    if (peer && peer->num) {
+        peer->stop |= media->stop;          // let the last one stop capture
+    } else if (media->stop) {
+        avc_async(media->target, "0", 0, NULL);
+    }
+}
+
+static http_client_t * media_attach(
+    http_media_t *media, httpd_req_t *req, const char *resp
+) {
+    http_client_t *client = NULL;
+    ITERP(ptr, media->clients) {
+        if (!ptr->fd) { client = ptr; break; }
+    }
+    if (!client) return NULL;
+    if (avc_attach(&media->reader)) return NULL;
+    int fd = httpd_req_to_sockfd(req);
+    if (socket_send_all(fd, (void *)resp, strlen(resp)) ||
+        (media->hlen && socket_send_all(fd, media->head, media->hlen))
+    ) {
+        if (!media->num) avc_detach(&media->reader);
+        return NULL;
+    }
+    if (!media->num++) media->stop = xTaskGetHandle(media->task) == NULL;
+    client->fd = fd;
+    client->media = media;
+    client->since = esp_timer_get_time();
+    snprintf(client->addr, ADDRSTRLEN, getaddrname(fd, false));
+    ESP_LOGI(TAG, "%s stream to %s started (%d/%d)",
+             media->name, client->addr, media->num, MEDIA_CLIENTS);
+    return client;
+}
+
+static void media_close(http_media_t *media) {
+    media->stop = false; // capture task is stopping
+    media->hlen = 0;
+    ITERP(client, media->clients) { media_detach(client); }
+}
+
+static bool media_check(http_client_t *client, int ret) {
+    if (ret < 0 || client_done(client)) {
+        media_detach(client);
+        return false;
+    }
+    return ret > 0;
+}
+
+// Called in httpd task to send queued frames to slow clients.
+static void media_flush(void *arg) {
+    http_media_t *media = arg;
+    bool pending = false;
+    media->flush = false;
+    ITERP(client, media->clients) {
+        if (!client->fd || !client->qnum) continue;
+        pending |= media_check(client, client_flush(client));
+    }
+    if (!pending) TRYNULL(media->timer, clearTimer);
+}
+
+// Called in esp_timer task when some clients have pending frames.
+static void media_poll(void *arg) {
+    http_media_t *media = arg;
+    if (!media->flush && !httpd_queue_work(server, media_flush, media))
+        media->flush = true;
+}
+
+// Try to send the frame to each subscriber without blocking. Clients that
+// are lagging behind get the frame queued (dropping the oldest one) so that
+// the frame can be released before this function returns.
+static void media_publish(http_media_t *media, http_frame_t *frame) {
+    http_frame_t *copy = NULL;
+    bool pending = false;
+    ITERP(client, media->clients) {
+        if (!client->fd) continue;
+        int ret = client_flush(client);
+        if (!ret && !client_done(client)) ret = frame_send(client, frame);
+        if (ret > 0 && !copy && !( copy = frame_clone(frame) )) {
+            client->drops++;
+            if (!client->qnum && client->off) ret = -1; // broken frame
+        } else if (ret > 0) {
+            client_push(client, copy, media->qlen);
+        }
+        pending |= media_check(client, ret);
+    }
+    TRYNULL(copy, frame_unref);
+    frame_unref(frame);
+    if (pending && !media->timer)
+        media->timer = setInterval(MEDIA_POLL_MS, media_poll, media);
+}
+
+static void handle_media_frame(
+    http_media_t *media, avc_frame_t *src, const char *fmt
+) {
+    video_evt_t *evt = &src->vid;
+    http_frame_t *frame = NULL;
+    if (!evt->len) {                        // XXX_EVENT_STOP
+        media_close(media);
+        goto exit;
+    } else if (!evt->mode) {                // XXX_EVENT_START
+        if (fmt) goto exit;                 // AVI header is useless for MJPG
+        media->hlen = MIN(evt->len, sizeof(media->head));
+        memcpy(media->head, evt->data, media->hlen);
+    }
+    if (ECALLOC(frame, 1, sizeof(http_frame_t))) goto exit;
+    frame->src = src;
+    frame->data = evt->mode ? evt->data : media->head;
+    frame->len = evt->mode ? evt->len : media->hlen;
+    frame->refs = 1;
+    if (fmt) frame->hlen = snprintf(
+        frame->head, sizeof(frame->head), fmt, (int)evt->len);
+    return media_publish(media, frame);     // avc_release in frame_unref
+exit:
+    avc_release(src);
+}
+
+// Encode audio frame into IMA-ADPCM blocks once for all clients. The header is
+// generated from the first audio data, so that clients can join when capture
+// task was started by others (i.e. the START frame was not seen).
+static void handle_adpcm_frame(http_media_t *media, avc_frame_t *src) {
+    audio_evt_t *evt = &src->aud;
+    http_frame_t *frame = NULL;
+    size_t len = 0;
+    if (!evt->len) {                        // AUD_EVENT_STOP
+        media_close(media);
+    } else if (!evt->mode) {                // AUD_EVENT_START
+        media->hlen = 0;
+    } else if (!media->hlen) {
+        media->hlen = adpcm_header(media->adpcm, evt->mode, media->head);
+        if (media->hlen && !ECALLOC(frame, 1, sizeof(http_frame_t))) {
+            frame->data = media->head;
+            frame->len = media->hlen;
+            frame->refs = 1;
+            media_publish(media, frame);    // for clients joined before
+        }
+    }
+    if (media->hlen && evt->mode && evt->len)
+        len = adpcm_encode(media->adpcm, NULL, evt->len, NULL);
+    if (!len || ECALLOC(frame, 1, sizeof(http_frame_t) + len)) {
+        if (!len && media->hlen && evt->mode)   // buffer until block is full
+            adpcm_encode(media->adpcm, evt->data, evt->len, NULL);
+        return avc_release(src);
+    }
+    frame->data = frame + 1;
+    frame->len = adpcm_encode(media->adpcm, evt->data, evt->len, frame + 1);
+    frame->refs = 1;
+    avc_release(src);                       // encoded data is owned by frame
+    media_publish(media, frame);
+}
+
+// Called in httpd task to send frames that were published since last call.
+static void handle_media_streaming(http_media_t *media, const char *fmt) {
+    avc_frame_t *frame;
+    __atomic_clear(&media->pending, __ATOMIC_RELEASE);
+    while (( frame = avc_read(&media->reader) )) {
+        if (media->adpcm) {
+            handle_adpcm_frame(media, frame);
+        } else {
+            handle_media_frame(media, frame, fmt);
+        }
+    }
+}
+#endif
+
 #ifdef CONFIG_BASE_USE_I2S
-static http_media_t audio_ctx;
+static void handle_audio_streaming(void *);
+static http_media_t audio_ctx, adpcm_ctx;
+static adpcm_state_t adpcm_state;
+
+static http_media_t audio_ctx = {
+    .name = "Audio", .task = "audio", .target = AUDIO_TARGET,
+    .qlen = MEDIA_QUEUE, .handle = handle_audio_streaming,
+    .reader = {
+        .name = "http", .target = AUDIO_TARGET,
+        .wake = on_media_data, .arg = &audio_ctx,
+    },
+    .peer = &adpcm_ctx,
+};
+
+// Compressed (4:1) stream: each frame is encoded once and shared by clients
+static http_media_t adpcm_ctx = {
+    .name = "ADPCM", .task = "audio", .target = AUDIO_TARGET,
+    .qlen = MEDIA_QUEUE, .handle = handle_audio_streaming,
+    .reader = {
+        .name = "adpcm", .target = AUDIO_TARGET,
+        .wake = on_media_data, .arg = &adpcm_ctx,
+    },
+    .peer = &audio_ctx, .adpcm = &adpcm_state,
+};
 
 static void handle_audio_streaming(void *arg) {
-    audio_evt_t *evt = arg;
-    notify_increase(evt->task);
-    if (!evt->len) goto stop;
-    if (!socket_send_all(audio_ctx.fd, evt->data, evt->len)) goto exit;
-stop:
-    UREGEVTS(AVC, audio_ctx.inst);
-    if (audio_ctx.stop) AUDIO_STOP();
-    ESP_LOGI(TAG, "Audio stream to %s stopped", audio_ctx.addr);
-exit:
-    notify_decrease(evt->task);
+    handle_media_streaming(arg, NULL);
 }
 #endif
 
 #ifdef CONFIG_BASE_USE_CAM
-static http_media_t video_ctx;
+static void handle_video_streaming(void *);
+static http_media_t video_ctx = {
+    .name = "Video", .task = "video", .target = VIDEO_TARGET,
+    .qlen = 2, .handle = handle_video_streaming,
+    .reader = {
+        .name = "http", .target = VIDEO_TARGET,
+        .wake = on_media_data, .arg = &video_ctx,
+    },
+};
 
 static void handle_video_streaming(void *arg) {
-    if (!video_ctx.fd) return;  // once
-    video_evt_t *evt = arg;
-    notify_increase(evt->task);
-    if (!evt->mode) goto exit;  // VID_EVENT_START
-    if (!evt->len) goto stop;   // VID_EVENT_STOP
-    static char bdary[51 + 14 + 1] =
+    handle_media_streaming(arg,
         "--FRAME\r\n"
         "Content-Type: image/jpeg\r\n"
-        "Content-Length: ";
-    int blen = 51 + snprintf(bdary + 51, 15, "%d\r\n\r\n", evt->len);
-    if (!socket_send_all(video_ctx.fd, bdary, blen) &&
-        !socket_send_all(video_ctx.fd, evt->data, evt->len) &&
-        !video_ctx.once) goto exit;
-    if (video_ctx.once) {
-        httpd_sess_trigger_close(server, video_ctx.fd);
-        video_ctx.fd = 0;
-    }
-stop:
-    UREGEVTS(AVC, video_ctx.inst);
-    if (video_ctx.stop) VIDEO_STOP();
-    ESP_LOGI(TAG, "Video stream to %s stopped", video_ctx.addr);
-exit:
-    notify_decrease(evt->task);
-}
-#endif
-
-#if defined(CONFIG_BASE_USE_I2S) || defined(CONFIG_BASE_USE_CAM)
-static void on_media_data(void *func, esp_event_base_t b, int32_t i, void *p) {
-    // this function is called in sys_evt task
-    // recv data from capture task
-    // send data to httpd task
-    httpd_queue_work(server, func, *(void **)p);
-    return; NOTUSED(b); NOTUSED(i);
+        "Content-Length: %d\r\n\r\n");
 }
 #endif
 
@@ -914,41 +2419,49 @@ static esp_err_t on_media(httpd_req_t *req) {
             TRYFREE(json);
             return ESP_OK;
         }
-        if (video_ctx.inst) return send_err(req, 403, "Video stream is busy");
-        const char *resp =
+        if (video_ctx.num == MEDIA_CLIENTS)
+            return send_err(req, 403, "Too many video streams");
+        http_client_t *client = media_attach(&video_ctx, req,
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: multipart/x-mixed-replace;boundary=FRAME\r\n"
             "Cache-Control: no-store\r\n"
-            "X-Framerate: 60\r\n\r\n";
-        int fd = video_ctx.fd = httpd_req_to_sockfd(req);
-        httpd_socket_send(req->handle, fd, resp, strlen(resp), 0);
-        REGEVTS(AVC, on_media_data, handle_video_streaming, &video_ctx.inst);
-        if (!video_ctx.inst) return ESP_FAIL;
-        video_ctx.stop = xTaskGetHandle("video") == NULL;
-        video_ctx.once = has_param(req, "still", FROM_ANY);
+            "X-Framerate: 60\r\n\r\n");
+        if (!client) return ESP_FAIL;
+        client->once = has_param(req, "still", FROM_ANY);
         VIDEO_START(-1);
-        snprintf(video_ctx.addr, ADDRSTRLEN, getaddrname(fd, false));
-        ESP_LOGI(TAG, "Video stream to %s started", video_ctx.addr);
 #endif
     } else if (has_param(req, "audio", FROM_ANY)) {
 #ifndef CONFIG_BASE_USE_I2S
         send_err(req, 403, "Audio stream not available");
 #else
         const char *audio = get_param(req, "audio", FROM_ANY);
-        if (strcmp(audio ?: "", "wav")) return send_str(req, NULL);
-        if (audio_ctx.inst) return send_err(req, 403, "Audio stream is busy");
-        const char *resp =
+        if (req->method == HTTP_POST) {
+            if (audio && AUDIO_LOADS(audio)) {
+                return send_err(req, 500, "Failed to load config from JSON");
+            } else {
+                return send_str(req, NULL);
+            }
+        }
+        http_media_t *media = !strcmp(audio ?: "", "wav") ? &audio_ctx :
+                              !strcmp(audio ?: "", "adpcm") ? &adpcm_ctx : NULL;
+        if (!media) {
+            char *json = NULL;
+            if (AUDIO_DUMPS(json)) {
+                send_err(req, 500, "Failed to dump config from JSON");
+            } else {
+                httpd_resp_set_type(req, CTYPE_JSON);
+                send_str(req, json);
+            }
+            TRYFREE(json);
+            return ESP_OK;
+        }
+        if (media->num == MEDIA_CLIENTS)
+            return send_err(req, 403, "Too many audio streams");
+        if (!media_attach(media, req,
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: audio/wav\r\n"
-            "Cache-Control: no-store\r\n\r\n";
-        int fd = audio_ctx.fd = httpd_req_to_sockfd(req);
-        httpd_socket_send(req->handle, fd, resp, strlen(resp), 0);
-        REGEVTS(AVC, on_media_data, handle_audio_streaming, &audio_ctx.inst);
-        if (!audio_ctx.inst) return ESP_FAIL;
-        audio_ctx.stop = xTaskGetHandle("audio") == NULL;
+            "Cache-Control: no-store\r\n\r\n")) return ESP_FAIL;
         AUDIO_START(-1);
-        snprintf(audio_ctx.addr, ADDRSTRLEN, getaddrname(fd, false));
-        ESP_LOGI(TAG, "Audio stream to %s started", audio_ctx.addr);
 #endif
     } else {
         return send_str(req, MEDIA_HTML);
@@ -956,22 +2469,219 @@ static esp_err_t on_media(httpd_req_t *req) {
     return ESP_OK;
 }
 
+#if CONFIG_BASE_HTTP_LOGS > 0
+#define LOG_LINE        160     // longer lines are truncated
+#define LOG_CLIENTS     4
+#define LOG_POLL_MS     200
+#define LOG_ALIVE_MS    15000   // send comment to detect closed clients
+
+// Log lines are formatted once into a ring of fixed slots shared by all
+// readers. Writers never wait: a slot is claimed by incrementing the head
+// and published by storing its sequence number. Readers that fall behind
+// by a whole ring skip ahead and report the number of lost lines.
+typedef struct {
+    uint32_t seq;           // sequence + 1 of the line, 0 while writing
+    uint16_t len;
+    char text[LOG_LINE];
+} log_line_t;
+
+typedef struct {
+    int fd;
+    uint32_t seq;           // sequence of the next line to send
+    uint32_t drops;
+    int64_t alive;          // timestamp in us of last sent data
+    size_t off, len;        // pending data in buf
+    char buf[2 * LOG_LINE];
+} log_client_t;
+
+static struct {
+    uint32_t head;          // sequence of the next line to write
+    log_line_t *lines;
+    vprintf_like_t vprintf; // original log output
+    bool flush;             // logs_flush is queued
+    uint8_t num;
+    void *timer;
+    log_client_t clients[LOG_CLIENTS];
+} logs;
+
+// Lines that fit in a slot are formatted only once and printed from there
+// unless log output has been redirected before logs_init
+static int logs_vprintf(const char *fmt, va_list ap) {
+    va_list copy;
+    va_copy(copy, ap);
+    uint32_t seq = __atomic_fetch_add(&logs.head, 1, __ATOMIC_RELAXED);
+    log_line_t *line = logs.lines + seq % CONFIG_BASE_HTTP_LOGS;
+    __atomic_store_n(&line->seq, 0, __ATOMIC_RELEASE);
+    int len = vsnprintf(line->text, LOG_LINE, fmt, ap);
+    line->len = CONS(len, 0, LOG_LINE - 1);
+    if (logs.vprintf != vprintf || len < 0 || len >= LOG_LINE) {
+        len = logs.vprintf(fmt, copy);
+    } else if (fputs(line->text, stdout) < 0) {
+        len = -1;
+    }
+    __atomic_store_n(&line->seq, seq + 1, __ATOMIC_RELEASE);
+    va_end(copy);
+    return len;
+}
+
+static void logs_init() {
+    if (logs.lines) return;
+    size_t size = CONFIG_BASE_HTTP_LOGS * sizeof(log_line_t);
+    logs.lines = heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM,
+                                         MALLOC_CAP_DEFAULT);
+    if (!logs.lines) return;
+    memset(logs.lines, 0, size);
+    logs.vprintf = esp_log_set_vprintf(logs_vprintf);
+}
+
+static void logs_detach(log_client_t *client) {
+    if (!client->fd) return;
+    ESP_LOGI(TAG, "Log stream to %s stopped: %" PRIu32 " lines dropped",
+             getaddrname(client->fd, false), client->drops);
+    httpd_sess_trigger_close(server, client->fd);
+    memset(client, 0, sizeof(log_client_t));
+    if (!logs.num || --logs.num) return;
+    TRYNULL(logs.timer, clearTimer);
+}
+
+// format next line in SSE: "data: <line 1>\ndata: <line 2>\n\n". CR would
+// end a line too so it is dropped. Lines of many LF are truncated to buf.
+static bool logs_format(log_client_t *client) {
+    uint32_t head = __atomic_load_n(&logs.head, __ATOMIC_ACQUIRE), drops = 0;
+    if (head - client->seq > CONFIG_BASE_HTTP_LOGS) {
+        drops = head - CONFIG_BASE_HTTP_LOGS - client->seq;
+        client->seq += drops;
+    }
+    while (!drops && client->seq != head) {
+        log_line_t *line = logs.lines + client->seq % CONFIG_BASE_HTTP_LOGS;
+        uint32_t seq = __atomic_load_n(&line->seq, __ATOMIC_ACQUIRE);
+        if (seq != client->seq + 1) {
+            if (!seq || seq < client->seq + 1) return false; // still writing
+            drops++;                                        // overwritten
+            client->seq++;
+            continue;
+        }
+        char *dst = client->buf, *lim = client->buf + sizeof(client->buf) - 2;
+        const char *src = line->text, *end = src + MIN(line->len, LOG_LINE);
+        dst += sprintf(dst, "data: ");
+        for (; src < end && *src; src++) {
+            if (*src == '\r') continue;
+            if (*src != '\n') {
+                if (dst == lim) break;
+                *dst++ = *src;
+            } else if (src + 1 == end || !src[1] || dst + 7 > lim) {
+                break;
+            } else {
+                memcpy(dst, "\ndata: ", 7);
+                dst += 7;
+            }
+        }
+        if (__atomic_load_n(&line->seq, __ATOMIC_ACQUIRE) != seq) {
+            drops++;                                        // overwritten
+            client->seq++;
+            continue;
+        }
+        client->seq++;
+        memcpy(dst, "\n\n", 2);
+        client->len = dst + 2 - client->buf;
+        client->off = 0;
+        return true;
+    }
+    if (!drops) return false;
+    client->drops += drops;
+    client->len = snprintf(client->buf, sizeof(client->buf),
+                           "data: [dropped %" PRIu32 " lines]\n\n", drops);
+    client->off = 0;
+    return true;
+}
+
+// Called in httpd task to send new lines to each client without blocking
+static void logs_flush(void *arg) {
+    int64_t now = esp_timer_get_time();
+    logs.flush = false;
+    ITERP(client, logs.clients) {
+        if (!client->fd) continue;
+        if (client->off == client->len && !logs_format(client) &&
+            now - client->alive > LOG_ALIVE_MS * 1000) {
+            client->len = sprintf(client->buf, ":\n\n");
+            client->off = 0;
+        }
+        while (client->off < client->len) {
+            int ret = httpd_socket_send(
+                server, client->fd, client->buf + client->off,
+                client->len - client->off, MSG_DONTWAIT);
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) break;
+            if (ret <= 0) {
+                logs_detach(client);
+                break;
+            }
+            client->alive = now;
+            if (( client->off += ret ) == client->len) logs_format(client);
+        }
+    }
+    return; NOTUSED(arg);
+}
+
+// Called in esp_timer task when there are clients
+static void logs_poll(void *arg) {
+    if (!logs.flush && !httpd_queue_work(server, logs_flush, NULL))
+        logs.flush = true;
+    return; NOTUSED(arg);
+}
+
+static esp_err_t on_logs(httpd_req_t *req) {
+    CHECK_REQUEST(req);
+    if (!logs.lines) return send_err(req, 500, "Log buffer not available");
+    log_client_t *client = NULL;
+    ITERP(ptr, logs.clients) {
+        if (!ptr->fd) { client = ptr; break; }
+    }
+    if (!client) return send_err(req, 403, "Too many log streams");
+    int fd = httpd_req_to_sockfd(req);
+    const char *resp = "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-store\r\n\r\n";
+    if (socket_send_all(fd, (void *)resp, strlen(resp))) return ESP_FAIL;
+    uint32_t head = __atomic_load_n(&logs.head, __ATOMIC_ACQUIRE);
+    client->fd = fd;
+    client->seq = head - MIN(head, CONFIG_BASE_HTTP_LOGS);  // send history
+    client->alive = esp_timer_get_time();
+    if (!logs.num++) logs.timer = setInterval(LOG_POLL_MS, logs_poll, NULL);
+    ESP_LOGI(TAG, "Log stream to %s started (%d/%d)",
+             getaddrname(fd, false), logs.num, LOG_CLIENTS);
+    return ESP_OK;
+}
+#else
+#   define logs_init()
+#endif // CONFIG_BASE_HTTP_LOGS
+
 #ifdef CONFIG_HTTPD_WS_SUPPORT
+// Send output of command to client as soon as it is printed. The send blocks
+// if the socket is full, which throttles the command instead of buffering.
+static bool websocket_sink(void *arg, const char *buf, size_t len) {
+    return !ws_send(*(int *)arg, HTTPD_WS_TYPE_TEXT, buf, len, -1);
+}
+
 static void handle_websocket_message(void *arg) {
     httpd_ws_frame_t *pkt = arg;
     if (!pkt) return;
     if (pkt->payload) {
         int fd = *(int *)(pkt->payload + pkt->len + 1);
-        char *ret = pkt->payload[0] == '{' ?
-                    console_handle_rpc((char *)pkt->payload) :
-                    console_handle_command((char *)pkt->payload, true, false);
+        size_t len = 0;
+        char *ret = NULL;
+        if (pkt->type == HTTPD_WS_TYPE_BINARY) {            // MessagePack
+            ret = (char *)console_handle_rpc_binary(pkt->payload, pkt->len, &len);
+        } else if (( ret = telemetry_request(fd, (char *)pkt->payload) )) {
+            // subscription updated
+        } else if (pkt->payload[0] == '{' ||                // JSON-RPC
+                   pkt->payload[0] == '[') {
+            ret = console_handle_rpc_stream(
+                (char *)pkt->payload, websocket_sink, &fd);
+        } else {                                            // plain text
+            console_handle_stream((char *)pkt->payload, websocket_sink, &fd);
+        }
         if (ret) {
-            httpd_ws_frame_t rep = {
-                .final = true, .fragmented = false,
-                .type = HTTPD_WS_TYPE_TEXT,
-                .payload = (uint8_t *)ret, .len = strlen(ret)
-            };
-            httpd_ws_send_frame_async(server, fd, &rep);
+            ws_send(fd, pkt->type, ret, len ?: strlen(ret), -1);
             free(ret);
         }
         free(pkt->payload);
@@ -985,7 +2695,9 @@ static esp_err_t on_websocket(httpd_req_t *req) {
     httpd_ws_frame_t *pkt = NULL;
     if (( err = ECALLOC(pkt, 1, sizeof(httpd_ws_frame_t)) ) ||
         ( err = httpd_ws_recv_frame(req, pkt, 0) ) ||
-        ( pkt->type != HTTPD_WS_TYPE_TEXT ) ||
+        ( pkt->type != HTTPD_WS_TYPE_TEXT &&
+          pkt->type != HTTPD_WS_TYPE_BINARY ) ||
+        ( !pkt->len ) ||
         ( pkt->len > (2 * CHUNK_SIZE) || !pkt->final ) ||
         ( err = ECALLOC(pkt->payload, 1, pkt->len + 1 + sizeof(int)) ) ||
         ( err = httpd_ws_recv_frame(req, pkt, pkt->len) )
@@ -994,11 +2706,44 @@ static esp_err_t on_websocket(httpd_req_t *req) {
         TRYFREE(pkt);
         return err;
     }
-    *(int *)(pkt->payload + pkt->len + 1) = httpd_req_to_sockfd(req);
-    return httpd_queue_work(req->handle, handle_websocket_message, pkt);
+    // Commands may block for seconds (e.g. ping), so run them out of httpd
+    int fd = *(int *)(pkt->payload + pkt->len + 1) = httpd_req_to_sockfd(req);
+    if (!worker_queue(handle_websocket_message, pkt)) return ESP_OK;
+    const char *msg = "Too many pending requests";
+    ws_send(fd, HTTPD_WS_TYPE_TEXT, msg, strlen(msg), 10);
+    free(pkt->payload);
+    free(pkt);
+    return ESP_OK;
 }
 #endif
 
+esp_err_t server_command(const char *ctrl) {
+#if CONFIG_BASE_HTTP_CACHE_SIZE > 0
+    if (ctrl && !strcmp(ctrl, "clear")) {
+        cache_invalidate(NULL);
+        return ESP_OK;
+    }
+    if (!ACQUIRE(cache.lock, 1000)) return ESP_ERR_TIMEOUT;
+    uint32_t total = cache.hits + cache.miss;
+    printf("Static file cache: %zu files, %s used of %dKB\n",
+           cache.count, format_size(cache.used), CONFIG_BASE_HTTP_CACHE_SIZE);
+    printf(" - hits  : %" PRIu32 " (%.1f%%)\n"
+           " - misses: %" PRIu32 "\n"
+           " - evicts: %" PRIu32 "\n",
+           cache.hits, total ? 100.0 * cache.hits / total : 0,
+           cache.miss, cache.evicts);
+    if (ctrl && !strcmp(ctrl, "list")) {
+        for (http_cache_t *entry = cache.head; entry; entry = entry->next) {
+            printf("%8s %s\n", format_size(entry->size), entry->path);
+        }
+    }
+    RELEASE(cache.lock);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED; NOTUSED(ctrl);
+#endif
+}
+
 bool rewrite_api(const char *tpl, const char *uri, size_t len) {
     // Rewrite "/api/xxx" to "/xxx"
     if (startswith(uri, "/api/")) { uri += 4; len -= 4; }
@@ -1008,6 +2753,7 @@ bool rewrite_api(const char *tpl, const char *uri, size_t len) {
 void server_initialize() {
     esp_log_level_set("httpd_uri", ESP_LOG_ERROR);
     esp_log_level_set("httpd_txrx", ESP_LOG_ERROR);
+    logs_init();
     server_loop_begin();
 }
 
@@ -1044,10 +2790,19 @@ void server_initialize() {
 #endif // CONFIG_HTTPD_WS_SUPPORT
 
 // Use `httpd_config_t.global_user_ctx` to store authorization info
-// Use `httpd_req_t.sess_ctx` to store `http_param_t *` which is auto released
+// Use `httpd_req_t.sess_ctx` to store `http_arena_t *` which is auto released
 // Use `httpd_req_t.user_ctx` to store `FLAG_XXXs` which is never released
 void server_loop_begin() {
     if (server) return;
+#if CONFIG_BASE_HTTP_CACHE_SIZE > 0
+    if (!cache.lock && ( cache.lock = MUTEX() )) RELEASE(cache.lock);
+#endif
+    bundle_init();
+    worker_init();
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    if (!telemetry.lock && ( telemetry.lock = MUTEX() )) RELEASE(telemetry.lock);
+    ws_init();
+#endif
 
     httpd_uri_t apis[] = {
         // WebSocket APIs
@@ -1057,6 +2812,12 @@ void server_loop_begin() {
         HTTP_API("/exec",   POST,   on_command, FLAG_NEED_AUTH),
         HTTP_API("/media",  GET,    on_media,   FLAG_NEED_AUTH),
         HTTP_API("/media",  POST,   on_media,   FLAG_NEED_AUTH),
+#if CONFIG_BASE_HTTP_LOGS > 0
+        HTTP_API("/logs",   GET,    on_logs,    FLAG_NEED_AUTH),
+#endif
+#ifdef CONFIG_BASE_HTTP_METRICS
+        HTTP_API("/metrics", GET,   on_metrics, NULL),
+#endif
         // AP APIs
         HTTP_API("/edit",   GET,    on_editor,  FLAG_AP_ONLY),
         HTTP_API("/edit",   PUT,    on_editor,  FLAG_AP_ONLY | FLAG_NEED_AUTH),
@@ -1082,6 +2843,12 @@ void server_loop_begin() {
     config.uri_match_fn = rewrite_api;
     config.global_user_ctx = auth_init();
     config.global_user_ctx_free_fn = free;
+    config.close_fn = on_close;
+#ifdef CONFIG_BASE_HTTP_METRICS
+    config.open_fn = metrics_open;
+    metrics.max_open = config.max_open_sockets;
+    ITERP(api, apis) { metrics_route(api); }
+#endif
 
     // Call stack: httpd_start => httpd_thread => httpd_server => select
     // If select rfds:
@@ -1102,7 +2869,11 @@ void server_loop_begin() {
                 break;
             }
         }
+#ifdef CONFIG_BASE_HTTP_METRICS
+        httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, on_unmatched);
+#else
         httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, on_error);
+#endif
     }
 }
 
@@ -1113,5 +2884,6 @@ void server_loop_end() { TRYNULL(server, httpd_stop); }
 void server_initialize() {}
 void server_loop_begin() {}
 void server_loop_end() {}
+esp_err_t server_command(const char *c) { return ESP_ERR_NOT_SUPPORTED; }
 
 #endif // CONFIG_BASE_USE_WEBSERVER
@@ -9,14 +9,40 @@
 #include "filesys.h"            // for filesys_xxx
 #include "network.h"            // for wifi_sta_wait
 
+#include "esp_timer.h"
 #include "esp_ota_ops.h"
+#include "esp_rom_crc.h"
+#include "esp_heap_caps.h"
 #include "esp_partition.h"
 #include "esp_http_client.h"
 #include "esp_image_format.h"
+#include "mbedtls/sha256.h"
 
 #if __has_include("esp_delta_ota.h")
 #   include "esp_delta_ota.h"
 #   define WITH_DELTA
+#   define DELTA_MAGIC  0xFCCDDE10  // see helper.py genpatch
+#   define DELTA_HDR    64          // magic, SHA-256 of base app, reserved
+#endif
+
+#if __has_include("rom/miniz.h")
+#   include "rom/miniz.h"
+#   define WITH_GZIP
+#endif
+
+#define OTA_MAGIC_LEN   4       // bytes to tell patch, gzip and plain image
+
+#if CONFIG_BASE_OTA_BUFFERS > 0
+#   define WITH_PIPELINE
+#   define OTA_BUF_SIZE 8192    // multiple of flash sector size (4KB)
+#endif
+
+#ifdef CONFIG_BASE_OTA_FETCH
+#   define RESUME_STEP  65536   // save fetch progress every 64KB written
+#   define RESUME_RETRY 5       // times to reconnect in one updation
+#   if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+#       define WITH_RESUME      // continue after reboot by esp_ota_resume
+#   endif
 #endif
 
 static const char *TAG = "Update";
@@ -34,8 +60,439 @@ static struct {
     esp_ota_handle_t handle;
     esp_err_t error;
     size_t saved, total;
+    size_t recv;            // length of image or patch received
+    uint8_t magic[OTA_MAGIC_LEN]; // first bytes held until type is known
+    int64_t tbegin, tend;   // timestamp in us
+    int64_t tstall, tflash; // time in us waiting for buffers / writing flash
+    mbedtls_sha256_context sha;
+    uint8_t sha256[32];     // of data written in last updation
+#ifdef WITH_PIPELINE
+    QueueHandle_t filled;   // ota_chunk_t to be written to flash
+    esp_err_t werror;       // set by writer task, see ota_pipeline_error
+    QueueHandle_t empty;    // buffers to be filled
+    SemaphoreHandle_t done; // writer task exited
+    uint8_t *bufs, *fill;
+    size_t flen;            // length of data in fill buffer
+#endif
+#ifdef WITH_DELTA
+    esp_delta_ota_handle_t delta;
+    bool patch;             // data received is a patch
+    size_t dlen;            // length of patch header received
+    uint8_t dhdr[DELTA_HDR];
+#endif
+#ifdef WITH_GZIP
+    struct ota_gzip *gzip;  // decompressing if not NULL
+    int64_t tinfl;          // time in us spent in decompression
+#endif
+#ifdef WITH_RESUME
+    struct ota_resume *resume; // save progress if not NULL
+    mbedtls_sha256_context rsha; // snapshot of sha at roffset
+    size_t roffset;
+    bool rsave;             // snapshot to be saved by receiving task
+#endif
 } ctx;
 
+#ifdef WITH_RESUME
+// Progress of fetching a plain image is saved in NVS at sector boundaries.
+// The digest lets a resumed fetch check data already in target partition.
+typedef struct ota_resume {
+    uint32_t url;           // CRC32 of URL
+    uint32_t addr;          // address of target partition
+    uint32_t offset;        // length of image written
+    uint32_t total;         // length of image
+    uint8_t sha256[32];     // of image[:offset]
+    char etag[64];          // ETag or Last-Modified of image
+} ota_resume_t;
+
+// Get digest of data hashed so far without finishing ctx.sha
+static void ota_resume_digest(uint8_t *digest) {
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_clone(&sha, &ctx.sha);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+}
+
+// Called by ota_flash, which may run in the writer task with a small stack
+static void ota_resume_snapshot() {
+    if (__atomic_load_n(&ctx.rsave, __ATOMIC_ACQUIRE)) return; // not saved
+    mbedtls_sha256_init(&ctx.rsha);
+    mbedtls_sha256_clone(&ctx.rsha, &ctx.sha);
+    ctx.roffset = ctx.saved;
+    __atomic_store_n(&ctx.rsave, true, __ATOMIC_RELEASE);
+}
+
+// Called in receiving task to finish the snapshot and write it to NVS
+static void ota_resume_save() {
+    void *nvs = NULL;
+    if (!__atomic_load_n(&ctx.rsave, __ATOMIC_ACQUIRE)) return;
+    if (ctx.resume) {
+        mbedtls_sha256_finish(&ctx.rsha, ctx.resume->sha256);
+        ctx.resume->offset = ctx.roffset;
+    }
+    mbedtls_sha256_free(&ctx.rsha);
+    if (ctx.resume && !config_nvs_open(&nvs, "ota", false)) {
+        config_nvs_write(nvs, "resume", ctx.resume, sizeof(ota_resume_t));
+        config_nvs_close(&nvs);
+    }
+    __atomic_store_n(&ctx.rsave, false, __ATOMIC_RELEASE);
+}
+
+static void ota_resume_clear() {
+    void *nvs = NULL;
+    if (ctx.rsave) {        // writer task has exited
+        mbedtls_sha256_free(&ctx.rsha);
+        ctx.rsave = false;
+    }
+    if (config_nvs_open(&nvs, "ota", false)) return;
+    config_nvs_delete(nvs, "resume");
+    config_nvs_close(&nvs);
+}
+#else
+#   define ota_resume_save()
+#endif // WITH_RESUME
+
+// Write to flash and update SHA-256 in the same pass
+static esp_err_t ota_flash(void *data, size_t size) {
+    int64_t ts = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(ctx.handle, data, size);
+    if (err) {
+        ESP_LOGE(TAG, "OTA write error: %s", esp_err_to_name(err));
+        return err;
+    }
+    ctx.tflash += esp_timer_get_time() - ts;
+    mbedtls_sha256_update(&ctx.sha, data, size);
+    ctx.saved += size;
+#ifdef WITH_RESUME
+    if (ctx.resume && !(ctx.saved & 0xFFF) &&   // sector aligned
+        ctx.saved / RESUME_STEP != (ctx.saved - size) / RESUME_STEP
+    ) {
+        ota_resume_snapshot();
+    }
+#endif
+    fprintf(stderr, "\rProgress: %4zu / %4zu KB %3zu%%",
+            ctx.saved / 1024, ctx.total / 1024,
+            100 * ctx.saved / (ctx.total ?: 1));
+    fflush(stderr);
+    return ESP_OK;
+}
+
+#ifdef WITH_PIPELINE
+// Network receive and flash write are overlapped: caller of
+// ota_updation_write fills buffers while writer task drains them.
+// Each write covers whole sectors so that they are erased only once.
+typedef struct {
+    uint8_t *buf;
+    size_t len;             // zero to stop writer task
+} ota_chunk_t;
+
+static void ota_writer_task(void *arg) {
+    ota_chunk_t chunk;
+    esp_err_t err = ESP_OK;
+    while (xQueueReceive(ctx.filled, &chunk, portMAX_DELAY) && chunk.len) {
+        if (!err && ( err = ota_flash(chunk.buf, chunk.len) ))
+            __atomic_store_n(&ctx.werror, err, __ATOMIC_RELEASE);
+        xQueueSend(ctx.empty, &chunk.buf, 0);
+    }
+    xSemaphoreGive(ctx.done);
+    vTaskDelete(NULL); NOTUSED(arg);
+}
+
+// ctx.error is only written by receiving task, which takes error of
+// writer task here
+static esp_err_t ota_pipeline_error() {
+    if (!ctx.error) ctx.error = __atomic_load_n(&ctx.werror, __ATOMIC_ACQUIRE);
+    return ctx.error;
+}
+
+static void ota_pipeline_submit() {
+    ota_chunk_t chunk = { ctx.fill, ctx.flen };
+    xQueueSend(ctx.filled, &chunk, portMAX_DELAY);
+    ctx.fill = NULL;
+    ctx.flen = 0;
+}
+
+static bool ota_pipeline_start() {
+    if (!ctx.filled) ctx.filled = xQueueCreate(
+        CONFIG_BASE_OTA_BUFFERS + 1, sizeof(ota_chunk_t));
+    if (!ctx.empty) ctx.empty = xQueueCreate(
+        CONFIG_BASE_OTA_BUFFERS, sizeof(uint8_t *));
+    if (!ctx.done) ctx.done = xSemaphoreCreateBinary();
+    if (!ctx.filled || !ctx.empty || !ctx.done) return false;
+    ctx.bufs = heap_caps_malloc(CONFIG_BASE_OTA_BUFFERS * OTA_BUF_SIZE,
+                                MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ctx.bufs) return false;
+    xQueueReset(ctx.filled);
+    xQueueReset(ctx.empty);
+    ctx.werror = ESP_OK;
+    LOOPN(i, CONFIG_BASE_OTA_BUFFERS) {
+        uint8_t *buf = ctx.bufs + i * OTA_BUF_SIZE;
+        xQueueSend(ctx.empty, &buf, 0);
+    }
+    if (xTaskCreate(ota_writer_task, "ota_writer", 4096, NULL,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        TRYFREE(ctx.bufs);
+        return false;
+    }
+    return true;
+}
+
+// Write pending data (if not discarded) and wait for writer task to exit
+static void ota_pipeline_stop(bool discard) {
+    if (!ctx.bufs) return;
+    if (discard || ctx.error) ctx.flen = 0;
+    if (ctx.flen) ota_pipeline_submit();
+    ota_pipeline_submit(); // stop writer task
+    xSemaphoreTake(ctx.done, portMAX_DELAY);
+    ota_pipeline_error();
+    ctx.fill = NULL;
+    TRYFREE(ctx.bufs);
+}
+#else
+#   define ota_pipeline_start() false
+#   define ota_pipeline_stop(d)
+#endif // WITH_PIPELINE
+
+static bool ota_image_write(const void *data, size_t size) {
+#ifdef WITH_PIPELINE
+    while (ctx.bufs && size && !ota_pipeline_error()) {
+        if (!ctx.fill) {
+            int64_t ts = esp_timer_get_time();
+            xQueueReceive(ctx.empty, &ctx.fill, portMAX_DELAY);
+            ctx.tstall += esp_timer_get_time() - ts;
+        }
+        size_t len = MIN(size, OTA_BUF_SIZE - ctx.flen);
+        memcpy(ctx.fill + ctx.flen, data, len);
+        data += len;
+        size -= len;
+        if (( ctx.flen += len ) == OTA_BUF_SIZE) ota_pipeline_submit();
+    }
+#endif
+    if (size && !ctx.error) ctx.error = ota_flash((void *)data, size);
+    return ctx.error == ESP_OK;
+}
+
+static UNUSED bool ota_is_patch(const void *data, size_t size) {
+#ifdef WITH_DELTA
+    uint32_t magic;
+    if (size < sizeof(magic)) return false;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == DELTA_MAGIC;
+#else
+    return false; NOTUSED(data); NOTUSED(size);
+#endif
+}
+
+static UNUSED bool ota_is_gzip(const void *data, size_t size) {
+    return size >= 3 && !memcmp(data, "\x1F\x8B\x08", 3); // deflate only
+}
+
+#ifdef WITH_GZIP
+// Compressed image is inflated on the fly through a 32KB circular window
+// and written by ota_image_write. Optional fields of gzip header are parsed
+// byte by byte so that chunks can be split at any point.
+enum {
+    GZ_HEAD, GZ_XLEN, GZ_EXTRA, GZ_NAME, GZ_COMMENT, GZ_HCRC, GZ_DATA, GZ_TAIL
+};
+
+struct ota_gzip {
+    tinfl_decompressor inflator;
+    tinfl_status status;
+    uint8_t state, flag;    // parse state and FLG byte of header
+    uint16_t skip, xlen;    // bytes parsed in current state
+    uint32_t crc, size;     // of inflated data
+    uint8_t tail[8];        // CRC32 and ISIZE
+    size_t dofs;            // offset of next output in window
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+};
+
+static void ota_gzip_next(struct ota_gzip *gz) {
+    static const uint8_t flags[] = {
+        [GZ_XLEN] = BIT(2), [GZ_NAME] = BIT(3),
+        [GZ_COMMENT] = BIT(4), [GZ_HCRC] = BIT(1),
+    };
+    gz->skip = 0;
+    while (++gz->state < GZ_DATA) {
+        if (gz->flag & flags[gz->state]) return;
+    }
+}
+
+static void ota_gzip_header(struct ota_gzip *gz, uint8_t c) {
+    switch (gz->state) {
+    case GZ_HEAD:
+        if (gz->skip == 3) gz->flag = c;
+        if (++gz->skip == 10) ota_gzip_next(gz);
+        break;
+    case GZ_XLEN:
+        gz->xlen |= c << (8 * gz->skip);
+        if (++gz->skip < 2) break;
+        gz->state = GZ_EXTRA;
+        gz->skip = 0;
+        if (!gz->xlen) ota_gzip_next(gz);
+        break;
+    case GZ_EXTRA:
+        if (++gz->skip == gz->xlen) ota_gzip_next(gz);
+        break;
+    case GZ_NAME: case GZ_COMMENT:
+        if (!c) ota_gzip_next(gz);
+        break;
+    case GZ_HCRC:
+        if (++gz->skip == 2) ota_gzip_next(gz);
+        break;
+    }
+}
+
+static bool ota_gzip_begin() {
+    struct ota_gzip *gz = heap_caps_malloc_prefer(
+        sizeof(struct ota_gzip), 2, MALLOC_CAP_INTERNAL, MALLOC_CAP_DEFAULT);
+    if (!gz) {
+        ctx.error = ESP_ERR_NO_MEM;
+        return false;
+    }
+    memset(gz, 0, offsetof(struct ota_gzip, dict));
+    tinfl_init(&gz->inflator);
+    gz->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    ctx.gzip = gz;
+    ctx.tinfl = 0;
+    return true;
+}
+
+static bool ota_gzip_feed(const uint8_t *data, size_t size) {
+    struct ota_gzip *gz = ctx.gzip;
+    while (gz->state < GZ_DATA && size) {
+        ota_gzip_header(gz, *data++);
+        size--;
+    }
+    while (gz->state == GZ_DATA && !ctx.error) {
+        if (!size && gz->status != TINFL_STATUS_HAS_MORE_OUTPUT) break;
+        size_t ilen = size, olen = TINFL_LZ_DICT_SIZE - gz->dofs;
+        uint8_t *out = gz->dict + gz->dofs;
+        int64_t ts = esp_timer_get_time();
+        gz->status = tinfl_decompress(
+            &gz->inflator, data, &ilen, gz->dict, out, &olen,
+            TINFL_FLAG_HAS_MORE_INPUT);
+        ctx.tinfl += esp_timer_get_time() - ts;
+        data += ilen;
+        size -= ilen;
+        if (olen) {
+            gz->crc = esp_rom_crc32_le(gz->crc, out, olen);
+            gz->size += olen;
+            gz->dofs = (gz->dofs + olen) & (TINFL_LZ_DICT_SIZE - 1);
+            if (!ota_image_write(out, olen)) break;
+        }
+        if (gz->status == TINFL_STATUS_DONE) {
+            gz->state = GZ_TAIL;
+        } else if (gz->status < 0) {
+            ESP_LOGE(TAG, "OTA inflate error: %d", gz->status);
+            ctx.error = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    if (gz->state == GZ_TAIL && size) {
+        size_t len = MIN(size, sizeof(gz->tail) - gz->skip);
+        memcpy(gz->tail + gz->skip, data, len);
+        gz->skip += len; // data after the first member is ignored
+    }
+    return ctx.error == ESP_OK;
+}
+
+static void ota_gzip_end() {
+    struct ota_gzip *gz = ctx.gzip;
+    uint32_t crc, size;
+    if (!gz) return;
+    memcpy(&crc, gz->tail, sizeof(crc));
+    memcpy(&size, gz->tail + 4, sizeof(size));
+    if (ctx.error) {
+        // keep the original error
+    } else if (gz->state != GZ_TAIL || gz->skip != sizeof(gz->tail)) {
+        ESP_LOGE(TAG, "OTA inflate error: incomplete data");
+        ctx.error = ESP_ERR_INVALID_SIZE;
+    } else if (crc != gz->crc) {
+        ESP_LOGE(TAG, "OTA inflate error: CRC 0x%08" PRIX32 " != 0x%08" PRIX32,
+                 gz->crc, crc);
+        ctx.error = ESP_ERR_INVALID_CRC;
+    } else if (size != gz->size) {
+        ESP_LOGE(TAG, "OTA inflate error: ISIZE %" PRIu32 " != %" PRIu32,
+                 gz->size, size);
+        ctx.error = ESP_ERR_INVALID_CRC;
+    }
+    TRYFREE(ctx.gzip);
+}
+#else
+#   define ota_gzip_end()
+#endif // WITH_GZIP
+
+#ifdef WITH_DELTA
+// Patch is applied as a stream: old firmware is read from running partition
+// and new firmware is written to target partition through ota_image_write.
+static esp_err_t ota_delta_read(uint8_t *buf, size_t size, int offset) {
+    return esp_partition_read(ctx.running, offset, buf, size);
+}
+
+static esp_err_t ota_delta_write(const uint8_t *buf, size_t size) {
+    return ota_image_write(buf, size) ? ESP_OK : ctx.error;
+}
+
+static bool ota_delta_begin() {
+    uint8_t digest[32];
+    if (( ctx.error = esp_partition_get_sha256(ctx.running, digest) )) {
+        ESP_LOGE(TAG, "Could not hash running app: %s", ota_updation_error());
+        return false;
+    }
+    if (memcmp(digest, ctx.dhdr + 4, sizeof(digest))) {
+        ESP_LOGE(TAG, "Patch is based on %s.. not the running app",
+                 format_sha256(ctx.dhdr + 4, 8));
+        ctx.error = ESP_ERR_INVALID_VERSION;
+        return false;
+    }
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = ota_delta_read,
+        .write_cb = ota_delta_write,
+    };
+    if (!( ctx.delta = esp_delta_ota_init(&cfg) )) {
+        ctx.error = ESP_ERR_NO_MEM;
+        return false;
+    }
+    ESP_LOGI(TAG, "Applying patch to running app %s..", format_sha256(digest, 8));
+    return true;
+}
+
+static bool ota_delta_feed(const uint8_t *data, size_t size) {
+    if (ctx.dlen < DELTA_HDR) {
+        size_t len = MIN(size, DELTA_HDR - ctx.dlen);
+        memcpy(ctx.dhdr + ctx.dlen, data, len);
+        data += len;
+        size -= len;
+        if (( ctx.dlen += len ) < DELTA_HDR) return true;
+        if (!ota_delta_begin()) return false;
+    }
+    esp_err_t err = size ? esp_delta_ota_feed_patch(ctx.delta, data, size) : 0;
+    if (err && !ctx.error) {
+        ctx.error = err;
+        ESP_LOGE(TAG, "OTA patch error: %s", ota_updation_error());
+    }
+    return ctx.error == ESP_OK;
+}
+
+static void ota_delta_end() {
+    esp_err_t err = ESP_OK;
+    if (!ctx.patch) return;
+    if (ctx.delta) {
+        err = esp_delta_ota_finalize(ctx.delta);
+    } else {
+        err = ESP_ERR_INVALID_SIZE; // incomplete patch header
+    }
+    if (err && !ctx.error) {
+        ctx.error = err;
+        ESP_LOGE(TAG, "OTA patch error: %s", ota_updation_error());
+    }
+    TRYNULL(ctx.delta, esp_delta_ota_deinit);
+    ctx.patch = false;
+    ctx.dlen = 0;
+}
+#else
+#   define ota_delta_end()
+#endif // WITH_DELTA
+
 void update_initialize() {
     const esp_partition_t
         *running = esp_ota_get_running_partition(),
@@ -79,9 +536,21 @@ void update_initialize() {
 }
 
 void ota_updation_reset() {
+    if (ctx.handle) {
+        ota_pipeline_stop(true);
+        esp_ota_abort(ctx.handle);
+    }
+#ifdef WITH_DELTA
+    TRYNULL(ctx.delta, esp_delta_ota_deinit);
+    ctx.patch = false;
+    ctx.dlen = 0;
+#endif
+#ifdef WITH_GZIP
+    TRYFREE(ctx.gzip);
+#endif
     ctx.handle = 0;
     ctx.error = ESP_OK;
-    ctx.saved = 0;
+    ctx.saved = ctx.recv = 0;
     ctx.total = ctx.target ? ctx.target->size : OTA_SIZE_UNKNOWN;
 }
 
@@ -112,33 +581,112 @@ bool ota_updation_begin(size_t size) {
             ctx.total = size;
         }
     }
+    // Erase sectors in writer task as data arrives instead of all at once
+    bool pipe = ota_pipeline_start();
+    if (pipe) size = OTA_WITH_SEQUENTIAL_WRITES;
     if (( ctx.error = esp_ota_begin(ctx.target, size, &ctx.handle) )) {
+        if (pipe) ota_pipeline_stop(true);
         ctx.handle = 0;
         ESP_LOGE(TAG, "OTA init error: %s", ota_updation_error());
         return false;
     }
+    mbedtls_sha256_init(&ctx.sha);
+    mbedtls_sha256_starts(&ctx.sha, 0);
+    ctx.tstall = ctx.tflash = 0;
+    ctx.tbegin = esp_timer_get_time();
+    ctx.tend = 0;
     return true;
 }
 
-bool ota_updation_write(void *data, size_t size) {
-    if (!ctx.handle || ctx.error) return false;
-    ctx.error = esp_ota_write(ctx.handle, data, size);
+#ifdef WITH_RESUME
+// Continue an interrupted fetch after data in target partition is verified
+static bool ota_resume_begin(const ota_resume_t *rec) {
+    uint8_t digest[32], *buf = NULL;
+    if (!ctx.target || ctx.handle || EMALLOC(buf, 4096)) return false;
+    ota_updation_reset();
+    mbedtls_sha256_init(&ctx.sha);
+    mbedtls_sha256_starts(&ctx.sha, 0);
+    for (size_t off = 0, len; off < rec->offset && !ctx.error; off += len) {
+        len = MIN(rec->offset - off, 4096);
+        if (!( ctx.error = esp_partition_read(ctx.target, off, buf, len) ))
+            mbedtls_sha256_update(&ctx.sha, buf, len);
+    }
+    TRYFREE(buf);
+    ota_resume_digest(digest);
+    if (!ctx.error && memcmp(digest, rec->sha256, sizeof(digest)))
+        ctx.error = ESP_ERR_INVALID_CRC;
+    if (!ctx.error && !ota_pipeline_start()) ESP_LOGD(TAG, "Write inline");
+    if (!ctx.error) ctx.error = esp_ota_resume(
+        ctx.target, OTA_WITH_SEQUENTIAL_WRITES, rec->offset, &ctx.handle);
     if (ctx.error) {
-        ESP_LOGE(TAG, "OTA write error: %s", ota_updation_error());
+        ota_pipeline_stop(true);
+        mbedtls_sha256_free(&ctx.sha);
+        ctx.handle = 0;
+        ESP_LOGW(TAG, "OTA resume error: %s", ota_updation_error());
         return false;
     }
-    ctx.saved += size;
-    fprintf(stderr, "\rProgress: %4d / %4d KB %3d%%",
-            ctx.saved / 1024, ctx.total / 1024,
-            100 * ctx.saved / (ctx.total ?: 1));
-    fflush(stderr);
+    ctx.saved = ctx.recv = rec->offset;
+    ctx.total = rec->total;
+    ctx.tstall = ctx.tflash = 0;
+    ctx.tbegin = esp_timer_get_time();
+    ctx.tend = 0;
+    ESP_LOGI(TAG, "OTA resumed from %s", format_size(rec->offset));
     return true;
 }
+#endif
+
+static bool ota_updation_feed(const void *data, size_t size) {
+#ifdef WITH_GZIP
+    if (ctx.gzip) return ota_gzip_feed(data, size);
+#endif
+#ifdef WITH_DELTA
+    if (ctx.patch) return ota_delta_feed(data, size);
+#endif
+    return ota_image_write(data, size);
+}
+
+// Tell the type of data by magic of the first `size` bytes and feed them
+static bool ota_updation_magic(size_t size) {
+#ifdef WITH_GZIP
+    if (ota_is_gzip(ctx.magic, size) && !ota_gzip_begin()) return false;
+#endif
+#ifdef WITH_DELTA
+    ctx.patch = ota_is_patch(ctx.magic, size);
+#endif
+    return ota_updation_feed(ctx.magic, size);
+}
+
+// Data is a firmware image, a gzip compressed image or a patch. The first
+// OTA_MAGIC_LEN bytes are held until the type is known, however the data
+// is split (a resumed fetch starts after them).
+bool ota_updation_write(void *data, size_t size) {
+    ota_resume_save();
+    if (!ctx.handle || ctx.error) return false;
+    if (ctx.recv < OTA_MAGIC_LEN) {
+        size_t len = MIN(size, OTA_MAGIC_LEN - ctx.recv);
+        memcpy(ctx.magic + ctx.recv, data, len);
+        data += len;
+        size -= len;
+        if (( ctx.recv += len ) < OTA_MAGIC_LEN) return true;
+        if (!ota_updation_magic(OTA_MAGIC_LEN)) return false;
+    }
+    ctx.recv += size;
+    return !size || ota_updation_feed(data, size);
+}
 
 bool ota_updation_end() {
     if (!ctx.handle) return false;
+    if (ctx.recv < OTA_MAGIC_LEN && !ctx.error) ota_updation_magic(ctx.recv);
+    ota_gzip_end();
+    ota_delta_end();
+    ota_pipeline_stop(false);
     fputc('\n', stderr); // enter newline after ota_updation_write progress
-    if (( ctx.error = esp_ota_end(ctx.handle) )) {
+    ctx.tend = esp_timer_get_time();
+    mbedtls_sha256_finish(&ctx.sha, ctx.sha256);
+    mbedtls_sha256_free(&ctx.sha);
+    if (ctx.error) {
+        esp_ota_abort(ctx.handle);
+    } else if (( ctx.error = esp_ota_end(ctx.handle) )) {
         ESP_LOGE(TAG, "OTA end error: %s", ota_updation_error());
     } else if (( ctx.error = esp_ota_set_boot_partition(ctx.target) )) {
         ESP_LOGI(TAG, "Set boot partition to %s error: %s",
@@ -154,6 +702,17 @@ const char * ota_updation_error() {
     return ctx.error != ESP_OK ? esp_err_to_name(ctx.error) : NULL;
 }
 
+#ifdef CONFIG_BASE_OTA_FETCH
+static esp_err_t ota_http_event(esp_http_client_event_t *evt) {
+    char *etag = evt->user_data;
+    if (evt->event_id != HTTP_EVENT_ON_HEADER || !etag) return ESP_OK;
+    if (!strcasecmp(evt->header_key, "ETag") ||
+        (!strcasecmp(evt->header_key, "Last-Modified") && !etag[0]))
+        snprintf(etag, 64, "%s", evt->header_value);
+    return ESP_OK;
+}
+#endif
+
 bool ota_updation_url(const char *url, bool force) {
 #ifndef CONFIG_BASE_OTA_FETCH
     ctx.error = ESP_ERR_NOT_SUPPORTED;
@@ -173,11 +732,34 @@ bool ota_updation_url(const char *url, bool force) {
         esp_app_desc_t app;
     } *ndesc = NULL;
     esp_app_desc_t tdesc, rdesc;
-    char buf[CDIV(sizeof(*ndesc), 256)], *cert = NULL;
+    char buf[CDIV(sizeof(*ndesc), 256) * 512], *cert = NULL;
+    char etag[64] = { 0 }, range[32];
+    int retry = 0, status;
+    int64_t clen;
+    esp_err_t err;
+    size_t offset = 0;      // request image from this offset
+#   ifdef WITH_RESUME
+    ota_resume_t rec;
+    void *nvs = NULL;
+    if (!config_nvs_open(&nvs, "ota", true)) {
+        if (config_nvs_read(nvs, "resume", &rec, sizeof(rec)) != sizeof(rec) ||
+            rec.url != esp_rom_crc32_le(0, (uint8_t *)url, strlen(url)) ||
+            rec.addr != ctx.target->address || rec.offset >= rec.total
+        ) {
+            rec.offset = 0;
+        }
+        config_nvs_close(&nvs);
+    } else {
+        rec.offset = 0;
+    }
+    if (( offset = rec.offset )) snprintf(etag, sizeof(etag), "%s", rec.etag);
+#   endif
     esp_http_client_config_t config = {
         .url = url,
         .timeout_ms = 2000,
         .keep_alive_enable = true,
+        .event_handler = ota_http_event,
+        .user_data = etag,
     };
 #   ifdef CONFIG_BASE_USE_FFS
     const char *fullpath = fjoin(2, Config.sys.DIR_DATA, "server.pem");
@@ -193,30 +775,81 @@ bool ota_updation_url(const char *url, bool force) {
         ctx.error = ESP_FAIL;
         goto http_clean;
     }
-    if (( ctx.error = esp_http_client_open(client, 0) )) goto http_clean;
-    esp_http_client_fetch_headers(client);
+http_open:
+    // Continue from where the connection was lost and make sure that the
+    // image is not changed on server. Ranges are ignored by server if not
+    // supported or If-Range does not match, then status will be 200.
+    if (offset) {
+        snprintf(range, sizeof(range), "bytes=%zu-", offset);
+        esp_http_client_set_header(client, "Range", range);
+        if (etag[0]) esp_http_client_set_header(client, "If-Range", etag);
+    }
+    if (( err = esp_http_client_open(client, 0) )) {
+        ESP_LOGE(TAG, "Firmware download error: %s", esp_err_to_name(err));
+        if (!ctx.handle) ctx.error = err;
+        goto http_retry;
+    }
+    clen = esp_http_client_fetch_headers(client);
+    status = esp_http_client_get_status_code(client);
+    esp_http_client_delete_header(client, "Range");
+    esp_http_client_delete_header(client, "If-Range");
+    if (status == 206 && offset) {
+        ESP_LOGI(TAG, "Continue from %s", format_size(offset));
+#   ifdef WITH_RESUME
+        if (!ctx.handle && ( clen += offset ) != rec.total) {
+            ESP_LOGW(TAG, "Image size changed: %" PRId64, clen);
+        } else if (!ctx.handle && ota_resume_begin(&rec)) {
+            ctx.resume = &rec;
+        }
+#   endif
+        if (!ctx.handle) {
+            esp_http_client_close(client);
+            offset = 0;
+            goto http_open;
+        }
+    } else if (status != 200) {
+        ESP_LOGE(TAG, "Firmware download error: status %d", status);
+        ctx.error = ESP_ERR_INVALID_RESPONSE;
+        goto ota_error;
+    } else if (ctx.handle) {
+        ESP_LOGE(TAG, "Firmware changed or range not supported");
+        ctx.error = ESP_ERR_INVALID_STATE;
+        goto ota_error;
+    } else {
+        offset = 0;
+    }
     while (1) {
         int ret = esp_http_client_read(client, buf, sizeof(buf));
+        // magic or app description must be complete in the first buffer
+        for (int len; !ctx.handle && ret > 0 && ret < sizeof(*ndesc);) {
+            if (( len = esp_http_client_read(
+                    client, buf + ret, sizeof(buf) - ret) ) <= 0) break;
+            ret += len;
+        }
         if (ret < 0) {
             ESP_LOGE(TAG, "Firmware download error: %s", esp_err_to_name(-ret));
-            goto ota_error;
+            goto http_retry;
         } else if (ret == 0) {
-            int err = esp_http_client_get_errno(client);
+            err = esp_http_client_get_errno(client);
             if (esp_http_client_is_complete_data_received(client)) {
                 if (ctx.handle) ESP_LOGD(TAG, "Firmware downloaded");
             } else if (err && err != -1) {
                 ESP_LOGE(TAG, "Firmware download error: %d", err);
-                goto ota_error;
+                goto http_retry;
             }
             break;
         }
-        if (!ctx.handle) {
+        if (!ctx.handle && (ota_is_patch(buf, ret) || ota_is_gzip(buf, ret))) {
+            ESP_LOGI(TAG, "Received firmware %s",
+                     ota_is_patch(buf, ret) ? "patch" : "compressed");
+            if (!ota_updation_begin(0)) goto http_clean;
+        } else if (!ctx.handle) {
             if (ret < sizeof(*ndesc)) {
                 ESP_LOGE(TAG, "Received header does not fit length: %d", ret);
                 ctx.error = ESP_ERR_INVALID_SIZE;
                 goto http_clean;
             }
-            ndesc = (typeof(ndesc) *)buf;
+            ndesc = (typeof(ndesc))buf;
             if (ndesc->hdr.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
                 ESP_LOGE(TAG, "Received chip ID does not match: 0x%04X",
                          ndesc->hdr.chip_id);
@@ -241,17 +874,48 @@ bool ota_updation_url(const char *url, bool force) {
                 ctx.error = ESP_ERR_INVALID_STATE;
                 goto http_clean;
             }
-            if (!ota_updation_begin(0)) goto http_clean;
+            if (!ota_updation_begin(clen > 0 ? clen : 0)) goto http_clean;
+#   ifdef WITH_RESUME
+            if (clen > 0) {
+                rec.url = esp_rom_crc32_le(0, (uint8_t *)url, strlen(url));
+                rec.addr = ctx.target->address;
+                rec.total = clen;
+                snprintf(rec.etag, sizeof(rec.etag), "%s", etag);
+                ctx.resume = &rec;
+            }
+#   endif
         }
-        if (!ota_updation_write(buf, rsize)) goto ota_error;
+        if (!ota_updation_write(buf, ret)) goto ota_error;
+    }
+    if (ota_updation_end()) {
+#   ifdef WITH_RESUME
+        if (ctx.resume) ota_resume_clear();
+#   endif
     }
-    ota_updation_end();
     goto http_clean;
 
+http_retry:
+    // Data received so far (and the state of decompression) is kept in
+    // RAM, so a broken connection only needs to request the rest of image
+    if (ctx.handle && retry++ < RESUME_RETRY) {
+        esp_http_client_close(client);
+        ESP_LOGW(TAG, "Reconnect %d/%d", retry, RESUME_RETRY);
+        msleep(1000 * retry);
+        offset = ctx.recv;
+        goto http_open;
+    }
 ota_error:
     if (!ctx.error) ctx.error = ESP_FAIL;
-    if (ctx.handle) esp_ota_abort(ctx.handle);
+    if (ctx.handle) {
+        ota_pipeline_stop(true);
+        esp_ota_abort(ctx.handle);
+        ctx.handle = 0;
+    }
 http_clean:
+#   ifdef WITH_RESUME
+    ota_resume_save();
+    ctx.resume = NULL;      // progress in NVS is kept for next boot
+#   endif
     TRYFREE(cert);
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
@@ -307,4 +971,19 @@ void ota_updation_info() {
                desc.version, desc.date, desc.time);
     }
     esp_partition_iterator_release(iter);
+    if (!ctx.tend) return;
+    int64_t usec = MAX(ctx.tend - ctx.tbegin, 1);
+    printf("Last updation: %s in %.1fs (%.1f KB/s), "
+           "stall %" PRId64 " ms, flash %" PRId64 " ms\n",
+           format_size(ctx.saved), usec / 1e6, ctx.saved * 1e3 / 1024 / usec,
+           ctx.tstall / 1000, ctx.tflash / 1000);
+    if (ctx.recv != ctx.saved)
+        printf("Received: %s (%.1f%%)\n",
+               format_size(ctx.recv), 100.0 * ctx.recv / (ctx.saved ?: 1));
+#ifdef WITH_GZIP
+    if (ctx.tinfl)
+        printf("Inflated: %" PRId64 " ms (%.1f KB/s)\n", ctx.tinfl / 1000,
+               ctx.saved * 1e3 / 1024 / ctx.tinfl);
+#endif
+    printf("SHA256: %s\n", format_sha256(ctx.sha256, sizeof(ctx.sha256)));
 }
@@ -229,7 +229,7 @@ void hexdumpl(const void *src, size_t bytes, size_t maxlen) {
     size_t maxbytes = maxlen / 3, count = MIN(bytes, maxbytes);
     LOOPN(i, count) { printf("%02X ", ((uint8_t *)src)[i]); }
     if (bytes && maxbytes && bytes > maxbytes)
-        printf("... [%u/%u]", count, bytes);
+        printf("... [%zu/%zu]", count, bytes);
     putchar('\n');
 }
 
@@ -254,7 +254,7 @@ char * hexdumps(const void *src, char *dst, size_t bytes, size_t maxlen) {
         offset -= numdigits(count);
         if (offset > (count * 2))
             memset(dst + count * 2, ' ', offset - count * 2);
-        sprintf(dst + offset, " ... [%u/%u]", count, bytes);
+        sprintf(dst + offset, " ... [%zu/%zu]", count, bytes);
     } else {
         dst[count * 2] = '\0';
     }
@@ -440,6 +440,92 @@ const char * format_time(double secs) {
     return buf;
 }
 
+static void jsonw_escape(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (uint8_t c; ( c = *str++ ); ) {
+        switch (c) {
+        case '"':  fputs("\\\"", fp); break;
+        case '\\': fputs("\\\\", fp); break;
+        case '\n': fputs("\\n", fp); break;
+        case '\r': fputs("\\r", fp); break;
+        case '\t': fputs("\\t", fp); break;
+        default:
+            if (c < 0x20) {
+                fprintf(fp, "\\u%04x", c);
+            } else {
+                fputc(c, fp);
+            }
+        }
+    }
+    fputc('"', fp);
+}
+
+// write separator and key (if inside an object) before a value
+static void jsonw_key(jsonw_t *jw, const char *key) {
+    uint32_t bit = BIT(jw->depth);
+    if (jw->items & bit) fputc(',', jw->fp);
+    jw->items |= bit;
+    if (!jw->depth || (jw->array & bit)) return;
+    jsonw_escape(jw->fp, key ?: "");
+    fputc(':', jw->fp);
+}
+
+void jsonw_open(jsonw_t *jw, const char *key, bool array) {
+    if (!jw || jw->depth >= 31) return;
+    jsonw_key(jw, key);
+    fputc(array ? '[' : '{', jw->fp);
+    uint32_t bit = BIT(++jw->depth);
+    jw->items &= ~bit;
+    if (array) {
+        jw->array |= bit;
+    } else {
+        jw->array &= ~bit;
+    }
+}
+
+void jsonw_close(jsonw_t *jw) {
+    if (!jw || !jw->depth) return;
+    fputc(jw->array & BIT(jw->depth--) ? ']' : '}', jw->fp);
+}
+
+void jsonw_null(jsonw_t *jw, const char *key) {
+    if (!jw) return;
+    jsonw_key(jw, key);
+    fputs("null", jw->fp);
+}
+
+void jsonw_bool(jsonw_t *jw, const char *key, bool val) {
+    if (!jw) return;
+    jsonw_key(jw, key);
+    fputs(val ? "true" : "false", jw->fp);
+}
+
+void jsonw_int(jsonw_t *jw, const char *key, int64_t val) {
+    if (!jw) return;
+    jsonw_key(jw, key);
+    fprintf(jw->fp, "%" PRId64, val);
+}
+
+void jsonw_num(jsonw_t *jw, const char *key, double val) {
+    if (!jw) return;
+    jsonw_key(jw, key);
+    if (isnan(val) || isinf(val)) {
+        fputs("null", jw->fp);
+    } else {
+        fprintf(jw->fp, "%.9g", val);
+    }
+}
+
+void jsonw_str(jsonw_t *jw, const char *key, const char *val) {
+    if (!jw) return;
+    jsonw_key(jw, key);
+    if (val) {
+        jsonw_escape(jw->fp, val);
+    } else {
+        fputs("null", jw->fp);
+    }
+}
+
 static void * createTimer(int64_t us, void (*func)(void *), void *arg) {
     esp_timer_handle_t hdl = NULL;
     const esp_timer_create_args_t args = { .callback = func, .arg = arg };
@@ -495,7 +581,7 @@ bool notify_wait_for(uint32_t target, uint32_t tout_ms, uint32_t wait_ms) {
 #define TASK_TOTAL  31
 static uint32_t task_hist[TASK_TOTAL + 1];
 
-static bool task_compare(tsort_t sort, TaskStatus_t *a, TaskStatus_t *b) {
+static UNUSED bool task_compare(tsort_t sort, TaskStatus_t *a, TaskStatus_t *b) {
     int aid = a->xCoreID > 1 ? -1 : a->xCoreID;
     int bid = b->xCoreID > 1 ? -1 : b->xCoreID;
     int rst = strcmp(a->pcTaskName, b->pcTaskName);
@@ -514,7 +600,7 @@ static bool task_compare(tsort_t sort, TaskStatus_t *a, TaskStatus_t *b) {
     }
 }
 
-void task_info(tsort_t sort) {
+void task_info(tsort_t sort, jsonw_t *jw) {
 #ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
     uint32_t total = 0, curr = xTaskGetTickCount(), dt;
     uint16_t num = uxTaskGetNumberOfTasks();
@@ -534,26 +620,52 @@ void task_info(tsort_t sort) {
         if (task_compare(sort, tasks + i, tasks + j)) continue;
         tmp = tasks[i]; tasks[i] = tasks[j]; tasks[j] = tmp;
     } }
-    printf("S ID CPU Pri Name            StackHW Used %s\n",
-            format_time(pdTICKS_TO_MS(curr - task_hist[TASK_TIME]) / 1e3));
+    if (jw) {
+        jsonw_open(jw, NULL, true);
+    } else {
+        printf("S ID CPU Pri Name            StackHW Used %s\n",
+               format_time(pdTICKS_TO_MS(curr - task_hist[TASK_TIME]) / 1e3));
+    }
     LOOPN(i, num) {
+        TaskStatus_t *task = tasks + i;
+        int cpu = task->xCoreID > 1 ? -1 : task->xCoreID;
+        float used = 1e2 * task->ulRunTimeCounter / total, usage = -1;
+        if (task->xTaskNumber <= TASK_MAXID) {
+            dt = task->ulRunTimeCounter - task_hist[task->xTaskNumber];
+            task_hist[task->xTaskNumber] = task->ulRunTimeCounter;
+            usage = 1e2 * dt / (total - task_hist[TASK_TOTAL]);
+        }
+        if (jw) {
+            jsonw_open(jw, NULL, false);
+            jsonw_str(jw, "state", (char []){ "*RBSD"[task->eCurrentState], 0 });
+            jsonw_int(jw, "id", task->xTaskNumber);
+            jsonw_int(jw, "cpu", cpu);
+            jsonw_int(jw, "pri", task->uxCurrentPriority);
+            jsonw_str(jw, "name", task->pcTaskName);
+            jsonw_int(jw, "stack", task->usStackHighWaterMark);
+            jsonw_num(jw, "used", used);
+            if (usage < 0) {
+                jsonw_null(jw, "usage");
+            } else {
+                jsonw_num(jw, "usage", usage);
+            }
+            jsonw_close(jw);
+            continue;
+        }
         printf(
             "%c %-2d %3d %3d %-15s %7s %3.0f%% ",
             // Current Ready Blocked Suspended Deleted
-            "*RBSD"[tasks[i].eCurrentState], tasks[i].xTaskNumber,
-            tasks[i].xCoreID > 1 ? -1 : tasks[i].xCoreID,
-            tasks[i].uxCurrentPriority, tasks[i].pcTaskName,
-            format_size(tasks[i].usStackHighWaterMark),
-            1e2 * tasks[i].ulRunTimeCounter / total
+            "*RBSD"[task->eCurrentState], task->xTaskNumber, cpu,
+            task->uxCurrentPriority, task->pcTaskName,
+            format_size(task->usStackHighWaterMark), used
         );
-        if (tasks[i].xTaskNumber > TASK_MAXID) {
+        if (usage < 0) {
             putchar('\n');
         } else {
-            dt = tasks[i].ulRunTimeCounter - task_hist[tasks[i].xTaskNumber];
-            task_hist[tasks[i].xTaskNumber] = tasks[i].ulRunTimeCounter;
-            printf("%5.0f%%\n", 1e2 * dt / (total - task_hist[TASK_TOTAL]));
+            printf("%5.0f%%\n", usage);
         }
     }
+    jsonw_close(jw);
     task_hist[TASK_TIME] = curr;
     task_hist[TASK_TOTAL] = total;
 exit:
@@ -561,7 +673,7 @@ exit:
 #else
     puts("Unsupported command! Enable `CONFIG_FREERTOS_USE_TRACE_FACILITY` "
          "in menuconfig/sdkconfig to run this command");
-    NOTUSED(sort_attr);
+    NOTUSED(sort); NOTUSED(jw);
 #endif
 }
 
@@ -576,7 +688,7 @@ void version_info() {
     );
 }
 
-void memory_info() {
+void memory_info(jsonw_t *jw) {
     const uint32_t caps[] = {
         MALLOC_CAP_DEFAULT, MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM,
         MALLOC_CAP_DMA, MALLOC_CAP_EXEC
@@ -585,19 +697,35 @@ void memory_info() {
         "DEFAULT", "INTERN", "SPI RAM", "DMA", "EXEC"
     };
     multi_heap_info_t info;
-    printf("%-7s %8s %8s %4s %4s %s\n",
-           "Type", "Total", "Avail", "Used", "Frag", "Caps");
+    if (jw) {
+        jsonw_open(jw, NULL, true);
+    } else {
+        printf("%-7s %8s %8s %4s %4s %s\n",
+               "Type", "Total", "Avail", "Used", "Frag", "Caps");
+    }
     LOOPN(i, LEN(caps)) {
         heap_caps_get_info(&info, caps[i]);
         size_t tfree = info.total_free_bytes;
         size_t tfrag = tfree - info.largest_free_block;
         size_t total = tfree + info.total_allocated_bytes;
+        if (jw) {
+            jsonw_open(jw, NULL, false);
+            jsonw_str(jw, "type", names[i]);
+            jsonw_int(jw, "total", total);
+            jsonw_int(jw, "free", tfree);
+            jsonw_int(jw, "largest", info.largest_free_block);
+            jsonw_int(jw, "minimum", info.minimum_free_bytes);
+            jsonw_int(jw, "caps", caps[i]);
+            jsonw_close(jw);
+            continue;
+        }
         printf("%-7s %8s ", names[i], format_size(total));
         printf("%8s ", format_size(tfree));
-        printf("%3d%% ", total ? 100 * info.total_allocated_bytes / total : 0);
-        printf("%3d%% ", tfree ? 100 * tfrag / tfree : 0);
-        printf("0x%08" PRIu32 "\n", caps[i]);
+        printf("%3zu%% ", total ? 100 * info.total_allocated_bytes / total : 0);
+        printf("%3zu%% ", tfree ? 100 * tfrag / tfree : 0);
+        printf("0x%08" PRIx32 "\n", caps[i]);
     }
+    jsonw_close(jw);
 }
 
 static const char * chip_model_str(esp_chip_model_t model) {
@@ -747,7 +875,7 @@ static uint8_t partition_used(const esp_partition_t *part) {
     return 0;
 }
 
-void partition_info() {
+void partition_info(jsonw_t *jw) {
     uint8_t num = 0;
     const esp_partition_t * parts[16], *part, *tmp;
     esp_partition_iterator_t iter = esp_partition_find(
@@ -763,11 +891,15 @@ void partition_info() {
         iter = esp_partition_next(iter);
     }
     esp_partition_iterator_release(iter);
-    if (!num) {
+    if (!num && !jw) {
         printf("No partitons found in flash. Skip");
         return;
     }
-    printf("Label        Type SubType   Offset   Size     Used Secure\n");
+    if (jw) {
+        jsonw_open(jw, NULL, true);
+    } else {
+        printf("Label        Type SubType   Offset   Size     Used Secure\n");
+    }
     while (num--) {
         part = parts[num];
         esp_partition_subtype_t subtype = part->subtype;
@@ -780,10 +912,23 @@ void partition_info() {
 #   endif
         }
 #endif
+        if (jw) {
+            jsonw_open(jw, NULL, false);
+            jsonw_str(jw, "label", part->label);
+            jsonw_str(jw, "type", partition_type_str(part->type));
+            jsonw_str(jw, "subtype", partition_subtype_str(part->type, subtype));
+            jsonw_int(jw, "offset", part->address);
+            jsonw_int(jw, "size", part->size);
+            jsonw_int(jw, "used", partition_used(part));
+            jsonw_bool(jw, "encrypted", part->encrypted);
+            jsonw_close(jw);
+            continue;
+        }
         printf("%-12s %-4s %-9s 0x%06" PRIX32 " 0x%06" PRIX32 " %3d%% %s\n",
                part->label, partition_type_str(part->type),
                partition_subtype_str(part->type, subtype),
                part->address, part->size, partition_used(part),
                part->encrypted ? "true" : "false");
     }
+    jsonw_close(jw);
 }
@@ -0,0 +1,235 @@
+/*
+ * File: host.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 10:12:40
+ *
+ * Minimal ESP-IDF / FreeRTOS runtime for host tests: only the calls that
+ * are reachable from the tested functions are implemented here. Anything
+ * else is discarded by --gc-sections at link time.
+ */
+
+#include "host.h"
+#include "timesync.h"
+#include "esp_rom_md5.h"
+
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return esp_timer_get_time() / 1000 / portTICK_PERIOD_MS;
+}
+
+void vTaskDelay(TickType_t ticks) { usleep(ticks * portTICK_PERIOD_MS * 1000); }
+
+const char * esp_err_to_name(esp_err_t code) {
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", code);
+    return buf;
+}
+
+void * heap_caps_malloc(size_t size, uint32_t caps) {
+    return malloc(size); (void)caps;
+}
+
+void * heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    return calloc(n, size); (void)caps;
+}
+
+void * heap_caps_malloc_prefer(size_t size, size_t num, ...) {
+    return malloc(size); (void)num;
+}
+
+/* Counting semaphore on pthread primitives, enough for MUTEX/ACQUIRE */
+
+typedef struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    UBaseType_t count, max;
+} host_sem_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t init) {
+    host_sem_t *sem = calloc(1, sizeof(host_sem_t));
+    if (!sem) return NULL;
+    pthread_mutex_init(&sem->mtx, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->count = init;
+    sem->max = max;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t hdl, TickType_t ticks) {
+    host_sem_t *sem = hdl;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t ns = ts.tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    int ret = 0;
+    pthread_mutex_lock(&sem->mtx);
+    while (!sem->count && ret != ETIMEDOUT) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->mtx);
+        } else {
+            ret = pthread_cond_timedwait(&sem->cond, &sem->mtx, &ts);
+        }
+    }
+    bool taken = sem->count;
+    if (taken) sem->count--;
+    pthread_mutex_unlock(&sem->mtx);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t hdl) {
+    host_sem_t *sem = hdl;
+    pthread_mutex_lock(&sem->mtx);
+    bool given = sem->count < sem->max;
+    if (given) sem->count++;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mtx);
+    return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t hdl) {
+    host_sem_t *sem = hdl;
+    if (!sem) return;
+    pthread_mutex_destroy(&sem->mtx);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+/* Queues of fixed size items and tasks on pthreads */
+
+typedef struct {
+    host_sem_t *items, *spaces;
+    pthread_mutex_t mtx;
+    UBaseType_t len, size, head, count;
+    uint8_t data[];
+} host_queue_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size) {
+    host_queue_t *q = calloc(1, sizeof(host_queue_t) + len * size);
+    if (!q) return NULL;
+    q->items = xSemaphoreCreateCounting(len, 0);
+    q->spaces = xSemaphoreCreateCounting(len, len);
+    pthread_mutex_init(&q->mtx, NULL);
+    q->len = len;
+    q->size = size;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t hdl, const void *item, TickType_t ticks) {
+    host_queue_t *q = hdl;
+    if (!xSemaphoreTake(q->spaces, ticks)) return pdFALSE;
+    pthread_mutex_lock(&q->mtx);
+    UBaseType_t tail = (q->head + q->count++) % q->len;
+    memcpy(q->data + tail * q->size, item, q->size);
+    pthread_mutex_unlock(&q->mtx);
+    xSemaphoreGive(q->items);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t hdl, void *item, TickType_t ticks) {
+    host_queue_t *q = hdl;
+    if (!xSemaphoreTake(q->items, ticks)) return pdFALSE;
+    pthread_mutex_lock(&q->mtx);
+    memcpy(item, q->data + q->head * q->size, q->size);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_mutex_unlock(&q->mtx);
+    xSemaphoreGive(q->spaces);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t hdl) {
+    host_queue_t *q = hdl;
+    pthread_mutex_lock(&q->mtx);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->mtx);
+    return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t hdl) {
+    host_queue_t *q = hdl;
+    pthread_mutex_lock(&q->mtx);
+    while (xSemaphoreTake(q->items, 0)) {}
+    while (xSemaphoreGive(q->spaces)) {}
+    q->head = q->count = 0;
+    pthread_mutex_unlock(&q->mtx);
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t hdl) {
+    host_queue_t *q = hdl;
+    if (!q) return;
+    vSemaphoreDelete(q->items);
+    vSemaphoreDelete(q->spaces);
+    pthread_mutex_destroy(&q->mtx);
+    free(q);
+}
+
+typedef struct {
+    TaskFunction_t func;
+    void *arg;
+} host_task_t;
+
+static void * host_task(void *arg) {
+    host_task_t task = *(host_task_t *)arg;
+    free(arg);
+    task.func(task.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+    host_task_t *task = malloc(sizeof(host_task_t));
+    pthread_t thread;
+    if (!task) return pdFALSE;
+    *task = (host_task_t){ func, arg };
+    if (pthread_create(&thread, NULL, host_task, task)) {
+        free(task);
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    if (handle) *handle = (TaskHandle_t)thread;
+    return pdPASS; (void)name; (void)stack; (void)prio;
+}
+
+// only a task deleting itself is supported
+void vTaskDelete(TaskHandle_t task) {
+    if (task) abort();
+    pthread_exit(NULL);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) { return 5; (void)task; }
+
+/* Test helpers */
+
+int host_failed;
+
+double host_usec(int64_t start, size_t count) {
+    return count ? (double)(esp_timer_get_time() - start) / count : 0;
+}
+
+/* Referenced by code paths that tests never take */
+
+#define UNREACHABLE(decl) decl { abort(); }
+
+UNREACHABLE(void esp_rom_md5_init(md5_context_t *ctx))
+UNREACHABLE(void esp_rom_md5_update(md5_context_t *ctx, const void *d, uint32_t l))
+UNREACHABLE(void esp_rom_md5_final(uint8_t *out, md5_context_t *ctx))
+UNREACHABLE(double get_timestamp_us(const struct timeval *tv))
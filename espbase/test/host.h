@@ -0,0 +1,36 @@
+/*
+ * File: host.h
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 10:12:40
+ *
+ * Helpers shared by host tests. Each test includes the module under test
+ * (e.g. ../main/server.c) so that static functions can be called directly.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+extern int host_failed;
+
+// average microseconds per item since `start` (from esp_timer_get_time)
+double host_usec(int64_t start, size_t count);
+
+#define CHECK(cond, ...)                                                    \
+    do {                                                                    \
+        if (cond) break;                                                    \
+        host_failed++;                                                      \
+        printf("%s:%d: check `%s` failed: ", __FILE__, __LINE__, #cond);    \
+        printf(__VA_ARGS__);                                                \
+        putchar('\n');                                                      \
+    } while (0)
+
+#define REPORT(name)                                                        \
+    (printf("%s: %s\n", name, host_failed ? "FAILED" : "OK"), !!host_failed)
@@ -0,0 +1,40 @@
+#pragma once
+#include "espstub.h"
+typedef struct cJSON { struct cJSON *next, *prev, *child; int type; char *valuestring; int valueint; double valuedouble; char *string; } cJSON;
+cJSON *cJSON_Parse(const char *);
+cJSON *cJSON_ParseWithLength(const char *, size_t);
+void cJSON_Delete(cJSON *);
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateArray(void);
+cJSON *cJSON_CreateString(const char *);
+cJSON *cJSON_CreateNumber(double);
+cJSON *cJSON_CreateNull(void);
+cJSON *cJSON_CreateBool(int);
+cJSON *cJSON_CreateIntArray(const int *, int);
+cJSON *cJSON_CreateRaw(const char *);
+cJSON *cJSON_GetObjectItem(const cJSON *, const char *);
+cJSON *cJSON_GetArrayItem(const cJSON *, int);
+int cJSON_GetArraySize(const cJSON *);
+char *cJSON_GetStringValue(const cJSON *);
+double cJSON_GetNumberValue(const cJSON *);
+int cJSON_IsArray(const cJSON *);
+int cJSON_IsObject(const cJSON *);
+int cJSON_IsNumber(const cJSON *);
+int cJSON_IsString(const cJSON *);
+int cJSON_IsBool(const cJSON *);
+int cJSON_IsTrue(const cJSON *);
+int cJSON_IsNull(const cJSON *);
+cJSON *cJSON_AddNullToObject(cJSON *, const char *);
+cJSON *cJSON_AddStringToObject(cJSON *, const char *, const char *);
+cJSON *cJSON_AddNumberToObject(cJSON *, const char *, double);
+cJSON *cJSON_AddBoolToObject(cJSON *, const char *, int);
+cJSON *cJSON_AddRawToObject(cJSON *, const char *, const char *);
+cJSON *cJSON_AddObjectToObject(cJSON *, const char *);
+cJSON *cJSON_AddArrayToObject(cJSON *, const char *);
+int cJSON_AddItemToObject(cJSON *, const char *, cJSON *);
+int cJSON_AddItemToArray(cJSON *, cJSON *);
+char *cJSON_Print(const cJSON *);
+char *cJSON_PrintUnformatted(const cJSON *);
+int cJSON_PrintPreallocated(cJSON *, char *, const int, const int);
+#define cJSON_ArrayForEach(e, a) for (e = (a) ? (a)->child : NULL; e; e = e->next)
+cJSON *cJSON_Duplicate(const cJSON *, int);
@@ -0,0 +1,3 @@
+#pragma once
+#include "espstub.h"
+#include "more.h"
@@ -0,0 +1,28 @@
+#pragma once
+#include <sys/time.h>
+#include "espstub.h"
+typedef enum { PIXFORMAT_RGB565, PIXFORMAT_JPEG = 4 } pixformat_t;
+typedef enum { FRAMESIZE_SVGA = 9, FRAMESIZE_HD = 11, FRAMESIZE_INVALID = 22 } framesize_t;
+typedef enum { CAMERA_FB_IN_PSRAM, CAMERA_FB_IN_DRAM } camera_fb_location_t;
+typedef enum { CAMERA_GRAB_WHEN_EMPTY, CAMERA_GRAB_LATEST } camera_grab_mode_t;
+typedef struct { uint8_t *buf; size_t len; size_t width; size_t height; pixformat_t format; struct timeval timestamp; } camera_fb_t;
+typedef struct { int pin_pwdn, pin_reset, pin_xclk, pin_sccb_sda, pin_sccb_scl, pin_d7, pin_d6, pin_d5, pin_d4, pin_d3, pin_d2, pin_d1, pin_d0, pin_vsync, pin_href, pin_pclk; int xclk_freq_hz; int ledc_timer, ledc_channel; pixformat_t pixel_format; framesize_t frame_size; int jpeg_quality; size_t fb_count; camera_fb_location_t fb_location; camera_grab_mode_t grab_mode; int sccb_i2c_port; } camera_config_t;
+typedef struct { framesize_t framesize; int8_t contrast, brightness, saturation, sharpness; uint8_t denoise, gainceiling, quality, colorbar, awb, agc, aec, hmirror, vflip, aec2, awb_gain, agc_gain; uint16_t aec_value; uint8_t special_effect, wb_mode; int8_t ae_level; uint8_t dcw, bpc, wpc, raw_gma, lenc; } camera_status_t;
+typedef struct { int pid; } sensor_id_t;
+typedef struct _sensor sensor_t;
+struct _sensor { sensor_id_t id; int xclk_freq_hz; pixformat_t pixformat; camera_status_t status;
+ int (*set_pixformat)(sensor_t*, int); int (*set_framesize)(sensor_t*, int); int (*set_contrast)(sensor_t*, int); int (*set_brightness)(sensor_t*, int); int (*set_saturation)(sensor_t*, int); int (*set_sharpness)(sensor_t*, int); int (*set_denoise)(sensor_t*, int); int (*set_gainceiling)(sensor_t*, int); int (*set_quality)(sensor_t*, int); int (*set_colorbar)(sensor_t*, int); int (*set_whitebal)(sensor_t*, int); int (*set_gain_ctrl)(sensor_t*, int); int (*set_exposure_ctrl)(sensor_t*, int); int (*set_hmirror)(sensor_t*, int); int (*set_vflip)(sensor_t*, int); int (*set_aec2)(sensor_t*, int); int (*set_awb_gain)(sensor_t*, int); int (*set_agc_gain)(sensor_t*, int); int (*set_aec_value)(sensor_t*, int); int (*set_special_effect)(sensor_t*, int); int (*set_wb_mode)(sensor_t*, int); int (*set_ae_level)(sensor_t*, int); int (*set_dcw)(sensor_t*, int); int (*set_bpc)(sensor_t*, int); int (*set_wpc)(sensor_t*, int); int (*set_raw_gma)(sensor_t*, int); int (*set_lenc)(sensor_t*, int);
+ int (*get_reg)(sensor_t*, int, int); int (*set_reg)(sensor_t*, int, int, int); int (*set_xclk)(sensor_t*, int, int); };
+typedef struct { int model; framesize_t max_size; } camera_sensor_info_t;
+#define CAMERA_OV3660 1
+#define CAMERA_OV5640 2
+typedef struct { uint16_t width, height; } resolution_info_t;
+extern const resolution_info_t resolution[];
+esp_err_t esp_camera_init(const camera_config_t *);
+camera_fb_t *esp_camera_fb_get(void);
+void esp_camera_fb_return(camera_fb_t *);
+sensor_t *esp_camera_sensor_get(void);
+camera_sensor_info_t *esp_camera_sensor_get_info(sensor_id_t *);
+esp_err_t esp_camera_save_to_nvs(const char *);
+esp_err_t esp_camera_load_from_nvs(const char *);
+bool frame2jpg(camera_fb_t *, uint8_t, uint8_t **, size_t *);
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+typedef void *esp_delta_ota_handle_t;
+typedef esp_err_t (*src_read_cb_t)(uint8_t *buf_p, size_t size, int src_offset);
+typedef esp_err_t (*merged_stream_write_cb_t)(const uint8_t *buf_p, size_t size);
+typedef struct { void *user_data; src_read_cb_t read_cb; merged_stream_write_cb_t write_cb; } esp_delta_ota_cfg_t;
+esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg);
+esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size);
+esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t handle);
+esp_err_t esp_delta_ota_deinit(esp_delta_ota_handle_t handle);
@@ -0,0 +1,4 @@
+#pragma once
+#include "espstub.h"
+esp_err_t esp_flash_read_id(void *, uint32_t *);
+esp_err_t esp_flash_get_physical_size(void *, uint32_t *);
@@ -0,0 +1,4 @@
+#pragma once
+#include "espstub.h"
+typedef struct { size_t total_free_bytes, total_allocated_bytes, largest_free_block, minimum_free_bytes, allocated_blocks, free_blocks, total_blocks; } multi_heap_info_t;
+void heap_caps_get_info(multi_heap_info_t *, uint32_t);
@@ -0,0 +1,61 @@
+#pragma once
+#include "espstub.h"
+typedef void *httpd_handle_t;
+typedef enum { HTTP_DELETE, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_OPTIONS = 6 } httpd_method_t;
+typedef void (*httpd_free_ctx_fn_t)(void *);
+typedef struct httpd_req { httpd_handle_t handle; int method; const char uri[513]; size_t content_len; void *aux; void *user_ctx; void *sess_ctx; httpd_free_ctx_fn_t free_ctx; bool ignore_sess_ctx_changes; } httpd_req_t;
+typedef esp_err_t (*httpd_uri_handler_t)(httpd_req_t *);
+typedef struct { const char *uri; httpd_method_t method; esp_err_t (*handler)(httpd_req_t *); void *user_ctx; bool is_websocket; bool handle_ws_control_frames; const char *supported_subprotocol; } httpd_uri_t;
+typedef enum { HTTPD_500_INTERNAL_SERVER_ERROR = 0, HTTPD_501_METHOD_NOT_IMPLEMENTED, HTTPD_505_VERSION_NOT_SUPPORTED, HTTPD_400_BAD_REQUEST, HTTPD_401_UNAUTHORIZED, HTTPD_403_FORBIDDEN, HTTPD_404_NOT_FOUND, HTTPD_405_METHOD_NOT_ALLOWED, HTTPD_408_REQ_TIMEOUT, HTTPD_411_LENGTH_REQUIRED, HTTPD_414_URI_TOO_LONG, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE, HTTPD_ERR_CODE_MAX } httpd_err_code_t;
+typedef esp_err_t (*httpd_err_handler_func_t)(httpd_req_t *, httpd_err_code_t);
+typedef bool (*httpd_uri_match_func_t)(const char *, const char *, size_t);
+typedef void (*httpd_work_fn_t)(void *);
+typedef struct { unsigned task_priority; size_t stack_size; BaseType_t core_id; uint16_t server_port; uint16_t ctrl_port; uint16_t max_open_sockets; uint16_t max_uri_handlers; uint16_t max_resp_headers; uint16_t backlog_conn; bool lru_purge_enable; uint16_t recv_wait_timeout; uint16_t send_wait_timeout; void *global_user_ctx; httpd_free_ctx_fn_t global_user_ctx_free_fn; void *global_transport_ctx; httpd_free_ctx_fn_t global_transport_ctx_free_fn; bool enable_so_linger; int linger_timeout; bool keep_alive_enable; int keep_alive_idle; int keep_alive_interval; int keep_alive_count; esp_err_t (*open_fn)(httpd_handle_t, int); void (*close_fn)(httpd_handle_t, int); httpd_uri_match_func_t uri_match_fn; } httpd_config_t;
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80 }
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_INVALID -2
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+#define HTTPD_RESP_USE_STRLEN -1
+esp_err_t httpd_start(httpd_handle_t *, const httpd_config_t *);
+esp_err_t httpd_stop(httpd_handle_t);
+esp_err_t httpd_register_uri_handler(httpd_handle_t, const httpd_uri_t *);
+esp_err_t httpd_register_err_handler(httpd_handle_t, httpd_err_code_t, httpd_err_handler_func_t);
+esp_err_t httpd_resp_send(httpd_req_t *, const char *, ssize_t);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *, const char *, ssize_t);
+esp_err_t httpd_resp_sendstr(httpd_req_t *, const char *);
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *, const char *);
+esp_err_t httpd_resp_set_status(httpd_req_t *, const char *);
+esp_err_t httpd_resp_set_type(httpd_req_t *, const char *);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *, const char *, const char *);
+esp_err_t httpd_resp_send_err(httpd_req_t *, httpd_err_code_t, const char *);
+int httpd_req_recv(httpd_req_t *, char *, size_t);
+size_t httpd_req_get_hdr_value_len(httpd_req_t *, const char *);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *, const char *, char *, size_t);
+size_t httpd_req_get_url_query_len(httpd_req_t *);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *, char *, size_t);
+int httpd_req_to_sockfd(httpd_req_t *);
+int httpd_socket_send(httpd_handle_t, int, const char *, size_t, int);
+int httpd_socket_recv(httpd_handle_t, int, char *, size_t, int);
+esp_err_t httpd_queue_work(httpd_handle_t, httpd_work_fn_t, void *);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t, int);
+void *httpd_get_global_user_ctx(httpd_handle_t);
+esp_err_t httpd_get_client_list(httpd_handle_t, size_t *, int *);
+const char *http_method_str(int);
+bool httpd_uri_match_wildcard(const char *, const char *, size_t);
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *, httpd_req_t **);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *);
+typedef enum { HTTPD_WS_TYPE_CONTINUE = 0, HTTPD_WS_TYPE_TEXT = 1, HTTPD_WS_TYPE_BINARY = 2, HTTPD_WS_TYPE_CLOSE = 8, HTTPD_WS_TYPE_PING, HTTPD_WS_TYPE_PONG } httpd_ws_type_t;
+typedef enum { HTTPD_WS_CLIENT_INVALID = 0, HTTPD_WS_CLIENT_HTTP = 1, HTTPD_WS_CLIENT_WEBSOCKET = 2 } httpd_ws_client_info_t;
+typedef struct { bool final; bool fragmented; httpd_ws_type_t type; uint8_t *payload; size_t len; } httpd_ws_frame_t;
+esp_err_t httpd_ws_recv_frame(httpd_req_t *, httpd_ws_frame_t *, size_t);
+esp_err_t httpd_ws_send_frame(httpd_req_t *, httpd_ws_frame_t *);
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t, int, httpd_ws_frame_t *);
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t, int);
+typedef void (*transfer_complete_cb)(esp_err_t, int, void *);
+esp_err_t httpd_ws_send_data_async(httpd_handle_t, int, httpd_ws_frame_t *, transfer_complete_cb, void *);
+void *httpd_sess_get_ctx(httpd_handle_t, int);
+void httpd_sess_set_ctx(httpd_handle_t, int, void *, httpd_free_ctx_fn_t);
+typedef int (*httpd_send_func_t)(httpd_handle_t, int, const char *, size_t, int);
+esp_err_t httpd_sess_set_send_override(httpd_handle_t, int, httpd_send_func_t);
+void *httpd_sess_get_transport_ctx(httpd_handle_t, int);
+void httpd_sess_set_transport_ctx(httpd_handle_t, int, void *, httpd_free_ctx_fn_t);
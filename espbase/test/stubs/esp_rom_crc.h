@@ -0,0 +1 @@
+uint32_t esp_rom_crc32_le(uint32_t, const uint8_t *, uint32_t);
@@ -0,0 +1,3 @@
+#pragma once
+#include "espstub.h"
+const char *esp_get_idf_version(void);
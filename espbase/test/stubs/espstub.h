@@ -0,0 +1,158 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/types.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+#define ESP_ERR_NOT_FINISHED 0x10C
+#define ESP_ERR_NOT_ALLOWED 0x10D
+#define ESP_ERR_HTTPD_BASE 0xb000
+#define ESP_ERR_HTTPD_INVALID_REQ 0xb005
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0xb006
+const char *esp_err_to_name(esp_err_t);
+#define ESP_ERROR_CHECK(x) (void)(x)
+#define ESP_LOGE(t, ...) (printf("E %s: ", t), printf(__VA_ARGS__), putchar(10))
+#define ESP_LOGW(t, ...) (printf("W %s: ", t), printf(__VA_ARGS__), putchar(10))
+#define ESP_LOGI(t, ...) (0 ? (void)printf(__VA_ARGS__) : (void)(t))
+#define ESP_LOGD(t, ...) (0 ? (void)printf(__VA_ARGS__) : (void)(t))
+#define ESP_LOGV(t, ...) (0 ? (void)printf(__VA_ARGS__) : (void)(t))
+#define ESP_LOG_LEVEL(l, t, ...) printf(__VA_ARGS__)
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+void esp_log_level_set(const char *, esp_log_level_t);
+esp_log_level_t esp_log_level_get(const char *);
+typedef int (*vprintf_like_t)(const char *, va_list);
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t);
+uint32_t esp_log_timestamp(void);
+#define LOG_COLOR_PURPLE "35"
+#define LOG_COLOR_CYAN "36"
+#define LOG_COLOR(c) "\033[0;" c "m"
+#define LOG_RESET_COLOR "\033[0m"
+typedef const char *esp_event_base_t;
+typedef void *esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(void *, esp_event_base_t, int32_t, void *);
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
+#define ESP_EVENT_ANY_ID -1
+esp_err_t esp_event_post(esp_event_base_t, int32_t, const void *, size_t, uint32_t);
+esp_err_t esp_event_handler_instance_register(esp_event_base_t, int32_t, esp_event_handler_t, void *, esp_event_handler_instance_t *);
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t, int32_t, esp_event_handler_instance_t);
+esp_err_t esp_event_dump(FILE *);
+#define ESP_IDF_VERSION_VAL(a,b,c) (((a)<<16)|((b)<<8)|(c))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5,3,0)
+#define IDF_VERSION_MAJOR 5
+/* freertos */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef void (*TaskFunction_t)(void *);
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(m) ((TickType_t)(m) / 10)
+#define pdTICKS_TO_MS(t) ((t) * 10)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t);
+void vTaskDelete(TaskHandle_t);
+TaskHandle_t xTaskGetHandle(const char *);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskCreate(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *, BaseType_t);
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite } eNotifyAction;
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction);
+BaseType_t xTaskNotifyAndQuery(TaskHandle_t, uint32_t, eNotifyAction, uint32_t *);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t *, TickType_t);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+uint32_t ulTaskNotifyValueClear(TaskHandle_t, uint32_t);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t, UBaseType_t);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+void vSemaphoreDelete(SemaphoreHandle_t);
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueSendToBack(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueReceive(QueueHandle_t, void *, TickType_t);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t);
+void vQueueDelete(QueueHandle_t);
+BaseType_t xQueueReset(QueueHandle_t);
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(m) (void)(m)
+#define portEXIT_CRITICAL(m) (void)(m)
+typedef struct { TaskHandle_t xHandle; const char *pcTaskName; UBaseType_t xTaskNumber; int eCurrentState; UBaseType_t uxCurrentPriority; uint32_t ulRunTimeCounter; uint32_t usStackHighWaterMark; BaseType_t xCoreID; } TaskStatus_t;
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t, BaseType_t);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t, BaseType_t, void *);
+/* misc */
+void esp_restart(void);
+int64_t esp_timer_get_time(void);
+typedef void *esp_timer_handle_t;
+typedef struct { void (*callback)(void *); void *arg; int dispatch_method; const char *name; bool skip_unhandled_events; } esp_timer_create_args_t;
+esp_err_t esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t *);
+esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t, uint64_t);
+esp_err_t esp_timer_stop(esp_timer_handle_t);
+esp_err_t esp_timer_delete(esp_timer_handle_t);
+esp_err_t esp_timer_dump(FILE *);
+#define MALLOC_CAP_SPIRAM (1<<10)
+#define MALLOC_CAP_INTERNAL (1<<11)
+#define MALLOC_CAP_8BIT (1<<2)
+#define MALLOC_CAP_DEFAULT (1<<12)
+#define MALLOC_CAP_DMA (1<<3)
+#define MALLOC_CAP_EXEC (1<<0)
+void *heap_caps_malloc(size_t, uint32_t);
+void *heap_caps_calloc(size_t, size_t, uint32_t);
+void *heap_caps_malloc_prefer(size_t, size_t, ...);
+size_t heap_caps_get_free_size(uint32_t);
+size_t heap_caps_get_largest_free_block(uint32_t);
+#define BIT0 1
+#define BIT1 2
+#define BIT2 4
+#define BIT3 8
+#define BIT4 16
+#define BIT5 32
+#define BIT6 64
+#define BIT7 128
+#define BIT16 65536
+#define BIT(n) (1UL << (n))
+#define GPIO_NUM_NC -1
+#define GPIO_PIN_COUNT 49
+#define GPIO_NUM_4 4
+#define GPIO_NUM_5 5
+const char *esp_err_to_name_r(esp_err_t, char *, size_t);
+/* md5 */
+typedef struct { uint32_t a[22]; } md5_context_t;
+void esp_rom_md5_init(md5_context_t *);
+void esp_rom_md5_update(md5_context_t *, const void *, uint32_t);
+void esp_rom_md5_final(uint8_t *, md5_context_t *);
+/* sha */
+typedef struct { uint32_t a[64]; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context *);
+void mbedtls_sha256_free(mbedtls_sha256_context *);
+int mbedtls_sha256_starts(mbedtls_sha256_context *, int);
+int mbedtls_sha256_update(mbedtls_sha256_context *, const unsigned char *, size_t);
+int mbedtls_sha256_finish(mbedtls_sha256_context *, unsigned char *);
+void mbedtls_sha256_clone(mbedtls_sha256_context *, const mbedtls_sha256_context *);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t);
@@ -0,0 +1,3 @@
+#pragma once
+#include "espstub.h"
+#define tskKERNEL_VERSION_NUMBER "V10.5.1"
@@ -0,0 +1,5 @@
+#pragma once
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#define LWIP_SOCKET_OFFSET 54
@@ -0,0 +1,2 @@
+#pragma once
+// managed component: only its presence is checked by network.h
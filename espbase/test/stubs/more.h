@@ -0,0 +1,134 @@
+#pragma once
+#include "espstub.h"
+typedef int wl_handle_t;
+typedef struct sdmmc_card sdmmc_card_t;
+typedef int i2s_chan_handle_t_;
+typedef void *i2s_chan_handle_t;
+#define I2S_DATA_BIT_WIDTH_16BIT 16
+#define I2S_SLOT_MODE_MONO 1
+#define I2S_SLOT_MODE_STEREO 2
+#define I2S_NUM_0 0
+#define I2S_ROLE_MASTER 0
+typedef struct { int a; } i2s_chan_config_t;
+typedef struct { int clk, din; } i2s_pdm_rx_gpio_config_t;
+typedef struct { int a; } i2s_pdm_rx_clk_config_t;
+typedef struct { int a; } i2s_pdm_rx_slot_config_t;
+typedef struct { i2s_pdm_rx_clk_config_t clk_cfg; i2s_pdm_rx_slot_config_t slot_cfg; i2s_pdm_rx_gpio_config_t gpio_cfg; } i2s_pdm_rx_config_t;
+#define I2S_CHANNEL_DEFAULT_CONFIG(a, b) {0}
+#define I2S_PDM_RX_CLK_DEFAULT_CONFIG(a) {0}
+#define I2S_PDM_RX_SLOT_DEFAULT_CONFIG(a, b) {0}
+esp_err_t i2s_new_channel(const i2s_chan_config_t *, i2s_chan_handle_t *, i2s_chan_handle_t *);
+esp_err_t i2s_channel_init_pdm_rx_mode(i2s_chan_handle_t, const i2s_pdm_rx_config_t *);
+esp_err_t i2s_channel_enable(i2s_chan_handle_t);
+esp_err_t i2s_channel_disable(i2s_chan_handle_t);
+esp_err_t i2s_channel_read(i2s_chan_handle_t, void *, size_t, size_t *, uint32_t);
+typedef int gpio_num_t;
+typedef int uart_port_t;
+#define UART_NUM_0 0
+/* partition / ota */
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1, ESP_PARTITION_TYPE_ANY = 0xff } esp_partition_type_t;
+typedef enum {
+    ESP_PARTITION_SUBTYPE_APP_FACTORY = 0x00, ESP_PARTITION_SUBTYPE_APP_OTA_MIN = 0x10,
+    ESP_PARTITION_SUBTYPE_APP_OTA_MAX = 0x20, ESP_PARTITION_SUBTYPE_APP_TEST = 0x20,
+    ESP_PARTITION_SUBTYPE_DATA_OTA = 0x00, ESP_PARTITION_SUBTYPE_DATA_PHY = 0x01,
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02, ESP_PARTITION_SUBTYPE_DATA_COREDUMP = 0x03,
+    ESP_PARTITION_SUBTYPE_DATA_NVS_KEYS = 0x04, ESP_PARTITION_SUBTYPE_DATA_EFUSE_EM = 0x05,
+    ESP_PARTITION_SUBTYPE_DATA_UNDEFINED = 0x06, ESP_PARTITION_SUBTYPE_DATA_ESPHTTPD = 0x80,
+    ESP_PARTITION_SUBTYPE_DATA_FAT = 0x81, ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+typedef struct { void *flash_chip; esp_partition_type_t type; esp_partition_subtype_t subtype; uint32_t address; uint32_t size; uint32_t erase_size; char label[17]; bool encrypted; bool readonly; } esp_partition_t;
+typedef void *esp_partition_iterator_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+typedef enum { ESP_PARTITION_MMAP_DATA, ESP_PARTITION_MMAP_INST } esp_partition_mmap_memory_t;
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t, esp_partition_subtype_t, const char *);
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char *);
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t);
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t);
+void esp_partition_iterator_release(esp_partition_iterator_t);
+esp_err_t esp_partition_read(const esp_partition_t *, size_t, void *, size_t);
+esp_err_t esp_partition_write(const esp_partition_t *, size_t, const void *, size_t);
+esp_err_t esp_partition_erase_range(const esp_partition_t *, size_t, size_t);
+esp_err_t esp_partition_mmap(const esp_partition_t *, size_t, size_t, esp_partition_mmap_memory_t, const void **, esp_partition_mmap_handle_t *);
+void esp_partition_munmap(esp_partition_mmap_handle_t);
+typedef uint32_t esp_ota_handle_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+typedef enum { ESP_OTA_IMG_NEW, ESP_OTA_IMG_PENDING_VERIFY, ESP_OTA_IMG_VALID, ESP_OTA_IMG_INVALID, ESP_OTA_IMG_ABORTED, ESP_OTA_IMG_UNDEFINED } esp_ota_img_states_t;
+typedef struct { uint32_t magic_word; uint32_t secure_version; uint32_t r1[2]; char version[32]; char project_name[32]; char time[16]; char date[16]; char idf_ver[32]; uint8_t app_elf_sha256[32]; } esp_app_desc_t;
+typedef struct { uint8_t magic; uint8_t segment_count; uint8_t spi_mode; uint8_t spi_speed; uint32_t entry_addr; uint8_t wp_pin; uint8_t d[3]; uint16_t chip_id; uint8_t rest[9]; } esp_image_header_t;
+typedef struct { uint32_t load_addr; uint32_t data_len; } esp_image_segment_header_t;
+typedef struct { uint32_t start_addr; uint32_t image_len; } esp_image_metadata_t;
+typedef struct { uint32_t offset; uint32_t size; } esp_partition_pos_t;
+#define ESP_IMAGE_VERIFY 0
+esp_err_t esp_image_verify(int, const esp_partition_pos_t *, esp_image_metadata_t *);
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+const esp_partition_t *esp_ota_get_last_invalid_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *);
+esp_err_t esp_ota_begin(const esp_partition_t *, size_t, esp_ota_handle_t *);
+esp_err_t esp_ota_write(esp_ota_handle_t, const void *, size_t);
+esp_err_t esp_ota_end(esp_ota_handle_t);
+esp_err_t esp_ota_abort(esp_ota_handle_t);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *);
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *, esp_app_desc_t *);
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *, esp_ota_img_states_t *);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+esp_err_t esp_ota_erase_last_boot_app_partition(void);
+bool esp_ota_check_rollback_is_possible(void);
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void);
+/* http client */
+typedef void *esp_http_client_handle_t;
+typedef enum { HTTP_EVENT_ERROR, HTTP_EVENT_ON_CONNECTED, HTTP_EVENT_HEADERS_SENT, HTTP_EVENT_ON_HEADER, HTTP_EVENT_ON_DATA } esp_http_client_event_id_t;
+typedef struct { esp_http_client_event_id_t event_id; void *client; void *data; int data_len; void *user_data; char *header_key; char *header_value; } esp_http_client_event_t;
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *);
+typedef struct { const char *url; int timeout_ms; bool keep_alive_enable; http_event_handle_cb event_handler; void *user_data; const char *cert_pem; size_t cert_len; bool skip_cert_common_name_check; int buffer_size; } esp_http_client_config_t;
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *);
+esp_err_t esp_http_client_open(esp_http_client_handle_t, int);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t);
+int esp_http_client_read(esp_http_client_handle_t, char *, int);
+int esp_http_client_get_errno(esp_http_client_handle_t);
+int esp_http_client_get_status_code(esp_http_client_handle_t);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t);
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t);
+esp_err_t esp_http_client_close(esp_http_client_handle_t);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t, const char *, const char *);
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t, const char *);
+esp_err_t esp_http_client_get_header(esp_http_client_handle_t, const char *, char **);
+/* console */
+typedef int (*esp_console_cmd_func_t)(int, char **);
+typedef int (*esp_console_cmd_func_with_context_t)(void *, int, char **);
+typedef struct { const char *command; const char *help; const char *hint; esp_console_cmd_func_t func; void *argtable; esp_console_cmd_func_with_context_t func_w_context; void *context; } esp_console_cmd_t;
+typedef struct { size_t max_cmdline_length; size_t max_cmdline_args; int hint_color; int hint_bold; } esp_console_config_t;
+esp_err_t esp_console_init(const esp_console_config_t *);
+esp_err_t esp_console_run(const char *, int *);
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *);
+void esp_console_get_completion(const char *, void *);
+const char *esp_console_get_hint(const char *, int *, int *);
+size_t esp_console_split_argv(char *, char **, size_t);
+char *linenoise(const char *);
+void linenoiseFree(void *);
+int linenoiseHistoryAdd(const char *);
+int linenoiseProbe(void);
+void linenoiseSetDumbMode(int);
+int linenoiseIsDumbMode(void);
+void linenoiseSetMultiLine(int);
+void linenoiseAllowEmpty(bool);
+int linenoiseSetMaxLineLen(size_t);
+typedef void linenoiseHintsCallback(void);
+void linenoiseSetCompletionCallback(void *);
+void linenoiseSetHintsCallback(linenoiseHintsCallback *);
+int linenoiseHistorySetMaxLen(int);
+#define ESP_LINE_ENDINGS_CR 1
+#define ESP_LINE_ENDINGS_CRLF 0
+void uart_vfs_dev_port_set_rx_line_endings(int, int);
+void uart_vfs_dev_port_set_tx_line_endings(int, int);
+void uart_vfs_dev_use_driver(int);
+#define CONFIG_ESP_CONSOLE_UART_DEFAULT 1
+#define I2C_NUM_0 0
+#define LEDC_TIMER_3 3
+#define LEDC_CHANNEL_4 4
+bool esp_psram_is_initialized(void);
+esp_err_t esp_partition_get_sha256(const esp_partition_t *, uint8_t *);
+esp_err_t esp_ota_resume(const esp_partition_t *, const size_t, const size_t, esp_ota_handle_t *);
@@ -0,0 +1,4 @@
+#pragma once
+#include "espstub.h"
+typedef struct { size_t used_entries, free_entries, available_entries, total_entries, namespace_count; } nvs_stats_t;
+esp_err_t nvs_get_stats(const char *, nvs_stats_t *);
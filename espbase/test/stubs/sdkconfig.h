@@ -0,0 +1,34 @@
+#pragma once
+#include "espstub.h"
+#define CONFIG_BASE_USE_WEBSERVER 1
+#define CONFIG_BASE_USE_WIFI 1
+#define CONFIG_HTTPD_WS_SUPPORT 1
+#define CONFIG_BASE_USE_I2S 1
+#define CONFIG_BASE_USE_CAM 1
+#define CONFIG_BASE_USE_FFS 1
+#define CONFIG_BASE_USE_SDFS 1
+#define CONFIG_BASE_USE_CONSOLE 1
+#define CONFIG_BASE_OTA_FETCH 1
+#define CONFIG_BASE_DEBUG 1
+#define CONFIG_BASE_PDM_SAMPLE_RATE 16000
+#define CONFIG_BASE_I2S_NUM 0
+#define CONFIG_IDF_FIRMWARE_CHIP_ID 0
+#define CONFIG_BASE_FFS_MP "/flashfs"
+#define CONFIG_BASE_SDFS_MP "/sdcard"
+#define CONFIG_PSRAM 1
+#define CONFIG_LWIP_IPV6 1
+#define CONFIG_BASE_GPIO_I2S_CLK 4
+#define CONFIG_BASE_GPIO_I2S_DAT 5
+#define CONFIG_BASE_USE_I2C 1
+#define CONFIG_BASE_I2C_NUM 0
+#define CONFIG_BASE_USE_I2C0 1
+#define CONFIG_BASE_CAM_PINS "-1,-1,1,2,3,4,5,6,7,8,9,10,11,12"
+#define CONFIG_BASE_HTTP_CACHE_SIZE 32
+#define CONFIG_BASE_HTTP_BUNDLE "assets"
+#define CONFIG_BASE_HTTP_METRICS 1
+#define CONFIG_BASE_HTTP_WORKERS 2
+#define CONFIG_BASE_HTTP_WORKER_QUEUE 4
+#define CONFIG_BASE_HTTP_LOGS 64
+#define CONFIG_BASE_OTA_BUFFERS 2
+#define CONFIG_BASE_FFS_PART "storage"
+#define CONFIG_LWIP_MAX_SOCKETS 10
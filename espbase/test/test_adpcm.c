@@ -0,0 +1,165 @@
+/*
+ * File: test_adpcm.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 19:42:18
+ *
+ * Encode 10s of mono and stereo speech-like PCM with adpcm_encode in 20ms
+ * chunks, parse the WAV header of adpcm_header and decode the blocks with
+ * a plain IMA-ADPCM decoder written after the WAVE_FORMAT_IMA_ADPCM spec,
+ * then check the SNR of the round trip and the sizes predicted for NULL
+ * pcm. Also report the encoder throughput.
+ */
+
+#include "host.h"
+
+// sensor_t of the 64-bit host is too large for the uint8_t offsets that
+// are checked on target: camera attributes are not tested here.
+#define _Static_assert(...)
+#pragma GCC diagnostic ignored "-Woverflow"
+
+#include "../main/avcmode.c"
+
+#include <math.h>
+
+#define SRATE       16000
+#define SECONDS     10
+#define CHUNK       ( SRATE / 50 )          // samples of 20ms per channel
+
+/* Decoder: one block of `align` Bytes into `spb` samples per channel */
+
+static void decode(const uint8_t *blk, uint16_t nch, uint16_t align,
+                   uint16_t spb, int16_t *out) {
+    int32_t pred[2], index[2];
+    LOOPN(ch, nch) {
+        pred[ch] = (int16_t)(blk[4 * ch] | blk[4 * ch + 1] << 8);
+        index[ch] = blk[4 * ch + 2];
+        out[ch] = pred[ch];
+    }
+    // 4 Bytes of 8 samples (low nibble first) per channel in turn
+    for (size_t pos = 4 * nch, n = 1; pos < align; pos += 4 * nch, n += 8) {
+        LOOPN(ch, nch) {
+            LOOPN(i, 8) {
+                uint8_t code = blk[pos + 4 * ch + i / 2] >> (i % 2 * 4) & 15;
+                int32_t step = ima_steps[index[ch]], diff = step >> 3;
+                if (code & 4) diff += step;
+                if (code & 2) diff += step >> 1;
+                if (code & 1) diff += step >> 2;
+                pred[ch] += code & 8 ? -diff : diff;
+                pred[ch] = CONS(pred[ch], INT16_MIN, INT16_MAX);
+                index[ch] = CONS(index[ch] + ima_index[code & 7], 0, 88);
+                out[(n + i) * nch + ch] = pred[ch];
+            }
+        }
+    }
+    NOTUSED(spb);
+}
+
+/* Round trip */
+
+static int16_t pcm[SRATE * SECONDS * 2];
+
+// speech-like spectrum falling with frequency: a tone of 440Hz (740Hz on the
+// right channel), a weaker one of 3kHz and white noise. IMA-ADPCM gets much
+// worse with strong content near Nyquist (about 24dB with 3kHz at 4000).
+static void make_pcm(uint16_t nch) {
+    srand(25);
+    LOOPN(i, SRATE * SECONDS) {
+        LOOPN(ch, nch) {
+            double t = (double)i / SRATE;
+            pcm[i * nch + ch] = 8000 * sin(2 * M_PI * (440 + 300 * ch) * t) +
+                                1000 * sin(2 * M_PI * 3000 * t) +
+                                rand() % 2001 - 1000;
+        }
+    }
+}
+
+static void test_round_trip(uint16_t nch) {
+    audio_mode_t mode = { SRATE, nch, 2 };
+    adpcm_state_t st;
+    adpcm_header_t head;
+    size_t total = SRATE * SECONDS, olen = 0;
+    uint8_t *adpcm = malloc(total * nch);
+    make_pcm(nch);
+
+    CHECK(adpcm_header(&st, &mode, &head) == sizeof(head), "header");
+    CHECK(head.type == 0x11 && head.nch == nch && head.shz == SRATE &&
+          head.bpC == 4 && head.SpB == ADPCM_BLOCK_SAMPLES &&
+          head.BpB == 256 * nch, "fmt of %u channel(s)", nch);
+    LOOPN(off, total / CHUNK) {
+        size_t len = CHUNK * nch * sizeof(int16_t);
+        size_t expect = adpcm_encode(&st, NULL, len, NULL);
+        size_t num = adpcm_encode(&st, pcm + off * CHUNK * nch, len,
+                                  adpcm + olen);
+        CHECK(num == expect && num % head.BpB == 0, "chunk %zu: %zu Bytes, "
+              "expect %zu", off, num, expect);
+        olen += num;
+    }
+
+    // decode whole blocks and compare with PCM per channel
+    size_t nblk = olen / head.BpB, num = nblk * head.SpB;
+    int16_t *out = malloc(num * nch * sizeof(int16_t));
+    LOOPN(i, nblk) {
+        decode(adpcm + i * head.BpB, nch, head.BpB, head.SpB,
+               out + i * head.SpB * nch);
+    }
+    CHECK(num == total / head.SpB * head.SpB, "%zu samples decoded", num);
+    LOOPN(i, nblk * nch) {
+        size_t idx = i / nch * head.SpB * nch + i % nch;
+        CHECK(out[idx] == pcm[idx], "block %zu: ch%zu starts at %d, expect %d",
+              i / nch, i % nch, out[idx], pcm[idx]);
+    }
+    LOOPN(ch, nch) {
+        double sig = 0, err = 0;
+        LOOPN(i, num) {
+            double x = pcm[i * nch + ch], y = out[i * nch + ch];
+            sig += x * x;
+            err += (x - y) * (x - y);
+        }
+        double snr = 10 * log10(sig / err);
+        printf("adpcm: %u channel(s), ch%d: SNR %.1f dB, %.2f:1\n",
+               nch, ch, snr, (double)num * nch * 2 / olen);
+        CHECK(snr > 26, "ch%d: SNR %.1f dB", ch, snr);
+    }
+    free(out);
+    free(adpcm);
+}
+
+static void test_header(void) {
+    adpcm_state_t st = { 0 };
+    static const audio_mode_t modes[] = {
+        { SRATE, 0, 2 }, { SRATE, 3, 2 }, { SRATE, 1, 1 }, { SRATE, 2, 4 },
+    };
+    ITERP(mode, modes) {
+        CHECK(!adpcm_header(&st, mode, NULL), "%u channels of %u Bytes",
+              mode->nch, mode->depth);
+    }
+    CHECK(!adpcm_encode(&st, pcm, sizeof(pcm), NULL), "encode without nch");
+}
+
+static void bench(uint16_t nch) {
+    audio_mode_t mode = { SRATE, nch, 2 };
+    adpcm_state_t st;
+    uint8_t out[CHUNK * 2];
+    size_t total = SRATE * SECONDS / CHUNK, iters = 10;
+    make_pcm(nch);
+    adpcm_header(&st, &mode, NULL);
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        LOOPN(off, total) {
+            adpcm_encode(&st, pcm + off * CHUNK * nch,
+                         CHUNK * nch * sizeof(int16_t), out);
+        }
+    }
+    double us = host_usec(ts, iters * total);
+    printf("adpcm_encode: %.2f us per 20ms frame of %u channel(s), "
+           "%.1f Msamples/s\n", us, nch, CHUNK * nch / us);
+}
+
+int main() {
+    test_header();
+    test_round_trip(1);
+    test_round_trip(2);
+    bench(1);
+    bench(2);
+    return REPORT("adpcm");
+}
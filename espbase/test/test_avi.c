@@ -0,0 +1,221 @@
+/*
+ * File: test_avi.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 17:48:30
+ *
+ * Record synthetic JPEG frames of odd and even lengths with avi_frame into
+ * segments of a temporary directory, then parse every segment: RIFF and
+ * LIST lengths, the 00dc chunks in movi (WORD aligned, frames in order) and
+ * the idx1 entries pointing at them. No ffprobe or decoder is needed; when
+ * ffprobe is installed it is asked to count the packets as well.
+ */
+
+#include "host.h"
+
+// sensor_t of the 64-bit host is too large for the uint8_t offsets that
+// are checked on target: camera attributes are not tested here.
+#define _Static_assert(...)
+#pragma GCC diagnostic ignored "-Woverflow"
+
+#include "../main/avcmode.c"
+
+// referenced by vid_rec: record_task is not started here
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { abort(); NOTUSED(task); }
+
+bool filesys_get_info(filesys_type_t type, filesys_info_t *info) {
+    return false; NOTUSED(type); NOTUSED(info);     // no cleanup
+}
+
+void filesys_walk(filesys_type_t type, const char *dir, walk_cb_t cb,
+                  void *arg) {
+    NOTUSED(type); NOTUSED(dir); NOTUSED(cb); NOTUSED(arg);
+}
+
+char * filesys_join_r(filesys_type_t type, filesys_path_t buf, size_t argc,
+                      ...) {
+    va_list ap;
+    va_start(ap, argc);
+    buf[0] = '\0';
+    LOOPN(i, argc) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, PATH_MAX_LEN - len, "%s%s",
+                 i ? "/" : "", va_arg(ap, const char *));
+    }
+    va_end(ap);
+    return buf; NOTUSED(type);
+}
+
+/* Synthetic JPEG: SOI, APP0 with frame ID, entropy data without 0xFF, EOI */
+
+#define JPEG_MAX    6000
+
+static size_t jpeg(uint8_t *buf, uint32_t id) {
+    static const uint8_t app0[] = {
+        0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+        0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    };
+    size_t len = (200 + rand() % (JPEG_MAX - 200)) / 2 * 2 + id % 2;
+    memcpy(buf, app0, sizeof(app0));
+    memcpy(buf + sizeof(app0), &id, sizeof(id));
+    LOOP(i, sizeof(app0) + sizeof(id), len - 2) { buf[i] = rand() % 0xFF; }
+    buf[len - 2] = 0xFF;
+    buf[len - 1] = 0xD9;
+    return len;
+}
+
+/* RIFF/idx1 checker */
+
+static struct {
+    uint32_t next;          // ID of the next frame expected
+    size_t segs, frames, odd;
+} seen;
+
+#define FAIL(...) do { CHECK(false, __VA_ARGS__); goto exit; } while (0)
+
+static bool fourcc(const void *ptr, const char *code) {
+    return !memcmp(ptr, code, 4);
+}
+
+// check JPEG markers and frame ID in data of 00dc chunk
+static bool check_chunk(const uint8_t *data, size_t len) {
+    uint32_t id;
+    if (len < 24 || data[0] != 0xFF || data[1] != 0xD8 ||
+        data[len - 2] != 0xFF || data[len - 1] != 0xD9) return false;
+    memcpy(&id, data + 20, sizeof(id));
+    if (id != seen.next) return false;
+    seen.next++;
+    seen.odd += len % 2;
+    return true;
+}
+
+static void check_avi(const char *path, const video_mode_t *mode) {
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (!fp || fseek(fp, 0, SEEK_END) || !( size = ftell(fp) ) ||
+        !( data = malloc(size) ) || fseek(fp, 0, SEEK_SET) ||
+        fread(data, 1, size, fp) != size) FAIL("%s: read", path);
+
+    const avi_header_t *avi = (void *)data;
+    const size_t movi = offsetof(avi_header_t, movi);
+    if (size < sizeof(*avi)) FAIL("%s: %zu Bytes", path, size);
+    if (!fourcc(avi->RIFF, "RIFF") || !fourcc(avi->AVI, "AVI ") ||
+        avi->filelen != size - 8) FAIL("%s: RIFF length %u", path, avi->filelen);
+    if (!fourcc(avi->LST1, "LIST") || !fourcc(avi->hdlr, "hdlr") ||
+        avi->lst1len != AVI_HEADER_HDLR_LEN || !fourcc(avi->avih, "avih") ||
+        !fourcc(avi->LST2, "LIST") || !fourcc(avi->strl, "strl") ||
+        !fourcc(avi->strh, "strh") || !fourcc(avi->strf, "strf") ||
+        !fourcc(avi->fourcc, "vids") || !fourcc(avi->compression, "MJPG"))
+        FAIL("%s: hdrl", path);
+    if (avi->width1 != mode->width || avi->height2 != mode->height)
+        FAIL("%s: %ux%u", path, avi->width1, avi->height2);
+    if (!fourcc(avi->LST3, "LIST") || !fourcc(avi->movi, "movi") ||
+        movi + avi->lst3len + 8 > size) FAIL("%s: movi length", path);
+
+    // chunks in movi, then idx1 right after it until the end of file
+    size_t idx1 = movi + avi->lst3len, num = 0;
+    for (size_t off = movi + 4, len; off < idx1; off += 8 + len + len % 2) {
+        const avi_frame_t *chunk = (void *)(data + off);
+        len = chunk->length;
+        if (!fourcc(chunk->two_code, "00dc") || off + 8 + len > idx1)
+            FAIL("%s: chunk %zu at %zu", path, num, off);
+        if (!check_chunk(data + off + 8, len))
+            FAIL("%s: frame %zu of %zu Bytes, expect ID %u",
+                 path, num, len, seen.next);
+        num++;
+    }
+    const avi_frame_t *chunk = (void *)(data + idx1);
+    if (!fourcc(chunk->two_code, "idx1") ||
+        chunk->length != num * sizeof(avi_index_t) ||
+        idx1 + 8 + chunk->length != size)
+        FAIL("%s: idx1 of %u Bytes for %zu frames", path, chunk->length, num);
+    const avi_index_t *idx = (void *)(data + idx1 + 8);
+    LOOPN(i, num) {
+        const avi_frame_t *frame = (void *)(data + movi + idx[i].offset);
+        if (!fourcc(idx[i].ckid, "00dc") ||
+            idx[i].flags != AVI_INDEX_KEYFRAME ||
+            movi + idx[i].offset + 8 + idx[i].length > idx1 ||
+            !fourcc(frame->two_code, "00dc") ||
+            frame->length != idx[i].length)
+            FAIL("%s: idx1 entry %zu", path, i);
+    }
+    if (avi->total_frames != num || avi->length != num)
+        FAIL("%s: %u frames in avih, %zu in movi", path, avi->total_frames, num);
+    seen.frames += num;
+    seen.segs++;
+exit:
+    if (fp) fclose(fp);
+    TRYFREE(data);
+}
+
+// optional: ffprobe (if installed) should find the same number of packets
+static void ffprobe(const char *path, size_t expect) {
+    if (system("command -v ffprobe > /dev/null")) return;
+    char cmd[PATH_MAX_LEN + 128];
+    snprintf(cmd, sizeof(cmd), "ffprobe -v error -select_streams v:0 "
+             "-count_packets -show_entries stream=nb_read_packets "
+             "-of csv=p=0 '%s'", path);
+    FILE *fp = popen(cmd, "r");
+    size_t num = 0;
+    if (fp && fscanf(fp, "%zu", &num) != 1) num = 0;
+    if (fp) pclose(fp);
+    CHECK(num == expect, "ffprobe %s: %zu packets, expect %zu",
+          path, num, expect);
+}
+
+/* Recording */
+
+static video_mode_t mode = { 10, 320, 240, 3, "MJPG" };
+
+static void record(size_t nframe, uint32_t seg_size, bool prealloc) {
+    avc_rec_t *rec = &vid_rec;
+    char tmpl[] = "/tmp/test_avi_XXXXXX", last[sizeof(rec->path)] = "";
+    uint8_t *buf = malloc(JPEG_MAX);
+    size_t frames = 0;
+    snprintf(rec->dir, sizeof(rec->dir), "%s", mkdtemp(tmpl));
+    rec->bsize = 4096;
+    rec->buf = malloc(rec->bsize);
+    rec->seg_size = seg_size;
+    rec->seg_secs = 3600;
+    rec->prealloc = prealloc;
+    memset(&seen, 0, sizeof(seen));
+
+    avc_frame_t frame = { .type = VID_EVENT_DATA };
+    LOOPN(i, nframe + 1) {
+        if (i == nframe) {
+            frame.type = VID_EVENT_STOP;
+        } else {
+            frame.vid = (video_evt_t){ i, jpeg(buf, i), buf, &mode };
+        }
+        rec->handle(rec, &frame);
+        if (!strcmp(last, rec->path) && i < nframe) continue;
+        if (last[0]) {          // segment closed: check and delete it
+            check_avi(last, &mode);
+            if (i == nframe) ffprobe(last, seen.frames - frames);
+            frames = seen.frames;
+            unlink(last);
+        }
+        strcpy(last, rec->path);          // same size
+    }
+    CHECK(seen.frames == nframe, "%zu of %zu frames recorded",
+          seen.frames, nframe);
+    CHECK(seen.segs == rec->segs && !rec->fp, "%zu of %u segments",
+          seen.segs, rec->segs);
+    CHECK(seen.odd == nframe / 2, "%zu frames of odd length", seen.odd);
+    rmdir(rec->dir);
+    rec->segs = 0;
+    TRYFREE(rec->sizes);
+    TRYFREE(rec->buf);
+    rec->cap = 0;
+    free(buf);
+}
+
+int main() {
+    srand(22);
+    record(1, 1 << 20, false);      // single frame
+    record(300, 1 << 20, false);    // single segment
+    record(300, 64 * 1024, false);  // rolled by size
+    record(300, 64 * 1024, true);   // preallocated and truncated
+    record(3000, 8 << 20, true);    // idx1 reallocated
+    return REPORT("avi");
+}
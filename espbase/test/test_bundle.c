@@ -0,0 +1,347 @@
+/*
+ * File: test_bundle.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 22:31:09
+ *
+ * Pack bundle images in the layout of `helper.py genpkg` (entries sorted by
+ * FNV-1a hash and URI) and check that bundle_init accepts only valid ones,
+ * that bundle_find hits every packed URI and misses others, including URIs
+ * whose hash collides with a packed one, and the headers of bundle_send.
+ * Colliding URIs are searched for at run time. Also compare the lookup
+ * with a linear scan of the entries.
+ */
+
+#include "host.h"
+#include "../main/server.c"
+
+#include <zlib.h>
+
+/* Partition of the bundle */
+
+static const esp_partition_t part = {
+    .type = ESP_PARTITION_TYPE_DATA, .size = 1 << 20, .label = "assets",
+};
+static uint8_t *image;
+static size_t image_len;
+
+const esp_partition_t * esp_partition_find_first(
+    esp_partition_type_t type, esp_partition_subtype_t sub, const char *label
+) {
+    return image && !strcmp(label, part.label) ? &part : NULL;
+    NOTUSED(type); NOTUSED(sub);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset,
+                             void *buf, size_t size) {
+    if (offset + size > image_len) return ESP_ERR_INVALID_SIZE;
+    memcpy(buf, image + offset, size);
+    return ESP_OK; NOTUSED(p);
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *p, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t mem,
+                             const void **ptr, esp_partition_mmap_handle_t *hdl) {
+    if (offset + size > image_len) return ESP_ERR_INVALID_SIZE;
+    *ptr = image + offset;
+    *hdl = 1;
+    return ESP_OK; NOTUSED(p); NOTUSED(mem);
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t hdl) { NOTUSED(hdl); }
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    return crc32(crc, buf, len);
+}
+
+/* Response */
+
+static struct {
+    const char *inm;        // If-None-Match of request
+    char status[32], ctype[64], etag[64], cenc[16];
+    const char *body;
+    ssize_t len;
+} resp;
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *key) {
+    return strcmp(key, "If-None-Match") ? 0 : strlen(resp.inm ?: "");
+    NOTUSED(req);
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *key,
+                                      char *buf, size_t len) {
+    snprintf(buf, len, "%s", resp.inm);
+    return ESP_OK; NOTUSED(req); NOTUSED(key);
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *key,
+                             const char *val) {
+    if (!strcmp(key, "ETag"))
+        snprintf(resp.etag, sizeof(resp.etag), "%s", val);
+    if (!strcmp(key, "Content-Encoding"))
+        snprintf(resp.cenc, sizeof(resp.cenc), "%s", val);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+    snprintf(resp.status, sizeof(resp.status), "%s", status);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+    snprintf(resp.ctype, sizeof(resp.ctype), "%s", type);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len) {
+    resp.body = buf;
+    resp.len = len;
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+    resp.body = str;
+    resp.len = 0;
+    return ESP_OK; NOTUSED(req);
+}
+
+/* Packing */
+
+#define FILES       1000
+
+typedef struct {
+    char path[32];
+    const char *ctype;
+    char data[48];
+    bool gzip;
+} file_t;
+
+static file_t files[FILES + 16];
+static size_t nfile;
+
+static file_t * add(const char *path, const char *ctype, bool gzip) {
+    file_t *file = files + nfile++;
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    snprintf(file->data, sizeof(file->data), "content of %s", path);
+    file->ctype = ctype;
+    file->gzip = gzip;
+    return file;
+}
+
+static int file_cmp(const void *a, const void *b) {
+    const file_t *fa = a, *fb = b;
+    uint32_t ha = fnv1a_hash(fa->path), hb = fnv1a_hash(fb->path);
+    return ha != hb ? (ha < hb ? -1 : 1) : strcmp(fa->path, fb->path);
+}
+
+static size_t put(size_t off, const void *data, size_t len) {
+    memcpy(image + off, data, len);
+    return off + len;
+}
+
+// same as genpkg: header, entries, strings, then 4 Bytes aligned data
+static void pack(void) {
+    qsort(files, nfile, sizeof(file_t), file_cmp);
+    size_t off = sizeof(http_bundle_t) + nfile * sizeof(http_bundle_entry_t);
+    http_bundle_entry_t *list = (void *)(image + sizeof(http_bundle_t));
+    LOOPN(i, nfile) {
+        char etag[16];
+        snprintf(etag, sizeof(etag), "\"%08zx\"", i);
+        list[i].hash = fnv1a_hash(files[i].path);
+        list[i].flags = files[i].gzip ? BUNDLE_GZIP : 0;
+        list[i].path = off;
+        off = put(off, files[i].path, strlen(files[i].path) + 1);
+        list[i].ctype = off;
+        off = put(off, files[i].ctype, strlen(files[i].ctype) + 1);
+        list[i].etag = off;
+        off = put(off, etag, strlen(etag) + 1);
+    }
+    LOOPN(i, nfile) {
+        off = (off + 3) & ~3;
+        list[i].data = off;
+        list[i].size = strlen(files[i].data);
+        off = put(off, files[i].data, list[i].size);
+    }
+    http_bundle_t head = { "EPKG", 1, nfile, off, 0 };
+    head.crc = crc32(0, image + sizeof(head), off - sizeof(head));
+    put(0, &head, sizeof(head));
+    image_len = off;
+}
+
+static bool load(void) {
+    memset(&bundle, 0, sizeof(bundle));
+    bundle_init();
+    return bundle.base != NULL;
+}
+
+// URIs of the same FNV-1a hash: dozens of pairs among 2^20 candidates
+static int find_collisions(char (*pairs)[2][32], int max) {
+    size_t num = 1 << 20;
+    uint64_t *keys = malloc(num * sizeof(uint64_t));
+    char path[32];
+    int found = 0;
+    LOOPN(i, num) {
+        snprintf(path, sizeof(path), "/c/%zx", i);
+        keys[i] = (uint64_t)fnv1a_hash(path) << 32 | i;
+    }
+    int cmp(const void *a, const void *b) {
+        uint64_t ka = *(uint64_t *)a, kb = *(uint64_t *)b;
+        return ka < kb ? -1 : ka > kb;
+    }
+    qsort(keys, num, sizeof(uint64_t), cmp);
+    LOOP(i, (size_t)1, num) {
+        if (found == max || keys[i] >> 32 != keys[i - 1] >> 32) continue;
+        snprintf(pairs[found][0], 32, "/c/%x", (uint32_t)keys[i - 1]);
+        snprintf(pairs[found][1], 32, "/c/%x", (uint32_t)keys[i]);
+        found++;
+    }
+    free(keys);
+    return found;
+}
+
+/* Cases */
+
+static void test_hash(void) {
+    static const struct {
+        const char *str;
+        uint32_t hash;
+    } vectors[] = {                     // FNV-1a 32 bits test vectors
+        { "", 0x811C9DC5 }, { "a", 0xE40C292C }, { "foobar", 0xBF9CF968 },
+    };
+    ITERP(v, vectors) {
+        CHECK(fnv1a_hash(v->str) == v->hash, "FNV-1a of `%s`: 0x%08" PRIX32,
+              v->str, fnv1a_hash(v->str));
+    }
+}
+
+static void test_lookup(char (*pairs)[2][32]) {
+    add("/", "text/html", false);
+    add("/index.html", "text/html", false);
+    add("/app.js", "application/javascript", true);
+    add("/docs/", "text/html", false);
+    add("/docs/index.html", "text/html", false);
+    LOOPN(i, FILES) {
+        char path[32];
+        snprintf(path, sizeof(path), "/f/%d.txt", i);
+        add(path, "text/plain", false);
+    }
+    add(pairs[0][0], "text/plain", false);  // both of a colliding pair
+    add(pairs[0][1], "text/plain", false);
+    add(pairs[1][1], "text/plain", false);  // one of a colliding pair
+    pack();
+    CHECK(load() && bundle.head->count == nfile, "bundle of %zu files", nfile);
+
+    size_t fails = 0;
+    LOOPN(i, nfile) {
+        const http_bundle_entry_t *entry = bundle_find(files[i].path);
+        if (entry && !strcmp(bundle.base + entry->path, files[i].path) &&
+            entry->size == strlen(files[i].data) &&
+            !memcmp(bundle.base + entry->data, files[i].data, entry->size))
+            continue;
+        if (!fails++) printf("lookup of %s failed\n", files[i].path);
+    }
+    CHECK(!fails, "%zu of %zu lookups failed", fails, nfile);
+    CHECK(fnv1a_hash(pairs[1][0]) == fnv1a_hash(pairs[1][1]) &&
+          !bundle_find(pairs[1][0]), "%s collides with packed %s",
+          pairs[1][0], pairs[1][1]);
+    CHECK(bundle_find(pairs[0][0]) != bundle_find(pairs[0][1]),
+          "both %s and %s packed", pairs[0][0], pairs[0][1]);
+    const char *misses[] = {
+        "", "/nope", "/index.htm", "/index.html/", "/docs", "/f/1000.txt",
+        "/F/1.txt", "/f/1.txt ", "/c/",
+    };
+    ITERV(path, misses) {
+        CHECK(!bundle_find(path), "`%s` found", path);
+    }
+}
+
+static void test_init(void) {
+    http_bundle_t *head = (void *)image;
+    size_t len = image_len;
+    image[len - 1] ^= 1;
+    CHECK(!load(), "data corrupted");
+    image[len - 1] ^= 1;
+    head->magic[0] = 'X';
+    CHECK(!load(), "magic");
+    head->magic[0] = 'E';
+    head->version = 2;
+    CHECK(!load(), "version");
+    head->version = 1;
+    head->count = (part.size - sizeof(*head)) / sizeof(http_bundle_entry_t);
+    CHECK(!load(), "entries out of image");
+    head->count = nfile;
+    image_len = sizeof(*head) - 1;
+    CHECK(!load(), "header cut");
+    image_len = len;
+    CHECK(load(), "valid bundle after errors");
+
+    // no entries: every lookup misses
+    size_t num = nfile;
+    nfile = 0;
+    pack();
+    CHECK(load() && !bundle_find("/") && !bundle_find(""), "empty bundle");
+    nfile = num;
+    pack();
+    CHECK(load(), "bundle reloaded");
+}
+
+static void test_send(void) {
+    httpd_req_t req = { 0 };
+    memset(&resp, 0, sizeof(resp));
+    CHECK(bundle_send(&req, "/app.js") == ESP_OK &&
+          !strcmp(resp.ctype, "application/javascript") &&
+          !strcmp(resp.cenc, "gzip") && resp.etag[0] == '"' &&
+          resp.len == (ssize_t)strlen("content of /app.js") &&
+          !memcmp(resp.body, "content of /app.js", resp.len), "/app.js");
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "%s", resp.etag);
+    memset(&resp, 0, sizeof(resp));
+    resp.inm = etag;
+    CHECK(bundle_send(&req, "/app.js") == ESP_OK &&
+          !strcmp(resp.status, "304 Not Modified") && !resp.len,
+          "If-None-Match: %s", etag);
+
+    memset(&resp, 0, sizeof(resp));
+    CHECK(bundle_send(&req, "/index.html") == ESP_OK && !resp.cenc[0] &&
+          strcmp(resp.etag, etag) && !strcmp(resp.ctype, "text/html"),
+          "/index.html");
+    CHECK(bundle_send(&req, "/missing") == ESP_ERR_NOT_FOUND, "missing");
+}
+
+static void bench(void) {
+    int iters = 200, scans = 10;
+    size_t found = 0;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        LOOPN(j, nfile) { found += bundle_find(files[j].path) != NULL; }
+    }
+    double us = host_usec(ts, iters * nfile);
+    ts = esp_timer_get_time();
+    LOOPN(i, scans) {
+        LOOPN(j, nfile) {
+            LOOPN(k, (size_t)bundle.head->count) {
+                if (strcmp(bundle.base + bundle.list[k].path, files[j].path))
+                    continue;
+                found++;
+                break;
+            }
+        }
+    }
+    double lin = host_usec(ts, scans * nfile);
+    CHECK(found == (iters + scans) * nfile, "%zu found", found);
+    printf("bundle_find: %.3f us per lookup in %zu entries "
+           "(linear scan %.3f us)\n", us, nfile, lin);
+}
+
+int main() {
+    char pairs[2][2][32];
+    image = malloc(part.size);
+    test_hash();
+    CHECK(find_collisions(pairs, 2) == 2, "no colliding URIs found");
+    test_lookup(pairs);
+    test_init();
+    test_send();
+    bench();
+    free(image);
+    return REPORT("bundle");
+}
@@ -0,0 +1,176 @@
+/*
+ * File: test_console.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 22:58:14
+ *
+ * Run packed RPC requests from two tasks at the same time and check the
+ * locks of console_exec: different registered commands run in parallel,
+ * the same command runs once at a time, and commands that fall back to
+ * esp_console_run share the global mutex. Output of each request must be
+ * its own. Also report the throughput of each case.
+ */
+
+#include "host.h"
+
+#include <pthread.h>
+
+// stdout of newlib is per task in ESP-IDF, but global in glibc
+static __thread FILE *task_stdout;
+
+static FILE ** task_out(void) {
+    if (!task_stdout) task_stdout = stdout;
+    return &task_stdout;
+}
+
+#undef stdout
+#define stdout (*task_out())
+
+#include "../main/console.c"
+
+#define WORK_US     1000        // run time of each command
+#define CALLS       100         // requests per task
+
+/* Commands */
+
+static struct {
+    int inside[3], peak[3];     // alpha, beta, esp_console_run
+    int running, concurrent;
+} stat;
+
+static void enter(int *inside, int *peak) {
+    int num = __atomic_add_fetch(inside, 1, __ATOMIC_SEQ_CST);
+    for (int max = *peak; num > max;) {
+        if (__atomic_compare_exchange_n(peak, &max, num, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            break;
+    }
+}
+
+static int work(int group, int argc, char **argv) {
+    enter(stat.inside + group, stat.peak + group);
+    enter(&stat.running, &stat.concurrent);
+    usleep(WORK_US);
+    if (argc > 1) fputs(argv[1], stdout);
+    __atomic_sub_fetch(&stat.running, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(stat.inside + group, 1, __ATOMIC_SEQ_CST);
+    return ESP_OK;
+}
+
+static int alpha(int argc, char **argv) { return work(0, argc, argv); }
+static int beta(int argc, char **argv) { return work(1, argc, argv); }
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd) {
+    return ESP_OK; NOTUSED(cmd);
+}
+
+size_t esp_console_split_argv(char *line, char **argv, size_t argv_size) {
+    size_t argc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " ", &save); tok && argc < argv_size - 1;
+         tok = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+int linenoiseHistoryAdd(const char *line) { return 0; NOTUSED(line); }
+
+// `gamma` and `delta` are not in the registry of console.c
+esp_err_t esp_console_run(const char *cmdline, int *ret) {
+    char *line = strdup(cmdline), *argv[CONSOLE_ARGS + 1];
+    size_t argc = esp_console_split_argv(line, argv, LEN(argv));
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (argc && (!strcmp(argv[0], "gamma") || !strcmp(argv[0], "delta")))
+        err = ESP_OK, *ret = work(2, argc, argv);
+    free(line);
+    return err;
+}
+
+/* Tasks */
+
+typedef struct {
+    const char *method;
+    int id, replies, busy, wrong;
+    pthread_t thread;
+} task_t;
+
+static void * task_run(void *arg) {
+    task_t *task = arg;
+    char *data = NULL, tag[16], reply[16];
+    size_t len = 0, olen;
+    LOOPN(i, CALLS) {
+        snprintf(tag, sizeof(tag), "t%d-%d", task->id, i);
+        FILE *req = open_memstream(&data, &len);
+        mp_put_map(req, 3);
+        mp_put_str(req, "id");
+        mp_put_int(req, i);
+        mp_put_str(req, "method");
+        mp_put_str(req, task->method);
+        mp_put_str(req, "params");
+        mp_put_array(req, 1);
+        mp_put_str(req, tag);
+        fclose(req);
+        uint8_t *out = console_handle_rpc_binary((uint8_t *)data, len, &olen);
+        mp_reader_t rd = { out, out + olen };
+        mp_item_t item;
+        LOOPN(j, 6) { mp_read(&rd, &item); }   // map, jsonrpc, 2.0, id, ...
+        if (mp_read(&rd, &item) && item.type == MP_STR) {
+            snprintf(reply, sizeof(reply), "%.*s", (int)item.len, item.str);
+            task->replies++;
+            if (!strcmp(reply, "Console task is busy")) task->busy++;
+            else if (strcmp(reply, tag)) task->wrong++;
+        }
+        TRYFREE(out);
+        TRYFREE(data);
+    }
+    return NULL;
+}
+
+// run methods `a` and `b` in two tasks, return microseconds taken
+static int64_t run(const char *a, const char *b, bool parallel) {
+    task_t tasks[2] = { { .method = a, .id = 1 }, { .method = b, .id = 2 } };
+    memset(&stat, 0, sizeof(stat));
+    int64_t ts = esp_timer_get_time();
+    ITERP(task, tasks) { pthread_create(&task->thread, NULL, task_run, task); }
+    ITERP(task, tasks) { pthread_join(task->thread, NULL); }
+    int64_t us = esp_timer_get_time() - ts;
+    ITERP(task, tasks) {
+        CHECK(task->replies == CALLS && !task->busy && !task->wrong,
+              "%s | %s: %d replies, %d busy, %d wrong output", a, b,
+              task->replies, task->busy, task->wrong);
+    }
+    LOOPN(i, LEN(stat.peak)) {
+        CHECK(stat.peak[i] <= 1, "%s | %s: group %zu run %d times at once",
+              a, b, i, stat.peak[i]);
+    }
+    if (parallel) {
+        CHECK(stat.concurrent == 2 && us < CALLS * WORK_US * 3 / 2,
+              "%s | %s: not parallel, %d at once in %.1f ms", a, b,
+              stat.concurrent, us / 1e3);
+    } else {
+        CHECK(stat.concurrent == 1 && us >= CALLS * WORK_US * 2,
+              "%s | %s: not serialized, %d at once in %.1f ms", a, b,
+              stat.concurrent, us / 1e3);
+    }
+    printf("%-5s | %-5s: %4.0f requests/s, %d at once\n", a, b,
+           2e6 * CALLS / us, stat.concurrent);
+    return us;
+}
+
+int main() {
+    static const esp_console_cmd_t cmds[] = {
+        { .command = "alpha", .func = alpha },
+        { .command = "beta", .func = beta },
+    };
+    ITERP(cmd, cmds) {
+        CHECK(!console_register_command(cmd), "register %s", cmd->command);
+    }
+    CHECK(( mutex = MUTEX() ) && RELEASE(mutex), "global mutex");
+
+    run("alpha", "beta", true);     // different locks
+    run("alpha", "gamma", true);    // own lock and global mutex
+    run("alpha", "alpha", false);   // same lock
+    run("gamma", "delta", false);   // both global mutex
+    return REPORT("console");
+}
@@ -0,0 +1,326 @@
+/*
+ * File: test_delta.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 20:25:14
+ *
+ * Feed delta OTA patches (header of helper.py genpatch) and plain images
+ * to ota_updation_write split at arbitrary points, through the writer task
+ * of the pipeline, and check the image written to the target partition and
+ * the errors of a wrong base app, truncated patches and flash failures.
+ * esp_delta_ota (detools) is replaced by a toy applier of copy / insert
+ * ops, so what is checked here is the magic and header handling, reading
+ * the running partition and writing through ota_image_write.
+ */
+
+#include "host.h"
+#include "../main/update.c"
+
+/* esp_delta_ota: op header is 'C' (copy from base), offset, length or
+ * 'I' (insert), length, 0 in little endian, then the inserted bytes */
+
+#define OP_LEN      9
+
+typedef struct {
+    esp_delta_ota_cfg_t cfg;
+    uint8_t op[OP_LEN];
+    size_t olen, remain;    // bytes of op header, bytes left to insert
+} delta_t;
+
+esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg) {
+    delta_t *delta = calloc(1, sizeof(delta_t));
+    if (delta) delta->cfg = *cfg;
+    return delta;
+}
+
+static esp_err_t delta_copy(delta_t *delta, uint32_t offset, uint32_t len) {
+    uint8_t buf[512];
+    esp_err_t err = ESP_OK;
+    for (uint32_t n; len && !err; offset += n, len -= n) {
+        n = MIN(len, (uint32_t)sizeof(buf));
+        err = delta->cfg.read_cb(buf, n, offset) ?: delta->cfg.write_cb(buf, n);
+    }
+    return err;
+}
+
+esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t hdl,
+                                   const uint8_t *buf, int size) {
+    delta_t *delta = hdl;
+    esp_err_t err = ESP_OK;
+    while (size > 0 && !err) {
+        if (delta->remain) {
+            size_t len = MIN(delta->remain, (size_t)size);
+            err = delta->cfg.write_cb(buf, len);
+            delta->remain -= len;
+            buf += len;
+            size -= len;
+            continue;
+        }
+        delta->op[delta->olen++] = *buf++;
+        size--;
+        if (delta->olen < OP_LEN) continue;
+        uint32_t a, b;
+        memcpy(&a, delta->op + 1, 4);
+        memcpy(&b, delta->op + 5, 4);
+        delta->olen = 0;
+        if (delta->op[0] == 'C') {
+            err = delta_copy(delta, a, b);
+        } else if (delta->op[0] == 'I') {
+            delta->remain = a;
+        } else {
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    return err;
+}
+
+esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t hdl) {
+    delta_t *delta = hdl;
+    return delta->olen || delta->remain ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t esp_delta_ota_deinit(esp_delta_ota_handle_t hdl) {
+    free(hdl);
+    return ESP_OK;
+}
+
+/* Partitions: base app in running one, new image collected in `out` */
+
+#define BASE_SIZE   (96 * 1024)
+#define IMAGE_MAX   (128 * 1024)
+
+static const esp_partition_t running = { .label = "ota_0", .size = 1 << 20 };
+static const esp_partition_t target = { .label = "ota_1", .size = 1 << 20 };
+static uint8_t base[BASE_SIZE];
+
+static struct {
+    uint8_t buf[IMAGE_MAX];
+    size_t len, fail;       // esp_ota_write fails after `fail` bytes if set
+    bool aborted, ended;
+} out;
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                             void *buf, size_t size) {
+    if (part != &running || offset + size > BASE_SIZE) return ESP_FAIL;
+    memcpy(buf, base + offset, size);
+    return ESP_OK;
+}
+
+// not a real SHA-256: only needs to change with the base app
+esp_err_t esp_partition_get_sha256(const esp_partition_t *part, uint8_t *out) {
+    LOOPN(i, 32) { out[i] = base[i * 997] ^ 0x5A; }
+    return part == &running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *part, size_t size,
+                        esp_ota_handle_t *hdl) {
+    out.len = 0;
+    out.aborted = out.ended = false;
+    *hdl = 1;
+    return part == &target ? ESP_OK : ESP_FAIL; NOTUSED(size);
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t hdl, const void *data, size_t size) {
+    if (out.fail && out.len + size > out.fail) return ESP_ERR_TIMEOUT;
+    if (out.len + size > sizeof(out.buf)) return ESP_ERR_INVALID_SIZE;
+    memcpy(out.buf + out.len, data, size);
+    out.len += size;
+    return ESP_OK; NOTUSED(hdl);
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t hdl) {
+    out.ended = true;
+    return ESP_OK; NOTUSED(hdl);
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t hdl) {
+    out.aborted = true;
+    return ESP_OK; NOTUSED(hdl);
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *part) {
+    return part == &target ? ESP_OK : ESP_FAIL;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *c) { NOTUSED(c); }
+void mbedtls_sha256_free(mbedtls_sha256_context *c) { NOTUSED(c); }
+void mbedtls_sha256_clone(mbedtls_sha256_context *d,
+                          const mbedtls_sha256_context *s) {
+    NOTUSED(d); NOTUSED(s);
+}
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int is224) {
+    return 0; NOTUSED(c); NOTUSED(is224);
+}
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const unsigned char *b,
+                          size_t l) {
+    return 0; NOTUSED(c); NOTUSED(b); NOTUSED(l);
+}
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, unsigned char *d) {
+    memset(d, 0, 32);
+    return 0; NOTUSED(c);
+}
+
+esp_err_t config_nvs_open(void **ptr, const char *ns, bool ro) {
+    return ESP_FAIL; NOTUSED(ptr); NOTUSED(ns); NOTUSED(ro);
+}
+int config_nvs_write(void *hdl, const char *key, const void *val, size_t len) {
+    return -1; NOTUSED(hdl); NOTUSED(key); NOTUSED(val); NOTUSED(len);
+}
+esp_err_t config_nvs_close(void **ptr) { return ESP_OK; NOTUSED(ptr); }
+
+// gzip images are tested by test_gzip.c
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in,
+                              size_t *ilen, uint8_t *start, uint8_t *out,
+                              size_t *olen, const uint32_t flags) {
+    abort(); NOTUSED(r); NOTUSED(in); NOTUSED(ilen); NOTUSED(start);
+    NOTUSED(out); NOTUSED(olen); NOTUSED(flags);
+}
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    abort(); NOTUSED(crc); NOTUSED(buf); NOTUSED(len);
+}
+
+/* Samples */
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} sample_t;
+
+static uint8_t image[IMAGE_MAX];
+static size_t image_len;
+
+static void put_op(sample_t *s, uint8_t type, uint32_t a, uint32_t b) {
+    s->data[s->len] = type;
+    memcpy(s->data + s->len + 1, &a, 4);
+    memcpy(s->data + s->len + 5, &b, 4);
+    s->len += OP_LEN;
+}
+
+// base app alike, and a new image of copied and inserted blocks with the
+// patch between them
+static sample_t make_patch(void) {
+    sample_t s = { malloc(2 * IMAGE_MAX), DELTA_HDR };
+    srand(14);
+    LOOPN(i, BASE_SIZE) { base[i] = i % 7 ? rand() : i >> 8; }
+    base[0] = 0xE9;
+    uint32_t magic = DELTA_MAGIC;
+    memset(s.data, 0, DELTA_HDR);
+    memcpy(s.data, &magic, sizeof(magic));
+    esp_partition_get_sha256(&running, s.data + 4);
+    for (image_len = 0; image_len < IMAGE_MAX - 8192;) {
+        uint32_t len = 1 + rand() % 4096;
+        if (rand() % 2) {
+            uint32_t off = rand() % (BASE_SIZE - len);
+            put_op(&s, 'C', off, len);
+            memcpy(image + image_len, base + off, len);
+        } else {
+            len %= 1024;
+            put_op(&s, 'I', len, 0);
+            LOOPN(i, len) { image[image_len + i] = rand(); }
+            memcpy(s.data + s.len, image + image_len, len);
+            s.len += len;
+        }
+        image_len += len;
+    }
+    return s;
+}
+
+// feed chunks of `step` bytes (random if 0) after the first `split` bytes
+static esp_err_t feed(const sample_t *s, size_t split, size_t step) {
+    ota_updation_reset();   // handle is kept after success until reboot
+    if (!ota_updation_begin(0)) return ctx.error;
+    for (size_t off = 0, len; off < s->len; off += len) {
+        len = MIN(!off && split ? split : step ?: 1 + rand() % 4096,
+                  s->len - off);
+        if (!ota_updation_write(s->data + off, len)) break;
+    }
+    CHECK(ota_updation_end() == !ctx.error, "end: %s", ota_updation_error());
+    CHECK(out.ended != out.aborted, "ended %d, aborted %d",
+          out.ended, out.aborted);
+    return ctx.error;
+}
+
+static bool written(const uint8_t *data, size_t len) {
+    return out.len == len && !memcmp(out.buf, data, len) && ctx.saved == len;
+}
+
+static void test_patch(const sample_t *s) {
+    size_t fails = 0;
+    CHECK(!ota_is_patch(s->data, 3) && ota_is_patch(s->data, 4), "magic");
+    // every split in magic and header, and some in the ops
+    LOOP(split, (size_t)1, (size_t)s->len) {
+        if (split > DELTA_HDR + OP_LEN * 2 && split % 1009) continue;
+        if (!feed(s, split, s->len) && written(image, image_len)) continue;
+        if (!fails++) printf("patch split at %zu: %s\n",
+                             split, ota_updation_error());
+    }
+    LOOPN(round, 20) {
+        if (!feed(s, 0, 0) && written(image, image_len)) continue;
+        if (!fails++) printf("patch in random chunks: %s\n",
+                             ota_updation_error());
+    }
+    if (feed(s, 0, 1) || !written(image, image_len)) fails++;
+    CHECK(!fails, "patch: %zu failures", fails);
+}
+
+// plain images are written as they are, even if the magic is split
+static void test_image(void) {
+    sample_t s = { base, BASE_SIZE };
+    LOOP(split, (size_t)1, (size_t)OTA_MAGIC_LEN + 2) {
+        CHECK(!feed(&s, split, 1460) && written(base, BASE_SIZE),
+              "image split at %zu: %s", split, ota_updation_error());
+    }
+    LOOP(len, (size_t)1, (size_t)OTA_MAGIC_LEN + 1) {
+        s.len = len;
+        CHECK(!feed(&s, 1, 1) && written(base, len), "image of %zu bytes: "
+              "%zu written, %s", len, out.len, ota_updation_error());
+    }
+}
+
+static void test_errors(sample_t *s) {
+    size_t len = s->len;
+
+    s->data[10] ^= 1;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_VERSION && !out.len, "base app");
+    s->data[10] ^= 1;
+
+    s->len = DELTA_HDR - 1;
+    CHECK(feed(s, 2, 1) == ESP_ERR_INVALID_SIZE, "header only");
+    s->len = len - 1;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_SIZE, "patch cut");
+    s->len = len;
+
+    uint8_t op = s->data[DELTA_HDR];
+    s->data[DELTA_HDR] = 'X';
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_ARG, "bad op");
+    s->data[DELTA_HDR] = op;
+
+    // flash error in writer task stops the patch
+    out.fail = 50000;
+    CHECK(feed(s, 0, 1460) == ESP_ERR_TIMEOUT, "flash error");
+    CHECK(out.len <= out.fail && ctx.saved == out.len, "%zu written",
+          out.len);
+    out.fail = 0;
+    CHECK(!feed(s, 0, 0) && written(image, image_len), "after errors");
+}
+
+static void bench(const sample_t *s) {
+    int iters = 50;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) { feed(s, 0, 1460); }
+    double us = host_usec(ts, iters);
+    printf("ota_updation_write: %.1f us per %zu KB patch (%.1f MB/s image)\n",
+           us, s->len / 1024, image_len / us);
+}
+
+int main() {
+    freopen("/dev/null", "w", stderr);  // progress printed by ota_flash
+    ctx.running = &running;
+    ctx.target = &target;
+    sample_t s = make_patch();
+    test_patch(&s);
+    test_image();
+    test_errors(&s);
+    bench(&s);
+    free(s.data);
+    return REPORT("delta");
+}
@@ -0,0 +1,168 @@
+/*
+ * File: test_dsp.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 19:10:26
+ *
+ * Golden vectors of the fixed-point DSP chain in dsp_apply: step response
+ * of the DC blocker, Q12 gain with saturation and the soft-knee limiter.
+ * Expected samples are listed literally (a floating point model of each
+ * stage agrees within 1 LSB), so any change of the arithmetic shows up.
+ * Also check config clamping in dsp_update, residual DC and levels of a
+ * long signal, and report the cost of a 20ms frame.
+ */
+
+#include "host.h"
+
+// sensor_t of the 64-bit host is too large for the uint8_t offsets that
+// are checked on target: camera attributes are not tested here.
+#define _Static_assert(...)
+#pragma GCC diagnostic ignored "-Woverflow"
+
+#include "../main/avcmode.c"
+
+#include <math.h>
+
+#define FRAME       ( PDM_SHZ / 50 )        // samples of 20ms per channel
+
+static audio_mode_t mono = { PDM_SHZ, 1, PDM_BPC };
+static audio_mode_t stereo = { PDM_SHZ, 2, PDM_BPC };
+
+static void setup(int hpf, int gain, int limit) {
+    dsp.cfg.hpf = hpf;
+    dsp.cfg.gain = gain;
+    dsp.cfg.limit = limit;
+    dsp_update();
+    dsp_reset();
+}
+
+static audio_evt_t apply(audio_mode_t *mode, int16_t *buf, size_t num) {
+    audio_evt_t evt = { 0, num * PDM_BPC, buf, mode };
+    dsp_apply(&evt);
+    return evt;
+}
+
+static void test_update(void) {
+    static const struct {
+        int16_t hpf, gain, limit;       // config before and after dsp_update
+        int16_t hpf2, gain2, limit2;
+        int32_t mul, knee;
+    } cases[] = {
+        {   20,   0,  -1,     20,   0,  -1,  4096, 29203 },
+        { 5000,  30,   3,   1000,  18,   0, 32536,     0 },
+        {   -5, -60, -40,      0, -40, -24,    41,  2067 },
+        {    0,   6,  -6,      0,   6,  -6,  8173, 16422 },
+    };
+    ITERP(c, cases) {
+        setup(c->hpf, c->gain, c->limit);
+        CHECK(dsp.cfg.hpf == c->hpf2 && dsp.cfg.gain == c->gain2 &&
+              dsp.cfg.limit == c->limit2, "clamp %d %d %d: %d %d %d",
+              c->hpf, c->gain, c->limit,
+              dsp.cfg.hpf, dsp.cfg.gain, dsp.cfg.limit);
+        CHECK(dsp.mul == c->mul && dsp.knee == c->knee, "gain %d limit %d: "
+              "mul %d knee %d", c->gain2, c->limit2, dsp.mul, dsp.knee);
+        CHECK(dsp.mul <= INT16_MAX, "Q12 gain %d overflows", dsp.mul);
+    }
+}
+
+static void golden(const char *desc, const int16_t *inp, const int16_t *exp,
+                   size_t num) {
+    int16_t buf[num];
+    memcpy(buf, inp, sizeof(buf));
+    apply(&mono, buf, num);
+    LOOPN(i, num) {
+        CHECK(buf[i] == exp[i], "%s: sample %zu of %d: %d, expect %d",
+              desc, i, inp[i], buf[i], exp[i]);
+    }
+}
+
+static void test_golden(void) {
+    // DC blocker (20Hz, pole 32510/32768) on a step of 10000
+    static const int16_t step[16] = {
+        10000, 10000, 10000, 10000, 10000, 10000, 10000, 10000,
+        10000, 10000, 10000, 10000, 10000, 10000, 10000, 10000,
+    };
+    static const int16_t hpf[16] = {
+        10000, 9921, 9843, 9765, 9688, 9612, 9536, 9461,
+        9387, 9313, 9239, 9167, 9095, 9023, 8952, 8881,
+    };
+    setup(20, 0, 0);
+    golden("hpf", step, hpf, LEN(step));
+
+    // +6dB (Q12 8173) rounded to nearest and saturated symmetrically
+    static const int16_t samples[] = {
+        1, -1, 100, -100, 4095, 16000, 16500, -16500, 32767, -32768,
+    };
+    static const int16_t gain[] = {
+        2, -2, 200, -200, 8171, 31926, 32767, -32767, 32767, -32767,
+    };
+    setup(0, 6, 0);
+    golden("gain", samples, gain, LEN(samples));
+
+    // soft knee at -6dBFS (16422) compressed towards but never to 0dBFS
+    static const int16_t loud[] = {
+        1000, 16000, 16422, 16423, 16500, 20000,
+        24000, 28000, 32767, -32768, -20000,
+    };
+    static const int16_t knee[] = {
+        1000, 16000, 16422, 16422, 16499, 19357,
+        21599, 23199, 24594, -24594, -19357,
+    };
+    setup(0, 0, -6);
+    golden("knee", loud, knee, LEN(loud));
+
+    // both: +18dB into the knee at -1dBFS keeps headroom
+    static const int16_t hot[] = { 32767, -32768, 4000, -4000 };
+    static const int16_t limit[] = { 32712, -32712, 30696, -30696 };
+    setup(0, 18, -1);
+    golden("gain + knee", hot, limit, LEN(hot));
+}
+
+// DC offsets on both channels and a 1kHz tone on the left one for 1s
+static void test_dc(int gain) {
+    int16_t buf[FRAME * 2];
+    double sum[2] = { 0 };
+    size_t num = 0, n = 0;
+    audio_evt_t evt;
+    setup(20, gain, 0);
+    double amp = 3000 / pow(10, gain / 20.0);
+    LOOPN(frame, 50) {
+        LOOPN(i, FRAME) {
+            buf[2 * i] = 5000 + amp * sin(2 * M_PI * 1000 * n++ / PDM_SHZ);
+            buf[2 * i + 1] = -7000;
+        }
+        evt = apply(&stereo, buf, LEN(buf));
+        if (frame < 25) continue;           // settled after 0.5s
+        LOOPN(i, FRAME) {
+            sum[0] += buf[2 * i];
+            sum[1] += buf[2 * i + 1];
+        }
+        num += FRAME;
+    }
+    CHECK(fabs(sum[0] / num) < 0.1 && fabs(sum[1] / num) < 0.1,
+          "%+ddB: residual DC %.2f %.2f", gain, sum[0] / num, sum[1] / num);
+    CHECK(abs(evt.peak[0] - 3000) < 30 && abs(evt.rms[0] - 2121) < 20,
+          "%+ddB: tone peak %u rms %u", gain, evt.peak[0], evt.rms[0]);
+    CHECK(evt.peak[1] <= 1 && !evt.rms[1], "%+ddB: DC peak %u rms %u",
+          gain, evt.peak[1], evt.rms[1]);
+}
+
+static void bench(audio_mode_t *mode) {
+    int16_t buf[FRAME * 2];
+    size_t num = FRAME * mode->nch, iters = 100000;
+    LOOPN(i, num) { buf[i] = 12000 * sin(i / 3.0) + rand() % 2000; }
+    setup(20, 6, -1);
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) { apply(mode, buf, num); }
+    printf("dsp_apply: %.2f us per 20ms frame of %u channel(s)\n",
+           host_usec(ts, iters), mode->nch);
+}
+
+int main() {
+    test_update();
+    test_golden();
+    test_dc(0);
+    test_dc(12);
+    bench(&mono);
+    bench(&stereo);
+    return REPORT("dsp");
+}
@@ -0,0 +1,293 @@
+/*
+ * File: test_gzip.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 15:20:36
+ *
+ * Feed gzip compressed images to ota_gzip_feed split at arbitrary points
+ * and check the inflated output and the error of ota_gzip_end.
+ * Images are generated with zlib, including every optional header field.
+ * ROM tinfl is replaced by raw inflate of zlib, so what is checked here
+ * is the header parser, the circular window and the GZ_TAIL handling.
+ * Images are also fed to ota_updation_write in first chunks shorter than
+ * the gzip magic, through the writer task of the pipeline.
+ */
+
+#include "host.h"
+#include "../main/update.c"
+
+#include <zlib.h>
+
+/* tinfl_decompress on zlib: one stream at a time is enough */
+
+static z_stream zs;
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in,
+                              size_t *ilen, uint8_t *start, uint8_t *out,
+                              size_t *olen, const uint32_t flags) {
+    if (!r->m_state) {
+        if (zs.state ? inflateReset(&zs) : inflateInit2(&zs, -MAX_WBITS))
+            return TINFL_STATUS_FAILED;
+        r->m_state = 1;
+    }
+    zs.next_in = (uint8_t *)in;
+    zs.avail_in = *ilen;
+    zs.next_out = out;
+    zs.avail_out = *olen;
+    int ret = inflate(&zs, Z_NO_FLUSH);
+    *ilen -= zs.avail_in;
+    *olen -= zs.avail_out;
+    if (ret == Z_STREAM_END) return TINFL_STATUS_DONE;
+    if (ret != Z_OK && ret != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+    return zs.avail_out ? TINFL_STATUS_NEEDS_MORE_INPUT
+                        : TINFL_STATUS_HAS_MORE_OUTPUT; NOTUSED(start);
+    NOTUSED(flags);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    return crc32(crc, buf, len);
+}
+
+/* Flash and NVS: inflated image is collected in `out` */
+
+static const esp_partition_t target = { .label = "ota_1", .size = 1 << 20 };
+
+static struct {
+    uint8_t *buf;
+    size_t len, size;
+} out;
+
+esp_err_t esp_ota_write(esp_ota_handle_t hdl, const void *data, size_t size) {
+    if (out.len + size > out.size) return ESP_ERR_INVALID_SIZE;
+    memcpy(out.buf + out.len, data, size);
+    out.len += size;
+    return ESP_OK; NOTUSED(hdl);
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *part, size_t size,
+                        esp_ota_handle_t *hdl) {
+    *hdl = 1;
+    return ESP_OK; NOTUSED(part); NOTUSED(size);
+}
+esp_err_t esp_ota_end(esp_ota_handle_t hdl) { return ESP_OK; NOTUSED(hdl); }
+esp_err_t esp_ota_abort(esp_ota_handle_t hdl) { return ESP_OK; NOTUSED(hdl); }
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *part) {
+    return ESP_OK; NOTUSED(part);
+}
+
+// patches are tested by test_delta.c
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                             void *buf, size_t size) {
+    abort(); NOTUSED(part); NOTUSED(offset); NOTUSED(buf); NOTUSED(size);
+}
+esp_err_t esp_partition_get_sha256(const esp_partition_t *part, uint8_t *out) {
+    abort(); NOTUSED(part); NOTUSED(out);
+}
+esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg) {
+    abort(); NOTUSED(cfg);
+}
+esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t hdl,
+                                   const uint8_t *buf, int size) {
+    abort(); NOTUSED(hdl); NOTUSED(buf); NOTUSED(size);
+}
+esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t hdl) {
+    abort(); NOTUSED(hdl);
+}
+esp_err_t esp_delta_ota_deinit(esp_delta_ota_handle_t hdl) {
+    abort(); NOTUSED(hdl);
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *c) { NOTUSED(c); }
+void mbedtls_sha256_free(mbedtls_sha256_context *c) { NOTUSED(c); }
+void mbedtls_sha256_clone(mbedtls_sha256_context *d,
+                          const mbedtls_sha256_context *s) {
+    NOTUSED(d); NOTUSED(s);
+}
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int is224) {
+    return 0; NOTUSED(c); NOTUSED(is224);
+}
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const unsigned char *b,
+                          size_t l) {
+    return 0; NOTUSED(c); NOTUSED(b); NOTUSED(l);
+}
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, unsigned char *d) {
+    memset(d, 0, 32);
+    return 0; NOTUSED(c);
+}
+
+esp_err_t config_nvs_open(void **ptr, const char *ns, bool ro) {
+    return ESP_FAIL; NOTUSED(ptr); NOTUSED(ns); NOTUSED(ro);
+}
+int config_nvs_write(void *hdl, const char *key, const void *val, size_t len) {
+    return -1; NOTUSED(hdl); NOTUSED(key); NOTUSED(val); NOTUSED(len);
+}
+esp_err_t config_nvs_close(void **ptr) { return ESP_OK; NOTUSED(ptr); }
+
+/* Samples */
+
+#define IMAGE_SIZE  (160 * 1024)    // larger than the 32KB window
+
+typedef struct {
+    const char *desc;
+    uint8_t *data;
+    size_t len;
+} sample_t;
+
+static uint8_t image[IMAGE_SIZE];
+
+// firmware alike: code with repeated patterns, tables, strings and padding
+static void make_image(void) {
+    srand(2);
+    for (size_t off = 0, len; off < IMAGE_SIZE; off += len) {
+        len = MIN(IMAGE_SIZE - off, 64 + rand() % 4096);
+        int kind = rand() % 4;
+        LOOPN(i, len) {
+            image[off + i] = kind == 0 ? rand() :
+                             kind == 1 ? image[(off + i) / 3] :
+                             kind == 2 ? "espbase firmware\n"[i % 17] : 0xFF;
+        }
+    }
+}
+
+static sample_t gzip(const char *desc, int level, gz_header *head) {
+    z_stream zs = { 0 };
+    sample_t s = { desc, malloc(compressBound(IMAGE_SIZE) + 1024), 0 };
+    deflateInit2(&zs, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    if (head) deflateSetHeader(&zs, head);
+    zs.next_in = image;
+    zs.avail_in = IMAGE_SIZE;
+    zs.next_out = s.data;
+    zs.avail_out = compressBound(IMAGE_SIZE) + 1024;
+    CHECK(deflate(&zs, Z_FINISH) == Z_STREAM_END, "deflate %s", desc);
+    s.len = zs.total_out;
+    deflateEnd(&zs);
+    return s;
+}
+
+// feed chunks of `step` bytes (random if 0) after the first `split` bytes
+static esp_err_t feed(const sample_t *s, size_t split, size_t step) {
+    memset(&ctx, 0, sizeof(ctx));
+    out.len = 0;
+    if (!ota_is_gzip(s->data, s->len) || !ota_gzip_begin()) return ESP_FAIL;
+    for (size_t off = 0, len; off < s->len; off += len) {
+        len = !off && split ? split : step ?: 1 + rand() % 8192;
+        if (!ota_gzip_feed(s->data + off, MIN(len, s->len - off))) break;
+    }
+    ota_gzip_end();
+    return ctx.error;
+}
+
+// same through ota_updation_write, which holds the magic until it is known
+static esp_err_t feed_ota(const sample_t *s, size_t split, size_t step) {
+    ota_updation_reset();   // handle is kept after success until reboot
+    ctx.target = &target;
+    out.len = 0;
+    if (!ota_updation_begin(0)) return ESP_FAIL;
+    for (size_t off = 0, len; off < s->len; off += len) {
+        len = MIN(!off && split ? split : step ?: 1 + rand() % 8192,
+                  s->len - off);
+        if (!ota_updation_write(s->data + off, len)) break;
+    }
+    ota_updation_end();
+    return ctx.error;
+}
+
+static bool inflated(void) {
+    return out.len == IMAGE_SIZE && !memcmp(out.buf, image, IMAGE_SIZE);
+}
+
+static void test_split(const sample_t *s) {
+    size_t fails = 0;
+    // every split in header and tail, near the ends of the deflate data
+    LOOP(split, 1, (size_t)s->len) {
+        if (split > 64 && split < s->len - 64 && split % 997) continue;
+        if (!feed(s, split, s->len) && inflated()) continue;
+        if (!fails++) printf("%s: split at %zu: %s\n",
+                             s->desc, split, ota_updation_error());
+    }
+    LOOPN(round, 50) {
+        if (!feed(s, 0, 0) && inflated()) continue;
+        if (!fails++) printf("%s: random chunks: %s\n",
+                             s->desc, ota_updation_error());
+    }
+    if (feed(s, 0, 1) || !inflated()) fails++;
+    CHECK(!fails, "%s: %zu failures", s->desc, fails);
+}
+
+// first chunks of 1 to 3 bytes: gzip magic is split
+static void test_magic(const sample_t *s) {
+    size_t steps[] = { 1, 2, 3, 0, 1460 };
+    LOOP(split, (size_t)1, (size_t)OTA_MAGIC_LEN) {
+        ITERV(step, steps) {
+            CHECK(!feed_ota(s, split, step) && inflated() &&
+                  ctx.saved == IMAGE_SIZE, "%s: first %zu then %zu bytes: %s",
+                  s->desc, split, step, ota_updation_error());
+        }
+    }
+}
+
+static void test_errors(sample_t *s) {
+    uint8_t *data = s->data;
+    size_t len = s->len;
+
+    LOOP(cut, 1, 20) {
+        s->len = len - cut;
+        CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_SIZE, "tail cut by %d", cut);
+    }
+    s->len = len / 2;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_SIZE, "truncated data");
+    s->len = 12;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_SIZE, "header only");
+
+    // data after the first member is ignored
+    s->len = len + 5;
+    memcpy(data + len, "\x1F\x8B\x08\x00\x00", 5);
+    CHECK(!feed(s, 0, 0) && inflated(), "trailing data");
+    s->len = len;
+
+    data[len - 8] ^= 1;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_CRC, "CRC");
+    data[len - 8] ^= 1;
+    data[len - 1] ^= 1;
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_CRC, "ISIZE");
+    data[len - 1] ^= 1;
+    uint8_t byte = data[10];
+    data[10] = 0xFF;    // first deflate block with reserved BTYPE 3
+    CHECK(feed(s, 0, 0) == ESP_ERR_INVALID_RESPONSE, "bad deflate block");
+    data[10] = byte;
+}
+
+static void bench(const sample_t *s) {
+    int iters = 20;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) { feed(s, 0, 1460); }
+    double us = host_usec(ts, iters);
+    printf("ota_gzip_feed: %.1f us per %d KB image (%.1f MB/s inflated)\n",
+           us, IMAGE_SIZE / 1024, IMAGE_SIZE / us);
+}
+
+int main() {
+    freopen("/dev/null", "w", stderr);  // progress printed by ota_flash
+    make_image();
+    out.size = IMAGE_SIZE + 1;
+    out.buf = malloc(out.size);
+    gz_header head = {
+        .text = 0, .time = 1760612345, .os = 3,
+        .extra = (uint8_t *)"ab\x04\x00test", .extra_len = 8,
+        .name = (uint8_t *)"espbase.bin", .comment = (uint8_t *)"comment",
+        .hcrc = 1,
+    };
+    gz_header empty = { .extra = (uint8_t *)"", .extra_len = 0 };
+    sample_t samples[] = {
+        gzip("plain", Z_BEST_COMPRESSION, NULL),
+        gzip("all header fields", Z_DEFAULT_COMPRESSION, &head),
+        gzip("empty extra field", 1, &empty),
+        gzip("stored blocks", 0, NULL),
+    };
+    ITERP(s, samples) { test_split(s); }
+    ITERP(s, samples) { test_magic(s); }
+    test_errors(samples);
+    bench(samples);
+    ITERP(s, samples) { free(s->data); }
+    free(out.buf);
+    return REPORT("gzip");
+}
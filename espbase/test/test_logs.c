@@ -0,0 +1,251 @@
+/*
+ * File: test_logs.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 21:08:37
+ *
+ * Log lines through logs_vprintf and read them as server-sent events with
+ * logs_flush: multi-line, CR, overlong and LF-only lines, ring overflow,
+ * partial and stalled sends, and the text printed to the original output.
+ * Also report the cost of a log line without and with subscribers.
+ */
+
+#include "host.h"
+#include "../main/server.c"
+
+/* Log output and sockets */
+
+static vprintf_like_t output;   // returned by esp_log_set_vprintf
+static char printed[1024];
+static size_t nprinted;
+
+static int print_vprintf(const char *fmt, va_list ap) {
+    nprinted++;
+    return vsnprintf(printed, sizeof(printed), fmt, ap);
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func) {
+    return output; NOTUSED(func);
+}
+
+static struct {
+    char buf[1 << 16];
+    size_t len, step;       // bytes accepted per call if step
+    bool stall, closed;
+} socks[LOG_CLIENTS + 1];   // indexed by fd
+
+int httpd_socket_send(httpd_handle_t hd, int fd, const char *buf, size_t len,
+                      int flags) {
+    if (socks[fd].stall) return HTTPD_SOCK_ERR_TIMEOUT;
+    len = MIN(len, socks[fd].step ?: len);
+    len = MIN(len, sizeof(socks[fd].buf) - 1 - socks[fd].len);
+    memcpy(socks[fd].buf + socks[fd].len, buf, len);
+    socks[fd].buf[socks[fd].len += len] = '\0';
+    return len; NOTUSED(hd); NOTUSED(flags);
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t hd, int fd) {
+    socks[fd].closed = true;
+    return ESP_OK; NOTUSED(hd);
+}
+
+const char * getaddrname(int fd, bool local) {
+    return "host"; NOTUSED(fd); NOTUSED(local);
+}
+
+// no timer of logs_poll: logs_flush is called directly
+esp_err_t esp_timer_stop(esp_timer_handle_t hdl) {
+    return ESP_OK; NOTUSED(hdl);
+}
+esp_err_t esp_timer_delete(esp_timer_handle_t hdl) {
+    return ESP_OK; NOTUSED(hdl);
+}
+
+static int say(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = logs_vprintf(fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+// subscribe fd 1 .. num from the current head
+static void subscribe(int num) {
+    memset(logs.clients, 0, sizeof(logs.clients));
+    memset(socks, 0, sizeof(socks));
+    LOOPN(i, num) {
+        logs.clients[i].fd = i + 1;
+        logs.clients[i].seq = logs.head;
+        logs.clients[i].alive = esp_timer_get_time();
+    }
+    logs.num = num;
+}
+
+// drain until nothing is sent, as the timer of logs_poll would
+static const char * received(int fd) {
+    for (size_t len = SIZE_MAX; len != socks[fd].len;) {
+        len = socks[fd].len;
+        logs_flush(NULL);
+    }
+    return socks[fd].buf;   // NUL terminated by httpd_socket_send
+}
+
+/* Cases */
+
+static const struct {
+    const char *line, *event;
+} cases[] = {
+    { "I (12) main: ready\n", "data: I (12) main: ready\n\n" },
+    { "no newline", "data: no newline\n\n" },
+    { "a\nb\r\nc\n", "data: a\ndata: b\ndata: c\n\n" },
+    { "bare\rCR\r\n", "data: bareCR\n\n" },
+    { "\n\nx\n", "data: \ndata: \ndata: x\n\n" },
+    { "", "data: \n\n" },
+    { "\r\r\r", "data: \n\n" },
+};
+
+// every event is "data: <text>" lines closed by a blank line
+static bool well_formed(const char *buf, size_t len, size_t *events) {
+    *events = 0;
+    for (size_t off = 0; off < len;) {
+        if (strncmp(buf + off, "data: ", 6) || strchr(buf + off, '\r'))
+            return false;
+        const char *eol = memchr(buf + off, '\n', len - off);
+        if (!eol) return false;
+        off = eol + 1 - buf;
+        if (off < len && buf[off] == '\n') {
+            (*events)++;
+            off++;
+        }
+    }
+    return !len || !strcmp(buf + len - 2, "\n\n");
+}
+
+static void test_lines(void) {
+    subscribe(2);
+    socks[2].step = 7;      // partial sends
+    ITERP(c, cases) { say("%s", c->line); }
+    char expect[512] = "";
+    ITERP(c, cases) { strcat(expect, c->event); }
+    CHECK(!strcmp(received(1), expect), "events:\n%s", socks[1].buf);
+    CHECK(!strcmp(received(2), expect), "events in partial sends");
+}
+
+static void test_overlong(void) {
+    char line[LOG_LINE * 2], buf[LOG_LINE + 16];
+    size_t events;
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+
+    // truncated to a slot, but printed in full
+    subscribe(1);
+    CHECK(say("%s", line) == (int)strlen(line), "length of long line");
+    snprintf(buf, sizeof(buf), "data: %.*s\n\n", LOG_LINE - 1, line);
+    CHECK(!strcmp(received(1), buf), "long line: %s", socks[1].buf);
+    CHECK(!strcmp(printed, line), "long line printed");
+
+    // LF only, and one of every two: up to 7 bytes out per byte in
+    const char *fills[] = { "\n", "x\n", "\r\n", "\nx" };
+    ITERV(fill, fills) {
+        subscribe(2);
+        size_t flen = strlen(fill);
+        LOOPN(i, LOG_LINE) { line[i] = fill[i % flen]; }
+        line[LOG_LINE] = '\0';
+        say("%s", line);
+        say("after");
+        received(1);
+        size_t len = socks[1].len;
+        CHECK(len > 0 && well_formed(socks[1].buf, len, &events) &&
+              events == 2 && !strcmp(socks[1].buf + len - 13,
+                                     "data: after\n\n"),
+              "fill `%s`: %zu bytes of %zu events", fill, len, events);
+        CHECK(logs.clients[1].fd == 2 && logs.clients[1].seq == logs.head,
+              "fill `%s`: next client", fill);
+    }
+}
+
+static void test_drops(void) {
+    size_t events;
+    subscribe(2);
+    socks[2].stall = true;
+    LOOPN(i, CONFIG_BASE_HTTP_LOGS * 3) { say("line %d\n", i); }
+    received(1);
+    CHECK(strstr(socks[1].buf, "data: [dropped 128 lines]\n\n") ==
+          socks[1].buf, "drops: %.40s", socks[1].buf);
+    CHECK(well_formed(socks[1].buf, socks[1].len, &events) &&
+          events == CONFIG_BASE_HTTP_LOGS + 1, "%zu events", events);
+    CHECK(!socks[2].len && !socks[2].closed && logs.clients[1].fd,
+          "stalled client is kept");
+    socks[2].stall = false;
+    received(2);
+    CHECK(strstr(socks[2].buf, "[dropped ") && logs.clients[1].drops >= 128,
+          "stalled client: %" PRIu32 " dropped", logs.clients[1].drops);
+}
+
+// lines that fit are formatted once and printed from their slot
+static void test_output(void) {
+    char line[LOG_LINE * 2];
+    int fd = dup(STDOUT_FILENO);
+    FILE *tmp = tmpfile();
+    fflush(stdout);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    logs.vprintf = vprintf;
+    say("%s %d\n", "first", 1);
+    memset(line, 'y', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    say("%s\n", line);
+    say("last\n");
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    logs.vprintf = print_vprintf;
+
+    char expect[sizeof(line) + 32], buf[sizeof(expect)] = "";
+    snprintf(expect, sizeof(expect), "first 1\n%s\nlast\n", line);
+    rewind(tmp);
+    fread(buf, 1, sizeof(buf) - 1, tmp);
+    fclose(tmp);
+    CHECK(!strcmp(buf, expect), "printed: %s", buf);
+}
+
+static void bench(void) {
+    int iters = 200000, fd = dup(STDOUT_FILENO);
+    double us[3];
+    fflush(stdout);
+    freopen("/dev/null", "w", stdout);
+    logs.vprintf = vprintf;
+    LOOPN(i, 3) {
+        subscribe(i ? (i - 1) * LOG_CLIENTS : 0);
+        int64_t ts = esp_timer_get_time();
+        LOOPN(j, iters) {
+            if (!i) {
+                printf("I (%d) bench: line %d of %s\n", j, j, __func__);
+                continue;
+            }
+            say("I (%d) bench: line %d of %s\n", j, j, __func__);
+            if (i == 2 && j % 16 == 0) {
+                logs_flush(NULL);
+                ITERP(s, socks) { s->len = 0; }
+            }
+        }
+        fflush(stdout);
+        us[i] = host_usec(ts, iters);
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    logs.vprintf = print_vprintf;
+    printf("logs_vprintf: %.3f us per line (printf %.3f us), "
+           "%.3f us with %d subscribers\n", us[1], us[0], us[2], LOG_CLIENTS);
+}
+
+int main() {
+    output = print_vprintf;
+    logs_init();
+    CHECK(logs.lines && logs.vprintf == print_vprintf, "logs_init");
+    test_lines();
+    test_overlong();
+    test_drops();
+    test_output();
+    CHECK(nprinted, "printed through original output");
+    bench();
+    return REPORT("logs");
+}
@@ -0,0 +1,491 @@
+/*
+ * File: test_media.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 21:46:52
+ *
+ * Publish frames of a synthetic capture source to the media streams of
+ * server.c and read them back from the sockets of the subscribers: MJPG
+ * parts, WAV with clients joining late, ADPCM encoded once for all, and
+ * still images. Check that every frame reaches every client in order with
+ * its header, that no private copy is made while clients keep up and that
+ * each slot of the capture ring is released by the time the httpd work
+ * returns. Clients that are stalled or slow get frames queued and dropped
+ * instead, and still receive whole frames only. Also report the cost of
+ * fanning a frame out.
+ */
+
+#include "host.h"
+
+static size_t ncopy;    // frames copied by frame_clone
+static bool nomem;      // let frame_clone fail
+
+#define malloc(n)       (ncopy++, nomem ? NULL : malloc(n))
+
+#include "../main/server.c"
+
+/* Capture source: frames of a ring shared by readers of the same target */
+
+#define FRAME_MAX   8192
+#define AUDIO_LEN   640         // 20ms of 16kHz mono PCM
+
+static struct {
+    avc_frame_t slots[AVC_SLOTS];
+    uint8_t data[AVC_SLOTS][FRAME_MAX];
+    avc_reader_t *readers[AVC_READERS];
+    avc_frame_t *fifo[AVC_READERS][AVC_SLOTS];
+    size_t head[AVC_READERS], tail[AVC_READERS];
+    uint32_t published, released, busy; // busy: capture found no free slot
+    uint32_t stops;         // capture stopped by avc_async
+} src;
+
+static video_mode_t vmode = { 30, 640, 480, 2, "MJPG" };
+static audio_mode_t amode = { 16000, 1, 2 };
+
+esp_err_t avc_attach(avc_reader_t *reader) {
+    ITERP(ptr, src.readers) {
+        if (*ptr == reader) return ESP_OK;
+    }
+    ITERP(ptr, src.readers) {
+        if (*ptr) continue;
+        *ptr = reader;
+        src.head[ptr - src.readers] = src.tail[ptr - src.readers] = 0;
+        return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t avc_detach(avc_reader_t *reader) {
+    ITERP(ptr, src.readers) {
+        if (*ptr != reader) continue;
+        size_t idx = ptr - src.readers;
+        while (src.tail[idx] != src.head[idx]) {
+            avc_release(src.fifo[idx][src.tail[idx]++ % AVC_SLOTS]);
+        }
+        *ptr = NULL;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+avc_frame_t * avc_read(avc_reader_t *reader) {
+    ITERP(ptr, src.readers) {
+        size_t idx = ptr - src.readers;
+        if (*ptr != reader || src.tail[idx] == src.head[idx]) continue;
+        reader->frames++;
+        return src.fifo[idx][src.tail[idx]++ % AVC_SLOTS];
+    }
+    return NULL;
+}
+
+void avc_release(avc_frame_t *frame) {
+    if (frame && !--frame->refs) src.released++;
+}
+
+esp_err_t avc_async(int tgt, const void *ctrl, uint32_t tout_ms, FILE *out) {
+    if (ctrl && !strcmp(ctrl, "0")) src.stops++;
+    return ESP_OK; NOTUSED(tgt); NOTUSED(tout_ms); NOTUSED(out);
+}
+
+// payload of frame `id` starts with its id: streams can be checked alone
+static void fill(uint8_t *buf, size_t len, uint32_t id) {
+    LOOPN(i, len) { buf[i] = id * 7 + i; }
+    memcpy(buf, &id, MIN(len, sizeof(id)));
+}
+
+// publish like a capture task: never wait for a slot held by readers
+static bool publish(int target, int type, size_t len, uint32_t id) {
+    avc_frame_t *frame = NULL;
+    ITERP(slot, src.slots) {
+        if (!slot->refs) { frame = slot; break; }
+    }
+    if (!frame) {
+        src.busy++;
+        return false;
+    }
+    size_t idx = frame - src.slots;
+    bool start = type == AUD_EVENT_START || type == VID_EVENT_START;
+    fill(src.data[idx], len, id);
+    memset(frame, 0, sizeof(avc_frame_t));
+    frame->type = type;
+    frame->vid.id = id;
+    frame->vid.len = len;
+    frame->vid.data = len ? src.data[idx] : NULL;
+    if (target == VIDEO_TARGET) {
+        frame->vid.mode = start ? NULL : &vmode;
+    } else {
+        frame->aud.mode = start ? NULL : &amode;
+    }
+    src.published++;
+    ITERP(ptr, src.readers) {
+        if (*ptr && (*ptr)->target == target) frame->refs++;
+    }
+    if (!frame->refs) src.released++;
+    ITERP(ptr, src.readers) {
+        if (!*ptr || (*ptr)->target != target) continue;
+        idx = ptr - src.readers;
+        src.fifo[idx][src.head[idx]++ % AVC_SLOTS] = frame;
+        (*ptr)->wake(*ptr);
+    }
+    return true;
+}
+
+/* httpd work, timers and sockets */
+
+static struct {
+    httpd_work_fn_t fn;
+    void *arg;
+} works[8], timer;
+static size_t nwork;
+
+esp_err_t httpd_queue_work(httpd_handle_t hd, httpd_work_fn_t fn, void *arg) {
+    if (nwork == LEN(works)) return ESP_FAIL;
+    works[nwork].fn = fn;
+    works[nwork++].arg = arg;
+    return ESP_OK; NOTUSED(hd);
+}
+
+// run queued work as httpd task would
+static void run_work(void) {
+    for (size_t i = 0; i < nwork; i++) { works[i].fn(works[i].arg); }
+    nwork = 0;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *hdl) {
+    timer.fn = args->callback;
+    timer.arg = args->arg;
+    *hdl = &timer;
+    return ESP_OK;
+}
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t hdl, uint64_t us) {
+    return ESP_OK; NOTUSED(hdl); NOTUSED(us);
+}
+esp_err_t esp_timer_stop(esp_timer_handle_t hdl) {
+    return ESP_OK; NOTUSED(hdl);
+}
+esp_err_t esp_timer_delete(esp_timer_handle_t hdl) {
+    timer.fn = NULL;
+    return ESP_OK; NOTUSED(hdl);
+}
+
+#define SOCKS       (MEDIA_CLIENTS * 2 + 1)
+
+static struct {
+    uint8_t *buf;
+    size_t len, room;       // room: bytes accepted until next tick
+    size_t rate;            // room given on tick, unlimited if 0
+    bool stall, closed;
+} socks[SOCKS];             // indexed by fd
+
+int httpd_socket_send(httpd_handle_t hd, int fd, const char *buf, size_t len,
+                      int flags) {
+    if (socks[fd].closed) return HTTPD_SOCK_ERR_FAIL;
+    if (socks[fd].stall) return HTTPD_SOCK_ERR_TIMEOUT;
+    if (socks[fd].rate) len = MIN(len, socks[fd].room);
+    if (!len) return HTTPD_SOCK_ERR_TIMEOUT;
+    if (socks[fd].rate) socks[fd].room -= len;
+    socks[fd].buf = realloc(socks[fd].buf, socks[fd].len + len);
+    memcpy(socks[fd].buf + socks[fd].len, buf, len);
+    socks[fd].len += len;
+    return len; NOTUSED(hd); NOTUSED(flags);
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t hd, int fd) {
+    socks[fd].closed = true;
+    return ESP_OK; NOTUSED(hd);
+}
+
+// time passes: sockets drain and media_poll runs
+static void tick(void) {
+    ITERP(sock, socks) { sock->room = sock->rate; }
+    if (timer.fn) timer.fn(timer.arg);
+    run_work();
+}
+
+static int next_fd = 1, req_fd;
+
+int httpd_req_to_sockfd(httpd_req_t *req) { return req_fd; NOTUSED(req); }
+
+const char * getaddrname(int fd, bool local) {
+    return "host"; NOTUSED(fd); NOTUSED(local);
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) { return &src; NOTUSED(name); }
+
+// encoded "ADPCM" is the 4:1 decimated PCM
+size_t adpcm_header(adpcm_state_t *st, const audio_mode_t *mode, void *out) {
+    if (out) memcpy(out, "ADPCMHDR", 8);
+    return 8; NOTUSED(st); NOTUSED(mode);
+}
+
+static size_t nencode;
+
+size_t adpcm_encode(adpcm_state_t *st, const void *pcm, size_t len,
+                    void *out) {
+    if (out) {
+        nencode++;
+        LOOPN(i, len / 4) { ((uint8_t *)out)[i] = ((uint8_t *)pcm)[i * 4]; }
+    }
+    return len / 4; NOTUSED(st);
+}
+
+/* Streams */
+
+static const char *MJPG_RESP = "multipart/x-mixed-replace;boundary=FRAME";
+
+static int subscribe(http_media_t *media, const char *ctype) {
+    char resp[128];
+    httpd_req_t req = { 0 };
+    int fd = req_fd = next_fd++;
+    free(socks[fd].buf);
+    memset(socks + fd, 0, sizeof(socks[fd]));
+    snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n\r\n", ctype);
+    http_client_t *client = media_attach(media, &req, resp);
+    CHECK(client && client->fd == fd, "%s client %d", media->name, fd);
+    return fd;
+}
+
+static http_client_t * client_of(http_media_t *media, int fd) {
+    ITERP(client, media->clients) {
+        if (client->fd == fd) return client;
+    }
+    return NULL;
+}
+
+// ids of whole frames received by fd after the response, or -1 if broken
+static int parse(int fd, size_t hlen, size_t flen, uint32_t *ids, int max) {
+    const uint8_t *buf = socks[fd].buf, *end = buf + socks[fd].len;
+    const char *body = memmem(buf, end - buf, "\r\n\r\n", 4);
+    if (!body) return -1;
+    buf = (uint8_t *)body + 4 + hlen;
+    int num = 0;
+    for (size_t len = flen; buf < end && num < max; buf += len) {
+        if (!flen) {
+            if (end - buf < 9 || memcmp(buf, "--FRAME\r\n", 9)) return -1;
+            const char *clen = memmem(buf, end - buf, "Length: ", 8);
+            if (!clen) return -1;
+            len = strtoul(clen + 8, NULL, 10);
+            if (!( body = memmem(buf, end - buf, "\r\n\r\n", 4) )) return -1;
+            buf = (uint8_t *)body + 4;
+        }
+        if ((size_t)(end - buf) < len || len < sizeof(uint32_t)) return -1;
+        uint8_t expect[FRAME_MAX];
+        memcpy(ids + num, buf, sizeof(uint32_t));
+        fill(expect, len, ids[num]);
+        if (memcmp(buf, expect, len)) return -1;
+        num++;
+    }
+    return num;
+}
+
+static bool in_order(const uint32_t *ids, int num, uint32_t first) {
+    LOOPN(i, num) {
+        if (ids[i] != first + i) return false;
+    }
+    return true;
+}
+
+static bool ascending(const uint32_t *ids, int num) {
+    LOOP(i, 1, num) {
+        if (ids[i] <= ids[i - 1]) return false;
+    }
+    return true;
+}
+
+static bool wav_head(int fd) {
+    uint8_t expect[44];
+    const uint8_t *body = memmem(socks[fd].buf, socks[fd].len, "\r\n\r\n", 4);
+    fill(expect, sizeof(expect), 0xFFFF);
+    return body && !memcmp(body + 4, expect, sizeof(expect));
+}
+
+static size_t mjpg_len(uint32_t id) { return 500 + id * 397 % 4000; }
+
+static void test_video(void) {
+    uint32_t ids[64];
+    int fds[MEDIA_CLIENTS - 1], num;
+    ITERP(fd, fds) { *fd = subscribe(&video_ctx, MJPG_RESP); }
+    ncopy = 0;
+    src.published = src.released = 0;
+
+    // AVI header is not sent to MJPG clients
+    publish(VIDEO_TARGET, VID_EVENT_START, 64, 0);
+    run_work();
+    LOOP(id, (uint32_t)1, (uint32_t)41) {
+        publish(VIDEO_TARGET, VID_EVENT_DATA, mjpg_len(id), id);
+        tick();
+        CHECK(src.released == src.published, "frame %" PRIu32 " held", id);
+    }
+    ITERV(fd, fds) {
+        num = parse(fd, 0, 0, ids, LEN(ids));
+        http_client_t *client = client_of(&video_ctx, fd);
+        CHECK(num == 40 && in_order(ids, num, 1) && client &&
+              client->count == 40 && !client->drops,
+              "video client %d: %d frames", fd, num);
+    }
+    CHECK(!ncopy, "%zu frames copied for clients keeping up", ncopy);
+
+    // still image: closed after first whole frame
+    int still = subscribe(&video_ctx, MJPG_RESP);
+    client_of(&video_ctx, still)->once = true;
+    socks[still].rate = 300;
+    LOOP(id, (uint32_t)41, (uint32_t)45) {
+        publish(VIDEO_TARGET, VID_EVENT_DATA, mjpg_len(id), id);
+        tick();
+    }
+    while (!socks[still].closed && timer.fn) { tick(); }
+    num = parse(still, 0, 0, ids, LEN(ids));
+    CHECK(socks[still].closed && num == 1 && ids[0] == 41 &&
+          !client_of(&video_ctx, still), "still image: %d frames", num);
+    CHECK(video_ctx.num == MEDIA_CLIENTS - 1, "%d video clients",
+          video_ctx.num);
+
+    publish(VIDEO_TARGET, VID_EVENT_STOP, 0, 0);
+    run_work();
+    ITERV(fd, fds) {
+        CHECK(socks[fd].closed, "video client %d closed on stop", fd);
+    }
+    CHECK(!video_ctx.num && !src.readers[0] && src.released == src.published,
+          "video stream stopped");
+}
+
+static void test_audio(void) {
+    uint32_t ids[64];
+    int early = subscribe(&audio_ctx, "audio/wav");
+    int adpcm[2] = {
+        subscribe(&adpcm_ctx, "audio/wav"), subscribe(&adpcm_ctx, "audio/wav")
+    };
+    src.published = src.released = 0;
+    nencode = 0;
+
+    // WAV header of START frame is kept for clients joining later
+    publish(AUDIO_TARGET, AUD_EVENT_START, 44, 0xFFFF);
+    run_work();
+    LOOP(id, (uint32_t)1, (uint32_t)21) {
+        publish(AUDIO_TARGET, AUD_EVENT_DATA, AUDIO_LEN, id);
+        run_work();
+    }
+    int late = subscribe(&audio_ctx, "audio/wav");
+    LOOP(id, (uint32_t)21, (uint32_t)31) {
+        publish(AUDIO_TARGET, AUD_EVENT_DATA, AUDIO_LEN, id);
+        run_work();
+    }
+    int num = parse(early, 44, AUDIO_LEN, ids, LEN(ids));
+    CHECK(num == 30 && in_order(ids, num, 1) && wav_head(early),
+          "early client: %d frames", num);
+    num = parse(late, 44, AUDIO_LEN, ids, LEN(ids));
+    CHECK(num == 10 && in_order(ids, num, 21) && wav_head(late),
+          "late client: %d frames", num);
+    CHECK(src.released == src.published, "%" PRIu32 " of %" PRIu32
+          " frames released", src.released, src.published);
+
+    // ADPCM: header from the first data, then each frame encoded once
+    CHECK(nencode == 30, "%zu frames encoded", nencode);
+    CHECK(socks[adpcm[0]].len == socks[adpcm[1]].len &&
+          !memcmp(socks[adpcm[0]].buf, socks[adpcm[1]].buf,
+                  socks[adpcm[0]].len), "ADPCM clients got the same data");
+    const uint8_t *body = memmem(socks[adpcm[0]].buf, socks[adpcm[0]].len,
+                                 "\r\n\r\n", 4);
+    CHECK(body && !memcmp(body + 4, "ADPCMHDR", 8) &&
+          socks[adpcm[0]].buf + socks[adpcm[0]].len - body ==
+          4 + 8 + 30 * AUDIO_LEN / 4, "ADPCM stream");
+
+    publish(AUDIO_TARGET, AUD_EVENT_STOP, 0, 0);
+    run_work();
+    CHECK(!audio_ctx.num && !adpcm_ctx.num && socks[early].closed &&
+          socks[late].closed && socks[adpcm[1]].closed, "audio stopped");
+}
+
+// a stalled client and a slow one must not hold the capture ring
+static void test_stall(void) {
+    uint32_t ids[64], frames = 30;
+    int fast = subscribe(&video_ctx, MJPG_RESP);
+    int stall = subscribe(&video_ctx, MJPG_RESP);
+    int slow = subscribe(&video_ctx, MJPG_RESP);
+    socks[stall].stall = true;
+    socks[slow].rate = 2000;    // partial frames
+    ncopy = 0;
+    src.published = src.released = 0;
+    LOOP(id, (uint32_t)1, frames + 1) {
+        size_t num = ncopy;
+        publish(VIDEO_TARGET, VID_EVENT_DATA, mjpg_len(id), id);
+        tick();
+        CHECK(src.released == src.published, "frame %" PRIu32 " held", id);
+        CHECK(ncopy <= num + 1, "frame %" PRIu32 " copied %zu times",
+              id, ncopy - num);
+    }
+    http_client_t *cs = client_of(&video_ctx, stall);
+    http_client_t *cl = client_of(&video_ctx, slow);
+    CHECK(cs && !cs->count && cs->qnum == video_ctx.qlen &&
+          cs->drops == frames - cs->qnum, "stalled client: %" PRIu32
+          " dropped, %u queued", cs->drops, cs->qnum);
+    CHECK(cl && cl->drops && cl->count + cl->drops + cl->qnum == frames,
+          "slow client: %" PRIu32 " sent, %" PRIu32 " dropped, %u queued",
+          cl->count, cl->drops, cl->qnum);
+    int num = parse(fast, 0, 0, ids, LEN(ids));
+    CHECK(num == (int)frames && in_order(ids, num, 1), "fast client: %d", num);
+
+    // queued frames are sent whole once the socket drains
+    socks[stall].stall = false;
+    while (timer.fn) { tick(); }
+    num = parse(stall, 0, 0, ids, LEN(ids));
+    CHECK(num == video_ctx.qlen && in_order(ids, num, frames - num + 1),
+          "stalled client: %d frames after drain", num);
+    num = parse(slow, 0, 0, ids, LEN(ids));
+    CHECK(num == (int)cl->count && ascending(ids, num) &&
+          ids[num - 1] == frames, "slow client: %d frames", num);
+
+    // wake only queues httpd work once while the capture task goes on
+    socks[stall].stall = true;
+    LOOP(id, frames + 1, frames + AVC_SLOTS + 1) {
+        publish(VIDEO_TARGET, VID_EVENT_DATA, mjpg_len(id), id);
+    }
+    CHECK(nwork == 1 && !src.busy, "%zu works queued", nwork);
+    run_work();
+    CHECK(src.released == src.published, "ring released after work");
+
+    // no memory for a copy: frame cut in the middle breaks the stream
+    socks[stall].stall = false;
+    while (timer.fn) { tick(); }
+    socks[stall].rate = socks[stall].room = 100;
+    nomem = true;
+    publish(VIDEO_TARGET, VID_EVENT_DATA, 1000, 100);
+    run_work();
+    nomem = false;
+    CHECK(socks[stall].closed && !client_of(&video_ctx, stall),
+          "client of broken frame closed");
+    CHECK(src.released == src.published && !socks[fast].closed,
+          "fast client kept");
+    publish(VIDEO_TARGET, VID_EVENT_STOP, 0, 0);
+    run_work();
+}
+
+static void bench(void) {
+    int iters = 2000;
+    LOOPN(i, MEDIA_CLIENTS) { subscribe(&video_ctx, MJPG_RESP); }
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        publish(VIDEO_TARGET, VID_EVENT_DATA, 4096, i);
+        run_work();
+        ITERP(sock, socks) { sock->len = 0; }
+    }
+    double us = host_usec(ts, iters);
+    printf("media_publish: %.2f us per 4KB frame to %d clients\n",
+           us, MEDIA_CLIENTS);
+    publish(VIDEO_TARGET, VID_EVENT_STOP, 0, 0);
+    run_work();
+}
+
+int main() {
+    test_video();
+    next_fd = 1;
+    test_audio();
+    next_fd = 1;
+    test_stall();
+    CHECK(!src.busy, "capture waited for %" PRIu32 " slots", src.busy);
+    next_fd = 1;
+    bench();
+    ITERP(sock, socks) { free(sock->buf); }
+    return REPORT("media");
+}
@@ -0,0 +1,331 @@
+/*
+ * File: test_msgpack.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 14:05:51
+ *
+ * Round trip values through the MessagePack writer (mp_put_xxx) and reader
+ * (mp_read / mp_skip), check every supported tag and truncated input, then
+ * run packed JSON-RPC requests through console_handle_rpc_binary against
+ * an `echo` command and measure the cost of one request.
+ */
+
+#include "host.h"
+#include "../main/console.c"
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd) {
+    return ESP_OK; NOTUSED(cmd);
+}
+
+size_t esp_console_split_argv(char *line, char **argv, size_t argv_size) {
+    size_t argc = 0;
+    for (char *tok = strtok(line, " "); tok && argc < argv_size - 1;
+         tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+int linenoiseHistoryAdd(const char *line) { return 0; NOTUSED(line); }
+
+esp_err_t esp_console_run(const char *cmdline, int *ret) {
+    return ESP_ERR_NOT_FOUND; NOTUSED(cmdline); NOTUSED(ret);
+}
+
+static int echo(int argc, char **argv) {
+    LOOP(i, 1, argc) { printf("%s%s", i > 1 ? " " : "", argv[i]); }
+    return ESP_OK;
+}
+
+/* Writer -> reader */
+
+static void test_int(void) {
+    static const int32_t nums[] = {
+        0, 1, 127, 128, 255, -1, -32, -33, -128, -129, 65535, -65536,
+        INT32_MAX, INT32_MIN,
+    };
+    uint8_t buf[16];
+    ITERP(ptr, nums) {
+        int32_t num = *ptr;
+        FILE *fp = fmemopen(buf, sizeof(buf), "w");
+        mp_put_int(fp, num);
+        size_t len = ftell(fp);
+        fclose(fp);
+        mp_reader_t rd = { buf, buf + len };
+        mp_item_t item;
+        CHECK(mp_read(&rd, &item) && item.type == MP_INT && item.num == num &&
+              rd.ptr == rd.end, "int %d: %zu bytes", num, len);
+        CHECK(len == (num >= -32 && num < 128 ? 1 : 5), "int %d: %zu", num, len);
+    }
+}
+
+static void test_head(void) {
+    static const size_t lens[] = {
+        0, 15, 16, 31, 32, 255, 256, 65535, 65536, 100000,
+    };
+    static char str[100001];
+    memset(str, 's', sizeof(str) - 1);
+    size_t size = sizeof(str) + 16;
+    uint8_t *buf = malloc(size);
+    ITERP(ptr, lens) {
+        size_t len = *ptr;
+        mp_item_t item;
+        FILE *fp = fmemopen(buf, size, "w");
+        mp_put_map(fp, len);
+        mp_put_array(fp, len);
+        str[len] = '\0';
+        mp_put_str(fp, str);
+        str[len] = 's';
+        mp_reader_t rd = { buf, buf + ftell(fp) };
+        fclose(fp);
+        CHECK(mp_read(&rd, &item) && item.type == MP_MAP && item.len == len,
+              "map of %zu", len);
+        CHECK(mp_read(&rd, &item) && item.type == MP_ARRAY && item.len == len,
+              "array of %zu", len);
+        CHECK(mp_read(&rd, &item) && item.type == MP_STR && item.len == len &&
+              !memcmp(item.str, str, len) && rd.ptr == rd.end,
+              "str of %zu", len);
+    }
+    free(buf);
+}
+
+/* Reader: every supported tag and truncated input */
+
+static void test_read(void) {
+    static const struct {
+        const char *data;
+        size_t len;
+        int type;
+        int64_t num;
+        double flt;
+    } cases[] = {
+#define CASE(s, ...) { s, sizeof(s) - 1, __VA_ARGS__ }
+        CASE("\x7F",                                MP_INT,   127),
+        CASE("\xE0",                                MP_INT,   -32),
+        CASE("\xC0",                                MP_NIL,   0),
+        CASE("\xC2",                                MP_BOOL,  0),
+        CASE("\xC3",                                MP_BOOL,  1),
+        CASE("\xCC\xFF",                            MP_INT,   255),
+        CASE("\xCD\xFF\xFE",                        MP_INT,   65534),
+        CASE("\xCE\xFF\xFF\xFF\xFF",                MP_INT,   UINT32_MAX),
+        CASE("\xCF\x00\x00\x00\x01\x00\x00\x00\x00",
+                                                    MP_INT,   1LL << 32),
+        CASE("\xD0\x80",                            MP_INT,   -128),
+        CASE("\xD1\xFF\x7F",                        MP_INT,   -129),
+        CASE("\xD2\x80\x00\x00\x00",                MP_INT,   INT32_MIN),
+        CASE("\xD3\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFE",
+                                                    MP_INT,   -2),
+        CASE("\xCA\x3F\xC0\x00\x00",                MP_FLOAT, 0, 1.5),
+        CASE("\xCB\xC0\x04\x00\x00\x00\x00\x00\x00",
+                                                    MP_FLOAT, 0, -2.5),
+        CASE("\xA3" "abc",                          MP_STR,   3),
+        CASE("\xD9\x02" "ab",                       MP_STR,   2),
+        CASE("\xDA\x00\x01" "a",                    MP_STR,   1),
+        CASE("\xDB\x00\x00\x00\x01" "a",            MP_STR,   1),
+        CASE("\x92",                                MP_ARRAY, 2),
+        CASE("\xDD\x00\x01\x00\x00",                MP_ARRAY, 65536),
+        CASE("\x81",                                MP_MAP,   1),
+        CASE("\xDF\x00\x00\x00\x03",                MP_MAP,   3),
+#undef CASE
+    };
+    ITERP(c, cases) {
+        const uint8_t *data = (const uint8_t *)c->data;
+        mp_reader_t rd = { data, data + c->len };
+        mp_item_t item;
+        bool ok = mp_read(&rd, &item) && item.type == c->type &&
+                  rd.ptr == rd.end;
+        if (ok && c->type == MP_FLOAT) {
+            ok = item.flt == c->flt;
+        } else if (ok && c->type >= MP_STR) {
+            ok = item.len == c->num;
+        } else if (ok && c->type != MP_NIL) {
+            ok = item.num == c->num;
+        }
+        CHECK(ok, "tag 0x%02X", data[0]);
+        LOOP(len, 0, (size_t)c->len) {
+            rd = (mp_reader_t){ data, data + len };
+            CHECK(!mp_read(&rd, &item) || c->type >= MP_ARRAY,
+                  "tag 0x%02X truncated to %zu", data[0], len);
+        }
+    }
+    static const uint8_t unsupported[] = { 0xC1, 0xC4, 0xC7, 0xD4, 0xD8 };
+    ITERP(tag, unsupported) {
+        mp_reader_t rd = { tag, tag + 1 };
+        mp_item_t item;
+        CHECK(!mp_read(&rd, &item), "tag 0x%02X", *tag);
+    }
+
+    // nested containers are skipped as a whole, up to 8 levels deep
+    static const uint8_t nested[] = {
+        0x82, 0xA1, 'a', 0x91, 0x91, 0xC0, 0xA1, 'b', 0x80, 0x2A
+    };
+    mp_reader_t rd = { nested, nested + sizeof(nested) - 1 };
+    CHECK(mp_skip(&rd, 0) && rd.ptr == rd.end, "skip nested map");
+    rd = (mp_reader_t){ nested, nested + sizeof(nested) - 2 };
+    CHECK(!mp_skip(&rd, 0), "skip truncated map");
+    uint8_t deep[16];
+    memset(deep, 0x91, sizeof(deep));
+    rd = (mp_reader_t){ deep, deep + sizeof(deep) };
+    CHECK(!mp_skip(&rd, 0), "skip too deep");
+}
+
+/* JSON-RPC over MessagePack */
+
+static FILE *req;
+
+// {"jsonrpc":"2.0","id":id,"method":"echo","params":[args]} where id < 0
+// means notify, and args are packed as str, int, float, true, nil
+static void put_request(int id, const char *arg) {
+    mp_put_map(req, id < 0 ? 3 : 4);
+    mp_put_str(req, "jsonrpc");
+    mp_put_str(req, "2.0");
+    if (id >= 0) {
+        mp_put_str(req, "id");
+        mp_put_int(req, id);
+    }
+    mp_put_str(req, "method");
+    mp_put_str(req, "echo");
+    mp_put_str(req, "params");
+    mp_put_array(req, 5);
+    mp_put_str(req, arg);
+    mp_put_int(req, -100000);
+    fwrite("\xCB\x3F\xF8\x00\x00\x00\x00\x00\x00", 1, 9, req);
+    fputc(0xC3, req);
+    mp_put_nil(req);
+}
+
+static bool read_str(mp_reader_t *rd, const char *str) {
+    mp_item_t item;
+    return mp_read(rd, &item) && item.type == MP_STR &&
+           item.len == strlen(str) && !memcmp(item.str, str, item.len);
+}
+
+// check one reply and return the id, -1 for nil or -2 on error
+static int read_reply(mp_reader_t *rd, int code, const char *result) {
+    mp_item_t item, id;
+    if (!mp_read(rd, &item) || item.type != MP_MAP || item.len != 3 ||
+        !read_str(rd, "jsonrpc") || !read_str(rd, "2.0") ||
+        !read_str(rd, "id") || !mp_read(rd, &id)) return -2;
+    if (result) {
+        if (!read_str(rd, "result") || !read_str(rd, result)) return -2;
+    } else if (!read_str(rd, "error") || !mp_read(rd, &item) ||
+               item.type != MP_MAP || item.len != 2 ||
+               !read_str(rd, "code") || !mp_read(rd, &item) ||
+               item.type != MP_INT || item.num != code ||
+               !read_str(rd, "message") || !mp_read(rd, &item) ||
+               item.type != MP_STR) {
+        return -2;
+    }
+    return id.type == MP_NIL ? -1 : id.type == MP_INT ? id.num : -2;
+}
+
+static uint8_t * call(const char *data, size_t len, size_t *olen) {
+    return console_handle_rpc_binary((const uint8_t *)data, len, olen);
+}
+
+static void test_rpc(void) {
+    static const esp_console_cmd_t cmd = { .command = "echo", .func = echo };
+    CHECK(!console_register_command(&cmd), "register");
+
+    char *data = NULL;
+    size_t len = 0, olen;
+    req = open_memstream(&data, &len);
+    put_request(7, "hello");
+    fflush(req);
+    uint8_t *out = call(data, len, &olen);
+    mp_reader_t rd = { out, out + olen };
+    CHECK(out && read_reply(&rd, 0, "hello -100000 1.5 true") == 7 &&
+          rd.ptr == rd.end, "single request");
+    TRYFREE(out);
+
+    LOOPN(i, len) {
+        out = call(data, i, &olen);
+        rd = (mp_reader_t){ out, out + olen };
+        CHECK(out && read_reply(&rd, i ? -32600 : -32700, NULL) != -2,
+              "request truncated to %zu", i);
+        TRYFREE(out);
+    }
+
+    // notify only: nothing to reply
+    rewind(req);
+    put_request(-1, "quiet");
+    fflush(req);
+    out = call(data, len, &olen);
+    CHECK(!out && !olen, "notify");
+    TRYFREE(out);
+
+    // batch of a request, a notify, an invalid request and another request
+    rewind(req);
+    mp_put_array(req, 4);
+    put_request(1, "one");
+    put_request(-1, "two");
+    mp_put_map(req, 1);
+    mp_put_str(req, "id");
+    mp_put_int(req, 3);
+    put_request(300, "four");
+    fflush(req);
+    out = call(data, len, &olen);
+    rd = (mp_reader_t){ out, out + olen };
+    mp_item_t item;
+    CHECK(out && mp_read(&rd, &item) && item.type == MP_ARRAY &&
+          item.len == 3, "batch");
+    CHECK(read_reply(&rd, 0, "one -100000 1.5 true") == 1, "batch 1");
+    CHECK(read_reply(&rd, -32600, NULL) == 3, "batch 3");
+    CHECK(read_reply(&rd, 0, "four -100000 1.5 true") == 300, "batch 4");
+    CHECK(rd.ptr == rd.end, "batch end");
+    TRYFREE(out);
+
+    out = call("\x90", 1, &olen);
+    rd = (mp_reader_t){ out, out + olen };
+    CHECK(out && read_reply(&rd, -32600, NULL) == -1, "empty batch");
+    TRYFREE(out);
+
+    rewind(req);
+    mp_put_array(req, 2);
+    put_request(1, "one");
+    fputc(0xC1, req);
+    fflush(req);
+    out = call(data, ftell(req), &olen);
+    rd = (mp_reader_t){ out, out + olen };
+    CHECK(out && mp_read(&rd, &item) && item.len == 2 &&
+          read_reply(&rd, 0, "one -100000 1.5 true") == 1 &&
+          read_reply(&rd, -32700, NULL) == -1, "batch with bad element");
+    TRYFREE(out);
+    fclose(req);
+    TRYFREE(data);
+}
+
+static void bench(void) {
+    char *data = NULL;
+    size_t len = 0, olen;
+    req = open_memstream(&data, &len);
+    put_request(12345, "sys info --json");
+    fclose(req);
+
+    int iters = 200000;
+    mp_item_t item;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        mp_reader_t rd = { (uint8_t *)data, (uint8_t *)data + len };
+        while (rd.ptr < rd.end && mp_read(&rd, &item)) {}
+    }
+    double us = host_usec(ts, iters);
+    printf("mp_read: %.3f us per %zu bytes request (%.1f MB/s)\n",
+           us, len, len / us);
+
+    iters = 50000;
+    ts = esp_timer_get_time();
+    LOOPN(i, iters) { free(call(data, len, &olen)); }
+    printf("console_handle_rpc_binary: %.3f us per request\n",
+           host_usec(ts, iters));
+    free(data);
+}
+
+int main() {
+    test_int();
+    test_head();
+    test_read();
+    test_rpc();
+    bench();
+    return REPORT("msgpack");
+}
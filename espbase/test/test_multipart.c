@@ -0,0 +1,246 @@
+/*
+ * File: test_multipart.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 10:12:40
+ *
+ * Feed multipart bodies to parse_files split at every byte offset and with
+ * every small recv size, then check the reassembled file parts.
+ */
+
+#include "host.h"
+#include "../main/server.c"
+
+static struct {
+    const char *ctype, *body;
+    size_t len, pos, split, step;
+    int status;
+} mock;
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len) {
+    size_t end = mock.pos < mock.split ? mock.split : mock.len;
+    if (mock.step) end = MIN(end, mock.pos + mock.step);
+    len = MIN(len, end - mock.pos);
+    memcpy(buf, mock.body + mock.pos, len);
+    mock.pos += len;
+    return len; NOTUSED(req);
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *key) {
+    return strcmp(key, "Content-Type") ? 0 : strlen(mock.ctype); NOTUSED(req);
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *key,
+                                      char *buf, size_t len) {
+    snprintf(buf, len, "%s", mock.ctype);
+    return ESP_OK; NOTUSED(req); NOTUSED(key);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t code,
+                              const char *msg) {
+    mock.status = code == HTTPD_408_REQ_TIMEOUT ? 408 : 400;
+    return ESP_OK; NOTUSED(req); NOTUSED(msg);
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+    mock.status = 200;
+    return ESP_OK; NOTUSED(req); NOTUSED(str);
+}
+
+// Parts are concatenated as "<name>:<data>|" so that both the file names
+// and the boundaries between parts are verified.
+static struct {
+    char buf[1 << 16];
+    size_t len, next;
+    bool skip;
+} out;
+
+static esp_err_t on_part(httpd_req_t *req, const char *name, size_t idx,
+                         char *buf, size_t len, bool end) {
+    if (out.skip && !strcmp(name, "skip")) return ESP_ERR_HTTPD_SKIP_DATA;
+    if (idx != out.next) return ESP_FAIL;
+    if (!idx) out.len += sprintf(out.buf + out.len, "%s:", name);
+    memcpy(out.buf + out.len, buf, len);
+    out.len += len;
+    out.next = end ? 0 : idx + len;
+    if (end) out.buf[out.len++] = '|';
+    return ESP_OK; NOTUSED(req);
+}
+
+static int parse(const char *ctype, const char *body, size_t len,
+                 size_t split, size_t step) {
+    httpd_req_t req = { .content_len = len };
+    mock.ctype = ctype;
+    mock.body = body;
+    mock.len = len;
+    mock.pos = 0;
+    mock.split = split;
+    mock.step = step;
+    mock.status = 0;
+    out.len = out.next = 0;
+    if (parse_files(&req, on_part)) return -1;
+    out.buf[out.len] = '\0';
+    return mock.status;
+}
+
+#define CTYPE   "multipart/form-data; boundary=xYz"
+#define DELIM   "\r\n--xYz"
+
+static const struct {
+    const char *desc, *ctype, *body, *expect;
+    int status;
+} cases[] = {
+    {
+        "single file", CTYPE,
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"up\"; filename=\"a.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "\r\n"
+        "hello world"
+        DELIM "--\r\n",
+        "up:hello world|", 200
+    }, {
+        "preamble, field and near-delimiters in data", CTYPE,
+        "preamble\r\n--xY\r\n"
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"field\"\r\n"
+        "\r\n"
+        "value"
+        DELIM "\r\n"
+        "Content-Disposition: form-data; filename=\"b.txt\"\r\n"
+        "\r\n"
+        "\r\n--xY\r\n-\r\r\n--x--xYZ\r\n"
+        DELIM "--\r\n"
+        "epilogue",
+        "b.txt:\r\n--xY\r\n-\r\r\n--x--xYZ\r\n|", 200
+    }, {
+        "two files and an empty one", "multipart/form-data; boundary=\"xYz\"",
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"f1\"; filename=\"1\"\r\n"
+        "\r\n"
+        "first"
+        DELIM "\r\n"
+        "Content-Disposition: form-data; name=\"f2\"; filename=\"2\"\r\n"
+        "\r\n"
+        DELIM "\r\n"
+        "content-disposition: form-data; name=\"f3\"; filename=\"3\"\r\n"
+        "\r\n"
+        "third\r\n"
+        DELIM "--",
+        "f1:first|f2:|f3:third\r\n|", 200
+    }, {
+        "skipped file", CTYPE,
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"skip\"; filename=\"s\"\r\n"
+        "\r\n"
+        "ignored data"
+        DELIM "\r\n"
+        "Content-Disposition: form-data; name=\"keep\"; filename=\"k\"\r\n"
+        "\r\n"
+        "kept"
+        DELIM "--\r\n",
+        "keep:kept|", 200
+    }, {
+        "missing closing delimiter", CTYPE,
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"up\"; filename=\"a\"\r\n"
+        "\r\n"
+        "truncated",
+        "up:truncated", 400
+    }, {
+        "garbage after delimiter", CTYPE,
+        "--xYz\r\n"
+        "Content-Disposition: form-data; name=\"up\"; filename=\"a\"\r\n"
+        "\r\n"
+        "data"
+        DELIM "xx\r\n",
+        "up:data|", 400
+    }, {
+        "part without name", CTYPE,
+        "--xYz\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "data"
+        DELIM "--\r\n",
+        "", 400
+    },
+};
+
+static void test_split(void) {
+    ITERP(c, cases) {
+        size_t len = strlen(c->body), fails = 0;
+        out.skip = !strcmp(c->desc, "skipped file");
+        LOOP(split, 1, len + 1) {
+            int status = parse(c->ctype, c->body, len, split, 0);
+            if (status == c->status && !strcmp(out.buf, c->expect)) continue;
+            if (!fails++) printf("%s: split at %zu: status %d, got \"%s\"\n",
+                                 c->desc, split, status, out.buf);
+        }
+        LOOP(step, 1, (size_t)64) {
+            int status = parse(c->ctype, c->body, len, len, step);
+            if (status == c->status && !strcmp(out.buf, c->expect)) continue;
+            if (!fails++) printf("%s: recv by %zu: status %d, got \"%s\"\n",
+                                 c->desc, step, status, out.buf);
+        }
+        CHECK(!fails, "%s: %zu failures", c->desc, fails);
+    }
+}
+
+// header line longer than the receive buffer can never be parsed
+static void test_long_header(void) {
+    char body[CHUNK_SIZE * 2];
+    size_t len = sprintf(body, "--xYz\r\nContent-Disposition: form-data; "
+                         "name=\"%0*d\"\r\n\r\nx" DELIM "--", CHUNK_SIZE, 0);
+    CHECK(parse(CTYPE, body, len, len, 0) == 400, "status %d", mock.status);
+    CHECK(parse("text/plain", body, len, len, 0) == 400, "no boundary");
+    char ctype[128];
+    sprintf(ctype, "multipart/form-data; boundary=%071d", 0);
+    CHECK(parse(ctype, body, len, len, 0) == 400, "boundary too long");
+}
+
+// random binary data that avoids the delimiter at all offsets
+static void test_random(void) {
+    static char file[1 << 15], body[sizeof(file) + 256];
+    srand(1);
+    LOOPN(iter, 200) {
+        size_t flen = rand() % sizeof(file), fails = 0;
+        LOOPN(i, flen) {
+            int k = rand() % 8;
+            file[i] = k < 2 ? "\r\n-"[rand() % 3] : k < 4 ? "xYz"[k % 3] : rand();
+        }
+        if (memmem(file, flen, DELIM, strlen(DELIM))) continue;
+        size_t len = sprintf(body, "--xYz\r\nContent-Disposition: form-data; "
+                             "name=\"r\"; filename=\"r\"\r\n\r\n");
+        memcpy(body + len, file, flen);
+        len += flen;
+        len += sprintf(body + len, DELIM "--\r\n");
+        size_t step = 1 + rand() % (2 * CHUNK_SIZE);
+        if (parse(CTYPE, body, len, rand() % len, step) != 200 ||
+            out.len != flen + 3 || memcmp(out.buf + 2, file, flen)) fails++;
+        CHECK(!fails, "random body %d: %zu bytes, recv by %zu",
+              iter, flen, step);
+    }
+}
+
+static void bench(void) {
+    static char body[1 << 16];
+    size_t len = sprintf(body, "--xYz\r\nContent-Disposition: form-data; "
+                         "name=\"b\"; filename=\"b\"\r\n\r\n");
+    size_t flen = sizeof(body) - len - 16;
+    LOOPN(i, flen) { body[len + i] = "\r\n-xYz0123456789"[i * 7 % 16]; }
+    len += flen;
+    len += sprintf(body + len, DELIM "--");
+    int iters = 200;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) { parse(CTYPE, body, len, len, 1460); }
+    double us = host_usec(ts, iters);
+    printf("parse_files: %.1f us per 64 KiB body (%.1f MB/s)\n",
+           us, len / us);
+}
+
+int main() {
+    test_split();
+    test_long_header();
+    test_random();
+    bench();
+    return REPORT("multipart");
+}
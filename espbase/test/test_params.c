@@ -0,0 +1,229 @@
+/*
+ * File: test_params.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 11:48:05
+ *
+ * Check request params decoded into the per-session arena by check_request
+ * and compare allocations and latency with the linked list of params that
+ * was used before (copied below as legacy_xxx).
+ */
+
+#include "host.h"
+
+static size_t nalloc;   // heap allocations made by the code under test
+
+#undef strdup
+#undef strndup
+#define malloc(n)       (nalloc++, malloc(n))
+#define calloc(n, s)    (nalloc++, calloc((n), (s)))
+#define realloc(p, n)   (nalloc++, realloc((p), (n)))
+#define strdup(s)       (nalloc++, strdup(s))
+#define strndup(s, n)   (nalloc++, strndup((s), (n)))
+
+#include "../main/server.c"
+
+config_t Config;
+
+static struct {
+    const char *query, *body;
+    size_t pos;
+} mock;
+
+const char * http_method_str(int method) { return "GET"; NOTUSED(method); }
+
+void * httpd_get_global_user_ctx(httpd_handle_t hd) { return NULL; NOTUSED(hd); }
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *k, const char *v) {
+    return ESP_OK; NOTUSED(req); NOTUSED(k); NOTUSED(v);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t code,
+                              const char *msg) {
+    return ESP_OK; NOTUSED(req); NOTUSED(code); NOTUSED(msg);
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *req) {
+    return strlen(mock.query ?: ""); NOTUSED(req);
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t len) {
+    return snprintf(buf, len, "%s", mock.query) < (int)len
+        ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC; NOTUSED(req);
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *key) {
+    return mock.body && !strcmp(key, "Content-Type")
+        ? strlen(CTYPE_UENC) : 0; NOTUSED(req);
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *key,
+                                      char *buf, size_t len) {
+    snprintf(buf, len, CTYPE_UENC);
+    return ESP_OK; NOTUSED(req); NOTUSED(key);
+}
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len) {
+    len = MIN(len, strlen(mock.body) - mock.pos);
+    memcpy(buf, mock.body + mock.pos, len);
+    mock.pos += len;
+    return len; NOTUSED(req);
+}
+
+static esp_err_t request(httpd_req_t *req, const char *query, const char *body) {
+    mock.query = query;
+    mock.body = body;
+    mock.pos = 0;
+    req->content_len = body ? strlen(body) : 0;
+    return check_request(req);
+}
+
+static void test_lookup(void) {
+    httpd_req_t req = { 0 };
+    LOOPN(round, 3) {
+        CHECK(!request(&req, "cmd=ls%20-l&Path=%2Fa%26b&flag&empty=&cmd=2nd",
+                       "json=%7B%22a%22%3A1%7D&cmd=body+text&&=x"), "parse");
+        CHECK(!strcmp(get_param(&req, "cmd", FROM_ANY), "body text"), "any");
+        CHECK(!strcmp(get_param(&req, "CMD", FROM_QUERY), "2nd"), "last wins");
+        CHECK(!strcmp(get_param(&req, "path", FROM_ANY), "/a&b"), "decode");
+        CHECK(!strcmp(get_param(&req, "json", FROM_BODY), "{\"a\":1}"), "json");
+        CHECK(!get_param(&req, "json", FROM_QUERY), "query only");
+        CHECK(has_param(&req, "flag", FROM_ANY), "flag");
+        CHECK(has_param(&req, "empty", FROM_ANY), "empty");
+        CHECK(!get_param(&req, "empty", FROM_ANY), "empty value");
+        CHECK(!has_param(&req, "", FROM_ANY), "empty key");
+        CHECK(!has_param(&req, "missing", FROM_ANY), "missing");
+    }
+    // the session arena is reused by the next request without old params
+    CHECK(!request(&req, "a=1", NULL), "parse");
+    CHECK(!has_param(&req, "cmd", FROM_ANY) && has_param(&req, "a", FROM_ANY),
+          "reset between requests");
+    free_params(req.sess_ctx);
+}
+
+// sizes near UINT16_MAX must be rejected instead of overflowing the arena
+static void test_reserve(void) {
+    http_arena_t arena = { 0 };
+    LOOP(need, ARENA_MAX - 300, (size_t)UINT16_MAX + 2) {
+        arena.used = arena.count = 0;
+        esp_err_t err = arena_reserve(&arena, need, 0);
+        CHECK(err || arena.size >= need, "need %zu, size %u", need, arena.size);
+        CHECK(!err == (need <= ARENA_MAX), "need %zu: %s",
+              need, esp_err_to_name(err));
+    }
+    TRYFREE(arena.data);
+
+    char *query = calloc(1, UINT16_MAX);
+    httpd_req_t req = { 0 };
+    memset(query, 'a', UINT16_MAX - 1);
+    CHECK(request(&req, query, NULL), "too long query accepted");
+    memcpy(query, "k=", 2);
+    query[ARENA_MAX / 2] = '\0';
+    CHECK(!request(&req, query, NULL), "long query rejected");
+    CHECK(strlen(get_param(&req, "k", FROM_QUERY) ?: "") == ARENA_MAX / 2 - 2,
+          "long value");
+    free_params(req.sess_ctx);
+    free(query);
+}
+
+/* Linked list of strdup'ed params with a sentinel before the arena */
+
+typedef struct legacy_param {
+    struct legacy_param *next;
+    char *key, *val;
+    bool body;
+} legacy_param_t;
+
+static void legacy_free(void *ctx) {
+    for (legacy_param_t *ptr = ctx, *next; ptr; ptr = next) {
+        TRYFREE(ptr->key); TRYFREE(ptr->val);
+        next = ptr->next; free(ptr);
+    }
+}
+
+static void legacy_parse(char *buf, bool body, void **arg) {
+    legacy_param_t **ctx = (legacy_param_t **)arg, *ptr, *param;
+    char *tok, *save = NULL;
+    for (tok = strtok_r(buf, "&", &save); tok; tok = strtok_r(0, "&", &save)) {
+        char *eql = strchr(tok, '=') ?: (tok + strlen(tok));
+        char *key = strndup(tok, eql - tok);
+        char *val = strlen(eql) > 1 ? strdup(eql + 1) : NULL;
+        if (!key) { TRYFREE(val); break; }
+        for (ptr = *ctx;; ptr = ptr->next) {
+            if (ptr && ptr->next && strncmp(ptr->key, tok, eql - tok)) continue;
+            if (ptr && ptr->next) {
+                TRYFREE(ptr->key); TRYFREE(ptr->val);
+                ptr->key = key; ptr->val = val; ptr->body = body;
+            } else if (ECALLOC(param, 1, sizeof(legacy_param_t))) {
+                TRYFREE(key); TRYFREE(val);
+            } else {
+                param->key = key; param->val = val; param->body = body;
+                ptr = ptr ? (ptr->next = param) : (*ctx = param);
+            }
+            break;
+        }
+    }
+}
+
+static esp_err_t legacy_request(httpd_req_t *req, const char *query) {
+    legacy_param_t *ptr = req->sess_ctx;
+    if (ptr) {
+        TRYNULL(ptr->next, legacy_free);
+    } else if (!ECALLOC(ptr, 1, sizeof(legacy_param_t))) {
+        ptr->key = strdup("");
+        req->sess_ctx = ptr;
+    }
+    size_t qlen = strlen(query) + 1;
+    char buf[qlen];
+    memcpy(buf, query, qlen);
+    buf[url_decode(buf, qlen)] = '\0';
+    legacy_parse(buf, false, &req->sess_ctx);
+    return ESP_OK;
+}
+
+static const char * legacy_get(httpd_req_t *req, const char *key, int body) {
+    for (legacy_param_t *param = req->sess_ctx; param; param = param->next) {
+        if (strcasecmp(param->key, key)) continue;
+        if (body == FROM_ANY || param->body == !!body) return param->val;
+    }
+    return NULL;
+}
+
+// query of the periodic polling of web UI and the params looked up for it
+#define POLL_QUERY  "cmd=sys%20info&type=json&path=%2Fdata%2Flog.txt" \
+                    "&from=0&size=4096&sort=name&desc&t=1760612345678"
+
+static const char * keys[] = { "cmd", "path", "size", "json", "desc" };
+
+static void bench(void) {
+    int iters = 100000;
+    httpd_req_t req = { 0 };
+    size_t n = nalloc;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        request(&req, POLL_QUERY, NULL);
+        ITERV(key, keys) { get_param(&req, key, FROM_ANY); }
+    }
+    double us = host_usec(ts, iters);
+    printf("arena:  %.3f us, %.2f allocs per request\n",
+           us, (double)(nalloc - n) / iters);
+    free_params(req.sess_ctx);
+
+    memset(&req, 0, sizeof(req));
+    n = nalloc;
+    ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        legacy_request(&req, POLL_QUERY);
+        ITERV(key, keys) { legacy_get(&req, key, FROM_ANY); }
+    }
+    us = host_usec(ts, iters);
+    printf("legacy: %.3f us, %.2f allocs per request\n",
+           us, (double)(nalloc - n) / iters);
+    legacy_free(req.sess_ctx);
+}
+
+int main() {
+    test_lookup();
+    test_reserve();
+    bench();
+    return REPORT("params");
+}
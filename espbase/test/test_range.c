@@ -0,0 +1,246 @@
+/*
+ * File: test_range.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 11:03:27
+ *
+ * Check Range header arithmetic of parse_range, and the status, headers
+ * and body generated by send_file for single, multiple and unsatisfiable
+ * ranges of a temporary file.
+ */
+
+#include "host.h"
+#include "../main/server.c"
+
+static struct {
+    const char *range, *ifrange;
+    char status[32], ctype[64], crange[64], clen[16];
+    char body[1 << 16];
+    size_t len;
+    bool done;
+} resp;
+
+const char * filesys_norm(filesys_type_t type, const char *path) {
+    return path; NOTUSED(type);
+}
+
+const char * format_datetime(const struct timespec *ts) {
+    return "Thu, 01 Jan 1970 00:00:00 GMT"; NOTUSED(ts);
+}
+
+static const char * mock_header(const char *key) {
+    if (!strcmp(key, "Range")) return resp.range;
+    if (!strcmp(key, "If-Range")) return resp.ifrange;
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *key) {
+    return strlen(mock_header(key) ?: ""); NOTUSED(req);
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *key,
+                                      char *buf, size_t len) {
+    snprintf(buf, len, "%s", mock_header(key));
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *key,
+                             const char *val) {
+    if (!strcmp(key, "Content-Range"))
+        snprintf(resp.crange, sizeof(resp.crange), "%s", val);
+    if (!strcmp(key, "Content-Length"))
+        snprintf(resp.clen, sizeof(resp.clen), "%s", val);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+    snprintf(resp.status, sizeof(resp.status), "%s", status);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+    snprintf(resp.ctype, sizeof(resp.ctype), "%s", type);
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len) {
+    if (!buf) {
+        resp.done = true;
+        return ESP_OK;
+    }
+    if (len < 0) len = strlen(buf);
+    if (resp.done || resp.len + len > sizeof(resp.body)) return ESP_FAIL;
+    memcpy(resp.body + resp.len, buf, len);
+    resp.len += len;
+    return ESP_OK; NOTUSED(req);
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len) {
+    return httpd_resp_send_chunk(req, buf, len) ?: httpd_resp_send_chunk(req, 0, 0);
+}
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *req, const char *str) {
+    return httpd_resp_send_chunk(req, str, str ? -1 : 0);
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+    resp.done = true;
+    return ESP_OK; NOTUSED(req); NOTUSED(str);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t code,
+                              const char *msg) {
+    snprintf(resp.status, sizeof(resp.status), "error %d", code);
+    return ESP_OK; NOTUSED(req); NOTUSED(msg);
+}
+
+static int parse(const char *hdr, size_t size, char *out) {
+    http_range_t ranges[RANGE_MAX];
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", hdr);
+    int num = parse_range(buf, size, ranges, RANGE_MAX);
+    out[0] = '\0';
+    LOOP(i, 0, num) {
+        out += sprintf(out, "%s%zu-%zu", i ? "," : "",
+                       ranges[i].start, ranges[i].end);
+    }
+    return num;
+}
+
+static void test_parse(void) {
+    static const struct {
+        const char *hdr;
+        size_t size;
+        int num;
+        const char *ranges;
+    } cases[] = {
+        // single and open ended ranges
+        { "bytes=0-99",             1000,  1, "0-99" },
+        { "bytes=500-",             1000,  1, "500-999" },
+        { "bytes=990-2000",         1000,  1, "990-999" },
+        { "bytes=999-999",          1000,  1, "999-999" },
+        { "bytes= 0-0 , 2-2 ",      1000,  2, "0-0,2-2" },
+        // suffix ranges
+        { "bytes=-100",             1000,  1, "900-999" },
+        { "bytes=-1000",            1000,  1, "0-999" },
+        { "bytes=-5000",            1000,  1, "0-999" },
+        { "bytes=-1",               1,     1, "0-0" },
+        { "bytes=0-9,-10",          1000,  2, "0-9,990-999" },
+        // overlapping ranges are served as requested, at most RANGE_MAX
+        { "bytes=0-499,100-199",    1000,  2, "0-499,100-199" },
+        { "bytes=0-,-1000,500-",    1000,  3, "0-999,0-999,500-999" },
+        { "bytes=0-,0-,0-,0-,0-,0-,0-,0-", 1000, 8,
+          "0-999,0-999,0-999,0-999,0-999,0-999,0-999,0-999" },
+        { "bytes=0-,0-,0-,0-,0-,0-,0-,0-,0-", 1000, 0, "" },
+        // unsatisfiable: 416
+        { "bytes=1000-",            1000, -1, "" },
+        { "bytes=1000-1999,5000-",  1000, -1, "" },
+        { "bytes=-0",               1000, -1, "" },
+        { "bytes=0-",               0,    -1, "" },
+        { "bytes=-10",              0,    -1, "" },
+        { "bytes=2000-,0-0",        1000,  1, "0-0" },
+        // invalid syntax: ignore the header
+        { "bytes=",                 1000,  0, "" },
+        { "bytes=abc",              1000,  0, "" },
+        { "bytes=5-1",              1000,  0, "" },
+        { "bytes=0-1x",             1000,  0, "" },
+        { "bytes=-",                1000,  0, "" },
+        { "bytes=-5x",              1000,  0, "" },
+        { "bytes=0-1,foo",          1000,  0, "" },
+        { "items=0-1",              1000,  0, "" },
+    };
+    char out[256];
+    ITERP(c, cases) {
+        int num = parse(c->hdr, c->size, out);
+        CHECK(num == c->num && !strcmp(out, c->ranges),
+              "\"%s\" of %zu: got %d \"%s\"", c->hdr, c->size, num, out);
+    }
+}
+
+#define FILE_SIZE 5000
+
+static char path[32], data[FILE_SIZE];
+
+static void request(const char *range, const char *ifrange) {
+    httpd_req_t req = { 0 };
+    memset(&resp, 0, sizeof(resp));
+    resp.range = range;
+    resp.ifrange = ifrange;
+    send_file(&req, path, false);
+}
+
+static void test_send(void) {
+    int fd = mkstemps(strcpy(path, "/tmp/test_range_XXXXXX.txt"), 4);
+    LOOPN(i, FILE_SIZE) { data[i] = 'A' + i % 26; }
+    CHECK(fd >= 0 && write(fd, data, FILE_SIZE) == FILE_SIZE, "%s", path);
+    close(fd);
+
+    request("bytes=100-199", NULL);
+    CHECK(!strcmp(resp.status, "206 Partial Content"), "%s", resp.status);
+    CHECK(!strcmp(resp.crange, "bytes 100-199/5000"), "%s", resp.crange);
+    CHECK(!strcmp(resp.clen, "100"), "%s", resp.clen);
+    CHECK(resp.len == 100 && !memcmp(resp.body, data + 100, 100) && resp.done,
+          "single range body of %zu bytes", resp.len);
+
+    request("bytes=-10", NULL);
+    CHECK(!strcmp(resp.crange, "bytes 4990-4999/5000"), "%s", resp.crange);
+    CHECK(resp.len == 10 && !memcmp(resp.body, data + 4990, 10), "suffix");
+
+    // multipart/byteranges: Content-Length must match the generated body
+    request("bytes=0-9, 4000-, 5-14", NULL);
+    CHECK(!strcmp(resp.status, "206 Partial Content"), "%s", resp.status);
+    CHECK(!strcmp(resp.ctype, "multipart/byteranges; boundary=" RANGE_BDARY),
+          "%s", resp.ctype);
+    CHECK(!resp.crange[0], "%s", resp.crange);
+    CHECK((size_t)atoi(resp.clen) == resp.len, "Content-Length %s, sent %zu",
+          resp.clen, resp.len);
+    resp.body[resp.len] = '\0';
+    const char *ptr = resp.body;
+    const struct { size_t start, end; } parts[] = {
+        { 0, 9 }, { 4000, 4999 }, { 5, 14 }
+    };
+    ITERP(part, parts) {
+        char head[128];
+        size_t hlen = sprintf(head, "%s--" RANGE_BDARY "\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Range: bytes %zu-%zu/5000\r\n\r\n",
+            part == parts ? "" : "\r\n", part->start, part->end);
+        size_t dlen = part->end - part->start + 1;
+        CHECK(!strncmp(ptr, head, hlen), "part %zu-%zu header: %.80s",
+              part->start, part->end, ptr);
+        ptr += hlen;
+        CHECK(!memcmp(ptr, data + part->start, dlen), "part data");
+        ptr += dlen;
+    }
+    CHECK(!strcmp(ptr, "\r\n--" RANGE_BDARY "--\r\n"), "trailer: %s", ptr);
+
+    request("bytes=5000-", NULL);
+    CHECK(!strcmp(resp.status, "416 Range Not Satisfiable"), "%s", resp.status);
+    CHECK(!strcmp(resp.crange, "bytes */5000"), "%s", resp.crange);
+    CHECK(!resp.len, "416 without body");
+
+    // invalid Range or stale If-Range: whole file
+    request("bytes=5-1", NULL);
+    CHECK(!resp.status[0] && !resp.crange[0], "%s", resp.status);
+    CHECK(resp.len == FILE_SIZE && !strcmp(resp.clen, "5000"), "whole file");
+    request("bytes=0-0", "\"0-0\"");
+    CHECK(!resp.status[0] && resp.len == FILE_SIZE, "If-Range mismatch");
+    unlink(path);
+}
+
+static void bench(void) {
+    char buf[128], out[256];
+    int iters = 200000;
+    int64_t ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        strcpy(buf, "bytes=0-1023, 4096-8191, -512");
+        parse(buf, 1 << 30, out);
+    }
+    printf("parse_range: %.3f us per 3-range header\n", host_usec(ts, iters));
+}
+
+int main() {
+    test_parse();
+    test_send();
+    bench();
+    return REPORT("range");
+}
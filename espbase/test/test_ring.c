@@ -0,0 +1,231 @@
+/*
+ * File: test_ring.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 17:05:12
+ *
+ * Stress the frame ring of avcmode.c: one producer thread publishes frames
+ * with ring_claim / ring_commit every few microseconds, while readers of
+ * various speeds (and one attaching and detaching in a loop) consume them with
+ * avc_read / avc_release. Check that a frame is never overwritten while it
+ * is held, that each reader sees frames in order and accounts for every
+ * frame it missed, and that ring_drain reclaims all frames at the end.
+ */
+
+#include "host.h"
+
+// sensor_t of the 64-bit host is too large for the uint8_t offsets that
+// are checked on target: camera attributes are not tested here.
+#define _Static_assert(...)
+#pragma GCC diagnostic ignored "-Woverflow"
+
+#include "../main/avcmode.c"
+
+#include <pthread.h>
+
+#define FRAMES      100000
+#define PERIOD      2           // microseconds between frames
+#define PAYLOAD     16          // words of payload per frame
+
+static struct {
+    uint32_t buf[AVC_SLOTS][PAYLOAD];
+    uint32_t published, reclaimed;
+    volatile bool done;
+} prod;
+
+typedef struct {
+    avc_reader_t reader;
+    int lag_us;                 // time to sleep after each frame
+    int stall;                  // hold 1 of `stall` frames for 2ms
+    uint32_t seq0, errors;
+} consumer_t;
+
+static void reclaim(avc_frame_t *frame) {
+    CHECK(frame->priv == frame->aud.data, "priv of frame %zu", frame->aud.id);
+    __atomic_fetch_add(&prod.reclaimed, 1, __ATOMIC_RELAXED);
+}
+
+static void wake(avc_reader_t *reader) { xSemaphoreGive(reader->arg); }
+
+static bool intact(avc_frame_t *frame, size_t id) {
+    const uint32_t *buf = frame->aud.data;
+    if (frame->aud.id != id) return false;
+    LOOPN(i, PAYLOAD) { if (buf[i] != id + i) return false; }
+    return true;
+}
+
+// read frames until the producer is done and the reader caught up with it
+static void consume(consumer_t *c, size_t limit) {
+    avc_reader_t *reader = &c->reader;
+    avc_ring_t *ring = reader->ring;
+    size_t last = 0, count = 0;
+    while (count < limit) {
+        avc_frame_t *frame = avc_read(reader);
+        if (!frame) {
+            if (prod.done && reader->seq == ring->head) break;
+            xSemaphoreTake(reader->arg, 1);
+            continue;
+        }
+        size_t id = frame->aud.id;
+        if (!intact(frame, id) || id <= last) c->errors++;
+        if (c->stall && !(id % c->stall)) usleep(2000);
+        if (!intact(frame, id)) c->errors++;    // overwritten while held
+        avc_release(frame);
+        if (c->lag_us) usleep(c->lag_us);
+        last = id;
+        count++;
+    }
+}
+
+static void * consumer(void *arg) {
+    consumer_t *c = arg;
+    consume(c, SIZE_MAX);
+    return NULL;
+}
+
+// attach, read a few frames and detach until the producer is done
+static void * churner(void *arg) {
+    consumer_t *c = arg;
+    avc_reader_t *reader = &c->reader;
+    uint32_t attached = 0;
+    while (!prod.done) {
+        if (avc_attach(reader)) continue;
+        uint32_t seq0 = reader->seq;
+        consume(c, 1 + rand() % 64);
+        if (reader->frames + reader->overruns != reader->seq - seq0)
+            c->errors++;
+        avc_detach(reader);
+        attached++;
+    }
+    c->seq0 = attached;
+    return NULL;
+}
+
+static void produce(size_t num, int period_us) {
+    avc_ring_t *ring = &aud_ring;
+    int64_t next = esp_timer_get_time();
+    LOOP(id, 1, num + 1) {
+        while (esp_timer_get_time() < next) {}
+        next += period_us;
+        avc_frame_t *frame = ring_claim(ring);
+        if (!frame) {
+            ring->drops++;
+            continue;
+        }
+        uint32_t *buf = prod.buf[frame - ring->slots];
+        LOOPN(i, PAYLOAD) { buf[i] = id + i; }
+        frame->type = AUD_EVENT_DATA;
+        frame->priv = frame->aud.data = buf;
+        frame->aud.id = id;
+        frame->aud.len = sizeof(prod.buf[0]);
+        ring_commit(ring, frame);
+        prod.published++;
+    }
+}
+
+static void test_stress(void) {
+    consumer_t cons[] = {
+        { .reader = { .name = "fast" } },
+        { .reader = { .name = "slow" }, .lag_us = 5 },
+        { .reader = { .name = "stall" }, .stall = 1000 },
+        { .reader = { .name = "churn" } },
+    };
+    pthread_t threads[LEN(cons)];
+    aud_ring.reclaim = reclaim;
+    LOOPN(i, LEN(cons)) {
+        avc_reader_t *reader = &cons[i].reader;
+        reader->target = AUDIO_TARGET;
+        reader->wake = wake;
+        reader->arg = xSemaphoreCreateBinary();
+        if (i < LEN(cons) - 1) {
+            CHECK(!avc_attach(reader), "attach %s", reader->name);
+            cons[i].seq0 = reader->seq;
+            pthread_create(threads + i, NULL, consumer, cons + i);
+        } else {
+            pthread_create(threads + i, NULL, churner, cons + i);
+        }
+    }
+
+    produce(FRAMES, PERIOD);
+    prod.done = true;
+    LOOPN(i, LEN(cons)) { pthread_join(threads[i], NULL); }
+    ring_drain(&aud_ring, 500);
+
+    ring_stats(&aud_ring, stdout);
+    CHECK(prod.published + aud_ring.drops == FRAMES, "lost frames");
+    CHECK(prod.published == aud_ring.head, "head %u", aud_ring.head);
+    CHECK(prod.reclaimed == prod.published, "%u of %u frames reclaimed",
+          prod.reclaimed, prod.published);
+    CHECK(aud_ring.drops, "stalled reader never blocked the producer");
+    CHECK(cons[1].reader.overruns, "slow reader never lagged behind");
+    CHECK(cons[0].reader.frames > cons[1].reader.frames, "fast vs slow");
+    ITERP(c, cons) {
+        avc_reader_t *reader = &c->reader;
+        CHECK(!c->errors, "%s: %u corrupted or out of order frames",
+              reader->name, c->errors);
+        if (c == cons + LEN(cons) - 1) {
+            CHECK(c->seq0 > 1, "churn: attached %u times", c->seq0);
+            continue;
+        }
+        CHECK(reader->frames + reader->overruns == aud_ring.head - c->seq0,
+              "%s: %u frames + %u overruns != %u", reader->name,
+              reader->frames, reader->overruns, aud_ring.head - c->seq0);
+        avc_detach(reader);
+    }
+    ITERP(frame, aud_ring.slots) {
+        CHECK(!frame->refs && !frame->seq && !frame->priv,
+              "slot %zu not drained", frame - aud_ring.slots);
+    }
+    ITERP(c, cons) { vSemaphoreDelete(c->reader.arg); }
+}
+
+// a frame still held by a reader after timeout is invalidated anyway
+// (with a warning of ring_drain)
+static void test_drain(void) {
+    avc_reader_t reader = { .target = AUDIO_TARGET };
+    prod.done = false;
+    CHECK(!avc_attach(&reader), "attach");
+    avc_frame_t *frame = ring_claim(&aud_ring);
+    frame->priv = frame->aud.data = prod.buf[0];
+    ring_commit(&aud_ring, frame);
+    CHECK(avc_read(&reader) == frame, "read");
+    ring_drain(&aud_ring, 20);
+    CHECK(!frame->seq && !frame->priv, "held frame not invalidated");
+    avc_release(frame);
+    CHECK(!frame->refs, "refs %u", frame->refs);
+    CHECK(!avc_read(&reader), "read drained frame");
+    avc_detach(&reader);
+}
+
+static void count(avc_reader_t *reader) { reader->arg++; }
+
+// single thread: cost of publishing and reading a frame with 3 readers
+static void bench(void) {
+    avc_reader_t readers[3];
+    ITERP(reader, readers) {
+        *reader = (avc_reader_t){ .target = AUDIO_TARGET, .wake = count };
+        avc_attach(reader);
+    }
+    size_t iters = 1000000;
+    int64_t ts = esp_timer_get_time();
+    produce(iters, 0);
+    double us = host_usec(ts, iters);
+    ts = esp_timer_get_time();
+    LOOPN(i, iters) {
+        ITERP(reader, readers) { avc_release(avc_read(reader)); }
+        avc_frame_t *frame = ring_claim(&aud_ring);
+        frame->priv = NULL;
+        ring_commit(&aud_ring, frame);
+    }
+    printf("ring_claim + ring_commit: %.3f us, "
+           "with 3 x avc_read + avc_release: %.3f us\n",
+           us, host_usec(ts, iters));
+    ITERP(reader, readers) { avc_detach(reader); }
+    ring_drain(&aud_ring, 0);
+}
+
+int main() {
+    test_stress();
+    test_drain();
+    bench();
+    return REPORT("ring");
+}
@@ -0,0 +1,218 @@
+/*
+ * File: test_wav.c
+ * Authors: Hank <hankso1106@gmail.com>
+ * Create: 2026-10-16 18:32:54
+ *
+ * Simulate power loss while recording WAV with wav_frame: the file is left
+ * preallocated to the segment size, without the data in the write-back
+ * buffer and with lengths in the header of the last wav_sync. Check that
+ * avc_recover truncates it to the synced length (which covers only data
+ * that reached the file) or deletes it if even the header was not flushed,
+ * and that the path tracked in NVS is kept until the filesystem is mounted
+ * and cleared afterwards.
+ */
+
+#include "host.h"
+
+// sensor_t of the 64-bit host is too large for the uint8_t offsets that
+// are checked on target: camera attributes are not tested here.
+#define _Static_assert(...)
+#pragma GCC diagnostic ignored "-Woverflow"
+
+// recording is driven by a fake clock: one audio frame every 20ms
+int64_t fake_time(void);
+#define esp_timer_get_time fake_time
+
+#include "../main/avcmode.c"
+
+static int64_t now;
+
+int64_t fake_time(void) { return now; }
+
+// referenced by aud_rec: record_task is not started here
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { abort(); NOTUSED(task); }
+
+/* NVS with a single key, filesystem that can be unmounted */
+
+static struct {
+    char val[PATH_MAX_LEN];
+    int len;                // -1 if key is not found
+    bool mounted;
+} mock = { .len = -1 };
+
+esp_err_t config_nvs_open(void **ptr, const char *ns, bool ro) {
+    *ptr = &mock;
+    return ESP_OK; NOTUSED(ns); NOTUSED(ro);
+}
+
+int config_nvs_read(void *hdl, const char *key, void *buf, size_t size) {
+    if (mock.len < 0 || (size_t)mock.len > size) return -1;
+    memcpy(buf, mock.val, mock.len);
+    return mock.len; NOTUSED(hdl); NOTUSED(key);
+}
+
+int config_nvs_write(void *hdl, const char *key, const void *val, size_t len) {
+    memcpy(mock.val, val, mock.len = MIN(len, sizeof(mock.val)));
+    return mock.len; NOTUSED(hdl); NOTUSED(key);
+}
+
+esp_err_t config_nvs_delete(void *hdl, const char *key) {
+    mock.len = -1;
+    return ESP_OK; NOTUSED(hdl); NOTUSED(key);
+}
+
+esp_err_t config_nvs_close(void **ptr) {
+    *ptr = NULL;
+    return ESP_OK;
+}
+
+bool filesys_get_info(filesys_type_t type, filesys_info_t *info) {
+    if (info) *info = (filesys_info_t){ .total = 1ULL << 40, .clsize = 4096 };
+    return mock.mounted && type == FILESYS_SDCARD;
+}
+
+void filesys_walk(filesys_type_t type, const char *dir, walk_cb_t cb,
+                  void *arg) {
+    NOTUSED(type); NOTUSED(dir); NOTUSED(cb); NOTUSED(arg);
+}
+
+char * filesys_join_r(filesys_type_t type, filesys_path_t buf, size_t argc,
+                      ...) {
+    va_list ap;
+    va_start(ap, argc);
+    buf[0] = '\0';
+    LOOPN(i, argc) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, PATH_MAX_LEN - len, "%s%s",
+                 i ? "/" : "", va_arg(ap, const char *));
+    }
+    va_end(ap);
+    return buf; NOTUSED(type);
+}
+
+/* Recording */
+
+#define FRAME_LEN   640                     // 20ms of 16kHz 16bit mono
+#define SEG_SIZE    (1 << 20)
+
+static audio_mode_t mode = { 16000, 1, 2 };
+static char dir[] = "/tmp/test_wav_XXXXXX";
+
+static int16_t sample(size_t idx) { return idx * 7 % 65521; }
+
+// record `nframe` frames and return path of the segment, which is left open
+// (i.e. power cut) unless `stop`
+static const char * record(size_t nframe, bool stop) {
+    avc_rec_t *rec = &aud_rec;
+    int16_t pcm[FRAME_LEN / 2];
+    snprintf(rec->dir, sizeof(rec->dir), "%s", dir);
+    rec->bsize = 32 * 1024;
+    rec->buf = malloc(rec->bsize);
+    rec->seg_size = SEG_SIZE;
+    rec->seg_secs = 3600;
+    rec->prealloc = true;
+    LOOPN(i, nframe) {
+        LOOPN(j, LEN(pcm)) { pcm[j] = sample(i * LEN(pcm) + j); }
+        avc_frame_t frame = {
+            .type = AUD_EVENT_DATA, .aud = { i, sizeof(pcm), pcm, &mode },
+        };
+        rec->handle(rec, &frame);
+        now += 20000;
+    }
+    if (stop) {
+        rec->handle(rec, &(avc_frame_t){ .type = AUD_EVENT_STOP });
+    } else {
+        TRYNULL(rec->fp, fclose);   // data in rec->buf is lost
+    }
+    TRYFREE(rec->buf);
+    CHECK(rec->segs == stop, "%u segments saved", rec->segs);
+    rec->segs = 0;
+    return rec->path;
+}
+
+static size_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) ? 0 : st.st_size;
+}
+
+// header lengths match the file and samples are those recorded in order
+static void check_wav(const char *path, size_t expect) {
+    FILE *fp = fopen(path, "rb");
+    wav_header_t wav;
+    size_t size = file_size(path), num = 0;
+    int16_t val;
+    CHECK(fp && fread(&wav, 1, sizeof(wav), fp) == sizeof(wav), "%s", path);
+    if (!fp) return;
+    CHECK(!strncmp(wav.RIFF, "RIFF", 4) && !strncmp(wav.data, "data", 4) &&
+          wav.shz == mode.srate && wav.nch == mode.nch, "%s: header", path);
+    CHECK(wav.filelen == size - 8 && wav.datalen == size - sizeof(wav),
+          "%s: %zu Bytes, RIFF %u, data %u",
+          path, size, wav.filelen, wav.datalen);
+    CHECK(expect == SIZE_MAX || wav.datalen == expect, "%s: data %u, "
+          "expect %zu", path, wav.datalen, expect);
+    while (fread(&val, sizeof(val), 1, fp) == 1 && val == sample(num)) num++;
+    CHECK(num * sizeof(val) == wav.datalen, "%s: sample %zu", path, num);
+    fclose(fp);
+}
+
+static void test_stop(void) {
+    const char *path = record(100, true);
+    CHECK(mock.len < 0, "track not cleared after close");
+    check_wav(path, 100 * FRAME_LEN);
+    unlink(path);
+}
+
+static void test_power_cut(size_t nframe) {
+    mock.mounted = true;
+    const char *path = record(nframe, false);
+    CHECK(mock.len > 0 && !strcmp(mock.val, path), "track %s", path);
+    CHECK(file_size(path) == SEG_SIZE, "not preallocated: %zu Bytes",
+          file_size(path));
+
+    // wav_sync updates the header every REC_SYNC_MS after the flushed data
+    wav_header_t wav = { 0 };
+    FILE *fp = fopen(path, "rb");
+    CHECK(fp && fread(&wav, 1, sizeof(wav), fp) == sizeof(wav), "%s", path);
+    TRYNULL(fp, fclose);
+    bool flushed = !strncmp(wav.RIFF, "RIFF", 4);
+    size_t synced = flushed ? wav.datalen : 0;
+    CHECK(synced <= nframe * FRAME_LEN, "synced %zu", synced);
+
+    mock.mounted = false;
+    avc_recover();
+    CHECK(mock.len > 0, "track cleared before filesystem is mounted");
+    CHECK(file_size(path) == SEG_SIZE, "truncated before mounted");
+    mock.mounted = true;
+    avc_recover();
+    CHECK(mock.len < 0, "track not cleared after recovery");
+    printf("power cut after %zu frames: %zu of %zu Bytes recovered\n",
+           nframe, synced, nframe * FRAME_LEN);
+    if (!flushed) {
+        CHECK(access(path, F_OK), "%s: file without header not deleted", path);
+        return;
+    }
+    check_wav(path, synced);
+    avc_recover();                  // nothing to do
+    check_wav(path, synced);
+    unlink(path);
+}
+
+// path in NVS of a file that does not exist any more
+static void test_missing(void) {
+    mock.mounted = true;
+    config_nvs_write(NULL, "wav", "/tmp/test_wav_missing.wav", 26);
+    avc_recover();
+    CHECK(mock.len < 0, "track of missing file not cleared");
+}
+
+int main() {
+    mock.mounted = true;
+    CHECK(mkdtemp(dir), "%s", dir);
+    test_stop();
+    test_power_cut(10);             // header not flushed yet
+    test_power_cut(60);             // after the first flush
+    test_power_cut(1000);           // 20 seconds
+    test_missing();
+    rmdir(dir);
+    return REPORT("wav");
+}